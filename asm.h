@@ -0,0 +1,25 @@
+#ifndef LICE_ASM_HDR
+#define LICE_ASM_HDR
+#include <stddef.h>
+
+/*
+ * File: asm.h
+ *  Built-in assembler for the code generator output
+ */
+
+/*
+ * Function: asm_assemble
+ *  Assemble the text the code generator emitted into a relocatable
+ *  object file.
+ *
+ * Parameters:
+ *  source - The assembly text
+ *  length - Length of the assembly text
+ *  size   - Where the size of the object file is stored
+ *
+ * Returns:
+ *  A buffer containing the object file, which the caller must free.
+ */
+unsigned char *asm_assemble(const char *source, size_t length, size_t *size);
+
+#endif
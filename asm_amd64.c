@@ -0,0 +1,1821 @@
+/*
+ * File: asm_amd64.c
+ *  Built-in assembler for the AMD64 code generator. It understands the
+ *  subset of AT&T syntax gen_amd64.c emits and encodes it straight into
+ *  an ELF64 relocatable object, which saves a trip through an external
+ *  assembler.
+ *
+ *  Everything is encoded in a single pass: instructions never change
+ *  size depending on where labels end up (branches always use 32-bit
+ *  displacements) so references to labels are recorded as fixups which
+ *  are either patched in place or turned into relocations once all the
+ *  input has been seen.
+ */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "asm.h"
+#include "elf.h"
+#include "lice.h"
+
+#define ASM_NONE                -1
+#define ASM_RIP                 16
+#define ASM_FIXUP_DIFFERENCE    0
+
+typedef struct {
+    unsigned char *data;
+    size_t         length;
+    size_t         allocated;
+    size_t         align;
+    size_t         base;
+} asm_chunk_t;
+
+/*
+ * A section is made of chunks, one for every subsection (.data 1) used,
+ * which are only concatenated once the section is laid out.
+ */
+typedef struct {
+    const char  *name;
+    unsigned     type;
+    uint64_t     flags;
+    uint64_t     entsize;
+    asm_chunk_t *chunks;
+    size_t       count;
+    size_t       elf;
+} asm_section_t;
+
+typedef struct {
+    const char *name;
+    bool        defined;
+    bool        global;
+    bool        referenced;
+    size_t      section;
+    size_t      chunk;
+    size_t      offset;
+    size_t      elf;
+} asm_symbol_t;
+
+typedef struct {
+    int64_t       value;
+    asm_symbol_t *symbol;
+    asm_symbol_t *minus;
+} asm_expression_t;
+
+typedef struct {
+    size_t        section;
+    size_t        chunk;
+    size_t        offset;
+    size_t        size;
+    unsigned      type;
+    asm_symbol_t *symbol;
+    asm_symbol_t *minus;
+    int64_t       addend;
+} asm_fixup_t;
+
+typedef enum {
+    ASM_REGISTER,
+    ASM_IMMEDIATE,
+    ASM_MEMORY
+} asm_kind_t;
+
+typedef struct {
+    asm_kind_t       kind;
+    bool             indirect;
+    bool             xmm;
+    int              reg;
+    int              size;
+    int              base;
+    int              index;
+    int              scale;
+    asm_expression_t expression;
+} asm_operand_t;
+
+typedef struct asm_mnemonic_s asm_mnemonic_t;
+typedef void (*asm_encoder_t)(const asm_mnemonic_t *, asm_operand_t *, size_t, int);
+
+struct asm_mnemonic_s {
+    const char    *name;
+    asm_encoder_t  encode;
+    unsigned       code;
+    unsigned       extra;
+};
+
+typedef struct {
+    const char *name;
+    int         reg;
+    int         size;
+} asm_register_t;
+
+static struct {
+    asm_section_t *sections;
+    size_t         length;
+    size_t         allocated;
+    size_t         section;
+    size_t         chunk;
+    size_t         previous;       /* section and chunk .previous returns to */
+    size_t         previous_chunk;
+    asm_fixup_t   *fixups;
+    size_t         fixup_length;
+    size_t         fixup_allocated;
+    list_t        *symbols;
+    table_t        symbol_table;
+    table_t        mnemonics;
+    table_t        registers;
+    size_t         line;
+    const char    *text;
+    int            columns;
+} asm_state;
+
+static void NORETURN asm_error(const char *fmt, ...) {
+    char    message[512];
+    va_list va;
+
+    va_start(va, fmt);
+    vsnprintf(message, sizeof(message), fmt, va);
+    va_end(va);
+
+    compile_ice("assembler: line %zu: `%.*s': %s", asm_state.line, asm_state.columns, asm_state.text, message);
+}
+
+static void *asm_grow(void *data, size_t *allocated, size_t need, size_t size) {
+    if (need <= *allocated)
+        return data;
+
+    size_t count = *allocated ? *allocated : 64;
+    while (count < need)
+        count *= 2;
+
+    if (!(data = realloc(data, count * size)))
+        compile_error("out of memory");
+
+    *allocated = count;
+    return data;
+}
+
+/* sections */
+static asm_chunk_t *asm_chunk(void) {
+    return &asm_state.sections[asm_state.section].chunks[asm_state.chunk];
+}
+
+static size_t asm_section(const char *name, unsigned type, uint64_t flags, uint64_t entsize) {
+    for (size_t i = 0; i < asm_state.length; i++)
+        if (!strcmp(asm_state.sections[i].name, name))
+            return i;
+
+    asm_state.sections = asm_grow(asm_state.sections, &asm_state.allocated, asm_state.length + 1, sizeof(asm_section_t));
+    asm_state.sections[asm_state.length] = (asm_section_t) {
+        .name    = string_intern(name, strlen(name)),
+        .type    = type,
+        .flags   = flags,
+        .entsize = entsize
+    };
+    return asm_state.length++;
+}
+
+static size_t asm_section_default(const char *name) {
+    if (!strcmp(name, ".text") || !strncmp(name, ".text.", 6))
+        return asm_section(name, ELF_SECTION_PROGBITS, ELF_FLAG_ALLOC | ELF_FLAG_EXEC, 0);
+    if (!strcmp(name, ".bss") || !strncmp(name, ".bss.", 5))
+        return asm_section(name, ELF_SECTION_NOBITS, ELF_FLAG_ALLOC | ELF_FLAG_WRITE, 0);
+    if (!strcmp(name, ".rodata") || !strncmp(name, ".rodata.", 8))
+        return asm_section(name, ELF_SECTION_PROGBITS, ELF_FLAG_ALLOC, 0);
+    if (!strcmp(name, ".data") || !strncmp(name, ".data.", 6))
+        return asm_section(name, ELF_SECTION_PROGBITS, ELF_FLAG_ALLOC | ELF_FLAG_WRITE, 0);
+    return asm_section(name, ELF_SECTION_PROGBITS, 0, 0);
+}
+
+static void asm_section_switch(size_t section, size_t chunk) {
+    asm_section_t *s = &asm_state.sections[section];
+    if (chunk >= s->count) {
+        s->chunks = realloc(s->chunks, (chunk + 1) * sizeof(asm_chunk_t));
+        if (!s->chunks)
+            compile_error("out of memory");
+        for (size_t i = s->count; i <= chunk; i++)
+            s->chunks[i] = (asm_chunk_t) { .align = 1 };
+        s->count = chunk + 1;
+    }
+    asm_state.previous       = asm_state.section;
+    asm_state.previous_chunk = asm_state.chunk;
+    asm_state.section        = section;
+    asm_state.chunk          = chunk;
+}
+
+/* output */
+static void asm_bytes(const void *data, size_t length) {
+    /* an empty chunk has no data yet, which memcpy and memset can't take */
+    if (!length)
+        return;
+
+    asm_chunk_t *chunk = asm_chunk();
+    chunk->data = asm_grow(chunk->data, &chunk->allocated, chunk->length + length, 1);
+    if (data)
+        memcpy(chunk->data + chunk->length, data, length);
+    else
+        memset(chunk->data + chunk->length, 0, length);
+    chunk->length += length;
+}
+
+static void asm_byte(unsigned value) {
+    unsigned char byte = value;
+    asm_bytes(&byte, 1);
+}
+
+static void asm_integer(uint64_t value, size_t size) {
+    unsigned char data[8];
+    for (size_t i = 0; i < size; i++)
+        data[i] = value >> (i * 8);
+    asm_bytes(data, size);
+}
+
+/*
+ * Emits the value of an expression, anything referring to a symbol is
+ * left as zero and recorded as a fixup. The adjustment is only applied
+ * to fixups, it's how PC-relative references account for the bytes of
+ * the instruction following the field.
+ */
+static void asm_value(asm_expression_t *expression, size_t size, unsigned type, int64_t adjust) {
+    if (!expression->symbol && !expression->minus) {
+        asm_integer(expression->value, size);
+        return;
+    }
+
+    if (!expression->symbol)
+        asm_error("cannot negate a symbol");
+
+    asm_state.fixups = asm_grow(asm_state.fixups, &asm_state.fixup_allocated, asm_state.fixup_length + 1, sizeof(asm_fixup_t));
+    asm_state.fixups[asm_state.fixup_length++] = (asm_fixup_t) {
+        .section = asm_state.section,
+        .chunk   = asm_state.chunk,
+        .offset  = asm_chunk()->length,
+        .size    = size,
+        .type    = expression->minus ? ASM_FIXUP_DIFFERENCE : type,
+        .symbol  = expression->symbol,
+        .minus   = expression->minus,
+        .addend  = expression->value + adjust
+    };
+
+    expression->symbol->referenced = true;
+    if (expression->minus)
+        expression->minus->referenced = true;
+
+    asm_integer(0, size);
+}
+
+/*
+ * Executable sections are padded with the recommended multi-byte NOP
+ * sequences instead of zeros.
+ */
+static const unsigned char asm_nops[9][9] = {
+    { 0x90 },
+    { 0x66, 0x90 },
+    { 0x0F, 0x1F, 0x00 },
+    { 0x0F, 0x1F, 0x40, 0x00 },
+    { 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+    { 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+    { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 },
+    { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 }
+};
+
+static void asm_pad(unsigned char *data, size_t length, bool code) {
+    if (!code) {
+        if (length)
+            memset(data, 0, length);
+        return;
+    }
+    while (length) {
+        size_t size = MIN(length, sizeof(asm_nops[0]));
+        memcpy(data, asm_nops[size - 1], size);
+        data   += size;
+        length -= size;
+    }
+}
+
+static void asm_align(size_t align) {
+    if (!align || (align & (align - 1)))
+        asm_error("alignment is not a power of two");
+
+    asm_chunk_t *chunk = asm_chunk();
+    size_t       pad   = (align - chunk->length % align) % align;
+
+    chunk->align = MAX(chunk->align, align);
+    asm_bytes(NULL, pad);
+    asm_pad(asm_chunk()->data + asm_chunk()->length - pad, pad,
+            asm_state.sections[asm_state.section].flags & ELF_FLAG_EXEC);
+}
+
+/* symbols */
+static asm_symbol_t *asm_symbol(const char *name, size_t length) {
+    char         *key    = string_intern(name, length);
+    asm_symbol_t *symbol = table_find(&asm_state.symbol_table, key);
+
+    if (symbol)
+        return symbol;
+
+    symbol       = memory_allocate(sizeof(asm_symbol_t));
+    *symbol      = (asm_symbol_t) { .name = key };
+    table_insert(&asm_state.symbol_table, key, symbol);
+    list_push(asm_state.symbols, symbol);
+    return symbol;
+}
+
+static void asm_symbol_define(asm_symbol_t *symbol, size_t section, size_t chunk, size_t offset) {
+    if (symbol->defined)
+        asm_error("symbol `%s' is already defined", symbol->name);
+
+    symbol->defined = true;
+    symbol->section = section;
+    symbol->chunk   = chunk;
+    symbol->offset  = offset;
+}
+
+/* parsing */
+static bool asm_identifier(int ch) {
+    return isalnum(ch) || ch == '_' || ch == '.' || ch == '$';
+}
+
+static char *asm_skip(char *p) {
+    while (*p == ' ' || *p == '\t')
+        p++;
+    return p;
+}
+
+/*
+ * Returns the next comma separated field trimmed of whitespace, or NULL
+ * once there are no more. Commas inside parentheses or quotes don't
+ * separate fields.
+ */
+static char *asm_field(char **cursor) {
+    char *p = asm_skip(*cursor);
+    if (!*p)
+        return NULL;
+
+    char *begin = p;
+    int   depth = 0;
+    bool  quote = false;
+    for (; *p; p++) {
+        if (quote) {
+            if (*p == '\\' && p[1])
+                p++;
+            else if (*p == '"')
+                quote = false;
+        } else if (*p == '"') {
+            quote = true;
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')') {
+            depth--;
+        } else if (*p == ',' && !depth) {
+            break;
+        }
+    }
+
+    char *end = p;
+    *cursor   = *p ? p + 1 : p;
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    *end = '\0';
+    return begin;
+}
+
+static char *asm_expression(char *p, asm_expression_t *expression) {
+    *expression = (asm_expression_t) { 0 };
+
+    for (bool first = true; ; first = false) {
+        p = asm_skip(p);
+
+        bool negative = false;
+        if (*p == '-' || *p == '+') {
+            negative = (*p == '-');
+            p = asm_skip(p + 1);
+        } else if (!first) {
+            break;
+        }
+
+        if (isdigit(*p)) {
+            char     *end;
+            uint64_t  value = strtoull(p, &end, 0);
+            expression->value += negative ? -value : value;
+            p = end;
+        } else if (asm_identifier(*p)) {
+            char *begin = p;
+            while (asm_identifier(*p))
+                p++;
+            asm_symbol_t *symbol = asm_symbol(begin, p - begin);
+            if (negative && !expression->minus)
+                expression->minus = symbol;
+            else if (!negative && !expression->symbol)
+                expression->symbol = symbol;
+            else
+                asm_error("expression is too complicated");
+        } else if (first && !negative) {
+            break;
+        } else {
+            asm_error("expected an operand");
+        }
+    }
+    return asm_skip(p);
+}
+
+static int64_t asm_constant(char *text) {
+    asm_expression_t expression;
+    if (*asm_expression(text, &expression) || expression.symbol || expression.minus)
+        asm_error("expected a constant");
+    return expression.value;
+}
+
+static const asm_register_t *asm_register(char *p, char **end) {
+    char *begin = p;
+    while (isalnum(*p))
+        p++;
+
+    char save = *p;
+    *p = '\0';
+    const asm_register_t *reg = table_find(&asm_state.registers, begin);
+    *p = save;
+
+    if (!reg)
+        asm_error("unknown register");
+    *end = p;
+    return reg;
+}
+
+static void asm_operand(char *text, asm_operand_t *operand) {
+    *operand = (asm_operand_t) {
+        .base  = ASM_NONE,
+        .index = ASM_NONE,
+        .scale = 1
+    };
+
+    if (*text == '*') {
+        operand->indirect = true;
+        text = asm_skip(text + 1);
+    }
+
+    if (*text == '%') {
+        const asm_register_t *reg = asm_register(text + 1, &text);
+        if (*asm_skip(text) || reg->size == 0)
+            asm_error("bad register operand");
+        operand->kind = ASM_REGISTER;
+        operand->reg  = reg->reg;
+        operand->size = reg->size;
+        operand->xmm  = (reg->size == 16);
+        return;
+    }
+
+    if (*text == '$') {
+        operand->kind = ASM_IMMEDIATE;
+        if (*asm_expression(text + 1, &operand->expression))
+            asm_error("bad immediate operand");
+        return;
+    }
+
+    operand->kind = ASM_MEMORY;
+    text = asm_expression(text, &operand->expression);
+    if (!*text)
+        return;
+    if (*text != '(')
+        asm_error("bad memory operand");
+
+    text = asm_skip(text + 1);
+    if (*text == '%') {
+        const asm_register_t *reg = asm_register(text + 1, &text);
+        if (reg->size != 8 && reg->size != 0)
+            asm_error("base register must be 64-bit");
+        operand->base = reg->reg;
+        text = asm_skip(text);
+    }
+    if (*text == ',') {
+        text = asm_skip(text + 1);
+        if (*text == '%') {
+            const asm_register_t *reg = asm_register(text + 1, &text);
+            if (reg->size != 8 || reg->reg == 4)
+                asm_error("bad index register");
+            operand->index = reg->reg;
+            text = asm_skip(text);
+        }
+        if (*text == ',') {
+            char *end;
+            operand->scale = strtol(asm_skip(text + 1), &end, 10);
+            if (operand->scale != 1 && operand->scale != 2 && operand->scale != 4 && operand->scale != 8)
+                asm_error("bad scale");
+            text = asm_skip(end);
+        }
+    }
+    if (*text != ')' || *asm_skip(text + 1))
+        asm_error("bad memory operand");
+    if (operand->base == ASM_RIP && operand->index != ASM_NONE)
+        asm_error("cannot index %%rip");
+}
+
+/* encoding */
+typedef struct {
+    unsigned char  prefix;
+    bool           operand16;
+    bool           w;
+    bool           rex;
+    unsigned char  opcode[3];
+    size_t         length;
+    int            reg;
+    asm_operand_t *rm;
+    size_t         immediate;
+    asm_operand_t *imm;
+    unsigned       relocation;
+} asm_encoding_t;
+
+/* spl, bpl, sil and dil are only reachable with a REX prefix */
+static bool asm_rex_byte(asm_operand_t *operand) {
+    return operand->kind == ASM_REGISTER && operand->size == 1 && operand->reg >= 4 && operand->reg < 8;
+}
+
+static bool asm_fits8(int64_t value) {
+    return value >= -128 && value <= 127;
+}
+
+static bool asm_fits32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static void asm_modrm(int reg, asm_operand_t *rm, size_t immediate) {
+    reg &= 7;
+    if (rm->kind == ASM_REGISTER) {
+        asm_byte(0xC0 | reg << 3 | (rm->reg & 7));
+        return;
+    }
+
+    asm_expression_t *displacement = &rm->expression;
+    if (!displacement->symbol && !asm_fits32(displacement->value))
+        asm_error("displacement out of range");
+
+    if (rm->base == ASM_RIP) {
+        asm_byte(0x05 | reg << 3);
+        asm_value(displacement, 4, ELF_RELOCATION_PC32, -(int64_t)(4 + immediate));
+        return;
+    }
+
+    int scale = (rm->scale == 8) ? 3 : (rm->scale == 4) ? 2 : (rm->scale == 2) ? 1 : 0;
+    int index = (rm->index == ASM_NONE) ? 4 : (rm->index & 7);
+
+    if (rm->base == ASM_NONE) {
+        asm_byte(0x04 | reg << 3);
+        asm_byte(scale << 6 | index << 3 | 5);
+        asm_value(displacement, 4, ELF_RELOCATION_32S, 0);
+        return;
+    }
+
+    int mod;
+    if (displacement->symbol || displacement->minus)
+        mod = 2;
+    else if (!displacement->value && (rm->base & 7) != 5)
+        mod = 0;
+    else if (asm_fits8(displacement->value))
+        mod = 1;
+    else
+        mod = 2;
+
+    if (rm->index != ASM_NONE || (rm->base & 7) == 4) {
+        asm_byte(mod << 6 | reg << 3 | 4);
+        asm_byte(scale << 6 | index << 3 | (rm->base & 7));
+    } else {
+        asm_byte(mod << 6 | reg << 3 | (rm->base & 7));
+    }
+
+    if (mod == 1)
+        asm_byte(displacement->value);
+    else if (mod == 2)
+        asm_value(displacement, 4, ELF_RELOCATION_32S, 0);
+}
+
+static void asm_encode(asm_encoding_t *encoding) {
+    unsigned       rex = 0x40;
+    asm_operand_t *rm  = encoding->rm;
+
+    if (encoding->w)
+        rex |= 0x08;
+    if (encoding->reg & 8)
+        rex |= 0x04;
+    if (rm && rm->kind == ASM_REGISTER && (rm->reg & 8))
+        rex |= 0x01;
+    if (rm && rm->kind == ASM_MEMORY) {
+        if (rm->index != ASM_NONE && (rm->index & 8))
+            rex |= 0x02;
+        if (rm->base != ASM_NONE && rm->base != ASM_RIP && (rm->base & 8))
+            rex |= 0x01;
+    }
+
+    if (encoding->operand16)
+        asm_byte(0x66);
+    if (encoding->prefix)
+        asm_byte(encoding->prefix);
+    if (rex != 0x40 || encoding->rex)
+        asm_byte(rex);
+
+    asm_bytes(encoding->opcode, encoding->length);
+    if (rm)
+        asm_modrm(encoding->reg, rm, encoding->immediate);
+    if (encoding->immediate)
+        asm_value(&encoding->imm->expression, encoding->immediate, encoding->relocation, 0);
+}
+
+/* instructions with the register encoded in the opcode */
+static void asm_encode_short(bool w, bool operand16, bool rex, unsigned opcode, int reg, size_t immediate, asm_operand_t *imm, unsigned relocation) {
+    if (operand16)
+        asm_byte(0x66);
+    if (w || rex || (reg & 8))
+        asm_byte(0x40 | (w ? 0x08 : 0) | ((reg & 8) ? 0x01 : 0));
+    asm_byte(opcode + (reg & 7));
+    if (immediate)
+        asm_value(&imm->expression, immediate, relocation, 0);
+}
+
+static void asm_expect(bool condition) {
+    if (!condition)
+        asm_error("invalid operands");
+}
+
+static int asm_size(asm_operand_t *operands, size_t count, int size) {
+    if (size)
+        return size;
+    for (size_t i = count; i--; )
+        if (operands[i].kind == ASM_REGISTER && !operands[i].xmm)
+            return operands[i].size;
+    asm_error("ambiguous operand size");
+}
+
+static size_t asm_immediate_size(int size) {
+    return (size == 8) ? 4 : size;
+}
+
+static void asm_encode_fixed(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    (void)operands;
+    asm_expect(!count && !size);
+    for (unsigned i = 0; i < mnemonic->extra; i++)
+        asm_byte(mnemonic->code >> (i * 8));
+}
+
+static void asm_encode_string(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    (void)operands;
+    asm_expect(!count);
+    size = size ? size : (int)mnemonic->extra;
+    asm_expect(size);
+    if (size == 2)
+        asm_byte(0x66);
+    if (size == 8)
+        asm_byte(0x48);
+    asm_byte(mnemonic->code + (size != 1));
+}
+
+static void asm_encode_mov(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 2);
+
+    asm_operand_t *src = &operands[0];
+    asm_operand_t *dst = &operands[1];
+    int64_t        v   = src->expression.value;
+    bool           sym = src->expression.symbol != NULL;
+
+    asm_expect(!src->xmm && !dst->xmm && dst->kind != ASM_IMMEDIATE);
+    size = asm_size(operands, count, size);
+
+    if (src->kind == ASM_IMMEDIATE) {
+        if (mnemonic->code) {
+            /* movabs */
+            asm_expect(dst->kind == ASM_REGISTER && size == 8);
+            asm_encode_short(true, false, false, 0xB8, dst->reg, 8, src, ELF_RELOCATION_64);
+        } else if (dst->kind == ASM_REGISTER) {
+            if (size == 8 && (sym || asm_fits32(v)))
+                asm_encode(&(asm_encoding_t) { .w = true, .opcode = { 0xC7 }, .length = 1, .reg = 0, .rm = dst, .immediate = 4, .imm = src, .relocation = ELF_RELOCATION_32S });
+            else if (size == 8 && (uint64_t)v <= UINT32_MAX)
+                asm_encode_short(false, false, false, 0xB8, dst->reg, 4, src, ELF_RELOCATION_32);
+            else
+                asm_encode_short(size == 8, size == 2, asm_rex_byte(dst), (size == 1) ? 0xB0 : 0xB8, dst->reg, size, src,
+                                 (size == 8) ? ELF_RELOCATION_64 : ELF_RELOCATION_32);
+        } else {
+            if (size == 8 && !sym && !asm_fits32(v))
+                asm_error("immediate out of range");
+            asm_encode(&(asm_encoding_t) {
+                .w          = size == 8,
+                .operand16  = size == 2,
+                .opcode     = { (size == 1) ? 0xC6 : 0xC7 },
+                .length     = 1,
+                .reg        = 0,
+                .rm         = dst,
+                .immediate  = asm_immediate_size(size),
+                .imm        = src,
+                .relocation = (size == 8) ? ELF_RELOCATION_32S : ELF_RELOCATION_32
+            });
+        }
+        return;
+    }
+
+    bool load = (src->kind == ASM_MEMORY);
+    asm_expect(!load || dst->kind == ASM_REGISTER);
+    asm_encode(&(asm_encoding_t) {
+        .w         = size == 8,
+        .operand16 = size == 2,
+        .rex       = asm_rex_byte(src) || asm_rex_byte(dst),
+        .opcode    = { (load ? 0x8A : 0x88) + (size != 1) },
+        .length    = 1,
+        .reg       = load ? dst->reg : src->reg,
+        .rm        = load ? src : dst
+    });
+}
+
+/*
+ * movs and movz with the source size in the low byte of extra and the
+ * destination size, when it's part of the mnemonic, in the high byte.
+ * Without operands movsb and friends are the string instructions.
+ */
+static void asm_encode_extend(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    int from = mnemonic->extra & 0xFF;
+    int to   = mnemonic->extra >> 8;
+
+    if (!count && !size && mnemonic->code == 0xBE) {
+        asm_encode_string(&(asm_mnemonic_t) { .code = 0xA4, .extra = from }, operands, count, 0);
+        return;
+    }
+
+    asm_expect(count == 2 && !size && operands[1].kind == ASM_REGISTER && !operands[1].xmm);
+    asm_expect(operands[0].kind != ASM_IMMEDIATE && !operands[0].xmm);
+
+    asm_operand_t *src = &operands[0];
+    asm_operand_t *dst = &operands[1];
+
+    to = to ? to : dst->size;
+    asm_expect(to == dst->size && (src->kind == ASM_MEMORY || src->size == from) && from < to);
+
+    if (from == 4) {
+        asm_expect(mnemonic->code == 0xBE && to == 8);
+        asm_encode(&(asm_encoding_t) { .w = true, .opcode = { 0x63 }, .length = 1, .reg = dst->reg, .rm = src });
+        return;
+    }
+
+    asm_encode(&(asm_encoding_t) {
+        .w         = to == 8,
+        .operand16 = to == 2,
+        .rex       = asm_rex_byte(src),
+        .opcode    = { 0x0F, mnemonic->code + (from == 2) },
+        .length    = 2,
+        .reg       = dst->reg,
+        .rm        = src
+    });
+}
+
+static void asm_encode_lea(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    (void)mnemonic;
+    asm_expect(count == 2 && operands[0].kind == ASM_MEMORY && operands[1].kind == ASM_REGISTER && !operands[1].xmm);
+    size = asm_size(operands, count, size);
+    asm_expect(size >= 2);
+    asm_encode(&(asm_encoding_t) {
+        .w         = size == 8,
+        .operand16 = size == 2,
+        .opcode    = { 0x8D },
+        .length    = 1,
+        .reg       = operands[1].reg,
+        .rm        = &operands[0]
+    });
+}
+
+/* code is the short opcode, extra the /digit of the memory form */
+static void asm_encode_stack(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 1 && (!size || size == 8));
+
+    asm_operand_t *operand = &operands[0];
+    if (operand->kind == ASM_REGISTER) {
+        asm_expect(operand->size == 8);
+        asm_encode_short(false, false, false, mnemonic->code, operand->reg, 0, NULL, 0);
+    } else if (operand->kind == ASM_IMMEDIATE) {
+        asm_expect(mnemonic->code == 0x50);
+        bool small = !operand->expression.symbol && asm_fits8(operand->expression.value);
+        asm_byte(small ? 0x6A : 0x68);
+        asm_value(&operand->expression, small ? 1 : 4, ELF_RELOCATION_32S, 0);
+    } else {
+        asm_encode(&(asm_encoding_t) {
+            .opcode = { (mnemonic->code == 0x50) ? 0xFF : 0x8F },
+            .length = 1,
+            .reg    = mnemonic->extra,
+            .rm     = operand
+        });
+    }
+}
+
+/* code is the /digit of the group 1 opcodes */
+static void asm_encode_arithmetic(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 2);
+
+    asm_operand_t *src = &operands[0];
+    asm_operand_t *dst = &operands[1];
+
+    asm_expect(!src->xmm && !dst->xmm && dst->kind != ASM_IMMEDIATE);
+    size = asm_size(operands, count, size);
+
+    if (src->kind == ASM_IMMEDIATE) {
+        if (size == 8 && !src->expression.symbol && !asm_fits32(src->expression.value))
+            asm_error("immediate out of range");
+        bool small = !src->expression.symbol && asm_fits8(src->expression.value);
+        asm_encode(&(asm_encoding_t) {
+            .w          = size == 8,
+            .operand16  = size == 2,
+            .rex        = asm_rex_byte(dst),
+            .opcode     = { (size == 1) ? 0x80 : small ? 0x83 : 0x81 },
+            .length     = 1,
+            .reg        = mnemonic->code,
+            .rm         = dst,
+            .immediate  = (size == 1 || small) ? 1 : asm_immediate_size(size),
+            .imm        = src,
+            .relocation = ELF_RELOCATION_32S
+        });
+        return;
+    }
+
+    bool load = (src->kind == ASM_MEMORY);
+    asm_expect(!load || dst->kind == ASM_REGISTER);
+    asm_encode(&(asm_encoding_t) {
+        .w         = size == 8,
+        .operand16 = size == 2,
+        .rex       = asm_rex_byte(src) || asm_rex_byte(dst),
+        .opcode    = { mnemonic->code * 8 + (load ? 2 : 0) + (size != 1) },
+        .length    = 1,
+        .reg       = load ? dst->reg : src->reg,
+        .rm        = load ? src : dst
+    });
+}
+
+static void asm_encode_test(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    (void)mnemonic;
+    asm_expect(count == 2);
+
+    asm_operand_t *src = &operands[0];
+    asm_operand_t *dst = &operands[1];
+
+    asm_expect(!src->xmm && !dst->xmm && dst->kind != ASM_IMMEDIATE);
+    size = asm_size(operands, count, size);
+
+    if (src->kind == ASM_IMMEDIATE) {
+        asm_encode(&(asm_encoding_t) {
+            .w          = size == 8,
+            .operand16  = size == 2,
+            .rex        = asm_rex_byte(dst),
+            .opcode     = { (size == 1) ? 0xF6 : 0xF7 },
+            .length     = 1,
+            .reg        = 0,
+            .rm         = dst,
+            .immediate  = asm_immediate_size(size),
+            .imm        = src,
+            .relocation = ELF_RELOCATION_32S
+        });
+        return;
+    }
+
+    /* test is symmetric, the memory operand goes in r/m */
+    if (src->kind == ASM_MEMORY) {
+        asm_operand_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    asm_expect(src->kind == ASM_REGISTER);
+    asm_encode(&(asm_encoding_t) {
+        .w         = size == 8,
+        .operand16 = size == 2,
+        .rex       = asm_rex_byte(src) || asm_rex_byte(dst),
+        .opcode    = { (size == 1) ? 0x84 : 0x85 },
+        .length    = 1,
+        .reg       = src->reg,
+        .rm        = dst
+    });
+}
+
+/* code is the /digit, extra the byte sized opcode of the group */
+static void asm_encode_unary(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 1 && operands[0].kind != ASM_IMMEDIATE && !operands[0].xmm);
+    size = asm_size(operands, count, size);
+    asm_encode(&(asm_encoding_t) {
+        .w         = size == 8,
+        .operand16 = size == 2,
+        .rex       = asm_rex_byte(&operands[0]),
+        .opcode    = { mnemonic->extra + (size != 1) },
+        .length    = 1,
+        .reg       = mnemonic->code,
+        .rm        = &operands[0]
+    });
+}
+
+static void asm_encode_imul(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    if (count == 1) {
+        asm_encode_unary(mnemonic, operands, count, size);
+        return;
+    }
+
+    asm_expect(count == 2 || count == 3);
+
+    asm_operand_t *dst = &operands[count - 1];
+    asm_operand_t *src = &operands[count - 2];
+
+    asm_expect(dst->kind == ASM_REGISTER && !dst->xmm && !src->xmm);
+    size = asm_size(operands, count, size);
+    asm_expect(size != 1);
+
+    if (operands[0].kind == ASM_IMMEDIATE) {
+        asm_operand_t *imm   = &operands[0];
+        bool           small = !imm->expression.symbol && asm_fits8(imm->expression.value);
+        asm_encode(&(asm_encoding_t) {
+            .w          = size == 8,
+            .operand16  = size == 2,
+            .opcode     = { small ? 0x6B : 0x69 },
+            .length     = 1,
+            .reg        = dst->reg,
+            .rm         = (count == 3) ? src : dst,
+            .immediate  = small ? 1 : asm_immediate_size(size),
+            .imm        = imm,
+            .relocation = ELF_RELOCATION_32S
+        });
+        return;
+    }
+
+    asm_expect(count == 2);
+    asm_encode(&(asm_encoding_t) {
+        .w         = size == 8,
+        .operand16 = size == 2,
+        .opcode    = { 0x0F, 0xAF },
+        .length    = 2,
+        .reg       = dst->reg,
+        .rm        = src
+    });
+}
+
+/* code is the /digit of the shift group */
+static void asm_encode_shift(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 1 || count == 2);
+
+    asm_operand_t *dst    = &operands[count - 1];
+    asm_operand_t *amount = (count == 2) ? &operands[0] : NULL;
+
+    asm_expect(dst->kind != ASM_IMMEDIATE && !dst->xmm);
+    size = asm_size(dst, 1, size);
+
+    unsigned opcode = 0xD0;
+    if (amount && amount->kind == ASM_REGISTER) {
+        asm_expect(amount->reg == 1 && amount->size == 1);
+        opcode = 0xD2;
+    } else if (amount) {
+        asm_expect(amount->kind == ASM_IMMEDIATE && !amount->expression.symbol);
+        if (amount->expression.value != 1)
+            opcode = 0xC0;
+    }
+
+    asm_encode(&(asm_encoding_t) {
+        .w         = size == 8,
+        .operand16 = size == 2,
+        .rex       = asm_rex_byte(dst),
+        .opcode    = { opcode + (size != 1) },
+        .length    = 1,
+        .reg       = mnemonic->code,
+        .rm        = dst,
+        .immediate = (opcode == 0xC0) ? 1 : 0,
+        .imm       = amount
+    });
+}
+
+/* code is the condition */
+static void asm_encode_setcc(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 1 && (!size || size == 1) && operands[0].kind != ASM_IMMEDIATE);
+    asm_expect(operands[0].kind == ASM_MEMORY || operands[0].size == 1);
+    asm_encode(&(asm_encoding_t) {
+        .rex    = asm_rex_byte(&operands[0]),
+        .opcode = { 0x0F, 0x90 + mnemonic->code },
+        .length = 2,
+        .reg    = 0,
+        .rm     = &operands[0]
+    });
+}
+
+static void asm_encode_cmov(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 2 && operands[0].kind != ASM_IMMEDIATE && operands[1].kind == ASM_REGISTER);
+    size = asm_size(operands, count, size);
+    asm_expect(size != 1);
+    asm_encode(&(asm_encoding_t) {
+        .w         = size == 8,
+        .operand16 = size == 2,
+        .opcode    = { 0x0F, 0x40 + mnemonic->code },
+        .length    = 2,
+        .reg       = operands[1].reg,
+        .rm        = &operands[0]
+    });
+}
+
+static bool asm_direct(asm_operand_t *operand) {
+    return operand->kind == ASM_MEMORY && !operand->indirect && operand->base == ASM_NONE && operand->index == ASM_NONE;
+}
+
+static void asm_branch(asm_operand_t *operand, unsigned type) {
+    if (!operand->expression.symbol)
+        asm_error("branch target must be a symbol");
+    asm_value(&operand->expression, 4, type, -4);
+}
+
+/* code is the condition */
+static void asm_encode_jcc(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 1 && !size && asm_direct(&operands[0]));
+    asm_byte(0x0F);
+    asm_byte(0x80 + mnemonic->code);
+    asm_branch(&operands[0], ELF_RELOCATION_PC32);
+}
+
+/* code is the direct opcode, extra the /digit of the indirect form */
+static void asm_encode_jump(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 1 && (!size || size == 8));
+
+    asm_operand_t *target = &operands[0];
+    if (asm_direct(target)) {
+        asm_byte(mnemonic->code);
+        asm_branch(target, ELF_RELOCATION_PLT32);
+        return;
+    }
+
+    asm_expect(target->indirect && (target->kind == ASM_MEMORY || target->size == 8));
+    asm_encode(&(asm_encoding_t) {
+        .opcode = { 0xFF },
+        .length = 1,
+        .reg    = mnemonic->extra,
+        .rm     = target
+    });
+}
+
+/*
+ * Scalar SSE with the mandatory prefix in extra. The opcode used when
+ * storing to memory, if there's one, is in the high byte of code.
+ */
+static void asm_encode_sse(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 2 && !size);
+
+    asm_operand_t *src   = &operands[0];
+    asm_operand_t *dst   = &operands[1];
+    bool           store = (dst->kind == ASM_MEMORY);
+
+    asm_expect(store ? (mnemonic->code >> 8) && src->xmm : dst->xmm);
+    asm_expect(src->kind != ASM_IMMEDIATE && (src->kind == ASM_MEMORY || src->xmm));
+
+    asm_encode(&(asm_encoding_t) {
+        .prefix = mnemonic->extra,
+        .opcode = { 0x0F, store ? (mnemonic->code >> 8) : (mnemonic->code & 0xFF) },
+        .length = 2,
+        .reg    = store ? src->reg : dst->reg,
+        .rm     = store ? dst : src
+    });
+}
+
+/* movsd is also the string instruction when it's got no operands */
+static void asm_encode_movsd(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    if (!count)
+        asm_encode_string(&(asm_mnemonic_t) { .code = 0xA4, .extra = 4 }, operands, count, size);
+    else
+        asm_encode_sse(mnemonic, operands, count, size);
+}
+
+/* integer to floating point, operand size from the suffix or register */
+static void asm_encode_cvtsi(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 2 && operands[1].xmm && operands[0].kind != ASM_IMMEDIATE && !operands[0].xmm);
+    size = size ? size : (operands[0].kind == ASM_REGISTER) ? operands[0].size : 4;
+    asm_expect(size == 4 || size == 8);
+    asm_encode(&(asm_encoding_t) {
+        .prefix = mnemonic->extra,
+        .w      = size == 8,
+        .opcode = { 0x0F, mnemonic->code },
+        .length = 2,
+        .reg    = operands[1].reg,
+        .rm     = &operands[0]
+    });
+}
+
+/* floating point to integer */
+static void asm_encode_cvtsi2(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 2 && operands[1].kind == ASM_REGISTER && !operands[1].xmm);
+    asm_expect(operands[0].kind == ASM_MEMORY || operands[0].xmm);
+    size = asm_size(operands, count, size);
+    asm_expect(size == 4 || size == 8);
+    asm_encode(&(asm_encoding_t) {
+        .prefix = mnemonic->extra,
+        .w      = size == 8,
+        .opcode = { 0x0F, mnemonic->code },
+        .length = 2,
+        .reg    = operands[1].reg,
+        .rm     = &operands[0]
+    });
+}
+
+/* movq and movd between general purpose and SSE registers, code is the size */
+static void asm_encode_movq(const asm_mnemonic_t *mnemonic, asm_operand_t *operands, size_t count, int size) {
+    asm_expect(count == 2 && !size);
+
+    asm_operand_t *src = &operands[0];
+    asm_operand_t *dst = &operands[1];
+    bool           w   = (mnemonic->code == 8);
+
+    if (!src->xmm && !dst->xmm) {
+        asm_expect(w);
+        asm_encode_mov(&(asm_mnemonic_t) { .code = 0 }, operands, count, 8);
+        return;
+    }
+
+    asm_expect(src->kind != ASM_IMMEDIATE);
+    if (dst->xmm) {
+        if (src->kind == ASM_REGISTER && !src->xmm) {
+            asm_expect(src->size == (int)mnemonic->code);
+            asm_encode(&(asm_encoding_t) { .prefix = 0x66, .w = w, .opcode = { 0x0F, 0x6E }, .length = 2, .reg = dst->reg, .rm = src });
+        } else if (w) {
+            asm_encode(&(asm_encoding_t) { .prefix = 0xF3, .opcode = { 0x0F, 0x7E }, .length = 2, .reg = dst->reg, .rm = src });
+        } else {
+            asm_expect(src->kind == ASM_MEMORY);
+            asm_encode(&(asm_encoding_t) { .prefix = 0x66, .opcode = { 0x0F, 0x6E }, .length = 2, .reg = dst->reg, .rm = src });
+        }
+        return;
+    }
+
+    if (dst->kind == ASM_REGISTER) {
+        asm_expect(dst->size == (int)mnemonic->code);
+        asm_encode(&(asm_encoding_t) { .prefix = 0x66, .w = w, .opcode = { 0x0F, 0x7E }, .length = 2, .reg = src->reg, .rm = dst });
+    } else {
+        asm_encode(&(asm_encoding_t) { .prefix = 0x66, .opcode = { 0x0F, w ? 0xD6 : 0x7E }, .length = 2, .reg = src->reg, .rm = dst });
+    }
+}
+
+static const asm_mnemonic_t asm_mnemonics[] = {
+    { "mov",       asm_encode_mov,        0,      0      },
+    { "movabs",    asm_encode_mov,        1,      0      },
+    { "movsb",     asm_encode_extend,     0xBE,   0x001  },
+    { "movsw",     asm_encode_extend,     0xBE,   0x002  },
+    { "movsl",     asm_encode_string,     0xA4,   4      },
+    { "movsq",     asm_encode_string,     0xA4,   8      },
+    { "movsbw",    asm_encode_extend,     0xBE,   0x201  },
+    { "movsbl",    asm_encode_extend,     0xBE,   0x401  },
+    { "movsbq",    asm_encode_extend,     0xBE,   0x801  },
+    { "movswl",    asm_encode_extend,     0xBE,   0x402  },
+    { "movswq",    asm_encode_extend,     0xBE,   0x802  },
+    { "movslq",    asm_encode_extend,     0xBE,   0x804  },
+    { "movzb",     asm_encode_extend,     0xB6,   0x001  },
+    { "movzw",     asm_encode_extend,     0xB6,   0x002  },
+    { "movzbw",    asm_encode_extend,     0xB6,   0x201  },
+    { "movzbl",    asm_encode_extend,     0xB6,   0x401  },
+    { "movzbq",    asm_encode_extend,     0xB6,   0x801  },
+    { "movzwl",    asm_encode_extend,     0xB6,   0x402  },
+    { "movzwq",    asm_encode_extend,     0xB6,   0x802  },
+    { "lea",       asm_encode_lea,        0,      0      },
+    { "push",      asm_encode_stack,      0x50,   6      },
+    { "pop",       asm_encode_stack,      0x58,   0      },
+    { "add",       asm_encode_arithmetic, 0,      0      },
+    { "or",        asm_encode_arithmetic, 1,      0      },
+    { "adc",       asm_encode_arithmetic, 2,      0      },
+    { "sbb",       asm_encode_arithmetic, 3,      0      },
+    { "and",       asm_encode_arithmetic, 4,      0      },
+    { "sub",       asm_encode_arithmetic, 5,      0      },
+    { "xor",       asm_encode_arithmetic, 6,      0      },
+    { "cmp",       asm_encode_arithmetic, 7,      0      },
+    { "test",      asm_encode_test,       0,      0      },
+    { "not",       asm_encode_unary,      2,      0xF6   },
+    { "neg",       asm_encode_unary,      3,      0xF6   },
+    { "mul",       asm_encode_unary,      4,      0xF6   },
+    { "imul",      asm_encode_imul,       5,      0xF6   },
+    { "div",       asm_encode_unary,      6,      0xF6   },
+    { "idiv",      asm_encode_unary,      7,      0xF6   },
+    { "inc",       asm_encode_unary,      0,      0xFE   },
+    { "dec",       asm_encode_unary,      1,      0xFE   },
+    { "rol",       asm_encode_shift,      0,      0      },
+    { "ror",       asm_encode_shift,      1,      0      },
+    { "shl",       asm_encode_shift,      4,      0      },
+    { "sal",       asm_encode_shift,      4,      0      },
+    { "shr",       asm_encode_shift,      5,      0      },
+    { "sar",       asm_encode_shift,      7,      0      },
+    { "jmp",       asm_encode_jump,       0xE9,   4      },
+    { "call",      asm_encode_jump,       0xE8,   2      },
+    { "ret",       asm_encode_fixed,      0xC3,   1      },
+    { "leave",     asm_encode_fixed,      0xC9,   1      },
+    { "nop",       asm_encode_fixed,      0x90,   1      },
+    { "hlt",       asm_encode_fixed,      0xF4,   1      },
+    { "ud2",       asm_encode_fixed,      0x0B0F, 2      },
+    { "cqto",      asm_encode_fixed,      0x9948, 2      },
+    { "cqo",       asm_encode_fixed,      0x9948, 2      },
+    { "cltq",      asm_encode_fixed,      0x9848, 2      },
+    { "cdqe",      asm_encode_fixed,      0x9848, 2      },
+    { "cltd",      asm_encode_fixed,      0x99,   1      },
+    { "cdq",       asm_encode_fixed,      0x99,   1      },
+    { "cwtl",      asm_encode_fixed,      0x98,   1      },
+    { "stosb",     asm_encode_string,     0xAA,   1      },
+    { "stosw",     asm_encode_string,     0xAA,   2      },
+    { "stosl",     asm_encode_string,     0xAA,   4      },
+    { "stosq",     asm_encode_string,     0xAA,   8      },
+    { "movss",     asm_encode_sse,        0x1110, 0xF3   },
+    { "movsd",     asm_encode_movsd,      0x1110, 0xF2   },
+    { "movaps",    asm_encode_sse,        0x2928, 0      },
+    { "movapd",    asm_encode_sse,        0x2928, 0x66   },
+    { "movups",    asm_encode_sse,        0x1110, 0      },
+    { "movupd",    asm_encode_sse,        0x1110, 0x66   },
+    { "movdqa",    asm_encode_sse,        0x7F6F, 0x66   },
+    { "movdqu",    asm_encode_sse,        0x7F6F, 0xF3   },
+    { "addss",     asm_encode_sse,        0x58,   0xF3   },
+    { "addsd",     asm_encode_sse,        0x58,   0xF2   },
+    { "mulss",     asm_encode_sse,        0x59,   0xF3   },
+    { "mulsd",     asm_encode_sse,        0x59,   0xF2   },
+    { "subss",     asm_encode_sse,        0x5C,   0xF3   },
+    { "subsd",     asm_encode_sse,        0x5C,   0xF2   },
+    { "minss",     asm_encode_sse,        0x5D,   0xF3   },
+    { "minsd",     asm_encode_sse,        0x5D,   0xF2   },
+    { "divss",     asm_encode_sse,        0x5E,   0xF3   },
+    { "divsd",     asm_encode_sse,        0x5E,   0xF2   },
+    { "maxss",     asm_encode_sse,        0x5F,   0xF3   },
+    { "maxsd",     asm_encode_sse,        0x5F,   0xF2   },
+    { "sqrtss",    asm_encode_sse,        0x51,   0xF3   },
+    { "sqrtsd",    asm_encode_sse,        0x51,   0xF2   },
+    { "ucomiss",   asm_encode_sse,        0x2E,   0      },
+    { "ucomisd",   asm_encode_sse,        0x2E,   0x66   },
+    { "comiss",    asm_encode_sse,        0x2F,   0      },
+    { "comisd",    asm_encode_sse,        0x2F,   0x66   },
+    { "andps",     asm_encode_sse,        0x54,   0      },
+    { "andpd",     asm_encode_sse,        0x54,   0x66   },
+    { "andnps",    asm_encode_sse,        0x55,   0      },
+    { "andnpd",    asm_encode_sse,        0x55,   0x66   },
+    { "orps",      asm_encode_sse,        0x56,   0      },
+    { "orpd",      asm_encode_sse,        0x56,   0x66   },
+    { "xorps",     asm_encode_sse,        0x57,   0      },
+    { "xorpd",     asm_encode_sse,        0x57,   0x66   },
+    { "pxor",      asm_encode_sse,        0xEF,   0x66   },
+    { "cvtss2sd",  asm_encode_sse,        0x5A,   0xF3   },
+    { "cvtsd2ss",  asm_encode_sse,        0x5A,   0xF2   },
+    { "cvtps2pd",  asm_encode_sse,        0x5A,   0      },
+    { "cvtpd2ps",  asm_encode_sse,        0x5A,   0x66   },
+    { "cvtsi2ss",  asm_encode_cvtsi,      0x2A,   0xF3   },
+    { "cvtsi2sd",  asm_encode_cvtsi,      0x2A,   0xF2   },
+    { "cvttss2si", asm_encode_cvtsi2,     0x2C,   0xF3   },
+    { "cvttsd2si", asm_encode_cvtsi2,     0x2C,   0xF2   },
+    { "cvtss2si",  asm_encode_cvtsi2,     0x2D,   0xF3   },
+    { "cvtsd2si",  asm_encode_cvtsi2,     0x2D,   0xF2   },
+    { "movq",      asm_encode_movq,       8,      0      },
+    { "movd",      asm_encode_movq,       4,      0      }
+};
+
+static const struct {
+    const char *name;
+    unsigned    code;
+} asm_conditions[] = {
+    { "o",  0x0 }, { "no",  0x1 }, { "b",   0x2 }, { "c",   0x2 },
+    { "nae",0x2 }, { "ae",  0x3 }, { "nb",  0x3 }, { "nc",  0x3 },
+    { "e",  0x4 }, { "z",   0x4 }, { "ne",  0x5 }, { "nz",  0x5 },
+    { "be", 0x6 }, { "na",  0x6 }, { "a",   0x7 }, { "nbe", 0x7 },
+    { "s",  0x8 }, { "ns",  0x9 }, { "p",   0xA }, { "pe",  0xA },
+    { "np", 0xB }, { "po",  0xB }, { "l",   0xC }, { "nge", 0xC },
+    { "ge", 0xD }, { "nl",  0xD }, { "le",  0xE }, { "ng",  0xE },
+    { "g",  0xF }, { "nle", 0xF }
+};
+
+static const char *asm_register_names[4][16] = {
+    { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+      "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15"  },
+    { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+      "r8d", "r9d", "r10d","r11d","r12d","r13d","r14d","r15d" },
+    { "ax",  "cx",  "dx",  "bx",  "sp",  "bp",  "si",  "di",
+      "r8w", "r9w", "r10w","r11w","r12w","r13w","r14w","r15w" },
+    { "al",  "cl",  "dl",  "bl",  "spl", "bpl", "sil", "dil",
+      "r8b", "r9b", "r10b","r11b","r12b","r13b","r14b","r15b" }
+};
+
+static void asm_mnemonic_add(const asm_mnemonic_t *mnemonic) {
+    table_insert(&asm_state.mnemonics, (char *)mnemonic->name, (void *)mnemonic);
+}
+
+static void asm_register_add(const char *name, int reg, int size) {
+    asm_register_t *entry = memory_allocate(sizeof(asm_register_t));
+    *entry = (asm_register_t) { .name = name, .reg = reg, .size = size };
+    table_insert(&asm_state.registers, (char *)name, entry);
+}
+
+static void asm_init(void) {
+    static bool ready = false;
+    if (ready)
+        return;
+    ready = true;
+
+    asm_state.mnemonics = SENTINEL_TABLE;
+    asm_state.registers = SENTINEL_TABLE;
+
+    for (size_t i = 0; i < sizeof(asm_mnemonics) / sizeof(*asm_mnemonics); i++)
+        asm_mnemonic_add(&asm_mnemonics[i]);
+
+    static const char *prefixes[]  = { "j", "set", "cmov" };
+    static const asm_encoder_t encoders[] = { asm_encode_jcc, asm_encode_setcc, asm_encode_cmov };
+    for (size_t i = 0; i < sizeof(prefixes) / sizeof(*prefixes); i++) {
+        for (size_t j = 0; j < sizeof(asm_conditions) / sizeof(*asm_conditions); j++) {
+            string_t       *name     = string_create();
+            asm_mnemonic_t *mnemonic = memory_allocate(sizeof(asm_mnemonic_t));
+
+            string_catf(name, "%s%s", prefixes[i], asm_conditions[j].name);
+            *mnemonic = (asm_mnemonic_t) {
+                .name   = string_buffer(name),
+                .encode = encoders[i],
+                .code   = asm_conditions[j].code
+            };
+            asm_mnemonic_add(mnemonic);
+        }
+    }
+
+    static const int sizes[] = { 8, 4, 2, 1 };
+    for (size_t i = 0; i < 4; i++)
+        for (int j = 0; j < 16; j++)
+            asm_register_add(asm_register_names[i][j], j, sizes[i]);
+
+    for (int i = 0; i < 16; i++) {
+        string_t *name = string_create();
+        string_catf(name, "xmm%d", i);
+        asm_register_add(string_buffer(name), i, 16);
+    }
+    asm_register_add("rip", ASM_RIP, 0);
+}
+
+/*
+ * Looks up a mnemonic, mnemonics which aren't known are retried with
+ * an operand size suffix removed.
+ */
+static const asm_mnemonic_t *asm_mnemonic(char *name, int *size) {
+    const asm_mnemonic_t *mnemonic;
+
+    *size = 0;
+    if ((mnemonic = table_find(&asm_state.mnemonics, name)))
+        return mnemonic;
+
+    size_t length = strlen(name);
+    if (length < 2)
+        return NULL;
+
+    char suffix = name[length - 1];
+    switch (suffix) {
+        case 'b': *size = 1; break;
+        case 'w': *size = 2; break;
+        case 'l': *size = 4; break;
+        case 'q': *size = 8; break;
+        default:
+            return NULL;
+    }
+
+    name[length - 1] = '\0';
+    mnemonic = table_find(&asm_state.mnemonics, name);
+    name[length - 1] = suffix;
+    return mnemonic;
+}
+
+static void asm_instruction(char *p) {
+    char *name = p;
+    while (isalnum(*p))
+        p++;
+
+    if (*p && *p != ' ' && *p != '\t')
+        asm_error("bad instruction");
+
+    if (*p)
+        *p++ = '\0';
+
+    /* rep prefix */
+    if (!strcmp(name, "rep") || !strcmp(name, "repz") || !strcmp(name, "repe")) {
+        asm_byte(0xF3);
+        asm_instruction(asm_skip(p));
+        return;
+    }
+
+    int                   size;
+    const asm_mnemonic_t *mnemonic = asm_mnemonic(name, &size);
+    if (!mnemonic)
+        asm_error("unknown instruction");
+
+    asm_operand_t operands[4];
+    size_t        count = 0;
+    char         *field;
+
+    while ((field = asm_field(&p))) {
+        if (count == sizeof(operands) / sizeof(*operands))
+            asm_error("too many operands");
+        asm_operand(field, &operands[count++]);
+    }
+
+    mnemonic->encode(mnemonic, operands, count, size);
+}
+
+/* directives */
+static void asm_string(char *p, bool terminate) {
+    char *field;
+    while ((field = asm_field(&p))) {
+        if (*field++ != '"')
+            asm_error("expected a string");
+
+        for (; *field != '"'; field++) {
+            if (!*field)
+                asm_error("unterminated string");
+
+            if (*field != '\\') {
+                asm_byte(*field);
+                continue;
+            }
+
+            switch (*++field) {
+                case 'n':  asm_byte('\n'); break;
+                case 't':  asm_byte('\t'); break;
+                case 'r':  asm_byte('\r'); break;
+                case 'a':  asm_byte('\a'); break;
+                case 'b':  asm_byte('\b'); break;
+                case 'f':  asm_byte('\f'); break;
+                case 'v':  asm_byte('\v'); break;
+                case 'x': {
+                    unsigned value = 0;
+                    while (isxdigit(field[1])) {
+                        field++;
+                        value = value * 16 + (isdigit(*field) ? *field - '0' : tolower(*field) - 'a' + 10);
+                    }
+                    asm_byte(value);
+                    break;
+                }
+                case '0': case '1': case '2': case '3':
+                case '4': case '5': case '6': case '7': {
+                    unsigned value = *field - '0';
+                    for (int i = 0; i < 2 && field[1] >= '0' && field[1] <= '7'; i++)
+                        value = value * 8 + (*++field - '0');
+                    asm_byte(value);
+                    break;
+                }
+                case '\0':
+                    asm_error("unterminated string");
+                default:
+                    asm_byte(*field);
+                    break;
+            }
+        }
+
+        if (*asm_skip(field + 1))
+            asm_error("junk after string");
+        if (terminate)
+            asm_byte('\0');
+    }
+}
+
+static void asm_data(char *p, size_t size) {
+    char *field;
+    while ((field = asm_field(&p))) {
+        asm_expression_t expression;
+        if (*asm_expression(field, &expression))
+            asm_error("bad expression");
+        if (expression.symbol && !expression.minus && size < 4)
+            asm_error("symbol doesn't fit");
+        asm_value(&expression, size, (size == 8) ? ELF_RELOCATION_64 : ELF_RELOCATION_32, 0);
+    }
+}
+
+static void asm_global(char *p, bool global) {
+    char *field;
+    while ((field = asm_field(&p)))
+        asm_symbol(field, strlen(field))->global = global;
+}
+
+/*
+ * .section name, "flags", @type, entsize with the flags and type
+ * defaulting to what the name implies.
+ */
+static void asm_directive_section(char *p) {
+    char *name = asm_field(&p);
+    if (!name)
+        asm_error("expected a section name");
+
+    char *flags = asm_field(&p);
+    if (!flags) {
+        asm_section_switch(asm_section_default(name), 0);
+        return;
+    }
+
+    uint64_t mask    = 0;
+    unsigned type    = ELF_SECTION_PROGBITS;
+    uint64_t entsize = 0;
+
+    if (*flags != '"')
+        asm_error("expected section flags");
+    for (flags++; *flags && *flags != '"'; flags++) {
+        switch (*flags) {
+            case 'a': mask |= ELF_FLAG_ALLOC;   break;
+            case 'w': mask |= ELF_FLAG_WRITE;   break;
+            case 'x': mask |= ELF_FLAG_EXEC;    break;
+            case 'M': mask |= ELF_FLAG_MERGE;   break;
+            case 'S': mask |= ELF_FLAG_STRINGS; break;
+            default:
+                asm_error("unknown section flag");
+        }
+    }
+
+    char *kind = asm_field(&p);
+    if (kind) {
+        if      (!strcmp(kind, "@progbits")) type = ELF_SECTION_PROGBITS;
+        else if (!strcmp(kind, "@nobits"))   type = ELF_SECTION_NOBITS;
+        else asm_error("unknown section type");
+
+        char *size = asm_field(&p);
+        if (size)
+            entsize = asm_constant(size);
+    }
+
+    size_t section = asm_section(name, type, mask, entsize);
+    if (asm_state.sections[section].flags != mask || asm_state.sections[section].type != type)
+        asm_error("section attributes changed");
+    asm_section_switch(section, 0);
+}
+
+static void asm_directive_lcomm(char *p) {
+    char *name  = asm_field(&p);
+    char *size  = asm_field(&p);
+    char *align = asm_field(&p);
+
+    if (!name || !size)
+        asm_error("expected a symbol and size");
+
+    int64_t bytes = asm_constant(size);
+    int64_t boundary;
+    if (align)
+        boundary = asm_constant(align);
+    else
+        for (boundary = 16; boundary > 1 && boundary > bytes; boundary /= 2)
+            ;
+
+    size_t section = asm_state.section;
+    size_t chunk   = asm_state.chunk;
+
+    asm_section_switch(asm_section_default(".bss"), 0);
+    asm_align(boundary);
+    asm_symbol_define(asm_symbol(name, strlen(name)), asm_state.section, 0, asm_chunk()->length);
+    asm_bytes(NULL, bytes);
+    asm_section_switch(section, chunk);
+}
+
+static void asm_directive(char *name, char *p) {
+    if (!strcmp(name, ".text") || !strcmp(name, ".data") || !strcmp(name, ".bss")) {
+        char *field = asm_field(&p);
+        asm_section_switch(asm_section_default(name), field ? (size_t)asm_constant(field) : 0);
+    }
+    else if (!strcmp(name, ".section"))                                asm_directive_section(p);
+    else if (!strcmp(name, ".previous"))                               asm_section_switch(asm_state.previous, asm_state.previous_chunk);
+    else if (!strcmp(name, ".global") || !strcmp(name, ".globl"))      asm_global(p, true);
+    else if (!strcmp(name, ".local"))                                  asm_global(p, false);
+    else if (!strcmp(name, ".lcomm"))                                  asm_directive_lcomm(p);
+    else if (!strcmp(name, ".string") || !strcmp(name, ".asciz"))      asm_string(p, true);
+    else if (!strcmp(name, ".ascii"))                                  asm_string(p, false);
+    else if (!strcmp(name, ".byte"))                                   asm_data(p, 1);
+    else if (!strcmp(name, ".short") || !strcmp(name, ".value") ||
+             !strcmp(name, ".word"))                                   asm_data(p, 2);
+    else if (!strcmp(name, ".long") || !strcmp(name, ".int"))          asm_data(p, 4);
+    else if (!strcmp(name, ".quad"))                                   asm_data(p, 8);
+    else if (!strcmp(name, ".zero") || !strcmp(name, ".skip")) {
+        char *field = asm_field(&p);
+        if (!field)
+            asm_error("expected a size");
+        asm_bytes(NULL, asm_constant(field));
+    }
+    else if (!strcmp(name, ".align") || !strcmp(name, ".balign")) {
+        char *field = asm_field(&p);
+        if (!field)
+            asm_error("expected an alignment");
+        asm_align(asm_constant(field));
+    }
+    else if (!strcmp(name, ".p2align")) {
+        char *field = asm_field(&p);
+        if (!field)
+            asm_error("expected an alignment");
+        asm_align((size_t)1 << asm_constant(field));
+    }
+    else if (!strcmp(name, ".type") || !strcmp(name, ".size") ||
+             !strcmp(name, ".file") || !strcmp(name, ".ident"))
+        ;
+    else
+        asm_error("unknown directive");
+}
+
+static void asm_line(char *line) {
+    /* strip comments */
+    bool quote = false;
+    for (char *p = line; *p; p++) {
+        if (quote) {
+            if (*p == '\\' && p[1])
+                p++;
+            else if (*p == '"')
+                quote = false;
+        } else if (*p == '"') {
+            quote = true;
+        } else if (*p == '#') {
+            *p = '\0';
+            break;
+        }
+    }
+
+    char *p = asm_skip(line);
+    if (!*p)
+        return;
+
+    /* label */
+    char *end = p;
+    while (asm_identifier(*end))
+        end++;
+    if (end != p && *end == ':') {
+        asm_symbol_define(asm_symbol(p, end - p), asm_state.section, asm_state.chunk, asm_chunk()->length);
+        p = asm_skip(end + 1);
+        if (!*p)
+            return;
+        end = p;
+        while (asm_identifier(*end))
+            end++;
+    }
+
+    if (*p != '.') {
+        asm_instruction(p);
+        return;
+    }
+
+    if (*end && *end != ' ' && *end != '\t')
+        asm_error("bad directive");
+    if (*end)
+        *end++ = '\0';
+    asm_directive(p, end);
+}
+
+/* resolution */
+static uint64_t asm_symbol_value(asm_symbol_t *symbol) {
+    return asm_state.sections[symbol->section].chunks[symbol->chunk].base + symbol->offset;
+}
+
+static void asm_patch(unsigned char *data, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        data[i] = value >> (i * 8);
+}
+
+static unsigned char *asm_finish(size_t *size) {
+    elf_t *elf = elf_create();
+
+    /* lay out the subsections */
+    for (size_t i = 0; i < asm_state.length; i++) {
+        asm_section_t *section = &asm_state.sections[i];
+        size_t         offset  = 0;
+        size_t         align   = 1;
+
+        for (size_t j = 0; j < section->count; j++) {
+            asm_chunk_t *chunk = &section->chunks[j];
+            offset      = (offset + chunk->align - 1) & ~(chunk->align - 1);
+            chunk->base = offset;
+            offset     += chunk->length;
+            align       = MAX(align, chunk->align);
+        }
+
+        section->elf = elf_section(elf, section->name, section->type, section->flags, align, section->entsize);
+        if (section->type == ELF_SECTION_NOBITS)
+            elf_section_size(elf, section->elf, offset);
+    }
+    elf_section(elf, ".note.GNU-stack", ELF_SECTION_PROGBITS, 0, 1, 0);
+
+    /* symbols, labels local to the object file are left out */
+    for (list_iterator_t *it = list_iterator(asm_state.symbols); !list_iterator_end(it); ) {
+        asm_symbol_t *symbol = list_iterator_next(it);
+        bool          label  = !strncmp(symbol->name, ".L", 2);
+
+        /*
+         * Labels in mergeable sections are kept as local symbols, the
+         * linker can't tell which entry a reference relative to the
+         * section means once the entries are merged.
+         */
+        if (symbol->defined && label && (asm_state.sections[symbol->section].flags & ELF_FLAG_MERGE))
+            label = false;
+
+        if (symbol->defined && (!label || symbol->global))
+            symbol->elf = elf_symbol(elf, symbol->name, asm_state.sections[symbol->section].elf, asm_symbol_value(symbol), symbol->global);
+        else if (!symbol->defined && (symbol->global || symbol->referenced)) {
+            if (label)
+                asm_error("undefined label `%s'", symbol->name);
+            symbol->global = true;
+            symbol->elf    = elf_symbol(elf, symbol->name, 0, 0, true);
+        }
+    }
+
+    for (size_t i = 0; i < asm_state.fixup_length; i++) {
+        asm_fixup_t   *fixup   = &asm_state.fixups[i];
+        asm_section_t *section = &asm_state.sections[fixup->section];
+        asm_chunk_t   *chunk   = &section->chunks[fixup->chunk];
+        asm_symbol_t  *symbol  = fixup->symbol;
+        unsigned char *data    = chunk->data + fixup->offset;
+        uint64_t       place   = chunk->base + fixup->offset;
+
+        if (fixup->type == ASM_FIXUP_DIFFERENCE) {
+            asm_symbol_t *minus = fixup->minus;
+            if (symbol->defined && minus->defined && symbol->section == minus->section) {
+                asm_patch(data, asm_symbol_value(symbol) - asm_symbol_value(minus) + fixup->addend, fixup->size);
+                continue;
+            }
+
+            /*
+             * Subtracting a symbol from the section the value is placed
+             * in makes it relative to the place, like jump tables which
+             * refer to the code from read only data.
+             */
+            if (!minus->defined || minus->section != fixup->section || fixup->size != 4)
+                asm_error("cannot take the difference of `%s' and `%s'", symbol->name, minus->name);
+            fixup->type    = ELF_RELOCATION_PC32;
+            fixup->addend += place - asm_symbol_value(minus);
+        }
+
+        bool relative = (fixup->type == ELF_RELOCATION_PC32 || fixup->type == ELF_RELOCATION_PLT32);
+        if (symbol->defined && !symbol->global && relative && symbol->section == fixup->section) {
+            asm_patch(data, asm_symbol_value(symbol) + fixup->addend - place, fixup->size);
+            continue;
+        }
+
+        if (!symbol->defined || symbol->global || (asm_state.sections[symbol->section].flags & ELF_FLAG_MERGE)) {
+            elf_relocation(elf, section->elf, place, symbol->elf, fixup->type, fixup->addend);
+        } else {
+            size_t target = asm_state.sections[symbol->section].elf;
+            elf_relocation(elf, section->elf, place, elf_section_symbol(elf, target), fixup->type,
+                           asm_symbol_value(symbol) + fixup->addend);
+        }
+    }
+
+    /* the contents, padding between subsections */
+    for (size_t i = 0; i < asm_state.length; i++) {
+        asm_section_t *section = &asm_state.sections[i];
+        size_t         offset  = 0;
+
+        if (section->type == ELF_SECTION_NOBITS)
+            continue;
+
+        for (size_t j = 0; j < section->count; j++) {
+            asm_chunk_t   *chunk = &section->chunks[j];
+            unsigned char  pad[16];
+
+            while (offset < chunk->base) {
+                size_t length = MIN(sizeof(pad), chunk->base - offset);
+                asm_pad(pad, length, section->flags & ELF_FLAG_EXEC);
+                elf_section_data(elf, section->elf, pad, length);
+                offset += length;
+            }
+            elf_section_data(elf, section->elf, chunk->data, chunk->length);
+            offset += chunk->length;
+        }
+    }
+
+    unsigned char *image = elf_image(elf, size);
+    elf_destroy(elf);
+    return image;
+}
+
+static void asm_reset(void) {
+    for (size_t i = 0; i < asm_state.length; i++) {
+        for (size_t j = 0; j < asm_state.sections[i].count; j++)
+            free(asm_state.sections[i].chunks[j].data);
+        free(asm_state.sections[i].chunks);
+    }
+    free(asm_state.sections);
+    free(asm_state.fixups);
+
+    asm_state.sections        = NULL;
+    asm_state.length          = 0;
+    asm_state.allocated       = 0;
+    asm_state.fixups          = NULL;
+    asm_state.fixup_length    = 0;
+    asm_state.fixup_allocated = 0;
+}
+
+unsigned char *asm_assemble(const char *source, size_t length, size_t *size) {
+    asm_init();
+
+    asm_state.symbols      = list_create();
+    asm_state.symbol_table = SENTINEL_TABLE;
+    asm_state.line         = 0;
+
+    /* like other assemblers the usual sections are always there */
+    asm_section_default(".text");
+    asm_section_default(".data");
+    asm_section_default(".bss");
+    asm_section_switch(0, 0);
+    asm_state.previous       = 0;
+    asm_state.previous_chunk = 0;
+
+    char   *line      = NULL;
+    size_t  allocated = 0;
+    for (const char *p = source, *end = source + length; p < end; ) {
+        const char *newline = memchr(p, '\n', end - p);
+        size_t      bytes   = (newline ? newline : end) - p;
+
+        line = asm_grow(line, &allocated, bytes + 1, 1);
+        memcpy(line, p, bytes);
+        line[bytes] = '\0';
+
+        asm_state.text   = p;
+        asm_state.columns = bytes;
+        asm_state.line++;
+        asm_line(line);
+
+        p += bytes + 1;
+    }
+    free(line);
+
+    asm_state.text   = "";
+    asm_state.columns = 0;
+    unsigned char *image = asm_finish(size);
+    asm_reset();
+    return image;
+}
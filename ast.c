@@ -120,7 +120,7 @@ ast_t *ast_new_binary(data_type_t *ctype, int type, ast_t *left, ast_t *right) {
     return ast;
 }
 
-ast_t *ast_new_integer(data_type_t *type, int value) {
+ast_t *ast_new_integer(data_type_t *type, long value) {
     return ast_copy(&(ast_t) {
         .type    = AST_TYPE_LITERAL,
         .ctype   = type,
@@ -272,7 +272,7 @@ ast_t *ast_switch(ast_t *expr, ast_t *body) {
     });
 }
 
-ast_t *ast_case(int begin, int end) {
+ast_t *ast_case(long begin, long end) {
     return ast_copy(&(ast_t){
         .type    = AST_TYPE_STATEMENT_CASE,
         .casebeg = begin,
@@ -346,13 +346,29 @@ data_type_t *ast_structure_new(table_t *fields, int size, bool isstruct) {
     });
 }
 
+/*
+ * Labels made while generating a toplevel are numbered within a namespace
+ * of its own, so they don't depend on what else was generated before it
+ * or on which thread generates it.
+ */
+static int               ast_label_index      = 0;
+static THREAD_LOCAL long ast_label_space      = -1;
+static THREAD_LOCAL int  ast_label_space_next = 0;
+
 char *ast_label(void) {
-    static int index = 0;
     string_t *string = string_create();
-    string_catf(string, ".L%d", index++);
+    if (ast_label_space < 0)
+        string_catf(string, ".L%d", ast_label_index++);
+    else
+        string_catf(string, ".L%ld_%d", ast_label_space, ast_label_space_next++);
     return string_buffer(string);
 }
 
+void ast_label_namespace(long space) {
+    ast_label_space      = space;
+    ast_label_space_next = 0;
+}
+
 ast_t *ast_label_address(char *label) {
     return ast_copy(&(ast_t){
         .type           = AST_TYPE_STATEMENT_LABEL_COMPUTED,
@@ -397,6 +413,81 @@ bool ast_type_isstring(data_type_t *type) {
     return type->type == TYPE_ARRAY && type->pointer->type == TYPE_CHAR;
 }
 
+/*
+ * Expressions which are small and can be generated twice, the conditions
+ * of rotated loops are tested on entry as well as at the bottom.
+ */
+#define AST_DUPLICATE 32
+
+static bool ast_duplicable_within(ast_t *ast, int *budget) {
+    if (!ast)
+        return true;
+    if (--*budget < 0)
+        return false;
+
+    switch (ast->type) {
+        case AST_TYPE_LITERAL:
+        case AST_TYPE_STRING:
+        case AST_TYPE_VAR_GLOBAL:
+            return true;
+
+        /* compound literals are initialized where they're first used */
+        case AST_TYPE_VAR_LOCAL:
+            return !ast->variable.init;
+
+        case AST_TYPE_CALL:
+        case AST_TYPE_POINTERCALL:
+            if (ast->type == AST_TYPE_POINTERCALL
+                && !ast_duplicable_within(ast->function.call.functionpointer, budget))
+                return false;
+            for (list_iterator_t *it = list_iterator(ast->function.call.args); !list_iterator_end(it); )
+                if (!ast_duplicable_within(list_iterator_next(it), budget))
+                    return false;
+            return true;
+
+        case AST_TYPE_ADDRESS:
+        case AST_TYPE_DEREFERENCE:
+        case AST_TYPE_CONVERT:
+        case AST_TYPE_EXPRESSION_CAST:
+        case AST_TYPE_NEGATE:
+        case AST_TYPE_POST_INCREMENT:
+        case AST_TYPE_POST_DECREMENT:
+        case AST_TYPE_PRE_INCREMENT:
+        case AST_TYPE_PRE_DECREMENT:
+        case '!':
+        case '~':
+            return ast_duplicable_within(ast->unary.operand, budget);
+
+        case AST_TYPE_STRUCT:
+            return ast_duplicable_within(ast->structure, budget);
+
+        case AST_TYPE_EXPRESSION_TERNARY:
+            return ast_duplicable_within(ast->ifstmt.cond, budget)
+                && ast_duplicable_within(ast->ifstmt.then, budget)
+                && ast_duplicable_within(ast->ifstmt.last, budget);
+
+        case '+': case '-': case '*': case '/': case '%': case '=':
+        case '&': case '|': case '^': case '<': case '>': case ',':
+        case AST_TYPE_EQUAL:
+        case AST_TYPE_NEQUAL:
+        case AST_TYPE_LEQUAL:
+        case AST_TYPE_GEQUAL:
+        case AST_TYPE_LSHIFT:
+        case AST_TYPE_RSHIFT:
+        case AST_TYPE_LRSHIFT:
+        case AST_TYPE_AND:
+        case AST_TYPE_OR:
+            return ast_duplicable_within(ast->left, budget)
+                && ast_duplicable_within(ast->right, budget);
+    }
+    return false;
+}
+
+bool ast_duplicable(ast_t *ast) {
+    int budget = AST_DUPLICATE;
+    return ast_duplicable_within(ast, &budget);
+}
+
 data_type_t *ast_type_copy(data_type_t *type) {
     return memcpy(memory_allocate(sizeof(data_type_t)), type, sizeof(data_type_t));
 }
@@ -595,6 +686,7 @@ static void ast_string_impl(string_t *string, ast_t *ast) {
     switch (ast->type) {
         case AST_TYPE_LITERAL:
             switch (ast->ctype->type) {
+                case TYPE_BOOL:
                 case TYPE_INT:
                 case TYPE_SHORT:
                     string_catf(string, "%d",   ast->integer);
@@ -602,10 +694,12 @@ static void ast_string_impl(string_t *string, ast_t *ast) {
 
                 case TYPE_FLOAT:
                 case TYPE_DOUBLE:
+                case TYPE_LDOUBLE:
                     string_catf(string, "%f",   ast->floating.value);
                     break;
 
                 case TYPE_LONG:
+                case TYPE_LLONG:
                     string_catf(string, "%ldL", ast->integer);
                     break;
 
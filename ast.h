@@ -262,6 +262,12 @@ struct data_type_s {
      */
     bool isstatic;
 
+    /*
+     * Variable: isconst
+     *  Describes if the type is const qualified.
+     */
+    bool isconst;
+
     /*
      * Variable: length
      *  Instances of the data type.
@@ -381,6 +387,25 @@ typedef struct {
      *  Compound literal list for initialization
      */
     list_t *init;
+
+    /*
+     * Variable: escapes
+     *  The address of the local variable is taken somewhere.
+     */
+    bool escapes;
+
+    /*
+     * Variable: weight
+     *  How often the local variable is used, uses in loops count more.
+     */
+    int weight;
+
+    /*
+     * Variable: reg
+     *  Register the local variable lives in for the whole function, NULL
+     *  when it lives on the stack.
+     */
+    const char *reg;
 } ast_variable_t;
 
 /*
@@ -615,8 +640,9 @@ struct ast_s {
 
     union {
         struct {
-            int         casebeg;
-            int         caseend;
+            long        casebeg;
+            long        caseend;
+            char       *caselabel;
         };
 
         long            integer;
@@ -696,13 +722,14 @@ data_type_t *ast_structure_new(table_t *fields, int size, bool isstruct);
 
 ast_t *ast_new_unary(int type, data_type_t *data, ast_t *operand);
 ast_t *ast_new_binary(data_type_t *ctype, int type, ast_t *left, ast_t *right);
-ast_t *ast_new_integer(data_type_t *type, int value);
+ast_t *ast_new_integer(data_type_t *type, long value);
 ast_t *ast_new_floating(data_type_t *, double value);
 ast_t *ast_new_char(char value);
 ast_t *ast_new_string(char *value);
 ast_t *ast_new_label(char *);
 
 char *ast_label(void);
+void  ast_label_namespace(long space);
 
 ast_t *ast_declaration(ast_t *var, list_t *init);
 ast_t *ast_variable_local(data_type_t *type, char *name);
@@ -719,7 +746,7 @@ ast_t *ast_return(ast_t *val);
 ast_t *ast_compound(list_t *statements);
 ast_t *ast_ternary(data_type_t *type, ast_t *cond, ast_t *then, ast_t *last);
 ast_t *ast_switch(ast_t *expr, ast_t *body);
-ast_t *ast_case(int begin, int end);
+ast_t *ast_case(long begin, long end);
 ast_t *ast_goto(char *);
 ast_t *ast_goto_computed(ast_t *expression);
 ast_t *ast_label_address(char *);
@@ -740,6 +767,17 @@ ast_t       *ast_designator_convert(ast_t *ast);
 
 bool ast_struct_compare(data_type_t *a, data_type_t *b);
 
+/*
+ * Function: ast_duplicable
+ *  Check if an expression is small enough and free of anything which
+ *  can only be generated once, such as the initialization of a compound
+ *  literal, to be generated twice.
+ *
+ * Parameters:
+ *  ast - The expression, may be NULL
+ */
+bool ast_duplicable(ast_t *ast);
+
 /*
  * Function: ast_type_string
  *  Get the type of a data_type_t as a string.
@@ -0,0 +1,474 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "util.h"
+#include "opt.h"
+
+/*
+ * Entries are named by the SHA-256 of the key in hex and spread over
+ * directories by the first two digits of it. An entry begins with the
+ * number of files the translation unit included on a line of its own,
+ * then a line for each of them with the hash of its contents and the
+ * path, the output follows right after.
+ */
+#define CACHE_HASH_SIZE 32
+#define CACHE_HEX_SIZE  (CACHE_HASH_SIZE * 2 + 1)
+
+typedef struct {
+    uint32_t      state[8];
+    uint64_t      length;
+    unsigned char block[64];
+    size_t        used;
+} cache_hash_t;
+
+static const uint32_t cache_hash_rounds[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const char     *cache_directory = NULL;
+static size_t          cache_bytes     = 0;
+static string_t       *cache_options   = NULL;
+static char            cache_key[CACHE_HEX_SIZE];
+static const void     *cache_map       = NULL;
+static size_t          cache_map_size  = 0;
+
+#define CACHE_ROTATE(X, N) (((X) >> (N)) | ((X) << (32 - (N))))
+
+static void cache_hash_block(cache_hash_t *hash, const unsigned char *block) {
+    uint32_t w[64];
+    uint32_t s[8];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)block[i*4] << 24 | (uint32_t)block[i*4+1] << 16 | (uint32_t)block[i*4+2] << 8 | block[i*4+3];
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = CACHE_ROTATE(w[i-15], 7) ^ CACHE_ROTATE(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = CACHE_ROTATE(w[i-2], 17) ^ CACHE_ROTATE(w[i-2],  19) ^ (w[i-2]  >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    memcpy(s, hash->state, sizeof(s));
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = s[7] + (CACHE_ROTATE(s[4], 6) ^ CACHE_ROTATE(s[4], 11) ^ CACHE_ROTATE(s[4], 25))
+                           + ((s[4] & s[5]) ^ (~s[4] & s[6])) + cache_hash_rounds[i] + w[i];
+        uint32_t t2 = (CACHE_ROTATE(s[0], 2) ^ CACHE_ROTATE(s[0], 13) ^ CACHE_ROTATE(s[0], 22))
+                    + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+
+        memmove(s + 1, s, sizeof(uint32_t) * 7);
+        s[4] += t1;
+        s[0]  = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++)
+        hash->state[i] += s[i];
+}
+
+static void cache_hash_begin(cache_hash_t *hash) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(hash->state, initial, sizeof(initial));
+    hash->length = 0;
+    hash->used   = 0;
+}
+
+static void cache_hash_data(cache_hash_t *hash, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+
+    hash->length += length;
+    if (hash->used) {
+        size_t take = MIN(length, 64 - hash->used);
+        memcpy(hash->block + hash->used, bytes, take);
+        hash->used += take;
+        bytes      += take;
+        length     -= take;
+        if (hash->used < 64)
+            return;
+        cache_hash_block(hash, hash->block);
+        hash->used = 0;
+    }
+
+    for (; length >= 64; bytes += 64, length -= 64)
+        cache_hash_block(hash, bytes);
+
+    memcpy(hash->block, bytes, length);
+    hash->used = length;
+}
+
+/* strings are hashed with their terminator so adjacent ones can't run together */
+static void cache_hash_string(cache_hash_t *hash, const char *string) {
+    cache_hash_data(hash, string, strlen(string) + 1);
+}
+
+static void cache_hash_end(cache_hash_t *hash, char *hex) {
+    uint64_t      bits = hash->length * 8;
+    unsigned char tail[8];
+
+    for (int i = 0; i < 8; i++)
+        tail[i] = bits >> (56 - i * 8);
+
+    cache_hash_data(hash, "\x80", 1);
+    while (hash->used != 56)
+        cache_hash_data(hash, "", 1);
+    cache_hash_data(hash, tail, 8);
+
+    for (int i = 0; i < CACHE_HASH_SIZE; i++)
+        sprintf(hex + i * 2, "%02x", (hash->state[i / 4] >> (24 - (i % 4) * 8)) & 0xff);
+}
+
+static bool cache_hash_file(const char *path, char *hex) {
+    struct stat  status;
+    cache_hash_t hash;
+    int          fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &status) || !S_ISREG(status.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    cache_hash_begin(&hash);
+    if (status.st_size) {
+        void *map = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        cache_hash_data(&hash, map, status.st_size);
+        munmap(map, status.st_size);
+    }
+    close(fd);
+
+    cache_hash_end(&hash, hex);
+    return true;
+}
+
+/*
+ * The compiler is identified by the contents of its executable, anything
+ * built differently has a different key for the same translation unit.
+ */
+static const char *cache_compiler(void) {
+    static char hex[CACHE_HEX_SIZE];
+
+    if (!*hex && !cache_hash_file("/proc/self/exe", hex))
+        strcpy(hex, __DATE__ " " __TIME__);
+    return hex;
+}
+
+static char *cache_path(const char *name) {
+    string_t *path = string_create();
+    string_catf(path, "%s/%s", cache_directory, name);
+    return string_buffer(path);
+}
+
+static char *cache_entry_path(const char *key) {
+    string_t *path = string_create();
+    string_catf(path, "%s/%.2s/%s", cache_directory, key, key + 2);
+    return string_buffer(path);
+}
+
+static bool cache_write(int fd, const void *data, size_t length) {
+    const char *bytes = data;
+    while (length) {
+        ssize_t wrote = write(fd, bytes, length);
+        if (wrote < 0)
+            return false;
+        bytes  += wrote;
+        length -= wrote;
+    }
+    return true;
+}
+
+/*
+ * Hits and misses of every compiler sharing the cache are counted in a
+ * file of fixed width records, which is locked while it's updated.
+ */
+static bool cache_counters(int fd, unsigned long counters[2]) {
+    char   buffer[64] = { 0 };
+    char  *end;
+
+    counters[0] = counters[1] = 0;
+    if (lseek(fd, 0, SEEK_SET) || read(fd, buffer, sizeof(buffer) - 1) <= 0)
+        return false;
+
+    counters[0] = strtoul(buffer, &end, 10);
+    counters[1] = strtoul(end, NULL, 10);
+    return true;
+}
+
+static void cache_count(bool hit) {
+    struct flock  lock   = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    int           fd     = open(cache_path("stats"), O_RDWR | O_CREAT, 0666);
+    unsigned long counters[2];
+    char          buffer[64];
+
+    if (fd < 0)
+        return;
+
+    if (fcntl(fd, F_SETLKW, &lock) == 0) {
+        cache_counters(fd, counters);
+        counters[hit ? 0 : 1]++;
+        snprintf(buffer, sizeof(buffer), "%20lu %20lu\n", counters[0], counters[1]);
+        if (lseek(fd, 0, SEEK_SET) == 0)
+            cache_write(fd, buffer, strlen(buffer));
+    }
+    close(fd);
+}
+
+bool cache_open(const char *directory) {
+    struct stat status;
+
+    if (mkdir(directory, 0777) && errno != EEXIST)
+        return false;
+    if (stat(directory, &status) || !S_ISDIR(status.st_mode))
+        return false;
+
+    cache_directory = directory;
+    return true;
+}
+
+bool cache_enabled(void) {
+    return cache_directory != NULL;
+}
+
+void cache_limit(size_t bytes) {
+    cache_bytes = bytes;
+}
+
+void cache_option(const char *option) {
+    if (!cache_options)
+        cache_options = string_create();
+    string_catf(cache_options, "%s%c", option, '\0');
+}
+
+/*
+ * An entry only holds if every file included is still what it was when
+ * the entry was stored, on a hit the rest of the mapping is the output.
+ */
+static const char *cache_entry_check(const char *entry, size_t size) {
+    const char *end   = entry + size;
+    char       *next;
+    size_t      count = strtoul(entry, &next, 10);
+
+    if (next == entry || next >= end || *next++ != '\n')
+        return NULL;
+
+    while (count--) {
+        const char *newline = memchr(next, '\n', end - next);
+        char        hex[CACHE_HEX_SIZE];
+        string_t   *path    = string_create();
+
+        if (!newline || newline - next < CACHE_HEX_SIZE)
+            return NULL;
+        for (const char *p = next + CACHE_HEX_SIZE; p < newline; p++)
+            string_cat(path, *p);
+        if (!cache_hash_file(string_buffer(path), hex) || memcmp(hex, next, CACHE_HEX_SIZE - 1))
+            return NULL;
+
+        next = (char *)newline + 1;
+    }
+    return next;
+}
+
+const void *cache_find(const char *input, size_t length, size_t *size) {
+    cache_hash_t hash;
+    struct stat  status;
+    char         buffer[64];
+
+    cache_hash_begin(&hash);
+    cache_hash_string(&hash, cache_compiler());
+    snprintf(buffer, sizeof(buffer), "%d %d %d", (int)opt_std(), (int)opt_extensions(), opt_level());
+    cache_hash_string(&hash, buffer);
+    if (cache_options)
+        cache_hash_data(&hash, string_buffer(cache_options), string_length(cache_options));
+    cache_hash_data(&hash, input, length);
+    cache_hash_end(&hash, cache_key);
+
+    char *path = cache_entry_path(cache_key);
+    int   fd   = open(path, O_RDONLY);
+
+    if (fd >= 0 && fstat(fd, &status) == 0 && status.st_size > 0) {
+        void *map = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            const char *output = cache_entry_check(map, status.st_size);
+            if (output) {
+                close(fd);
+                utime(path, NULL);
+                cache_count(true);
+
+                cache_map      = map;
+                cache_map_size = status.st_size;
+                *size          = (const char *)map + status.st_size - output;
+                return output;
+            }
+            munmap(map, status.st_size);
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+
+    cache_count(false);
+    return NULL;
+}
+
+void cache_release(void) {
+    if (cache_map)
+        munmap((void *)cache_map, cache_map_size);
+    cache_map = NULL;
+}
+
+typedef struct {
+    char   *path;
+    size_t  size;
+    time_t  used;
+} cache_entry_t;
+
+static int cache_entry_compare(const void *a, const void *b) {
+    time_t x = ((const cache_entry_t *)a)->used;
+    time_t y = ((const cache_entry_t *)b)->used;
+    return (x > y) - (x < y);
+}
+
+/* walk the entries of the cache, leaving out files still being written */
+static cache_entry_t *cache_entries(size_t *count, size_t *total) {
+    cache_entry_t *entries   = NULL;
+    size_t         allocated = 0;
+    DIR           *top       = opendir(cache_directory);
+
+    *count = *total = 0;
+    if (!top)
+        return NULL;
+
+    for (struct dirent *shard; (shard = readdir(top)); ) {
+        if (*shard->d_name == '.' || strlen(shard->d_name) != 2)
+            continue;
+
+        string_t *directory = string_create();
+        string_catf(directory, "%s/%s", cache_directory, shard->d_name);
+
+        DIR *files = opendir(string_buffer(directory));
+        if (!files)
+            continue;
+
+        for (struct dirent *file; (file = readdir(files)); ) {
+            struct stat  status;
+            string_t    *path = string_create();
+
+            if (*file->d_name == '.' || strchr(file->d_name, '.'))
+                continue;
+
+            string_catf(path, "%s/%s", string_buffer(directory), file->d_name);
+            if (stat(string_buffer(path), &status) || !S_ISREG(status.st_mode))
+                continue;
+
+            if (*count == allocated) {
+                allocated = allocated ? allocated * 2 : 256;
+                entries   = realloc(entries, sizeof(cache_entry_t) * allocated);
+                if (!entries) {
+                    closedir(files);
+                    closedir(top);
+                    *count = 0;
+                    return NULL;
+                }
+            }
+
+            entries[(*count)++] = (cache_entry_t){ string_buffer(path), status.st_size, status.st_mtime };
+            *total += status.st_size;
+        }
+        closedir(files);
+    }
+    closedir(top);
+    return entries;
+}
+
+static void cache_evict(void) {
+    size_t         count;
+    size_t         total;
+    cache_entry_t *entries = cache_entries(&count, &total);
+
+    if (total > cache_bytes) {
+        /* hits touch an entry, the least recently used is the oldest */
+        qsort(entries, count, sizeof(cache_entry_t), &cache_entry_compare);
+        for (size_t i = 0; i < count && total > cache_bytes; i++)
+            if (!unlink(entries[i].path))
+                total -= entries[i].size;
+    }
+    free(entries);
+}
+
+void cache_store(const void *data, size_t length, list_t *dependencies) {
+    string_t *header = string_create();
+    char      hex[CACHE_HEX_SIZE];
+    char     *path   = cache_entry_path(cache_key);
+    string_t *temp   = string_create();
+
+    string_catf(header, "%d\n", list_length(dependencies));
+    for (list_iterator_t *it = list_iterator(dependencies); !list_iterator_end(it); ) {
+        const char *dependency = list_iterator_next(it);
+        if (!cache_hash_file(dependency, hex))
+            return;
+        string_catf(header, "%s %s\n", hex, dependency);
+    }
+
+    *strrchr(path, '/') = '\0';
+    if (mkdir(path, 0777) && errno != EEXIST)
+        return;
+    path[strlen(path)] = '/';
+
+    /* written to the side and renamed into place, readers never see half an entry */
+    string_catf(temp, "%s.%ld.tmp", path, (long)getpid());
+
+    int fd = open(string_buffer(temp), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        return;
+
+    bool written = cache_write(fd, string_buffer(header), string_length(header))
+                && cache_write(fd, data, length);
+
+    if (close(fd) || !written || rename(string_buffer(temp), path)) {
+        unlink(string_buffer(temp));
+        return;
+    }
+
+    if (cache_bytes)
+        cache_evict();
+}
+
+void cache_stats(FILE *stream) {
+    size_t         count;
+    size_t         total;
+    unsigned long  counters[2] = { 0, 0 };
+    int            fd          = open(cache_path("stats"), O_RDONLY);
+    cache_entry_t *entries     = cache_entries(&count, &total);
+
+    if (fd >= 0) {
+        cache_counters(fd, counters);
+        close(fd);
+    }
+    free(entries);
+
+    fprintf(stream, "cache directory  %s\n", cache_directory);
+    fprintf(stream, "cache hits       %lu\n", counters[0]);
+    fprintf(stream, "cache misses     %lu\n", counters[1]);
+    fprintf(stream, "entries          %zu\n", count);
+    fprintf(stream, "size             %zu bytes", total);
+    if (cache_bytes)
+        fprintf(stream, " of %zu", cache_bytes);
+    fprintf(stream, "\n");
+}
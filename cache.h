@@ -0,0 +1,109 @@
+#ifndef LICE_CACHE_HDR
+#define LICE_CACHE_HDR
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "list.h"
+
+/*
+ * File: cache.h
+ *  Implements the interface to LICE's compilation cache, which keeps the
+ *  output of a translation unit on disk under a hash of everything which
+ *  went into it, so compiling the same unit again only reads it back.
+ */
+
+/*
+ * Function: cache_open
+ *  Use a directory for the cache, creating it if it doesn't exist.
+ *
+ * Parameters:
+ *  directory - The directory the cache is kept in
+ *
+ * Returns:
+ *  false if the directory cannot be created, true otherwise.
+ *
+ * Remarks:
+ *  Entries are only ever written by renaming a complete file in place,
+ *  so any number of compilers can share the same directory at once.
+ */
+bool cache_open(const char *directory);
+
+/*
+ * Function: cache_enabled
+ *  Check if a directory for the cache was opened.
+ */
+bool cache_enabled(void);
+
+/*
+ * Function: cache_limit
+ *  Bound the size of the cache.
+ *
+ * Parameters:
+ *  bytes   - The size the entries of the cache may take up in total
+ *
+ * Remarks:
+ *  Whenever an entry is stored the least recently used entries are
+ *  evicted until the cache fits again. Zero, the default, is no bound.
+ */
+void cache_limit(size_t bytes);
+
+/*
+ * Function: cache_option
+ *  Add an option which affects the output to the key of the cache.
+ *
+ * Parameters:
+ *  option  - The option as given on the command line
+ *
+ * Remarks:
+ *  The standard, extensions and optimization level are part of the key
+ *  already, as is the compiler itself.
+ */
+void cache_option(const char *option);
+
+/*
+ * Function: cache_find
+ *  Find the output of a translation unit in the cache.
+ *
+ * Parameters:
+ *  input   - The source of the translation unit
+ *  length  - Length of *input* in bytes
+ *  size    - Receives the length of the output
+ *
+ * Returns:
+ *  The output mapped from the cache, or NULL if there is no entry or
+ *  one of the files the translation unit included has changed since.
+ *
+ * Remarks:
+ *  The key is remembered for <cache_store>. The output stays mapped
+ *  until <cache_release> is called.
+ */
+const void *cache_find(const char *input, size_t length, size_t *size);
+
+/*
+ * Function: cache_release
+ *  Unmap the output returned by <cache_find>.
+ */
+void cache_release(void);
+
+/*
+ * Function: cache_store
+ *  Store the output of the translation unit last looked up.
+ *
+ * Parameters:
+ *  data         - The output
+ *  length       - Length of *data* in bytes
+ *  dependencies - Paths of the files the translation unit included
+ */
+void cache_store(const void *data, size_t length, list_t *dependencies);
+
+/*
+ * Function: cache_stats
+ *  Print the hits, misses and size of the cache.
+ *
+ * Parameters:
+ *  stream  - The stream to print to
+ */
+void cache_stats(FILE *stream);
+
+#endif
@@ -258,6 +258,19 @@ static data_type_t *decl_spec_get(const decl_spec_t *spec) {
     compile_ice("declaration specifier");
 }
 
+/*
+ * const is kept on a copy since user types are shared. Structures which
+ * aren't complete yet are completed in place later on, which a copy would
+ * never see, so those stay unqualified.
+ */
+static data_type_t *decl_spec_const(data_type_t *type) {
+    if (type->type == TYPE_STRUCTURE && !type->fields)
+        return type;
+    type = ast_type_copy(type);
+    type->isconst = true;
+    return type;
+}
+
 data_type_t *decl_spec(storage_t *const class) {
     decl_spec_t spec;
     memset(&spec, 0, sizeof(spec));
@@ -272,57 +285,43 @@ data_type_t *decl_spec(storage_t *const class) {
             break;
         }
 
-        if (!strcmp(token->string, "const"))
-            spec.kconst = true;
-        else if (!strcmp(token->string, "volatile"))
-            spec.kvolatile = true;
-        else if (!strcmp(token->string, "inline"))
-            spec.kinline = true;
-        else if (!strcmp(token->string, "typedef"))
-            decl_spec_class(&spec, STORAGE_TYPEDEF);
-        else if (!strcmp(token->string, "extern"))
-            decl_spec_class(&spec, STORAGE_EXTERN);
-        else if (!strcmp(token->string, "static") || !strcmp(token->string, "__static__"))
-            decl_spec_class(&spec, STORAGE_STATIC);
-        else if (!strcmp(token->string, "auto"))
-            decl_spec_class(&spec, STORAGE_AUTO);
-        else if (!strcmp(token->string, "register"))
-            decl_spec_class(&spec, STORAGE_REGISTER);
-        else if (!strcmp(token->string, "void"))
-            decl_spec_seti(&spec, SPEC_VAR_TYPE, SPEC_TYPE_VOID);
-        else if (!strcmp(token->string, "_Bool"))
-            decl_spec_seti(&spec, SPEC_VAR_TYPE, SPEC_TYPE_BOOL);
-        else if (!strcmp(token->string, "char"))
-            decl_spec_seti(&spec, SPEC_VAR_TYPE, SPEC_TYPE_CHAR);
-        else if (!strcmp(token->string, "int"))
-            decl_spec_seti(&spec, SPEC_VAR_TYPE, SPEC_TYPE_INT);
-        else if (!strcmp(token->string, "float"))
-            decl_spec_seti(&spec, SPEC_VAR_TYPE, SPEC_TYPE_FLOAT);
-        else if (!strcmp(token->string, "double"))
-            decl_spec_seti(&spec, SPEC_VAR_TYPE, SPEC_TYPE_DOUBLE);
-        else if (!strcmp(token->string, "signed"))
-            decl_spec_seti(&spec, SPEC_VAR_SIGN, SPEC_SIGN_SIGNED);
-        else if (!strcmp(token->string, "unsigned"))
-            decl_spec_seti(&spec, SPEC_VAR_SIGN, SPEC_SIGN_UNSIGNED);
-        else if (!strcmp(token->string, "struct"))
-            decl_spec_set(&spec, SPEC_VAR_USER, parse_structure());
-        else if (!strcmp(token->string, "union"))
-            decl_spec_set(&spec, SPEC_VAR_USER, parse_union());
-        else if (!strcmp(token->string, "enum"))
-            decl_spec_set(&spec, SPEC_VAR_USER, parse_enumeration());
-        else if (!strcmp(token->string, "short"))
-            decl_spec_seti(&spec, SPEC_VAR_SIZE, SPEC_SIZE_SHORT);
-        else if (!strcmp(token->string, "long")) {
-            if (spec.size == 0)
-                decl_spec_seti(&spec, SPEC_VAR_SIZE, SPEC_SIZE_LONG);
-            else if (spec.size == SPEC_SIZE_LONG)
-                spec.size = SPEC_SIZE_LLONG;
-            else
-                decl_spec_error(&spec, SPEC_VAR_NULL);
+        switch (token->keyword) {
+            case LEXER_KEYWORD_CONST:    spec.kconst    = true;                                    continue;
+            case LEXER_KEYWORD_VOLATILE: spec.kvolatile = true;                                    continue;
+            case LEXER_KEYWORD_INLINE:   spec.kinline   = true;                                    continue;
+            case LEXER_KEYWORD_TYPEDEF:  decl_spec_class(&spec, STORAGE_TYPEDEF);                  continue;
+            case LEXER_KEYWORD_EXTERN:   decl_spec_class(&spec, STORAGE_EXTERN);                   continue;
+            case LEXER_KEYWORD_STATIC:   decl_spec_class(&spec, STORAGE_STATIC);                   continue;
+            case LEXER_KEYWORD_AUTO:     decl_spec_class(&spec, STORAGE_AUTO);                     continue;
+            case LEXER_KEYWORD_REGISTER: decl_spec_class(&spec, STORAGE_REGISTER);                 continue;
+            case LEXER_KEYWORD_VOID:     decl_spec_seti(&spec, SPEC_VAR_TYPE, SPEC_TYPE_VOID);     continue;
+            case LEXER_KEYWORD_BOOL:     decl_spec_seti(&spec, SPEC_VAR_TYPE, SPEC_TYPE_BOOL);     continue;
+            case LEXER_KEYWORD_CHAR:     decl_spec_seti(&spec, SPEC_VAR_TYPE, SPEC_TYPE_CHAR);     continue;
+            case LEXER_KEYWORD_INT:      decl_spec_seti(&spec, SPEC_VAR_TYPE, SPEC_TYPE_INT);      continue;
+            case LEXER_KEYWORD_FLOAT:    decl_spec_seti(&spec, SPEC_VAR_TYPE, SPEC_TYPE_FLOAT);    continue;
+            case LEXER_KEYWORD_DOUBLE:   decl_spec_seti(&spec, SPEC_VAR_TYPE, SPEC_TYPE_DOUBLE);   continue;
+            case LEXER_KEYWORD_SIGNED:   decl_spec_seti(&spec, SPEC_VAR_SIGN, SPEC_SIGN_SIGNED);   continue;
+            case LEXER_KEYWORD_UNSIGNED: decl_spec_seti(&spec, SPEC_VAR_SIGN, SPEC_SIGN_UNSIGNED); continue;
+            case LEXER_KEYWORD_STRUCT:   decl_spec_set(&spec, SPEC_VAR_USER, parse_structure());   continue;
+            case LEXER_KEYWORD_UNION:    decl_spec_set(&spec, SPEC_VAR_USER, parse_union());       continue;
+            case LEXER_KEYWORD_ENUM:     decl_spec_set(&spec, SPEC_VAR_USER, parse_enumeration()); continue;
+            case LEXER_KEYWORD_SHORT:    decl_spec_seti(&spec, SPEC_VAR_SIZE, SPEC_SIZE_SHORT);    continue;
+            case LEXER_KEYWORD_TYPEOF:   decl_spec_set(&spec, SPEC_VAR_USER, parse_typeof());      continue;
+
+            case LEXER_KEYWORD_LONG:
+                if (spec.size == 0)
+                    decl_spec_seti(&spec, SPEC_VAR_SIZE, SPEC_SIZE_LONG);
+                else if (spec.size == SPEC_SIZE_LONG)
+                    spec.size = SPEC_SIZE_LLONG;
+                else
+                    decl_spec_error(&spec, SPEC_VAR_NULL);
+                continue;
+
+            default:
+                break;
         }
-        else if (!strcmp(token->string, "typeof") || !strcmp(token->string, "__typeof__"))
-            decl_spec_set(&spec, SPEC_VAR_USER, parse_typeof());
-        else if (parse_typedef_find(token->string) && !spec.user)
+
+        if (parse_typedef_find(token->string) && !spec.user)
             decl_spec_set(&spec, SPEC_VAR_USER, parse_typedef_find(token->string));
         else {
             lexer_unget(token);
@@ -332,8 +331,7 @@ data_type_t *decl_spec(storage_t *const class) {
 
     if (class)
         *class = spec.class;
-    if (spec.user)
-        return spec.user;
 
-    return decl_spec_get(&spec);
+    data_type_t *type = spec.user ? spec.user : decl_spec_get(&spec);
+    return spec.kconst ? decl_spec_const(type) : type;
 }
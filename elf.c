@@ -0,0 +1,410 @@
+/*
+ * File: elf.c
+ *  Writer for ELF64 relocatable objects. Sections, symbols and
+ *  relocations are collected as they're added and only laid out
+ *  once the image is requested, which is when symbols get sorted
+ *  into locals and globals as the format requires.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf.h"
+#include "lice.h"
+
+#define ELF_HEADER_SIZE     64
+#define ELF_SECTION_SIZE    64
+#define ELF_SYMBOL_SIZE     24
+#define ELF_RELA_SIZE       24
+
+#define ELF_SECTION_SYMTAB  2
+#define ELF_SECTION_STRTAB  3
+#define ELF_SECTION_RELA    4
+#define ELF_FLAG_INFO_LINK  0x40
+
+#define ELF_BIND_LOCAL      0
+#define ELF_BIND_GLOBAL     1
+#define ELF_TYPE_NOTYPE     0
+#define ELF_TYPE_SECTION    3
+
+typedef struct {
+    unsigned char *data;
+    size_t         length;
+    size_t         allocated;
+} elf_buffer_t;
+
+typedef struct {
+    uint64_t offset;
+    size_t   symbol;
+    unsigned type;
+    int64_t  addend;
+} elf_relocation_t;
+
+typedef struct {
+    const char       *name;
+    unsigned          type;
+    uint64_t          flags;
+    uint64_t          align;
+    uint64_t          entsize;
+    uint64_t          size;
+    elf_buffer_t      data;
+    elf_relocation_t *relocations;
+    size_t            relocation_length;
+    size_t            relocation_allocated;
+    size_t            symbol;
+} elf_section_t;
+
+typedef struct {
+    const char *name;
+    size_t      section;
+    uint64_t    value;
+    bool        global;
+    bool        isection;
+    size_t      index;
+} elf_symbol_t;
+
+struct elf_s {
+    elf_section_t *sections;
+    size_t         section_length;
+    size_t         section_allocated;
+    elf_symbol_t  *symbols;
+    size_t         symbol_length;
+    size_t         symbol_allocated;
+};
+
+static void *elf_grow(void *data, size_t *allocated, size_t need, size_t size) {
+    if (need <= *allocated)
+        return data;
+
+    size_t count = *allocated ? *allocated : 16;
+    while (count < need)
+        count *= 2;
+
+    if (!(data = realloc(data, count * size)))
+        compile_error("out of memory");
+
+    *allocated = count;
+    return data;
+}
+
+static void elf_buffer_write(elf_buffer_t *buffer, const void *data, size_t length) {
+    if (!length)
+        return;
+
+    buffer->data = elf_grow(buffer->data, &buffer->allocated, buffer->length + length, 1);
+    if (data)
+        memcpy(buffer->data + buffer->length, data, length);
+    else
+        memset(buffer->data + buffer->length, 0, length);
+    buffer->length += length;
+}
+
+static void elf_buffer_integer(elf_buffer_t *buffer, uint64_t value, size_t bytes) {
+    unsigned char data[8];
+    for (size_t i = 0; i < bytes; i++)
+        data[i] = value >> (i * 8);
+    elf_buffer_write(buffer, data, bytes);
+}
+
+static void elf_buffer_align(elf_buffer_t *buffer, size_t align) {
+    if (buffer->length % align)
+        elf_buffer_write(buffer, NULL, align - buffer->length % align);
+}
+
+static size_t elf_buffer_string(elf_buffer_t *buffer, const char *string) {
+    size_t offset = buffer->length;
+    elf_buffer_write(buffer, string, strlen(string) + 1);
+    return offset;
+}
+
+elf_t *elf_create(void) {
+    elf_t *elf = calloc(1, sizeof(elf_t));
+    if (!elf)
+        compile_error("out of memory");
+
+    /* the null section and null symbol */
+    elf_section(elf, "", 0, 0, 0, 0);
+    elf_symbol(elf, "", 0, 0, false);
+    return elf;
+}
+
+void elf_destroy(elf_t *elf) {
+    for (size_t i = 0; i < elf->section_length; i++) {
+        free(elf->sections[i].data.data);
+        free(elf->sections[i].relocations);
+    }
+    free(elf->sections);
+    free(elf->symbols);
+    free(elf);
+}
+
+size_t elf_section(elf_t *elf, const char *name, unsigned type, uint64_t flags, uint64_t align, uint64_t entsize) {
+    elf->sections = elf_grow(elf->sections, &elf->section_allocated, elf->section_length + 1, sizeof(elf_section_t));
+    elf->sections[elf->section_length] = (elf_section_t) {
+        .name    = name,
+        .type    = type,
+        .flags   = flags,
+        .align   = align ? align : 1,
+        .entsize = entsize
+    };
+    return elf->section_length++;
+}
+
+void elf_section_data(elf_t *elf, size_t section, const void *data, size_t length) {
+    elf_section_t *s = &elf->sections[section];
+    elf_buffer_write(&s->data, data, length);
+    s->size = s->data.length;
+}
+
+void elf_section_size(elf_t *elf, size_t section, uint64_t size) {
+    elf->sections[section].size = size;
+}
+
+static size_t elf_symbol_add(elf_t *elf, elf_symbol_t symbol) {
+    elf->symbols = elf_grow(elf->symbols, &elf->symbol_allocated, elf->symbol_length + 1, sizeof(elf_symbol_t));
+    elf->symbols[elf->symbol_length] = symbol;
+    return elf->symbol_length++;
+}
+
+size_t elf_section_symbol(elf_t *elf, size_t section) {
+    if (!elf->sections[section].symbol) {
+        elf->sections[section].symbol = elf_symbol_add(elf, (elf_symbol_t) {
+            .name     = "",
+            .section  = section,
+            .isection = true
+        });
+    }
+    return elf->sections[section].symbol;
+}
+
+size_t elf_symbol(elf_t *elf, const char *name, size_t section, uint64_t value, bool global) {
+    return elf_symbol_add(elf, (elf_symbol_t) {
+        .name    = name,
+        .section = section,
+        .value   = value,
+        .global  = global
+    });
+}
+
+void elf_relocation(elf_t *elf, size_t section, uint64_t offset, size_t symbol, unsigned type, int64_t addend) {
+    elf_section_t *s = &elf->sections[section];
+    s->relocations = elf_grow(s->relocations, &s->relocation_allocated, s->relocation_length + 1, sizeof(elf_relocation_t));
+    s->relocations[s->relocation_length++] = (elf_relocation_t) {
+        .offset = offset,
+        .symbol = symbol,
+        .type   = type,
+        .addend = addend
+    };
+}
+
+/*
+ * Section headers are written after the contents of all sections, the
+ * ones the writer adds itself (relocations, the symbol table and the
+ * string tables) follow the ones added by the user.
+ */
+typedef struct {
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t align;
+    uint64_t entsize;
+} elf_header_t;
+
+static void elf_header_write(elf_buffer_t *buffer, elf_header_t *header) {
+    elf_buffer_integer(buffer, header->name,    4);
+    elf_buffer_integer(buffer, header->type,    4);
+    elf_buffer_integer(buffer, header->flags,   8);
+    elf_buffer_integer(buffer, 0,               8); /* address */
+    elf_buffer_integer(buffer, header->offset,  8);
+    elf_buffer_integer(buffer, header->size,    8);
+    elf_buffer_integer(buffer, header->link,    4);
+    elf_buffer_integer(buffer, header->info,    4);
+    elf_buffer_integer(buffer, header->align,   8);
+    elf_buffer_integer(buffer, header->entsize, 8);
+}
+
+unsigned char *elf_image(elf_t *elf, size_t *length) {
+    elf_buffer_t  image    = { 0 };
+    elf_buffer_t  strtab   = { 0 };
+    elf_buffer_t  shstrtab = { 0 };
+    elf_buffer_t  symtab   = { 0 };
+    size_t        count    = elf->section_length;
+    size_t        extra    = 0;
+
+    for (size_t i = 1; i < count; i++)
+        if (elf->sections[i].relocation_length)
+            extra++;
+
+    size_t        total    = count + extra + 3;
+    elf_header_t *headers  = calloc(total, sizeof(elf_header_t));
+    if (!headers)
+        compile_error("out of memory");
+
+    size_t isymtab   = count + extra;
+    size_t istrtab   = isymtab + 1;
+    size_t ishstrtab = istrtab + 1;
+
+    elf_buffer_string(&strtab, "");
+    elf_buffer_string(&shstrtab, "");
+
+    /* locals go before globals, section symbols first */
+    size_t *order = malloc(elf->symbol_length * sizeof(size_t));
+    size_t  index = 1;
+    if (!order)
+        compile_error("out of memory");
+
+    for (size_t pass = 0; pass < 3; pass++) {
+        for (size_t i = 1; i < elf->symbol_length; i++) {
+            elf_symbol_t *symbol = &elf->symbols[i];
+            size_t        which  = symbol->isection ? 0 : symbol->global ? 2 : 1;
+            if (which != pass)
+                continue;
+            symbol->index  = index;
+            order[index++] = i;
+        }
+    }
+
+    size_t locals = 1;
+    elf_buffer_write(&symtab, NULL, ELF_SYMBOL_SIZE);
+    for (size_t i = 1; i < index; i++) {
+        elf_symbol_t *symbol = &elf->symbols[order[i]];
+        unsigned char info   = symbol->isection
+            ? (ELF_BIND_LOCAL << 4) | ELF_TYPE_SECTION
+            : ((symbol->global ? ELF_BIND_GLOBAL : ELF_BIND_LOCAL) << 4) | ELF_TYPE_NOTYPE;
+
+        if (!symbol->global)
+            locals++;
+
+        elf_buffer_integer(&symtab, *symbol->name ? elf_buffer_string(&strtab, symbol->name) : 0, 4);
+        elf_buffer_integer(&symtab, info, 1);
+        elf_buffer_integer(&symtab, 0, 1);
+        elf_buffer_integer(&symtab, symbol->section, 2);
+        elf_buffer_integer(&symtab, symbol->value, 8);
+        elf_buffer_integer(&symtab, 0, 8);
+    }
+    free(order);
+
+    /* file header is filled in at the end */
+    elf_buffer_write(&image, NULL, ELF_HEADER_SIZE);
+
+    for (size_t i = 1; i < count; i++) {
+        elf_section_t *section = &elf->sections[i];
+        elf_header_t  *header  = &headers[i];
+
+        header->name    = elf_buffer_string(&shstrtab, section->name);
+        header->type    = section->type;
+        header->flags   = section->flags;
+        header->align   = section->align;
+        header->entsize = section->entsize;
+        header->size    = section->size;
+
+        elf_buffer_align(&image, section->align);
+        header->offset = image.length;
+        if (section->type != ELF_SECTION_NOBITS)
+            elf_buffer_write(&image, section->data.data, section->data.length);
+    }
+
+    size_t irela = count;
+    for (size_t i = 1; i < count; i++) {
+        elf_section_t *section = &elf->sections[i];
+        if (!section->relocation_length)
+            continue;
+
+        elf_header_t *header = &headers[irela++];
+        char         *name   = malloc(strlen(section->name) + 6);
+        if (!name)
+            compile_error("out of memory");
+        strcpy(name, ".rela");
+        strcat(name, section->name);
+        header->name = elf_buffer_string(&shstrtab, name);
+        free(name);
+
+        elf_buffer_align(&image, 8);
+        header->type    = ELF_SECTION_RELA;
+        header->flags   = ELF_FLAG_INFO_LINK;
+        header->offset  = image.length;
+        header->size    = section->relocation_length * ELF_RELA_SIZE;
+        header->link    = isymtab;
+        header->info    = i;
+        header->align   = 8;
+        header->entsize = ELF_RELA_SIZE;
+
+        for (size_t j = 0; j < section->relocation_length; j++) {
+            elf_relocation_t *relocation = &section->relocations[j];
+            uint64_t          symbol     = elf->symbols[relocation->symbol].index;
+
+            elf_buffer_integer(&image, relocation->offset, 8);
+            elf_buffer_integer(&image, (symbol << 32) | relocation->type, 8);
+            elf_buffer_integer(&image, relocation->addend, 8);
+        }
+    }
+
+    headers[isymtab].name   = elf_buffer_string(&shstrtab, ".symtab");
+    headers[istrtab].name   = elf_buffer_string(&shstrtab, ".strtab");
+    headers[ishstrtab].name = elf_buffer_string(&shstrtab, ".shstrtab");
+
+    elf_buffer_align(&image, 8);
+    headers[isymtab].type    = ELF_SECTION_SYMTAB;
+    headers[isymtab].offset  = image.length;
+    headers[isymtab].size    = symtab.length;
+    headers[isymtab].link    = istrtab;
+    headers[isymtab].info    = locals;
+    headers[isymtab].align   = 8;
+    headers[isymtab].entsize = ELF_SYMBOL_SIZE;
+    elf_buffer_write(&image, symtab.data, symtab.length);
+
+    headers[istrtab].type   = ELF_SECTION_STRTAB;
+    headers[istrtab].offset = image.length;
+    headers[istrtab].size   = strtab.length;
+    headers[istrtab].align  = 1;
+    elf_buffer_write(&image, strtab.data, strtab.length);
+
+    headers[ishstrtab].type   = ELF_SECTION_STRTAB;
+    headers[ishstrtab].offset = image.length;
+    headers[ishstrtab].size   = shstrtab.length;
+    headers[ishstrtab].align  = 1;
+    elf_buffer_write(&image, shstrtab.data, shstrtab.length);
+
+    elf_buffer_align(&image, 8);
+    size_t shoff = image.length;
+    for (size_t i = 0; i < total; i++)
+        elf_header_write(&image, &headers[i]);
+
+    /* the file header */
+    static const unsigned char ident[16] = {
+        0x7F, 'E', 'L', 'F',
+        2,    /* 64-bit         */
+        1,    /* little endian  */
+        1,    /* version        */
+        0     /* System V ABI   */
+    };
+
+    elf_buffer_t header = { 0 };
+    elf_buffer_write(&header, ident, sizeof(ident));
+    elf_buffer_integer(&header, 1,                2); /* relocatable */
+    elf_buffer_integer(&header, 62,               2); /* x86-64 */
+    elf_buffer_integer(&header, 1,                4); /* version */
+    elf_buffer_integer(&header, 0,                8); /* entry */
+    elf_buffer_integer(&header, 0,                8); /* program headers */
+    elf_buffer_integer(&header, shoff,            8);
+    elf_buffer_integer(&header, 0,                4); /* flags */
+    elf_buffer_integer(&header, ELF_HEADER_SIZE,  2);
+    elf_buffer_integer(&header, 0,                2);
+    elf_buffer_integer(&header, 0,                2);
+    elf_buffer_integer(&header, ELF_SECTION_SIZE, 2);
+    elf_buffer_integer(&header, total,            2);
+    elf_buffer_integer(&header, ishstrtab,        2);
+    memcpy(image.data, header.data, ELF_HEADER_SIZE);
+
+    free(header.data);
+    free(headers);
+    free(symtab.data);
+    free(strtab.data);
+    free(shstrtab.data);
+
+    *length = image.length;
+    return image.data;
+}
@@ -0,0 +1,120 @@
+#ifndef LICE_ELF_HDR
+#define LICE_ELF_HDR
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * File: elf.h
+ *  Writer for ELF64 relocatable objects (x86-64, little endian).
+ */
+
+/*
+ * Constants: Section types
+ *  ELF_SECTION_PROGBITS - Section with contents in the file
+ *  ELF_SECTION_NOBITS   - Section only occupying memory (.bss)
+ */
+#define ELF_SECTION_PROGBITS 1
+#define ELF_SECTION_NOBITS   8
+
+/*
+ * Constants: Section flags
+ *  ELF_FLAG_WRITE   - Writable at runtime
+ *  ELF_FLAG_ALLOC   - Occupies memory at runtime
+ *  ELF_FLAG_EXEC    - Contains executable code
+ *  ELF_FLAG_MERGE   - Identical entries may be merged by the linker
+ *  ELF_FLAG_STRINGS - Entries are nul-terminated strings
+ */
+#define ELF_FLAG_WRITE   0x01
+#define ELF_FLAG_ALLOC   0x02
+#define ELF_FLAG_EXEC    0x04
+#define ELF_FLAG_MERGE   0x10
+#define ELF_FLAG_STRINGS 0x20
+
+/*
+ * Constants: Relocation types
+ *  ELF_RELOCATION_64    - S + A, 64 bits
+ *  ELF_RELOCATION_PC32  - S + A - P, 32 bits
+ *  ELF_RELOCATION_PLT32 - L + A - P, 32 bits
+ *  ELF_RELOCATION_32    - S + A, 32 bits zero extended
+ *  ELF_RELOCATION_32S   - S + A, 32 bits sign extended
+ */
+#define ELF_RELOCATION_64    1
+#define ELF_RELOCATION_PC32  2
+#define ELF_RELOCATION_PLT32 4
+#define ELF_RELOCATION_32    10
+#define ELF_RELOCATION_32S   11
+
+/*
+ * Type: elf_t
+ *  An object file being put together
+ */
+typedef struct elf_s elf_t;
+
+/*
+ * Function: elf_create
+ *  Create an empty object file
+ */
+elf_t *elf_create(void);
+
+/*
+ * Function: elf_destroy
+ *  Release an object file and everything in it
+ */
+void elf_destroy(elf_t *elf);
+
+/*
+ * Function: elf_section
+ *  Add a section to the object file.
+ *
+ * Returns:
+ *  The index of the section which is used to refer to it.
+ */
+size_t elf_section(elf_t *elf, const char *name, unsigned type, uint64_t flags, uint64_t align, uint64_t entsize);
+
+/*
+ * Function: elf_section_data
+ *  Append contents to a section
+ */
+void elf_section_data(elf_t *elf, size_t section, const void *data, size_t length);
+
+/*
+ * Function: elf_section_size
+ *  Set the size of a section without contents
+ */
+void elf_section_size(elf_t *elf, size_t section, uint64_t size);
+
+/*
+ * Function: elf_section_symbol
+ *  Get the symbol which refers to the start of a section, to be used
+ *  for relocations against local symbols.
+ */
+size_t elf_section_symbol(elf_t *elf, size_t section);
+
+/*
+ * Function: elf_symbol
+ *  Add a symbol to the object file, a section of zero makes it an
+ *  undefined symbol.
+ *
+ * Returns:
+ *  A handle which is used to refer to the symbol in relocations.
+ */
+size_t elf_symbol(elf_t *elf, const char *name, size_t section, uint64_t value, bool global);
+
+/*
+ * Function: elf_relocation
+ *  Add a relocation to a location in a section
+ */
+void elf_relocation(elf_t *elf, size_t section, uint64_t offset, size_t symbol, unsigned type, int64_t addend);
+
+/*
+ * Function: elf_image
+ *  Lay the object file out in memory.
+ *
+ * Returns:
+ *  A buffer which the caller must free containing the object file,
+ *  the size of it is stored in length.
+ */
+unsigned char *elf_image(elf_t *elf, size_t *length);
+
+#endif
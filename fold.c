@@ -0,0 +1,525 @@
+/*
+ * File: fold.c
+ *  Constant folding and algebraic simplification of expressions.
+ *
+ *  The parser already placed the usual arithmetic conversions into the
+ *  tree, so folding literals is a matter of evaluating every operation in
+ *  the type of it's node. Like the code generator, arithmetic on types
+ *  narrower than int is carried out in int, a value is only narrowed by
+ *  an explicit conversion.
+ */
+#include <stdint.h>
+#include <limits.h>
+
+#include "fold.h"
+#include "conv.h"
+#include "lice.h"
+
+static bool fold_literal(ast_t *ast) {
+    return ast && ast->type == AST_TYPE_LITERAL && conv_capable(ast->ctype);
+}
+
+static bool fold_literal_integer(ast_t *ast) {
+    return fold_literal(ast) && ast_type_isinteger(ast->ctype);
+}
+
+static bool fold_type_same(data_type_t *a, data_type_t *b) {
+    return a->type == b->type && a->size == b->size && a->sign == b->sign;
+}
+
+static data_type_t *fold_promote(data_type_t *type) {
+    if (type->size < ast_data_table[AST_DATA_INT]->size)
+        return ast_data_table[AST_DATA_INT];
+    return type;
+}
+
+static uint64_t fold_mask(data_type_t *type) {
+    if (type->size >= 8)
+        return UINT64_MAX;
+    return (UINT64_C(1) << type->size * 8) - 1;
+}
+
+/* the value an integer of the given type holds, extended to 64 bits */
+static long fold_truncate(data_type_t *type, long value) {
+    if (type->type == TYPE_BOOL)
+        return !!value;
+
+    uint64_t mask = fold_mask(type);
+    uint64_t bits = (uint64_t)value & mask;
+    if (type->sign && mask != UINT64_MAX && (bits & ~(mask >> 1)))
+        bits |= ~mask;
+    return (long)bits;
+}
+
+static long fold_value(ast_t *ast) {
+    return fold_truncate(fold_promote(ast->ctype), ast->integer);
+}
+
+static uint64_t fold_unsigned(ast_t *ast) {
+    return (uint64_t)fold_value(ast) & fold_mask(fold_promote(ast->ctype));
+}
+
+static double fold_double(ast_t *ast) {
+    if (ast_type_isfloating(ast->ctype))
+        return ast->floating.value;
+    if (!fold_promote(ast->ctype)->sign)
+        return (double)fold_unsigned(ast);
+    return (double)fold_value(ast);
+}
+
+/* 1 or 0 for a literal which is true or false, -1 for anything else */
+static int fold_truth(ast_t *ast) {
+    if (!fold_literal(ast))
+        return -1;
+    if (ast_type_isfloating(ast->ctype))
+        return ast->floating.value != 0;
+    return fold_value(ast) != 0;
+}
+
+/* operations on integers of the same size are unsigned if either is */
+static bool fold_signed(data_type_t *left, data_type_t *right) {
+    left  = fold_promote(left);
+    right = fold_promote(right);
+    if (left->size != right->size)
+        return (left->size > right->size) ? left->sign : right->sign;
+    return left->sign && right->sign;
+}
+
+/* log2 of a power of two, -1 for anything else */
+static int fold_power(long value) {
+    if (value <= 0 || (value & (value - 1)))
+        return -1;
+    int shift = 0;
+    while (value >>= 1)
+        shift++;
+    return shift;
+}
+
+static ast_t *fold_integer(data_type_t *type, long value) {
+    return ast_new_integer(type, fold_truncate(fold_promote(type), value));
+}
+
+static ast_t *fold_floating(data_type_t *type, double value) {
+    if (type->type == TYPE_FLOAT)
+        value = (float)value;
+    return ast_new_floating(type, value);
+}
+
+/*
+ * An expression without side effects, which can be dropped when it's
+ * value isn't needed.
+ */
+static bool fold_pure(ast_t *ast) {
+    switch (ast->type) {
+        case AST_TYPE_LITERAL:
+        case AST_TYPE_STRING:
+        case AST_TYPE_VAR_GLOBAL:
+        case AST_TYPE_STATEMENT_LABEL_COMPUTED:
+            return true;
+
+        /* compound literals are initialized when they're first used */
+        case AST_TYPE_VAR_LOCAL:
+            return !ast->variable.init;
+
+        case AST_TYPE_ADDRESS:
+        case AST_TYPE_DEREFERENCE:
+        case AST_TYPE_CONVERT:
+        case AST_TYPE_EXPRESSION_CAST:
+        case AST_TYPE_NEGATE:
+        case '!':
+        case '~':
+            return fold_pure(ast->unary.operand);
+
+        case AST_TYPE_STRUCT:
+            return fold_pure(ast->structure);
+
+        case AST_TYPE_EXPRESSION_TERNARY:
+            return fold_pure(ast->ifstmt.cond)
+                && (!ast->ifstmt.then || fold_pure(ast->ifstmt.then))
+                && fold_pure(ast->ifstmt.last);
+
+        case '+': case '-': case '*': case '/': case '%':
+        case '&': case '|': case '^': case '<': case '>': case ',':
+        case AST_TYPE_EQUAL:
+        case AST_TYPE_NEQUAL:
+        case AST_TYPE_LEQUAL:
+        case AST_TYPE_GEQUAL:
+        case AST_TYPE_LSHIFT:
+        case AST_TYPE_RSHIFT:
+        case AST_TYPE_LRSHIFT:
+        case AST_TYPE_AND:
+        case AST_TYPE_OR:
+            return fold_pure(ast->left) && fold_pure(ast->right);
+    }
+    return false;
+}
+
+static ast_t *fold_convert(ast_t *ast) {
+    ast_t       *operand = ast->unary.operand;
+    data_type_t *type    = ast->ctype;
+
+    if (!fold_literal(operand) || !conv_capable(type))
+        return ast;
+
+    if (type->type == TYPE_BOOL)
+        return ast_new_integer(type, fold_truth(operand));
+    if (ast_type_isfloating(type))
+        return fold_floating(type, fold_double(operand));
+
+    if (ast_type_isfloating(operand->ctype)) {
+        /* out of range is undefined, leave that to run time */
+        double value = operand->floating.value;
+        if (!(value >= -9223372036854775808.0 && value < 9223372036854775808.0))
+            return ast;
+        return ast_new_integer(type, fold_truncate(type, (long)value));
+    }
+
+    return ast_new_integer(type, fold_truncate(type, fold_value(operand)));
+}
+
+static ast_t *fold_unary(ast_t *ast) {
+    ast_t *operand = ast->unary.operand;
+
+    if (!fold_literal(operand))
+        return ast;
+
+    switch (ast->type) {
+        case '!':
+            return ast_new_integer(ast->ctype, !fold_truth(operand));
+
+        case '~':
+            return fold_integer(ast->ctype, ~fold_value(operand));
+
+        case AST_TYPE_NEGATE:
+            if (ast_type_isfloating(ast->ctype))
+                return fold_floating(ast->ctype, -fold_double(operand));
+            return fold_integer(ast->ctype, -fold_unsigned(operand));
+    }
+    return ast;
+}
+
+static ast_t *fold_binary_floating(ast_t *ast) {
+    double left  = fold_double(ast->left);
+    double right = fold_double(ast->right);
+
+    switch (ast->type) {
+        case '+': return fold_floating(ast->ctype, left + right);
+        case '-': return fold_floating(ast->ctype, left - right);
+        case '*': return fold_floating(ast->ctype, left * right);
+        case '/': return fold_floating(ast->ctype, left / right);
+
+        case '<':             return ast_new_integer(ast->ctype, left <  right);
+        case '>':             return ast_new_integer(ast->ctype, left >  right);
+        case AST_TYPE_EQUAL:  return ast_new_integer(ast->ctype, left == right);
+        case AST_TYPE_NEQUAL: return ast_new_integer(ast->ctype, left != right);
+        case AST_TYPE_LEQUAL: return ast_new_integer(ast->ctype, left <= right);
+        case AST_TYPE_GEQUAL: return ast_new_integer(ast->ctype, left >= right);
+    }
+    return ast;
+}
+
+static ast_t *fold_binary_integer(ast_t *ast) {
+    long     left   = fold_value(ast->left);
+    long     right  = fold_value(ast->right);
+    uint64_t uleft  = fold_unsigned(ast->left);
+    uint64_t uright = fold_unsigned(ast->right);
+    bool     sign   = fold_signed(ast->left->ctype, ast->right->ctype);
+    long     value;
+
+    switch (ast->type) {
+        case '+': value = uleft + uright; break;
+        case '-': value = uleft - uright; break;
+        case '*': value = uleft * uright; break;
+        case '&': value = uleft & uright; break;
+        case '|': value = uleft | uright; break;
+        case '^': value = uleft ^ uright; break;
+
+        case '/':
+        case '%':
+            /* trapping is left to run time */
+            if (!right || (sign && left == LONG_MIN && right == -1))
+                return ast;
+            if (ast->type == '/')
+                value = sign ? left / right : (long)(uleft / uright);
+            else
+                value = sign ? left % right : (long)(uleft % uright);
+            break;
+
+        case '<':             return ast_new_integer(ast->ctype, sign ? left <  right : uleft <  uright);
+        case '>':             return ast_new_integer(ast->ctype, sign ? left >  right : uleft >  uright);
+        case AST_TYPE_LEQUAL: return ast_new_integer(ast->ctype, sign ? left <= right : uleft <= uright);
+        case AST_TYPE_GEQUAL: return ast_new_integer(ast->ctype, sign ? left >= right : uleft >= uright);
+        case AST_TYPE_EQUAL:  return ast_new_integer(ast->ctype, uleft == uright);
+        case AST_TYPE_NEQUAL: return ast_new_integer(ast->ctype, uleft != uright);
+
+        case AST_TYPE_LSHIFT:
+        case AST_TYPE_RSHIFT:
+        case AST_TYPE_LRSHIFT:
+            if (right < 0 || right >= fold_promote(ast->left->ctype)->size * 8)
+                return ast;
+            if (ast->type == AST_TYPE_LSHIFT)
+                value = uleft << right;
+            else if (ast->type == AST_TYPE_RSHIFT)
+                value = left >> right;
+            else
+                value = uleft >> right;
+            break;
+
+        default:
+            return ast;
+    }
+
+    return fold_integer(ast->ctype, value);
+}
+
+/*
+ * Identities with a literal operand. Only integers are simplified, for
+ * floating point x+0 isn't x when x is negative zero. Shifts replace
+ * multiplication and division only for int and wider, the code generator
+ * shifts narrower types in their own width.
+ */
+static ast_t *fold_identity(ast_t *ast) {
+    if (!ast_type_isinteger(ast->ctype))
+        return ast;
+
+    /* literals go to the right of commutative operations */
+    switch (ast->type) {
+        case '+': case '*': case '&': case '|': case '^':
+            if (fold_literal_integer(ast->left) && !fold_literal(ast->right)) {
+                ast_t *swap = ast->left;
+                ast->left   = ast->right;
+                ast->right  = swap;
+            }
+            break;
+    }
+
+    ast_t *left  = ast->left;
+    ast_t *right = ast->right;
+
+    if (!fold_literal_integer(right) || !fold_type_same(left->ctype, ast->ctype))
+        return ast;
+
+    long value  = fold_value(right);
+    int  shift  = (ast->ctype->size >= ast_data_table[AST_DATA_INT]->size) ? fold_power(value) : -1;
+    bool sign   = fold_signed(left->ctype, right->ctype);
+
+    switch (ast->type) {
+        case '+':
+        case '-':
+        case '|':
+        case '^':
+        case AST_TYPE_LSHIFT:
+        case AST_TYPE_RSHIFT:
+        case AST_TYPE_LRSHIFT:
+            return value ? ast : left;
+
+        case '*':
+            if (value == 0 && fold_pure(left))
+                return fold_integer(ast->ctype, 0);
+            if (value == 1)
+                return left;
+            if (shift > 0)
+                return ast_new_binary(ast->ctype, AST_TYPE_LSHIFT, left, ast_new_integer(ast_data_table[AST_DATA_INT], shift));
+            break;
+
+        case '/':
+            if (value == 1)
+                return left;
+            if (shift > 0 && !sign)
+                return ast_new_binary(ast->ctype, AST_TYPE_LRSHIFT, left, ast_new_integer(ast_data_table[AST_DATA_INT], shift));
+            break;
+
+        case '%':
+            if (value == 1 && fold_pure(left))
+                return fold_integer(ast->ctype, 0);
+            if (shift > 0 && !sign)
+                return ast_new_binary(ast->ctype, '&', left, fold_integer(ast->ctype, value - 1));
+            break;
+
+        case '&':
+            if (value == 0 && fold_pure(left))
+                return fold_integer(ast->ctype, 0);
+            if (fold_unsigned(right) == fold_mask(fold_promote(ast->ctype)))
+                return left;
+            break;
+    }
+    return ast;
+}
+
+static ast_t *fold_binary(ast_t *ast) {
+    ast->left  = fold_expression(ast->left);
+    ast->right = fold_expression(ast->right);
+
+    if (!fold_literal(ast->left) || !fold_literal(ast->right))
+        return fold_identity(ast);
+    if (ast_type_isfloating(ast->left->ctype) || ast_type_isfloating(ast->right->ctype))
+        return fold_binary_floating(ast);
+    return fold_binary_integer(ast);
+}
+
+/* the right operand isn't evaluated when the left one decides */
+static ast_t *fold_logical(ast_t *ast) {
+    ast->left  = fold_expression(ast->left);
+    ast->right = fold_expression(ast->right);
+
+    int left  = fold_truth(ast->left);
+    int right = fold_truth(ast->right);
+
+    if (left == -1)
+        return ast;
+    if (ast->type == AST_TYPE_AND && !left)
+        return ast_new_integer(ast->ctype, 0);
+    if (ast->type == AST_TYPE_OR && left)
+        return ast_new_integer(ast->ctype, 1);
+    if (right != -1)
+        return ast_new_integer(ast->ctype, right);
+    return ast;
+}
+
+static ast_t *fold_ternary(ast_t *ast) {
+    ast->ifstmt.cond = fold_expression(ast->ifstmt.cond);
+    ast->ifstmt.then = fold_expression(ast->ifstmt.then);
+    ast->ifstmt.last = fold_expression(ast->ifstmt.last);
+
+    int cond = fold_truth(ast->ifstmt.cond);
+    if (cond == -1 || !ast->ifstmt.then)
+        return ast;
+
+    ast_t *taken = cond ? ast->ifstmt.then : ast->ifstmt.last;
+    if (!fold_type_same(taken->ctype, ast->ctype))
+        return ast;
+    return taken;
+}
+
+static list_t *fold_list(list_t *list) {
+    list_t *folded = list_create();
+    for (list_iterator_t *it = list_iterator(list); !list_iterator_end(it); )
+        list_push(folded, fold_expression(list_iterator_next(it)));
+    return folded;
+}
+
+static void fold_initializers(list_t *init) {
+    if (!init)
+        return;
+    for (list_iterator_t *it = list_iterator(init); !list_iterator_end(it); ) {
+        ast_t *node = list_iterator_next(it);
+        node->init.value = fold_expression(node->init.value);
+    }
+}
+
+ast_t *fold_expression(ast_t *ast) {
+    if (!ast)
+        return NULL;
+
+    switch (ast->type) {
+        case AST_TYPE_STATEMENT_IF:
+            ast->ifstmt.cond = fold_expression(ast->ifstmt.cond);
+            ast->ifstmt.then = fold_expression(ast->ifstmt.then);
+            ast->ifstmt.last = fold_expression(ast->ifstmt.last);
+            return ast;
+
+        case AST_TYPE_EXPRESSION_TERNARY:
+            return fold_ternary(ast);
+
+        case AST_TYPE_STATEMENT_FOR:
+        case AST_TYPE_STATEMENT_WHILE:
+        case AST_TYPE_STATEMENT_DO:
+            ast->forstmt.init = fold_expression(ast->forstmt.init);
+            ast->forstmt.cond = fold_expression(ast->forstmt.cond);
+            ast->forstmt.step = fold_expression(ast->forstmt.step);
+            ast->forstmt.body = fold_expression(ast->forstmt.body);
+            return ast;
+
+        case AST_TYPE_STATEMENT_SWITCH:
+            ast->switchstmt.expr = fold_expression(ast->switchstmt.expr);
+            ast->switchstmt.body = fold_expression(ast->switchstmt.body);
+            return ast;
+
+        case AST_TYPE_STATEMENT_RETURN:
+            ast->returnstmt = fold_expression(ast->returnstmt);
+            return ast;
+
+        case AST_TYPE_STATEMENT_COMPOUND:
+            ast->compound = fold_list(ast->compound);
+            return ast;
+
+        case AST_TYPE_DECLARATION:
+            fold_initializers(ast->decl.init);
+            return ast;
+
+        case AST_TYPE_VAR_LOCAL:
+            fold_initializers(ast->variable.init);
+            return ast;
+
+        case AST_TYPE_POINTERCALL:
+            ast->function.call.functionpointer = fold_expression(ast->function.call.functionpointer);
+            ast->function.call.args = fold_list(ast->function.call.args);
+            return ast;
+
+        case AST_TYPE_CALL:
+            ast->function.call.args = fold_list(ast->function.call.args);
+            return ast;
+
+        case AST_TYPE_STATEMENT_GOTO_COMPUTED:
+        case AST_TYPE_ADDRESS:
+        case AST_TYPE_DEREFERENCE:
+        case AST_TYPE_POST_INCREMENT:
+        case AST_TYPE_POST_DECREMENT:
+        case AST_TYPE_PRE_INCREMENT:
+        case AST_TYPE_PRE_DECREMENT:
+            ast->unary.operand = fold_expression(ast->unary.operand);
+            return ast;
+
+        case AST_TYPE_STRUCT:
+            ast->structure = fold_expression(ast->structure);
+            return ast;
+
+        case AST_TYPE_VA_START:
+        case AST_TYPE_VA_ARG:
+            ast->ap = fold_expression(ast->ap);
+            return ast;
+
+        case AST_TYPE_CONVERT:
+        case AST_TYPE_EXPRESSION_CAST:
+            ast->unary.operand = fold_expression(ast->unary.operand);
+            return fold_convert(ast);
+
+        case '!':
+        case '~':
+        case AST_TYPE_NEGATE:
+            ast->unary.operand = fold_expression(ast->unary.operand);
+            return fold_unary(ast);
+
+        case AST_TYPE_AND:
+        case AST_TYPE_OR:
+            return fold_logical(ast);
+
+        case ',':
+        case '=':
+            ast->left  = fold_expression(ast->left);
+            ast->right = fold_expression(ast->right);
+            return ast;
+
+        case '+': case '-': case '*': case '/': case '%':
+        case '&': case '|': case '^': case '<': case '>':
+        case AST_TYPE_EQUAL:
+        case AST_TYPE_NEQUAL:
+        case AST_TYPE_LEQUAL:
+        case AST_TYPE_GEQUAL:
+        case AST_TYPE_LSHIFT:
+        case AST_TYPE_RSHIFT:
+        case AST_TYPE_LRSHIFT:
+            /* pointer arithmetic is scaled by the code generator */
+            if (ast->ctype->type == TYPE_POINTER || !conv_capable(ast->left->ctype) || !conv_capable(ast->right->ctype)) {
+                ast->left  = fold_expression(ast->left);
+                ast->right = fold_expression(ast->right);
+                return ast;
+            }
+            return fold_binary(ast);
+    }
+    return ast;
+}
+
+void fold_function(ast_t *function) {
+    function->function.body = fold_expression(function->function.body);
+}
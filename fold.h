@@ -0,0 +1,41 @@
+#ifndef LICE_FOLD_HDR
+#define LICE_FOLD_HDR
+#include "ast.h"
+
+/*
+ * File: fold.h
+ *  Implements the interface to LICE's constant folding and algebraic
+ *  simplification of expressions.
+ */
+
+/*
+ * Function: fold_expression
+ *  Fold an expression or statement tree.
+ *
+ * Parameters:
+ *  ast - The tree to fold
+ *
+ * Returns:
+ *  The folded tree, which is either *ast* itself (with it's operands
+ *  folded) or a replacement for it.
+ *
+ * Remarks:
+ *  Literal operands are folded under the usual conversion rules (the
+ *  parser already placed the conversions into the tree), identities like
+ *  x+0, x*1 and x*0 are simplified and multiplication, division and
+ *  remainder by a power of two are turned into shifts and masks where
+ *  that gives the same result. Nothing with side effects is ever
+ *  dropped.
+ */
+ast_t *fold_expression(ast_t *ast);
+
+/*
+ * Function: fold_function
+ *  Fold every expression in the body of a function.
+ *
+ * Parameters:
+ *  function - An *AST_TYPE_FUNCTION* ast node
+ */
+void fold_function(ast_t *function);
+
+#endif
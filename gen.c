@@ -4,27 +4,250 @@
  */
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "gen.h"
 #include "lice.h"
+#include "opt.h"
+#include "peep.h"
 
-char *gen_label_break           = NULL;
-char *gen_label_continue        = NULL;
-char *gen_label_switch          = NULL;
-char *gen_label_break_backup    = NULL;
-char *gen_label_continue_backup = NULL;
-char *gen_label_switch_backup   = NULL;
+THREAD_LOCAL char *gen_label_break           = NULL;
+THREAD_LOCAL char *gen_label_continue        = NULL;
+THREAD_LOCAL char *gen_label_break_backup    = NULL;
+THREAD_LOCAL char *gen_label_continue_backup = NULL;
 
-static void gen_emit_emitter(bool indent, const char *fmt, va_list list) {
-    if (indent)
-        fputc('\t', stdout);
+/*
+ * Output is gathered in a large in-memory buffer which is handed to the
+ * sink whenever it fills up or is flushed. The sink is either a file
+ * descriptor or memory, in which case the buffer just keeps growing until
+ * it's released. Every thread has an output of its own.
+ */
+#define GEN_OUTPUT_BUFFER 0x100000
+
+static THREAD_LOCAL struct {
+    char   *buffer;
+    size_t  length;
+    size_t  allocated;
+    size_t  marks;
+    int     fd;
+    bool    memory;
+    bool    close;
+} gen_output = {
+    .fd = STDOUT_FILENO
+};
+
+static void gen_output_write(const char *data, size_t length) {
+    while (length) {
+        ssize_t wrote = write(gen_output.fd, data, length);
+        if (wrote < 0) {
+            if (errno == EINTR)
+                continue;
+            compile_error("failed writing output: %s", strerror(errno));
+        }
+        data   += wrote;
+        length -= wrote;
+    }
+}
+
+void gen_output_flush(void) {
+    if (gen_output.memory || !gen_output.length)
+        return;
+    gen_output_write(gen_output.buffer, gen_output.length);
+    gen_output.length = 0;
+}
+
+static void gen_output_close(void) {
+    gen_output_flush();
+    if (gen_output.close)
+        close(gen_output.fd);
+    gen_output.close = false;
+}
+
+void gen_output_fd(int fd) {
+    gen_output_close();
+    gen_output.fd     = fd;
+    gen_output.memory = false;
+}
+
+bool gen_output_file(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+        return false;
+    gen_output_fd(fd);
+    gen_output.close = true;
+    return true;
+}
+
+void gen_output_memory(void) {
+    gen_output_close();
+    gen_output.memory = true;
+}
+
+char *gen_output_release(size_t *length) {
+    char *buffer = gen_output.buffer;
+    if (length)
+        *length = gen_output.length;
+
+    gen_output.buffer    = NULL;
+    gen_output.length    = 0;
+    gen_output.allocated = 0;
+
+    return buffer;
+}
+
+static void gen_output_reserve(size_t bytes) {
+    if (gen_output.length + bytes <= gen_output.allocated)
+        return;
+
+    if (!gen_output.memory && !gen_output.marks) {
+        gen_output_flush();
+        if (bytes <= gen_output.allocated)
+            return;
+    }
+
+    size_t allocated = gen_output.allocated ? gen_output.allocated : GEN_OUTPUT_BUFFER;
+    while (allocated < gen_output.length + bytes)
+        allocated *= 2;
+
+    if (!(gen_output.buffer = realloc(gen_output.buffer, allocated)))
+        compile_error("out of memory");
+    gen_output.allocated = allocated;
+}
+
+static void gen_output_string(const char *string, size_t length) {
+    gen_output_reserve(length);
+    memcpy(gen_output.buffer + gen_output.length, string, length);
+    gen_output.length += length;
+}
+
+void gen_output_data(const void *data, size_t length) {
+    gen_output_string(data, length);
+}
+
+static void gen_output_char(char ch) {
+    gen_output_reserve(1);
+    gen_output.buffer[gen_output.length++] = ch;
+}
+
+static void gen_output_integer(unsigned long value, bool negative, unsigned base) {
+    char  digits[24];
+    char *p = &digits[sizeof(digits)];
+
+    do {
+        *--p   = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value);
+
+    if (negative)
+        *--p = '-';
+
+    gen_output_string(p, &digits[sizeof(digits)] - p);
+}
+
+/*
+ * The code generator only uses a handful of conversions (%s, %c, %d, %i,
+ * %u and %x with the l, ll and z length modifiers), those are formatted
+ * straight into the output buffer. Formats using anything else are passed
+ * along to vsnprintf.
+ */
+static bool gen_output_simple(const char *fmt) {
+    while ((fmt = strchr(fmt, '%'))) {
+        fmt++;
+        if (*fmt == 'l')
+            fmt += (fmt[1] == 'l') ? 2 : 1;
+        else if (*fmt == 'z')
+            fmt++;
+        if (!*fmt || !strchr("%scdiux", *fmt))
+            return false;
+        fmt++;
+    }
+    return true;
+}
+
+static void gen_output_fallback(const char *fmt, va_list va) {
+    va_list copy;
+    va_copy(copy, va);
+    int length = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+
+    if (length < 0)
+        compile_ice("gen_output_fallback");
+
+    gen_output_reserve(length + 1);
+    vsnprintf(gen_output.buffer + gen_output.length, length + 1, fmt, va);
+    gen_output.length += length;
+}
+
+static void gen_output_format(const char *fmt, va_list va) {
+    if (!gen_output_simple(fmt)) {
+        gen_output_fallback(fmt, va);
+        return;
+    }
 
+    for (const char *p = fmt; *p; p++) {
+        const char *begin = p;
+        while (*p && *p != '%')
+            p++;
+        if (p != begin)
+            gen_output_string(begin, p - begin);
+        if (!*p)
+            break;
+
+        bool wide = false;
+        switch (*++p) {
+            case 'l':
+                wide = true;
+                p   += (p[1] == 'l') ? 2 : 1;
+                break;
+            case 'z':
+                wide = true;
+                p++;
+                break;
+        }
+
+        switch (*p) {
+            case '%':
+                gen_output_char('%');
+                break;
+            case 's': {
+                const char *string = va_arg(va, const char *);
+                gen_output_string(string, strlen(string));
+                break;
+            }
+            case 'c':
+                gen_output_char((char)va_arg(va, int));
+                break;
+            case 'd':
+            case 'i': {
+                long value = wide ? va_arg(va, long) : va_arg(va, int);
+                gen_output_integer(value < 0 ? -(unsigned long)value : (unsigned long)value, value < 0, 10);
+                break;
+            }
+            case 'u':
+            case 'x': {
+                unsigned long value = wide ? va_arg(va, unsigned long) : va_arg(va, unsigned int);
+                gen_output_integer(value, false, *p == 'x' ? 16 : 10);
+                break;
+            }
+        }
+    }
+}
+
+static void gen_emit_emitter(bool indent, const char *fmt, va_list list) {
     va_list va;
     va_copy(va, list);
-    vprintf(fmt, va);
-    va_end(va);
 
-    fputc('\n', stdout);
+    if (indent)
+        gen_output_char('\t');
+
+    gen_output_format(fmt, va);
+    gen_output_char('\n');
+
+    va_end(va);
 }
 
 void gen_emit(const char *fmt, ...) {
@@ -41,6 +264,64 @@ void gen_emit_inline(const char *fmt, ...) {
     va_end(va);
 }
 
+/*
+ * While a mark is held the output stays in the buffer, so text can still be
+ * inserted at the mark after what follows it was emitted.
+ */
+size_t gen_output_mark(void) {
+    gen_output.marks++;
+    return gen_output.length;
+}
+
+void gen_output_unmark(void) {
+    if (!gen_output.marks)
+        compile_ice("gen_output_unmark");
+    gen_output.marks--;
+}
+
+/*
+ * Take what was emitted since a mark back out of the output, into memory
+ * from the selected arena. The mark is released.
+ */
+char *gen_output_cut(size_t mark, size_t *length) {
+    char *text = memory_allocate(gen_output.length - mark + 1);
+
+    *length = gen_output.length - mark;
+    memcpy(text, gen_output.buffer + mark, *length);
+    gen_output.length = mark;
+    gen_output_unmark();
+    return text;
+}
+
+/*
+ * The whole function is still in the buffer when it's done, the peephole
+ * optimizer rewrites it there before it's ever written out.
+ */
+static void gen_output_peephole(size_t mark) {
+    size_t length;
+    char  *text = peep_function(gen_output.buffer + mark, gen_output.length - mark, &length);
+
+    gen_output.length = mark;
+    gen_output_string(text, length);
+}
+
+void gen_emit_at(size_t *mark, const char *fmt, ...) {
+    size_t  end = gen_output.length;
+    va_list va;
+    va_start(va, fmt);
+    gen_emit_emitter(true, fmt, va);
+    va_end(va);
+
+    /* rotate the new line into place using the space past the end */
+    size_t length = gen_output.length - end;
+    gen_output_reserve(length);
+    char *buffer = gen_output.buffer;
+    memcpy(buffer + end + length, buffer + end, length);
+    memmove(buffer + *mark + length, buffer + *mark, end - *mark);
+    memcpy(buffer + *mark, buffer + end + length, length);
+    *mark += length;
+}
+
 void gen_jump_backup(void) {
     gen_label_break_backup    = gen_label_break;
     gen_label_continue_backup = gen_label_continue;
@@ -69,34 +350,98 @@ void gen_label(const char *label) {
     gen_emit("%s:", label);
 }
 
+/* the top of a loop is aligned so it's fetched in as few lines as possible */
+void gen_label_loop(const char *label) {
+    if (opt_level())
+        gen_emit(".p2align 4");
+    gen_label(label);
+}
+
+/*
+ * All the cases of a switch are collected before its body is generated,
+ * so the dispatch can be emitted up front. The cases themselves are just
+ * labels in the body.
+ */
+static void gen_statement_switch_cases(ast_t *ast, list_t *cases, ast_t **fallback) {
+    if (!ast)
+        return;
+
+    switch (ast->type) {
+        case AST_TYPE_STATEMENT_CASE:
+            ast->caselabel = ast_label();
+            if (ast->casebeg <= ast->caseend)
+                list_push(cases, ast);
+            break;
+
+        case AST_TYPE_STATEMENT_DEFAULT:
+            if (*fallback)
+                compile_error("multiple default labels in one switch");
+            ast->caselabel = ast_label();
+            *fallback      = ast;
+            break;
+
+        case AST_TYPE_STATEMENT_COMPOUND:
+            for (list_iterator_t *it = list_iterator(ast->compound); !list_iterator_end(it); )
+                gen_statement_switch_cases(list_iterator_next(it), cases, fallback);
+            break;
+
+        case AST_TYPE_STATEMENT_IF:
+            gen_statement_switch_cases(ast->ifstmt.then, cases, fallback);
+            gen_statement_switch_cases(ast->ifstmt.last, cases, fallback);
+            break;
+
+        case AST_TYPE_STATEMENT_FOR:
+        case AST_TYPE_STATEMENT_WHILE:
+        case AST_TYPE_STATEMENT_DO:
+            gen_statement_switch_cases(ast->forstmt.body, cases, fallback);
+            break;
+    }
+}
+
+static int gen_statement_switch_compare(const void *a, const void *b) {
+    const ast_t *lhs = *(ast_t *const *)a;
+    const ast_t *rhs = *(ast_t *const *)b;
+    return (lhs->casebeg > rhs->casebeg) - (lhs->casebeg < rhs->casebeg);
+}
+
 /*
  * Some expressions are architecture-independent thanks to generic generation
  * functions.
  */
 static void gen_statement_switch(ast_t *ast) {
-    gen_label_switch_backup = gen_label_switch;
-    gen_label_break_backup  = gen_label_break;
+    char   *lbreak   = gen_label_break;
+    list_t *list     = list_create();
+    ast_t  *fallback = NULL;
+
+    gen_statement_switch_cases(ast->switchstmt.body, list, &fallback);
+
+    int     count = list_length(list);
+    ast_t **cases = memory_allocate(sizeof(ast_t *) * (count + 1));
+    int     index = 0;
+    for (list_iterator_t *it = list_iterator(list); !list_iterator_end(it); )
+        cases[index++] = list_iterator_next(it);
+
+    /* the parser rejected overlapping cases already */
+    qsort(cases, count, sizeof(ast_t *), &gen_statement_switch_compare);
+
+    gen_label_break = ast_label();
     gen_expression(ast->switchstmt.expr);
-    gen_label_switch = ast_label();
-    gen_label_break  = ast_label();
-    gen_jump(gen_label_switch);
+    gen_switch(cases, count, fallback ? fallback->caselabel : gen_label_break, ast->switchstmt.expr->ctype->size > 4);
     if (ast->switchstmt.body)
         gen_expression(ast->switchstmt.body);
-    gen_label(gen_label_switch);
     gen_label(gen_label_break);
-    gen_label_switch = gen_label_switch_backup;
-    gen_label_break  = gen_label_break_backup;
+    gen_label_break = lbreak;
 }
 
 static void gen_statement_do(ast_t *ast) {
     char *begin = ast_label();
+    char *next  = ast_label();
     char *end   = ast_label();
-    gen_jump_save(end, begin);
-    gen_label(begin);
+    gen_jump_save(end, next);
+    gen_label_loop(begin);
     gen_expression(ast->forstmt.body);
-    gen_expression(ast->forstmt.cond);
-    gen_je(end);
-    gen_jump(begin);
+    gen_label(next);
+    gen_branch(ast->forstmt.cond, begin, true);
     gen_label(end);
     gen_jump_restore();
 }
@@ -116,11 +461,15 @@ static void gen_statement_label(ast_t *ast) {
 }
 
 static void gen_statement_cond(ast_t *ast) {
-    gen_expression(ast->ifstmt.cond);
     char *ne = ast_label();
-    gen_je(ne);
-    if (ast->ifstmt.then)
+    if (ast->ifstmt.then) {
+        gen_branch(ast->ifstmt.cond, ne, false);
         gen_expression(ast->ifstmt.then);
+    } else {
+        /* a ?: b yields the condition itself when it's true */
+        gen_expression(ast->ifstmt.cond);
+        gen_je(ne);
+    }
     if (ast->ifstmt.last) {
         char *end = ast_label();
         gen_jump(end);
@@ -132,38 +481,48 @@ static void gen_statement_cond(ast_t *ast) {
     }
 }
 
-static void gen_statement_for(ast_t *ast) {
-    if (ast->forstmt.init)
-        gen_expression(ast->forstmt.init);
+/*
+ * Loops are rotated so an iteration takes a single conditional branch at
+ * the bottom. The condition is tested once up front to skip the loop
+ * entirely, or when it can't be duplicated the loop is entered with a
+ * jump to the test at the bottom.
+ */
+static void gen_statement_loop(ast_t *cond, ast_t *body, ast_t *step) {
     char *begin = ast_label();
-    char *step  = ast_label();
+    char *next  = ast_label();
+    char *test  = ast_label();
     char *end   = ast_label();
-    gen_jump_save(end, step);
-    gen_label(begin);
-    if (ast->forstmt.cond) {
-        gen_expression(ast->forstmt.cond);
-        gen_je(end);
+
+    if (cond) {
+        if (ast_duplicable(cond))
+            gen_branch(cond, end, false);
+        else
+            gen_jump(test);
     }
-    gen_expression(ast->forstmt.body);
-    gen_label(step);
-    if (ast->forstmt.step)
-        gen_expression(ast->forstmt.step);
-    gen_jump(begin);
+
+    gen_jump_save(end, next);
+    gen_label_loop(begin);
+    gen_expression(body);
+    gen_label(next);
+    if (step)
+        gen_expression(step);
+    gen_label(test);
+    if (cond)
+        gen_branch(cond, begin, true);
+    else
+        gen_jump(begin);
     gen_label(end);
     gen_jump_restore();
 }
 
+static void gen_statement_for(ast_t *ast) {
+    if (ast->forstmt.init)
+        gen_expression(ast->forstmt.init);
+    gen_statement_loop(ast->forstmt.cond, ast->forstmt.body, ast->forstmt.step);
+}
+
 static void gen_statement_while(ast_t *ast) {
-    char *begin = ast_label();
-    char *end   = ast_label();
-    gen_jump_save(end, begin);
-    gen_label(begin);
-    gen_expression(ast->forstmt.cond);
-    gen_je(end);
-    gen_expression(ast->forstmt.body);
-    gen_jump(begin);
-    gen_label(end);
-    gen_jump_restore();
+    gen_statement_loop(ast->forstmt.cond, ast->forstmt.body, NULL);
 }
 
 static void gen_statement_return(ast_t *ast) {
@@ -182,9 +541,8 @@ static void gen_statement_continue(void) {
     gen_jump(gen_label_continue);
 }
 
-static void gen_statement_default(void) {
-    gen_label(gen_label_switch);
-    gen_label_switch = ast_label();
+static void gen_statement_case(ast_t *ast) {
+    gen_label(ast->caselabel);
 }
 
 static void gen_comma(ast_t *ast) {
@@ -193,22 +551,195 @@ static void gen_comma(ast_t *ast) {
 }
 
 static void gen_data_bss(ast_t *ast) {
-    gen_emit(".data");
+    int size = ast->decl.var->ctype->size;
+    int align;
+
+    /* aligned like .lcomm does, by the size up to 16 bytes */
+    for (align = 4; align > 0 && (1 << align) > size; align--)
+        ;
+
+    gen_emit(".bss");
     if (!ast->decl.var->ctype->isstatic)
         gen_emit(".global %s", ast->decl.var->variable.name);
-    gen_emit(".lcomm %s, %d", ast->decl.var->variable.name, ast->decl.var->ctype->size);
+    gen_emit(".p2align %d", align);
+    gen_emit_inline("%s:", ast->decl.var->variable.name);
+    gen_emit(".zero %d", size);
+}
+
+/* never written, const itself or an array of const elements */
+static bool gen_data_readonly(data_type_t *type) {
+    for (; type->type == TYPE_ARRAY; type = type->pointer)
+        if (type->isconst)
+            return true;
+    return type->isconst;
+}
+
+/*
+ * Whether an initializer holds addresses, those need relocations at load
+ * time in position independent executables, which read only data can't
+ * take.
+ */
+static bool gen_data_relocated(list_t *init) {
+    for (list_iterator_t *it = list_iterator(init); !list_iterator_end(it); ) {
+        ast_t *value = ((ast_t *)list_iterator_next(it))->init.value;
+        if (value->type == AST_TYPE_VAR_LOCAL && value->variable.init) {
+            if (gen_data_relocated(value->variable.init))
+                return true;
+        } else if (value->type == AST_TYPE_ADDRESS
+                || value->type == AST_TYPE_VAR_GLOBAL
+                || value->type == AST_TYPE_STRING
+                || value->ctype->type == TYPE_POINTER) {
+            return true;
+        }
+    }
+    return false;
 }
 
+static bool gen_data_zeroes(list_t *init) {
+    static const double zero = 0;
+
+    for (list_iterator_t *it = list_iterator(init); !list_iterator_end(it); ) {
+        ast_t *value = ((ast_t *)list_iterator_next(it))->init.value;
+        if (value->type == AST_TYPE_VAR_LOCAL && value->variable.init) {
+            if (!gen_data_zeroes(value->variable.init))
+                return false;
+            continue;
+        }
+        while (value->type == AST_TYPE_CONVERT)
+            value = value->unary.operand;
+        if (value->type != AST_TYPE_LITERAL)
+            return false;
+        if (ast_type_isfloating(value->ctype)) {
+            if (memcmp(&value->floating.value, &zero, sizeof(zero)))
+                return false;
+        } else if (value->integer) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Read only objects go to .rodata unless they need relocations, objects
+ * which are all zeroes take no space in the file in .bss and everything
+ * else is in .data.
+ */
 static void gen_data_global(ast_t *variable) {
-    if (variable->decl.init)
+    list_t *init = variable->decl.init;
+
+    if (init && gen_data_readonly(variable->decl.var->ctype) && !gen_data_relocated(init)) {
+        gen_emit(".section .rodata");
         gen_data(variable, 0, 0);
-    else
+    } else if (!init || gen_data_zeroes(init)) {
         gen_data_bss(variable);
+    } else {
+        gen_emit(".data 0");
+        gen_data(variable, 0, 0);
+    }
 }
 
-static void gen_declaration_initialization(list_t *init, int offset) {
-    for (list_iterator_t *it = list_iterator(init); !list_iterator_end(it); ) {
-        ast_t *node = list_iterator_next(it);
+/*
+ * Runs of constant initializers at least this large are copied from a read
+ * only template, holes of up to GEN_TEMPLATE_HOLE bytes between them are
+ * part of the template. Beyond GEN_ZERO_GAPS gaps the whole object is
+ * zeroed at once instead of gap by gap.
+ */
+#define GEN_TEMPLATE_MINIMUM 32
+#define GEN_TEMPLATE_HOLE    16
+#define GEN_ZERO_GAPS        8
+
+static bool gen_initializer_constant(ast_t *node) {
+    data_type_t *type  = node->init.type;
+    ast_t       *value = node->init.value;
+
+    if (type->bitfield.size > 0)
+        return false;
+    if (!ast_type_isinteger(type) && type->type != TYPE_POINTER
+            && type->type != TYPE_FLOAT && type->type != TYPE_DOUBLE)
+        return false;
+    while (value->type == AST_TYPE_CONVERT)
+        value = value->unary.operand;
+    return value->type == AST_TYPE_LITERAL;
+}
+
+static int gen_initializer_end(ast_t *node) {
+    return node->init.offset + node->init.type->size;
+}
+
+/*
+ * The initializers are sorted by offset, which makes finding the runs of
+ * constants and the bytes nothing writes a single walk each. Only those
+ * bytes are zeroed, bitfields included since they're stored into what's
+ * already there.
+ */
+static void gen_declaration_initialization(list_t *init, int offset, int size) {
+    size_t  length  = list_length(init);
+    size_t  index   = 0;
+    ast_t **nodes   = memory_allocate(sizeof(ast_t *) * (length + 1));
+    size_t *runs    = memory_allocate(sizeof(size_t) * (length + 1));
+    int    *gaps    = memory_allocate(sizeof(int) * 2 * (length + 1));
+    int     count   = 0;
+    int     covered = 0;
+
+    for (list_iterator_t *it = list_iterator(init); !list_iterator_end(it); index++) {
+        nodes[index] = list_iterator_next(it);
+        runs[index]  = 0;
+    }
+
+    for (size_t i = 0; i < length; ) {
+        if (!gen_initializer_constant(nodes[i])) {
+            i++;
+            continue;
+        }
+        size_t j   = i + 1;
+        int    end = gen_initializer_end(nodes[i]);
+        for (; j < length && gen_initializer_constant(nodes[j]); j++) {
+            if (nodes[j]->init.offset - end >= GEN_TEMPLATE_HOLE)
+                break;
+            end = MAX(end, gen_initializer_end(nodes[j]));
+        }
+        if (end - nodes[i]->init.offset >= GEN_TEMPLATE_MINIMUM)
+            runs[i] = j;
+        i = j;
+    }
+
+    for (size_t i = 0; i < length; ) {
+        int    start = nodes[i]->init.offset;
+        int    end   = gen_initializer_end(nodes[i]);
+        size_t next  = i + 1;
+
+        if (runs[i]) {
+            for (next = i; next < runs[i]; next++)
+                end = MAX(end, gen_initializer_end(nodes[next]));
+        } else if (nodes[i]->init.type->bitfield.size > 0) {
+            i = next;
+            continue;
+        }
+        if (start > covered) {
+            gaps[count++] = covered;
+            gaps[count++] = start;
+        }
+        covered = MAX(covered, end);
+        i = next;
+    }
+    if (covered < size) {
+        gaps[count++] = covered;
+        gaps[count++] = size;
+    }
+
+    if (count > GEN_ZERO_GAPS * 2)
+        gen_zero(offset, offset + size);
+    else
+        for (int i = 0; i < count; i += 2)
+            gen_zero(offset + gaps[i], offset + gaps[i + 1]);
+
+    for (size_t i = 0; i < length; ) {
+        if (runs[i]) {
+            gen_literal_block(nodes + i, runs[i] - i, offset);
+            i = runs[i];
+            continue;
+        }
+        ast_t *node = nodes[i++];
         if (node->init.value->type == AST_TYPE_LITERAL && node->init.type->bitfield.size <= 0)
             gen_literal_save(node->init.value, node->init.type, node->init.offset + offset);
         else {
@@ -222,18 +753,195 @@ static void gen_declaration(ast_t *ast) {
     if (!ast->decl.init)
         return;
 
-    gen_zero(ast->decl.var->variable.off, ast->decl.var->variable.off + ast->decl.var->ctype->size);
-    gen_declaration_initialization(ast->decl.init, ast->decl.var->variable.off);
+    /* variables in registers are scalars, which are simply assigned */
+    if (ast->decl.var->variable.reg) {
+        ast_t *node  = list_head(ast->decl.init);
+        ast_t *value = node ? node->init.value : ast_new_integer(ast_data_table[AST_DATA_INT], 0);
+        gen_expression(ast_new_binary(ast->decl.var->ctype, '=', ast->decl.var, value));
+        return;
+    }
+
+    gen_declaration_initialization(ast->decl.init, ast->decl.var->variable.off, ast->decl.var->ctype->size);
 }
 
 void gen_ensure_lva(ast_t *ast) {
-    if (ast->variable.init) {
-        gen_zero(ast->variable.off, ast->variable.off + ast->ctype->size);
-        gen_declaration_initialization(ast->variable.init, ast->variable.off);
-    }
+    if (ast->variable.init)
+        gen_declaration_initialization(ast->variable.init, ast->variable.off, ast->ctype->size);
     ast->variable.init = NULL;
 }
 
+/*
+ * Escape analysis for register promotion: every use of a local variable
+ * is weighted by how deeply nested in loops it is, and taking it's
+ * address marks it as escaping.
+ */
+#define GEN_PROMOTE_LOOP_WEIGHT 3
+#define GEN_PROMOTE_LOOP_DEPTH  4
+
+static void gen_promotable_walk(ast_t *ast, int depth);
+
+static void gen_promotable_list(list_t *list, int depth) {
+    if (!list)
+        return;
+    for (list_iterator_t *it = list_iterator(list); !list_iterator_end(it); )
+        gen_promotable_walk(list_iterator_next(it), depth);
+}
+
+static void gen_promotable_initializers(list_t *init, int depth) {
+    if (!init)
+        return;
+    for (list_iterator_t *it = list_iterator(init); !list_iterator_end(it); )
+        gen_promotable_walk(((ast_t *)list_iterator_next(it))->init.value, depth);
+}
+
+static void gen_promotable_walk(ast_t *ast, int depth) {
+    if (!ast)
+        return;
+
+    switch (ast->type) {
+        case AST_TYPE_VAR_LOCAL:
+            ast->variable.weight += 1 << (GEN_PROMOTE_LOOP_WEIGHT * MIN(depth, GEN_PROMOTE_LOOP_DEPTH));
+            gen_promotable_initializers(ast->variable.init, depth);
+            break;
+
+        case AST_TYPE_ADDRESS:
+            if (ast->unary.operand->type == AST_TYPE_VAR_LOCAL)
+                ast->unary.operand->variable.escapes = true;
+            gen_promotable_walk(ast->unary.operand, depth);
+            break;
+
+        case AST_TYPE_STATEMENT_IF:
+        case AST_TYPE_EXPRESSION_TERNARY:
+            gen_promotable_walk(ast->ifstmt.cond, depth);
+            gen_promotable_walk(ast->ifstmt.then, depth);
+            gen_promotable_walk(ast->ifstmt.last, depth);
+            break;
+
+        case AST_TYPE_STATEMENT_FOR:
+        case AST_TYPE_STATEMENT_WHILE:
+        case AST_TYPE_STATEMENT_DO:
+            gen_promotable_walk(ast->forstmt.init, depth);
+            gen_promotable_walk(ast->forstmt.cond, depth + 1);
+            gen_promotable_walk(ast->forstmt.step, depth + 1);
+            gen_promotable_walk(ast->forstmt.body, depth + 1);
+            break;
+
+        case AST_TYPE_STATEMENT_SWITCH:
+            gen_promotable_walk(ast->switchstmt.expr, depth);
+            gen_promotable_walk(ast->switchstmt.body, depth);
+            break;
+
+        case AST_TYPE_STATEMENT_RETURN:
+            gen_promotable_walk(ast->returnstmt, depth);
+            break;
+
+        case AST_TYPE_STATEMENT_COMPOUND:
+            gen_promotable_list(ast->compound, depth);
+            break;
+
+        case AST_TYPE_DECLARATION:
+            gen_promotable_initializers(ast->decl.init, depth);
+            break;
+
+        case AST_TYPE_POINTERCALL:
+            gen_promotable_walk(ast->function.call.functionpointer, depth);
+            /* fall through */
+        case AST_TYPE_CALL:
+            gen_promotable_list(ast->function.call.args, depth);
+            break;
+
+        case AST_TYPE_STATEMENT_GOTO_COMPUTED:
+        case AST_TYPE_DEREFERENCE:
+        case AST_TYPE_POST_INCREMENT:
+        case AST_TYPE_POST_DECREMENT:
+        case AST_TYPE_PRE_INCREMENT:
+        case AST_TYPE_PRE_DECREMENT:
+        case AST_TYPE_CONVERT:
+        case AST_TYPE_EXPRESSION_CAST:
+        case AST_TYPE_NEGATE:
+        case '!':
+        case '~':
+            gen_promotable_walk(ast->unary.operand, depth);
+            break;
+
+        case AST_TYPE_STRUCT:
+            gen_promotable_walk(ast->structure, depth);
+            break;
+
+        case AST_TYPE_VA_START:
+        case AST_TYPE_VA_ARG:
+            gen_promotable_walk(ast->ap, depth);
+            break;
+
+        case AST_TYPE_LITERAL:
+        case AST_TYPE_STRING:
+        case AST_TYPE_VAR_GLOBAL:
+        case AST_TYPE_STATEMENT_GOTO:
+        case AST_TYPE_STATEMENT_LABEL:
+        case AST_TYPE_STATEMENT_LABEL_COMPUTED:
+        case AST_TYPE_STATEMENT_BREAK:
+        case AST_TYPE_STATEMENT_CONTINUE:
+        case AST_TYPE_STATEMENT_CASE:
+        case AST_TYPE_STATEMENT_DEFAULT:
+            break;
+
+        default:
+            gen_promotable_walk(ast->left, depth);
+            gen_promotable_walk(ast->right, depth);
+            break;
+    }
+}
+
+static int gen_promotable_compare(const void *a, const void *b) {
+    const ast_t *lhs = *(const ast_t *const *)a;
+    const ast_t *rhs = *(const ast_t *const *)b;
+    return rhs->variable.weight - lhs->variable.weight;
+}
+
+static bool gen_promotable_variable(ast_t *variable) {
+    data_type_t *type = variable->ctype;
+    if (variable->variable.escapes || variable->variable.init || !variable->variable.weight)
+        return false;
+    if (type->bitfield.size > 0)
+        return false;
+    return ast_type_isinteger(type) || type->type == TYPE_POINTER;
+}
+
+list_t *gen_promotable(ast_t *function) {
+    list_t *variables = list_create();
+    list_t *result    = list_create();
+
+    if (function->ctype->hasdots)
+        return result;
+
+    for (list_iterator_t *it = list_iterator(function->function.params); !list_iterator_end(it); )
+        list_push(variables, list_iterator_next(it));
+    for (list_iterator_t *it = list_iterator(function->function.locals); !list_iterator_end(it); )
+        list_push(variables, list_iterator_next(it));
+
+    for (list_iterator_t *it = list_iterator(variables); !list_iterator_end(it); ) {
+        ast_t *variable = list_iterator_next(it);
+        variable->variable.escapes = false;
+        variable->variable.weight  = 0;
+        variable->variable.reg     = NULL;
+    }
+
+    gen_promotable_walk(function->function.body, 0);
+
+    int     count = 0;
+    ast_t **array = memory_allocate(sizeof(ast_t *) * (list_length(variables) + 1));
+    for (list_iterator_t *it = list_iterator(variables); !list_iterator_end(it); ) {
+        ast_t *variable = list_iterator_next(it);
+        if (gen_promotable_variable(variable))
+            array[count++] = variable;
+    }
+
+    qsort(array, count, sizeof(ast_t *), &gen_promotable_compare);
+    for (int i = 0; i < count; i++)
+        list_push(result, array[i]);
+    return result;
+}
+
 void gen_expression(ast_t *ast) {
     if (!ast) return;
 
@@ -250,7 +958,7 @@ void gen_expression(ast_t *ast) {
         case AST_TYPE_STATEMENT_RETURN:         gen_statement_return(ast);       break;
         case AST_TYPE_STATEMENT_BREAK:          gen_statement_break();           break;
         case AST_TYPE_STATEMENT_CONTINUE:       gen_statement_continue();        break;
-        case AST_TYPE_STATEMENT_DEFAULT:        gen_statement_default();         break;
+        case AST_TYPE_STATEMENT_DEFAULT:        gen_statement_case(ast);         break;
         case AST_TYPE_CALL:                     gen_function_call(ast);          break;
         case AST_TYPE_POINTERCALL:              gen_function_call(ast);          break;
         case AST_TYPE_LITERAL:                  gen_literal(ast);                break;
@@ -260,7 +968,7 @@ void gen_expression(ast_t *ast) {
         case AST_TYPE_DECLARATION:              gen_declaration(ast);            break;
         case AST_TYPE_DEREFERENCE:              gen_dereference(ast);            break;
         case AST_TYPE_ADDRESS:                  gen_address(ast->unary.operand); break;
-        case AST_TYPE_STATEMENT_CASE:           gen_case(ast);                   break;
+        case AST_TYPE_STATEMENT_CASE:           gen_statement_case(ast);         break;
         case AST_TYPE_VA_START:                 gen_va_start(ast);               break;
         case AST_TYPE_VA_ARG:                   gen_va_arg(ast);                 break;
         case '!':                               gen_not(ast);                    break;
@@ -289,9 +997,19 @@ void gen_expression(ast_t *ast) {
 void gen_toplevel(ast_t *ast) {
     gen_function(ast);
     if (ast->type == AST_TYPE_FUNCTION) {
-        gen_function_prologue(ast);
-        gen_expression(ast->function.body);
-        gen_function_epilogue();
+        size_t mark = gen_output_mark();
+        /* optimized functions are generated from the IR where it can express them */
+        if (!opt_level() || !gen_function_ir(ast)) {
+            gen_function_prologue(ast);
+            gen_expression(ast->function.body);
+            /* reaching the end of main returns zero */
+            if (!strcmp(ast->function.name, "main"))
+                gen_literal(ast_new_integer(ast_data_table[AST_DATA_INT], 0));
+            gen_function_epilogue();
+        }
+        if (opt_level())
+            gen_output_peephole(mark);
+        gen_output_unmark();
     } else if (ast->type == AST_TYPE_DECLARATION) {
         gen_data_global(ast);
     }
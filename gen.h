@@ -2,16 +2,26 @@
 #define LICE_GEN_HDR
 #include "ast.h"
 
-extern char *gen_label_break;
-extern char *gen_label_continue;
-extern char *gen_label_switch;
-extern char *gen_label_break_backup;
-extern char *gen_label_continue_backup;
-extern char *gen_label_switch_backup;
+extern THREAD_LOCAL char *gen_label_break;
+extern THREAD_LOCAL char *gen_label_continue;
+extern THREAD_LOCAL char *gen_label_break_backup;
+extern THREAD_LOCAL char *gen_label_continue_backup;
+
+/* output */
+void  gen_output_fd(int fd);
+bool  gen_output_file(const char *path);
+void  gen_output_memory(void);
+char *gen_output_release(size_t *length);
+void  gen_output_data(const void *data, size_t length);
+void  gen_output_flush(void);
+size_t gen_output_mark(void);
+void   gen_output_unmark(void);
+char  *gen_output_cut(size_t mark, size_t *length);
 
 /* emitters */
 void gen_emit(const char *fmt, ...);
 void gen_emit_inline(const char *fmt, ...);
+void gen_emit_at(size_t *mark, const char *fmt, ...);
 
 /* jump */
 void gen_jump(const char *label);
@@ -24,18 +34,21 @@ void gen_jump_continue(void);
 /* label */
 void gen_label(const char *label);
 void gen_label_default(void);
+void gen_label_loop(const char *label);
 
 /* expression */
 void gen_expression(ast_t *ast);
 
 /* semantics */
 void gen_ensure_lva(ast_t *ast);
+list_t *gen_promotable(ast_t *function);
 
 /* need to implement */
 void gen_return(void);
 void gen_literal(ast_t *ast);
 void gen_literal_string(ast_t *ast);
 void gen_literal_save(ast_t *ast, data_type_t *, int);
+void gen_literal_block(ast_t **, size_t, int);
 void gen_save_local(data_type_t *type, int offset);
 void gen_variable_local(ast_t *ast);
 void gen_variable_global(ast_t *ast);
@@ -44,9 +57,10 @@ void gen_address(ast_t *ast);
 void gen_binary(ast_t *ast);
 void gen_zero(int start, int end);
 void gen_je(const char *label);
+void gen_branch(ast_t *ast, const char *label, bool when);
 void gen_data(ast_t *, int, int);
 void gen_function_call(ast_t *ast);
-void gen_case(ast_t *ast);
+void gen_switch(ast_t **cases, int count, const char *fallback, bool wide);
 void gen_va_start(ast_t *ast);
 void gen_va_arg(ast_t *ast);
 void gen_not(ast_t *ast);
@@ -62,12 +76,22 @@ void gen_assign(ast_t *ast);
 void gen_function(ast_t *ast);
 void gen_function_prologue(ast_t *ast);
 void gen_function_epilogue(void);
+bool gen_function_ir(ast_t *ast);
 void gen_boolean_maybe(data_type_t *);
 void gen_negate(ast_t *ast);
 void gen_conversion(ast_t *ast);
 void gen_address_label(ast_t *ast);
 void gen_goto_computed(ast_t *ast);
 
+/* context, the state of generating one toplevel on the calling thread */
+void gen_context_begin(size_t index, memory_arena_t *persistent);
+void gen_context_end(void);
+
+/* constant pool of the whole unit */
+list_t *gen_constants_release(void);
+void    gen_constants_merge(list_t *constants);
+void    gen_constants_emit(void);
+
 /* entry */
 void gen_toplevel(ast_t *);
 #endif
@@ -1,5 +1,6 @@
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #define __STDC_FORMAT_MACROS
@@ -7,6 +8,8 @@
 
 #include "lice.h"
 #include "gen.h"
+#include "ir.h"
+#include "opt.h"
 
 #define REGISTER_AREA_SIZE     304
 #define REGISTER_MULT_SIZE_XMM 8
@@ -44,27 +47,71 @@ static const char *register_table[][REGISTER_MULT_SIZE] = {
 #define SREG(I) register_table[1][I]
 #define MREG(I) register_table[2][I]
 
-static int stack = 0;
-static int gp    = 0;
-static int fp    = 0;
+/*
+ * The state of the function being generated. Functions may be generated
+ * on several threads at once, each has a context of its own.
+ */
+typedef struct {
+    int             stack;
+    int             gp;
+    int             fp;
+    int             variables;       /* registers taken by promoted variables          */
+    char           *label_return;
+    int             frame;           /* offset of the stack pointer after the prologue */
+    table_t        *constants;       /* constants used by the toplevel, by key         */
+    list_t         *used;            /* the same in order of first use                 */
+    memory_arena_t *persistent;      /* where what outlives the toplevel is allocated  */
+} gen_context_t;
+
+static THREAD_LOCAL gen_context_t gen_context;
+
+/*
+ * Local variables promoted to registers when optimizing take callee-saved
+ * ones for the whole function, which survive calls without being saved
+ * around them.
+ */
+static const char *variable_table[] = {
+    "rbx", "r12", "r13", "r14", "r15"
+};
+
+static const char *variable_table_32[] = {
+    "ebx", "r12d", "r13d", "r14d", "r15d"
+};
+
+#define VARIABLE_SIZE (int)(sizeof(variable_table) / sizeof(*variable_table))
+
+/*
+ * The register a promoted variable lives in, so it can be used as an
+ * operand directly instead of being copied through %rax first.
+ */
+static const char *gen_register_operand(ast_t *ast, bool wide) {
+    if (!ast || ast->type != AST_TYPE_VAR_LOCAL || !ast->variable.reg)
+        return NULL;
+    if (wide)
+        return ast->variable.reg;
+    for (int i = 0; i < VARIABLE_SIZE; i++)
+        if (!strcmp(variable_table[i], ast->variable.reg))
+            return variable_table_32[i];
+    return NULL;
+}
 
 static void gen_push(const char *reg) {
     gen_emit("push %%%s", reg);
-    stack += 8;
+    gen_context.stack += 8;
 }
 static void gen_pop(const char *reg) {
     gen_emit("pop %%%s", reg);
-    stack -= 8;
+    gen_context.stack -= 8;
 }
 static void gen_push_xmm(int r) {
     gen_emit("sub $8, %%rsp");
     gen_emit("movsd %%xmm%d, (%%rsp)", r);
-    stack += 8;
+    gen_context.stack += 8;
 }
 static void gen_pop_xmm(int r) {
     gen_emit("movsd (%%rsp), %%xmm%d", r);
     gen_emit("add $8, %%rsp");
-    stack -= 8;
+    gen_context.stack -= 8;
 }
 
 /*
@@ -121,7 +168,11 @@ static void gen_shift_load(data_type_t *type) {
     gen_pop(SRCX);
 }
 
-static void gen_shift_save(data_type_t *type, char *address) {
+/*
+ * Merge the bitfield value in rax with the rest of the storage unit, which
+ * lives either at label+offset(%rip) or, without a label, at offset(%rbp).
+ */
+static void gen_shift_save(data_type_t *type, const char *label, int offset) {
     if (type->bitfield.size <= 0)
         return;
     gen_push(SRCX);
@@ -130,7 +181,15 @@ static void gen_shift_save(data_type_t *type, char *address) {
     gen_emit("mov $0x%" PRIx64 ", %%rdi", (1 << (uint64_t)type->bitfield.size) - 1);
     gen_emit("and %%rdi, %%rax");
     gen_emit("shl $%d, %%rax", type->bitfield.offset);
-    gen_emit("mov %s, %%%s", address, gen_register_integer(type, 'c'));
+    const char *reg = gen_register_integer(type, 'c');
+    if (label && offset)
+        gen_emit("mov %s+%d(%%rip), %%%s", label, offset, reg);
+    else if (label)
+        gen_emit("mov %s(%%rip), %%%s", label, reg);
+    else if (offset)
+        gen_emit("mov %d(%%rbp), %%%s", offset, reg);
+    else
+        gen_emit("mov (%%rbp), %%%s", reg);
     gen_emit("mov $0x%" PRIx64 ", %%rdi", ~(((1 << (uint64_t)type->bitfield.size) - 1) << type->bitfield.offset));
     gen_emit("and %%rdi, %%rcx");
     gen_emit("or %%rcx, %%rax");
@@ -147,8 +206,14 @@ static void gen_load_global(data_type_t *type, char *label, int offset) {
             gen_emit("lea %s(%%rip), %%rax", label);
         return;
     }
-    gen_emit("%s %s+%d(%%rip), %%rax", gen_load_instruction(type), label, offset);
-    gen_shift_load(type);
+    if (type->type == TYPE_FLOAT)
+        gen_emit("movss %s+%d(%%rip), %%xmm0", label, offset);
+    else if (type->type == TYPE_DOUBLE || type->type == TYPE_LDOUBLE)
+        gen_emit("movsd %s+%d(%%rip), %%xmm0", label, offset);
+    else {
+        gen_emit("%s %s+%d(%%rip), %%rax", gen_load_instruction(type), label, offset);
+        gen_shift_load(type);
+    }
 }
 
 static void gen_cast_int(data_type_t *type) {
@@ -194,18 +259,23 @@ void gen_boolean_maybe(data_type_t *type) {
 }
 
 static void gen_save_global(char *name, data_type_t *type, int offset) {
+    if (type->type == TYPE_FLOAT) {
+        gen_emit("movss %%xmm0, %s+%d(%%rip)", name, offset);
+        return;
+    }
+    if (type->type == TYPE_DOUBLE || type->type == TYPE_LDOUBLE) {
+        gen_emit("movsd %%xmm0, %s+%d(%%rip)", name, offset);
+        return;
+    }
+
     gen_boolean_maybe(type);
+    gen_shift_save(type, name, offset);
 
     const char *reg = gen_register_integer(type, 'a');
-    string_t   *str = string_create();
-
     if (offset != 0)
-        string_catf(str, "%s+%d(%%rip)", name, offset);
+        gen_emit("mov %%%s, %s+%d(%%rip)", reg, name, offset);
     else
-        string_catf(str, "%s(%%rip)", name);
-
-    gen_shift_save(type, string_buffer(str));
-    gen_emit("mov %%%s, %s", reg, string_buffer(str));
+        gen_emit("mov %%%s, %s(%%rip)", reg, name);
 }
 
 void gen_save_local(data_type_t *type, int offset) {
@@ -215,17 +285,13 @@ void gen_save_local(data_type_t *type, int offset) {
         gen_emit("movsd %%xmm0, %d(%%rbp)", offset);
     else {
         gen_boolean_maybe(type);
+        gen_shift_save(type, NULL, offset);
 
-        string_t   *str = string_create();
         const char *reg = gen_register_integer(type, 'a');
-
         if (offset != 0)
-            string_catf(str, "%d(%%rbp)", offset);
+            gen_emit("mov %%%s, %d(%%rbp)", reg, offset);
         else
-            string_catf(str, "(%%rbp)");
-
-        gen_shift_save(type, string_buffer(str));
-        gen_emit("mov %%%s, %s", reg, string_buffer(str));
+            gen_emit("mov %%%s, (%%rbp)", reg);
     }
 }
 
@@ -261,7 +327,7 @@ void gen_address(ast_t *ast) {
 }
 
 void gen_address_label(ast_t *ast) {
-    gen_emit("mov $%s, %%rax", ast->gotostmt.where);
+    gen_emit("lea %s(%%rip), %%rax", ast->gotostmt.where);
 }
 
 void gen_goto_computed(ast_t *ast) {
@@ -269,31 +335,80 @@ void gen_goto_computed(ast_t *ast) {
     gen_emit("jmp *%%rax");
 }
 
-static void gen_structure_copy(int size, const char *base) {
+/*
+ * Blocks are zeroed and copied by size. Those of at least 16 bytes up to
+ * GEN_BLOCK_INLINE bytes are unrolled into unaligned 16 byte SSE moves
+ * through %xmm15, which nothing else uses, where the last move overlaps
+ * the one before it for the tail. Smaller ones are split into integer
+ * moves and larger ones are left to the string instructions.
+ */
+#define GEN_BLOCK_INLINE 256
+
+static const struct {
+    int         size;
+    const char *suffix;
+    const char *reg;
+} gen_block_pieces[] = {
+    { 8, "q", "r11"  },
+    { 4, "l", "r11d" },
+    { 2, "w", "r11w" },
+    { 1, "b", "r11b" }
+};
+
+#define GEN_BLOCK_PIECES (sizeof(gen_block_pieces) / sizeof(*gen_block_pieces))
+
+/* copy size bytes from (%rcx) to displacement(%base), clobbers %r11 */
+static void gen_structure_copy(int size, const char *base, int displacement) {
     int i = 0;
-    for (; i < size; i += 8) {
-        gen_emit("movq %d(%%rcx), %%r11", i);
-        gen_emit("movq %%r11, %d(%%%s)", i, base);
+
+    if (size > GEN_BLOCK_INLINE) {
+        gen_push(SRCX);
+        gen_push(SRSI);
+        gen_push(SRDI);
+        gen_emit("mov %%rcx, %%rsi");
+        gen_emit("lea %d(%%%s), %%rdi", displacement, base);
+        gen_emit("mov $%d, %%ecx", size);
+        gen_emit("rep movsb");
+        gen_pop(SRDI);
+        gen_pop(SRSI);
+        gen_pop(SRCX);
+        return;
     }
 
-    for (; i < size; i += 4) {
-        gen_emit("movl %d(%%rcx), %%r11", i);
-        gen_emit("movl %%r11d, %d(%%%s)", i, base);
+    if (size >= 16) {
+        for (; i <= size - 16; i += 16) {
+            gen_emit("movups %d(%%rcx), %%xmm15", i);
+            gen_emit("movups %%xmm15, %d(%%%s)", displacement + i, base);
+        }
+        if (i < size) {
+            gen_emit("movups %d(%%rcx), %%xmm15", size - 16);
+            gen_emit("movups %%xmm15, %d(%%%s)", displacement + size - 16, base);
+        }
+        return;
     }
 
-    for (; i < size; i++) {
-        gen_emit("movb %d(%%rcx), %%r11", i);
-        gen_emit("movb %%r11b, %d(%%%s)", i, base);
+    for (size_t piece = 0; piece < GEN_BLOCK_PIECES; piece++) {
+        const char *suffix = gen_block_pieces[piece].suffix;
+        const char *reg    = gen_block_pieces[piece].reg;
+        for (; size - i >= gen_block_pieces[piece].size; i += gen_block_pieces[piece].size) {
+            gen_emit("mov%s %d(%%rcx), %%%s", suffix, i, reg);
+            gen_emit("mov%s %%%s, %d(%%%s)", suffix, reg, displacement + i, base);
+        }
     }
 }
 
+/*
+ * The address of the source is kept as a temporary while the one of the
+ * destination is computed, which may well use %rcx itself.
+ */
 static void gen_structure_assign(ast_t *left, ast_t *right) {
     gen_push(SRCX);
     gen_push(SR11);
     gen_address(right);
-    gen_emit("mov %%rax, %%rcx");
+    gen_push(SRAX);
     gen_address(left);
-    gen_structure_copy(left->ctype->size, "rax");
+    gen_pop(SRCX);
+    gen_structure_copy(left->ctype->size, "rax", 0);
     gen_pop(SR11);
     gen_pop(SRCX);
 }
@@ -309,13 +424,35 @@ static int gen_structure_push(int size) {
     compile_error("cannot pass structure of size: %d bytes by copy (unimplemented)", size);
 }
 
+/* zero from start to end in the frame, tiered like the copies above */
 void gen_zero(int start, int end) {
-    for (; start <= end - 8; start += 8)
-      gen_emit("movq $0, %d(%%rbp)", start);
-    for (; start <= end - 4; start += 4)
-        gen_emit("movl $0, %d(%%rbp)", start);
-    for (; start < end; start ++)
-        gen_emit("movb $0, %d(%%rbp)", start);
+    int size = end - start;
+
+    if (size > GEN_BLOCK_INLINE) {
+        /* locals are 8 byte aligned, so are the stores of rep stosq */
+        gen_push(SRAX);
+        gen_push(SRCX);
+        gen_push(SRDI);
+        gen_emit("lea %d(%%rbp), %%rdi", start);
+        gen_emit("mov $%d, %%ecx", size / 8);
+        gen_emit("xor %%eax, %%eax");
+        gen_emit("rep stosq");
+        gen_pop(SRDI);
+        gen_pop(SRCX);
+        gen_pop(SRAX);
+        start += size & ~7;
+    } else if (size >= 16) {
+        gen_emit("xorps %%xmm15, %%xmm15");
+        for (; start <= end - 16; start += 16)
+            gen_emit("movups %%xmm15, %d(%%rbp)", start);
+        if (start < end)
+            gen_emit("movups %%xmm15, %d(%%rbp)", end - 16);
+        return;
+    }
+
+    for (size_t piece = 0; piece < GEN_BLOCK_PIECES; piece++)
+        for (; end - start >= gen_block_pieces[piece].size; start += gen_block_pieces[piece].size)
+            gen_emit("mov%s $0, %d(%%rbp)", gen_block_pieces[piece].suffix, start);
 }
 
 static void gen_assignment_dereference(ast_t *var) {
@@ -389,6 +526,20 @@ static void gen_load_structure(ast_t *structure, data_type_t *field, int offset)
     }
 }
 
+/*
+ * A variable in a register holds the value just like a load from memory
+ * would produce it, extended to the whole register.
+ */
+static void gen_save_register(data_type_t *type, const char *reg) {
+    gen_boolean_maybe(type);
+    switch (type->size) {
+        case 1:  gen_emit("movsbq %%al, %%%s",  reg); break;
+        case 2:  gen_emit("movswq %%ax, %%%s",  reg); break;
+        case 4:  gen_emit("movslq %%eax, %%%s", reg); break;
+        default: gen_emit("mov %%rax, %%%s",    reg); break;
+    }
+}
+
 static void gen_store(ast_t *var) {
     switch (var->type) {
         case AST_TYPE_DEREFERENCE:
@@ -398,6 +549,10 @@ static void gen_store(ast_t *var) {
             gen_assignment_structure(var->structure, var->ctype, 0);
             break;
         case AST_TYPE_VAR_LOCAL:
+            if (var->variable.reg) {
+                gen_save_register(var->ctype, var->variable.reg);
+                break;
+            }
             gen_ensure_lva(var);
             gen_save_local(var->ctype, var->variable.off);
             break;
@@ -409,72 +564,310 @@ static void gen_store(ast_t *var) {
     }
 }
 
-static void gen_comparision(char *operation, ast_t *ast) {
-    if (ast_type_isfloating(ast->left->ctype)) {
-        gen_expression(ast->left);
-        gen_push_xmm(0);
+/*
+ * An integer literal which fits the sign extended 32-bit immediate of
+ * an instruction.
+ */
+static bool gen_immediate(ast_t *ast) {
+    return ast->type == AST_TYPE_LITERAL
+        && ast_type_isinteger(ast->ctype)
+        && ast->integer == (int32_t)ast->integer;
+}
+
+/*
+ * Conditions are what a comparison leaves in the flags. Floating point
+ * equality needs the parity flag too, as ucomis reports an unordered
+ * result (NaN) as equal with parity set. Every condition has an exact
+ * inverse, which is how a branch on false is formed.
+ */
+typedef enum {
+    GEN_CONDITION_E,
+    GEN_CONDITION_NE,
+    GEN_CONDITION_L,
+    GEN_CONDITION_GE,
+    GEN_CONDITION_LE,
+    GEN_CONDITION_G,
+    GEN_CONDITION_B,
+    GEN_CONDITION_AE,
+    GEN_CONDITION_BE,
+    GEN_CONDITION_A,
+    GEN_CONDITION_FE,  /* floating point equal, false when unordered    */
+    GEN_CONDITION_FNE  /* floating point not equal, true when unordered */
+} gen_condition_t;
+
+static const char *gen_condition_table[] = {
+    "e", "ne", "l", "ge", "le", "g", "b", "ae", "be", "a", "e", "ne"
+};
+
+/* conditions are laid out in pairs of inverses */
+static gen_condition_t gen_condition_invert(gen_condition_t condition) {
+    return condition ^ 1;
+}
+
+static bool gen_comparision_operator(int type) {
+    switch (type) {
+        case '<':
+        case '>':
+        case AST_TYPE_EQUAL:
+        case AST_TYPE_NEQUAL:
+        case AST_TYPE_LEQUAL:
+        case AST_TYPE_GEQUAL:
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Operands narrower than int are promoted to int before they're compared,
+ * so only int sized (or larger) unsigned operands and addresses compare
+ * unsigned.
+ */
+static bool gen_comparision_unsigned(data_type_t *type) {
+    if (!ast_type_isinteger(type))
+        return true;
+    return !type->sign && type->size >= 4;
+}
+
+static bool gen_comparision_wide(data_type_t *type) {
+    return !ast_type_isinteger(type) || type->size == 8;
+}
+
+static gen_condition_t gen_comparision_floating(ast_t *ast) {
+    const char *instruction = (ast->left->ctype->type == TYPE_FLOAT) ? "ucomiss" : "ucomisd";
+
+    gen_expression(ast->left);
+    gen_push_xmm(0);
+    gen_expression(ast->right);
+    gen_pop_xmm(1);
+
+    /*
+     * Only the above and below conditions are false for unordered
+     * operands, so less than is a swapped greater than.
+     */
+    switch (ast->type) {
+        case '<':
+        case AST_TYPE_LEQUAL:
+            gen_emit("%s %%xmm1, %%xmm0", instruction);
+            return (ast->type == '<') ? GEN_CONDITION_A : GEN_CONDITION_AE;
+    }
+
+    gen_emit("%s %%xmm0, %%xmm1", instruction);
+    switch (ast->type) {
+        case '>':             return GEN_CONDITION_A;
+        case AST_TYPE_GEQUAL: return GEN_CONDITION_AE;
+        case AST_TYPE_EQUAL:  return GEN_CONDITION_FE;
+        case AST_TYPE_NEQUAL: return GEN_CONDITION_FNE;
+    }
+    compile_ice("gen_comparision_floating");
+}
+
+static gen_condition_t gen_comparision_integer(ast_t *ast) {
+    data_type_t *left  = ast->left->ctype;
+    data_type_t *right = ast->right->ctype;
+    bool         wide  = gen_comparision_wide(left) || gen_comparision_wide(right);
+    bool         sign  = !gen_comparision_unsigned(left) && !gen_comparision_unsigned(right);
+
+    const char  *reg   = gen_register_operand(ast->left, wide);
+
+    if (reg && !gen_immediate(ast->right)) {
         gen_expression(ast->right);
-        gen_pop_xmm(1);
-        if (ast->left->ctype->type == TYPE_FLOAT)
-            gen_emit("ucomiss %%xmm0, %%xmm1");
-        else
-            gen_emit("ucomisd %%xmm0, %%xmm1");
+        gen_emit(wide ? "cmp %%rax, %%%s" : "cmp %%eax, %%%s", reg);
+    } else if ((reg = gen_register_operand(ast->right, wide))) {
+        gen_expression(ast->left);
+        gen_emit(wide ? "cmp %%%s, %%rax" : "cmp %%%s, %%eax", reg);
+    } else if (gen_immediate(ast->right)) {
+        gen_expression(ast->left);
+        gen_emit(wide ? "cmp $%d, %%rax" : "cmp $%d, %%eax", (int)ast->right->integer);
     } else {
         gen_expression(ast->left);
         gen_push(SRAX);
         gen_expression(ast->right);
         gen_pop(SRCX);
+        gen_emit(wide ? "cmp %%rax, %%rcx" : "cmp %%eax, %%ecx");
+    }
 
-        int type = ast->left->ctype->type;
-        if (type == TYPE_LONG || type == TYPE_LLONG)
-            gen_emit("cmp %%rax, %%rcx");
-        else
-            gen_emit("cmp %%eax, %%ecx");
+    switch (ast->type) {
+        case AST_TYPE_EQUAL:  return GEN_CONDITION_E;
+        case AST_TYPE_NEQUAL: return GEN_CONDITION_NE;
+        case '<':             return sign ? GEN_CONDITION_L  : GEN_CONDITION_B;
+        case '>':             return sign ? GEN_CONDITION_G  : GEN_CONDITION_A;
+        case AST_TYPE_LEQUAL: return sign ? GEN_CONDITION_LE : GEN_CONDITION_BE;
+        case AST_TYPE_GEQUAL: return sign ? GEN_CONDITION_GE : GEN_CONDITION_AE;
+    }
+    compile_ice("gen_comparision_integer");
+}
+
+static void gen_condition_zero(data_type_t *type) {
+    if (type->type == TYPE_FLOAT) {
+        gen_emit("xorps %%xmm1, %%xmm1");
+        gen_emit("ucomiss %%xmm1, %%xmm0");
+    } else if (ast_type_isfloating(type)) {
+        gen_emit("xorpd %%xmm1, %%xmm1");
+        gen_emit("ucomisd %%xmm1, %%xmm0");
+    } else {
+        gen_emit("test %%rax, %%rax");
+    }
+}
+
+/*
+ * Evaluate an expression for it's truth value only. The flags are set
+ * and the condition which holds when the expression is true is returned,
+ * comparisons never materialize a value this way.
+ */
+static gen_condition_t gen_condition(ast_t *ast) {
+    if (gen_comparision_operator(ast->type)) {
+        if (ast_type_isfloating(ast->left->ctype))
+            return gen_comparision_floating(ast);
+        return gen_comparision_integer(ast);
+    }
+
+    if (ast->type == '!')
+        return gen_condition_invert(gen_condition(ast->unary.operand));
+
+    /* conversion of a floating point value to bool */
+    if (ast->type == AST_TYPE_CONVERT && ast->ctype->type == TYPE_BOOL
+                                      && ast_type_isfloating(ast->unary.operand->ctype))
+        return gen_condition(ast->unary.operand);
+
+    gen_expression(ast);
+    gen_condition_zero(ast->ctype);
+    return ast_type_isfloating(ast->ctype) ? GEN_CONDITION_FNE : GEN_CONDITION_NE;
+}
+
+static void gen_condition_jump(gen_condition_t condition, const char *label) {
+    switch (condition) {
+        case GEN_CONDITION_FE: {
+            char *unordered = ast_label();
+            gen_emit("jp %s", unordered);
+            gen_emit("je %s", label);
+            gen_label(unordered);
+            break;
+        }
+        case GEN_CONDITION_FNE:
+            gen_emit("jp %s", label);
+            gen_emit("jne %s", label);
+            break;
+        default:
+            gen_emit("j%s %s", gen_condition_table[condition], label);
+            break;
+    }
+}
+
+static void gen_condition_set(gen_condition_t condition) {
+    gen_emit("set%s %%al", gen_condition_table[condition]);
+    if (condition == GEN_CONDITION_FE) {
+        gen_emit("setnp %%cl");
+        gen_emit("and %%cl, %%al");
+    } else if (condition == GEN_CONDITION_FNE) {
+        gen_emit("setp %%cl");
+        gen_emit("or %%cl, %%al");
     }
-    gen_emit("%s %%al", operation);
     gen_emit("movzb %%al, %%eax");
 }
 
+void gen_branch(ast_t *ast, const char *label, bool when) {
+    switch (ast->type) {
+        case AST_TYPE_AND:
+        case AST_TYPE_OR:
+            /*
+             * The left operand alone decides the result when it's false
+             * for && (true for ||), which either is the branch itself or
+             * skips straight past the right operand.
+             */
+            if ((ast->type == AST_TYPE_AND) != when) {
+                gen_branch(ast->left,  label, when);
+                gen_branch(ast->right, label, when);
+            } else {
+                char *skip = ast_label();
+                gen_branch(ast->left,  skip,  !when);
+                gen_branch(ast->right, label, when);
+                gen_label(skip);
+            }
+            return;
+
+        case '!':
+            gen_branch(ast->unary.operand, label, !when);
+            return;
+
+        case ',':
+            gen_expression(ast->left);
+            gen_branch(ast->right, label, when);
+            return;
+
+        case AST_TYPE_LITERAL:
+            if (ast_type_isinteger(ast->ctype)) {
+                if (!!ast->integer == when)
+                    gen_jump(label);
+                return;
+            }
+            break;
+    }
+
+    gen_condition_t condition = gen_condition(ast);
+    gen_condition_jump(when ? condition : gen_condition_invert(condition), label);
+}
+
 static const char *gen_binary_instruction(ast_t *ast) {
-    string_t *string = string_create();
     if (ast_type_isfloating(ast->ctype)) {
+        bool dbl = ast->ctype->type == TYPE_DOUBLE || ast->ctype->type == TYPE_LDOUBLE;
         switch (ast->type) {
-            case '+': string_catf(string, "adds"); break;
-            case '-': string_catf(string, "subs"); break;
-            case '*': string_catf(string, "muls"); break;
-            case '/': string_catf(string, "divs"); break;
+            case '+': return dbl ? "addsd" : "addss";
+            case '-': return dbl ? "subsd" : "subss";
+            case '*': return dbl ? "mulsd" : "mulss";
+            case '/': return dbl ? "divsd" : "divss";
         }
-        if (ast->ctype->type == TYPE_DOUBLE || ast->ctype->type == TYPE_LDOUBLE)
-            string_cat(string, 'd');
-        else
-            string_cat(string, 's');
-        if (!string_length(string))
-            goto error;
-
-        return string_buffer(string);
+        compile_ice("gen_binary_instruction");
     }
     /* integer */
     switch (ast->type) {
-        case '+':              string_catf(string, "add");  break;
-        case '-':              string_catf(string, "sub");  break;
-        case '*':              string_catf(string, "imul"); break;
-        case '^':              string_catf(string, "xor");  break;
-        case AST_TYPE_LSHIFT:  string_catf(string, "sal");  break;
-        case AST_TYPE_RSHIFT:  string_catf(string, "sar");  break;
-        case AST_TYPE_LRSHIFT: string_catf(string, "shr");  break;
+        case '+':              return "add";
+        case '-':              return "sub";
+        case '*':              return "imul";
+        case '^':              return "xor";
+        case AST_TYPE_LSHIFT:  return "sal";
+        case AST_TYPE_RSHIFT:  return "sar";
+        case AST_TYPE_LRSHIFT: return "shr";
 
         /* need to be handled specially */
         case '/': return "@/";
         case '%': return "@%";
     }
-    return string_buffer(string);
-error:
-    compile_ice("gen_binary_instruction");
+    return "";
+}
+
+static const char *gen_register_shift(ast_t *ast) {
+    /* left shifts work on the whole register, like multiplication */
+    if (ast->type == AST_TYPE_LSHIFT)
+        return "rax";
+    return gen_register_integer(ast->left->ctype, 'a');
 }
 
 static void gen_binary_arithmetic_integer(ast_t *ast) {
-    const char *op = gen_binary_instruction(ast);
+    const char *op    = gen_binary_instruction(ast);
+    bool        shift = ast->type == AST_TYPE_LSHIFT
+                     || ast->type == AST_TYPE_RSHIFT
+                     || ast->type == AST_TYPE_LRSHIFT;
+
     gen_expression(ast->left);
+
+    /* a literal right hand side is encoded into the instruction */
+    if (*op && *op != '@' && gen_immediate(ast->right)) {
+        int value = ast->right->integer;
+        if (!shift) {
+            gen_emit("%s $%d, %%rax", op, value);
+            return;
+        }
+        if (value >= 0 && value < 64) {
+            gen_emit("%s $%d, %%%s", op, value, gen_register_shift(ast));
+            return;
+        }
+    }
+
+    if (*op && *op != '@' && !shift && gen_register_operand(ast->right, true)) {
+        gen_emit("%s %%%s, %%rax", op, ast->right->variable.reg);
+        return;
+    }
+
     gen_push(SRAX);
     gen_expression(ast->right);
     gen_emit("mov %%rax, %%rcx");
@@ -485,11 +878,8 @@ static void gen_binary_arithmetic_integer(ast_t *ast) {
         gen_emit("idiv %%rcx");
         if (op[1] == '%')
             gen_emit("mov %%edx, %%eax");
-    } else if (ast->type == AST_TYPE_LSHIFT
-        ||     ast->type == AST_TYPE_RSHIFT
-        ||     ast->type == AST_TYPE_LRSHIFT
-    ) {
-        gen_emit("%s %%cl, %%%s", op, gen_register_integer(ast->left->ctype, 'a'));
+    } else if (shift) {
+        gen_emit("%s %%cl, %%%s", op, gen_register_shift(ast));
     } else {
         gen_emit("%s %%rcx, %%rax", op);
     }
@@ -534,13 +924,9 @@ void gen_binary(ast_t *ast) {
         return;
     }
 
-    switch (ast->type) {
-        case '<':             gen_comparision("setl",  ast); return;
-        case '>':             gen_comparision("setg",  ast); return;
-        case AST_TYPE_EQUAL:  gen_comparision("sete",  ast); return;
-        case AST_TYPE_GEQUAL: gen_comparision("setge", ast); return;
-        case AST_TYPE_LEQUAL: gen_comparision("setle", ast); return;
-        case AST_TYPE_NEQUAL: gen_comparision("setne", ast); return;
+    if (gen_comparision_operator(ast->type)) {
+        gen_condition_set(gen_condition(ast));
+        return;
     }
 
     if (ast_type_isinteger(ast->ctype))
@@ -606,10 +992,10 @@ void gen_postfix(ast_t *ast, const char *op) {
 }
 
 static void gen_register_area_calculate(list_t *args) {
-    gp = 0;
-    fp = 0;
+    gen_context.gp = 0;
+    gen_context.fp = 0;
     for (list_iterator_t *it = list_iterator(args); !list_iterator_end(it); )
-        (*((ast_type_isfloating(((ast_t*)list_iterator_next(it))->ctype)) ? &fp : &gp)) ++;
+        (*((ast_type_isfloating(((ast_t*)list_iterator_next(it))->ctype)) ? &gen_context.fp : &gen_context.gp)) ++;
 }
 
 void gen_je(const char *label) {
@@ -622,12 +1008,212 @@ void gen_cast(ast_t *ast) {
     gen_load_convert(ast->ctype, ast->unary.operand->ctype);
 }
 
+/*
+ * Constant pool, string and floating point literals are interned by value
+ * for the whole translation unit and emitted once into mergeable read only
+ * sections, where the linker merges them with those of other objects.
+ *
+ * Toplevels may be generated on several threads, each one only pools the
+ * constants it uses itself under labels of its own namespace. They're
+ * merged into the pool of the unit in source order afterwards, which puts
+ * the labels of every toplevel using a constant on a single copy of it.
+ */
+typedef struct {
+    const char *key;
+    const char *section;
+    int         align;
+    const char *label;
+    list_t     *labels;
+    char       *data;
+    size_t      length;
+} gen_constant_t;
+
+static table_t *constant_pool      = NULL;
+static list_t  *constant_pool_list = NULL;
+
+static gen_constant_t *gen_constant(string_t *key, const char *section, int align) {
+    gen_constant_t *constant = table_find(gen_context.constants, string_buffer(key));
+    if (constant)
+        return constant;
+
+    memory_arena_t *previous = memory_arena_select(gen_context.persistent);
+    char           *copy     = memory_allocate(string_length(key) + 1);
+
+    memcpy(copy, string_buffer(key), string_length(key) + 1);
+    constant  = memory_allocate(sizeof(gen_constant_t));
+    *constant = (gen_constant_t){
+        .key     = copy,
+        .section = section,
+        .align   = align,
+        .label   = ast_label()
+    };
+    list_push(gen_context.used, constant);
+
+    memory_arena_select(previous);
+
+    table_insert(gen_context.constants, copy, constant);
+    return constant;
+}
+
+/* the data of a constant used for the first time is emitted after a mark */
+static void gen_constant_define(gen_constant_t *constant, size_t mark) {
+    memory_arena_t *previous = memory_arena_select(gen_context.persistent);
+    constant->data = gen_output_cut(mark, &constant->length);
+    memory_arena_select(previous);
+}
+
+list_t *gen_constants_release(void) {
+    list_t *used = gen_context.used;
+    gen_context.used = NULL;
+    return used;
+}
+
+void gen_constants_merge(list_t *constants) {
+    if (!constants)
+        return;
+
+    memory_arena_t *previous = memory_arena_select(NULL);
+
+    if (!constant_pool) {
+        constant_pool      = table_create(NULL);
+        constant_pool_list = list_create();
+    }
+
+    for (list_iterator_t *it = list_iterator(constants); !list_iterator_end(it); ) {
+        gen_constant_t *constant = list_iterator_next(it);
+        gen_constant_t *pooled   = table_find(constant_pool, constant->key);
+
+        if (!pooled) {
+            pooled         = constant;
+            pooled->labels = list_create();
+            table_insert(constant_pool, (char *)pooled->key, pooled);
+            list_push(constant_pool_list, pooled);
+        }
+        list_push(pooled->labels, (char *)constant->label);
+    }
+
+    memory_arena_select(previous);
+}
+
+void gen_constants_emit(void) {
+    if (!constant_pool_list)
+        return;
+
+    for (list_iterator_t *it = list_iterator(constant_pool_list); !list_iterator_end(it); ) {
+        gen_constant_t *constant = list_iterator_next(it);
+
+        gen_emit_inline("%s", constant->section);
+        if (constant->align)
+            gen_emit(".p2align %d", constant->align);
+        for (list_iterator_t *label = list_iterator(constant->labels); !list_iterator_end(label); )
+            gen_label(list_iterator_next(label));
+        gen_output_data(constant->data, constant->length);
+        gen_emit_inline(".previous");
+    }
+}
+
+void gen_context_begin(size_t index, memory_arena_t *persistent) {
+    gen_context = (gen_context_t){
+        .constants       = table_create(NULL),
+        .persistent      = persistent
+    };
+
+    memory_arena_t *previous = memory_arena_select(persistent);
+    gen_context.used = list_create();
+    memory_arena_select(previous);
+
+    ast_label_namespace(index);
+}
+
+void gen_context_end(void) {
+    ast_label_namespace(-1);
+}
+
+static const char *gen_constant_string(char *data) {
+    string_t *key = string_create();
+
+    string_catf(key, "s%s", data);
+    gen_constant_t *constant = gen_constant(key, ".section .rodata.str1.1, \"aMS\", @progbits, 1", 0);
+    if (!constant->data) {
+        size_t mark = gen_output_mark();
+        gen_emit(".string \"%s\"", string_quote(data));
+        gen_constant_define(constant, mark);
+    }
+    return constant->label;
+}
+
+static const char *gen_constant_floating(data_type_t *type, double value) {
+    string_t *key    = string_create();
+    bool      single = type->type == TYPE_FLOAT;
+    float     narrow = value;
+    uint32_t  load32;
+    uint64_t  load64;
+
+    memcpy(&load32, &narrow, sizeof(load32));
+    memcpy(&load64, &value,  sizeof(load64));
+
+    if (single)
+        string_catf(key, "f%" PRIx32, load32);
+    else
+        string_catf(key, "d%" PRIx64, load64);
+
+    gen_constant_t *constant = single
+        ? gen_constant(key, ".section .rodata.cst4, \"aM\", @progbits, 4", 2)
+        : gen_constant(key, ".section .rodata.cst8, \"aM\", @progbits, 8", 3);
+
+    if (!constant->data) {
+        size_t mark = gen_output_mark();
+        if (single)
+            gen_emit(".long 0x%" PRIx32, load32);
+        else
+            gen_emit(".quad 0x%" PRIx64, load64);
+        gen_constant_define(constant, mark);
+    }
+    return constant->label;
+}
+
+/* the sign bit of every lane, aligned for use as a packed operand */
+static const char *gen_constant_sign(data_type_t *type) {
+    string_t *key    = string_create();
+    bool      single = type->type == TYPE_FLOAT;
+
+    string_catf(key, single ? "mf" : "md");
+    gen_constant_t *constant = gen_constant(key, ".section .rodata.cst16, \"aM\", @progbits, 16", 4);
+    if (!constant->data) {
+        size_t mark = gen_output_mark();
+        if (single)
+            gen_emit(".long 0x80000000, 0x80000000, 0x80000000, 0x80000000");
+        else
+            gen_emit(".quad 0x8000000000000000, 0x8000000000000000");
+        gen_constant_define(constant, mark);
+    }
+    return constant->label;
+}
+
+static void gen_literal_floating(ast_t *ast) {
+    bool     single = ast->ctype->type == TYPE_FLOAT;
+    double   value  = ast->floating.value;
+    uint64_t bits;
+
+    /* positive zero is all bits clear, no need to load it */
+    memcpy(&bits, &value, sizeof(bits));
+    if (!bits) {
+        gen_emit(single ? "xorps %%xmm0, %%xmm0" : "xorpd %%xmm0, %%xmm0");
+        return;
+    }
+
+    if (!ast->floating.label)
+        ast->floating.label = (char *)gen_constant_floating(ast->ctype, value);
+    gen_emit(single ? "movss %s(%%rip), %%xmm0" : "movsd %s(%%rip), %%xmm0", ast->floating.label);
+}
+
 void gen_literal(ast_t *ast) {
     switch (ast->ctype->type) {
         case TYPE_CHAR:
         case TYPE_BOOL:
             gen_emit("mov $%d, %%rax", ast->integer);
             break;
+        case TYPE_SHORT:
         case TYPE_INT:
             gen_emit("mov $%d, %%rax", ast->integer);
             break;
@@ -637,31 +1223,9 @@ void gen_literal(ast_t *ast) {
             break;
 
         case TYPE_FLOAT:
-            if (!ast->floating.label) {
-                ast->floating.label = ast_label();
-                float  fval = ast->floating.value;
-                int   *iptr = (int*)&fval;
-                gen_emit_inline(".data");
-                gen_label(ast->floating.label);
-                gen_emit(".long %d", *iptr);
-                gen_emit_inline(".text");
-            }
-            gen_emit("movss %s(%%rip), %%xmm0", ast->floating.label);
-            break;
-
         case TYPE_DOUBLE:
         case TYPE_LDOUBLE:
-            if (!ast->floating.label) {
-                ast->floating.label = ast_label();
-                double dval = ast->floating.value;
-                int   *iptr = (int*)&dval;
-                gen_emit_inline(".data");
-                gen_label(ast->floating.label);
-                gen_emit(".long %d", iptr[0]);
-                gen_emit(".long %d", iptr[1]);
-                gen_emit_inline(".text");
-            }
-            gen_emit("movsd %s(%%rip), %%xmm0", ast->floating.label);
+            gen_literal_floating(ast);
             break;
 
         default:
@@ -670,17 +1234,16 @@ void gen_literal(ast_t *ast) {
 }
 
 void gen_literal_string(ast_t *ast) {
-    if (!ast->string.label) {
-        ast->string.label = ast_label();
-        gen_emit_inline(".data");
-        gen_label(ast->string.label);
-        gen_emit(".string \"%s\"", string_quote(ast->string.data));
-        gen_emit_inline(".text");
-    }
+    if (!ast->string.label)
+        ast->string.label = (char *)gen_constant_string(ast->string.data);
     gen_emit("lea %s(%%rip), %%rax", ast->string.label);
 }
 
 void gen_variable_local(ast_t *ast) {
+    if (ast->variable.reg) {
+        gen_emit("mov %%%s, %%rax", ast->variable.reg);
+        return;
+    }
     gen_ensure_lva(ast);
     gen_load_local(ast->ctype, "rbp", ast->variable.off);
 }
@@ -759,39 +1322,128 @@ static int gen_function_args(list_t *args) {
     return rest;
 }
 
-static void gen_function_call_default(ast_t *ast) {
-    int          save = stack;
-    bool         fptr = (ast->type == AST_TYPE_POINTERCALL);
-    data_type_t *type = fptr ? ast->function.call.functionpointer->ctype->pointer
-                             : ast->function.call.type;
-
-    gen_emit("# function call {");
-
-    /* deal with arguments */
-    list_t *in = list_create();
-    list_t *fl = list_create();
-    list_t *re = list_create();
-
-    gen_function_args_classify(in, fl, re, ast->function.call.args);
-    gen_function_args_save(list_length(in), list_length(fl));
-
-    bool algn = stack % 16;
-    if (algn) {
-        gen_emit("sub $8, %%rsp");
-        stack += 8;
+/*
+ * Call lowering used when optimizing. Values never live in argument
+ * registers across the evaluation of an expression, so there is nothing
+ * to save around a call. Arguments containing anything but a leaf are
+ * evaluated into temporaries first, since any call among them clobbers
+ * the argument registers. Leaves only touch %rax or %xmm0 and are moved
+ * straight into their register afterwards, the first floating point one
+ * last as it's evaluated in place. The temporaries are popped into their
+ * registers at the end.
+ */
+static bool gen_function_args_leaf(ast_t *ast) {
+    switch (ast->type) {
+        case AST_TYPE_LITERAL:
+        case AST_TYPE_STRING:
+        case AST_TYPE_VAR_GLOBAL:
+            return true;
+        case AST_TYPE_VAR_LOCAL:
+            return !ast->variable.init;
+        case AST_TYPE_ADDRESS:
+            return ast->unary.operand->type == AST_TYPE_VAR_GLOBAL
+                || (ast->unary.operand->type == AST_TYPE_VAR_LOCAL && !ast->unary.operand->variable.init);
     }
+    return false;
+}
 
-    int rest = gen_function_args(list_reverse(re));
-
-    if (fptr) {
-        gen_expression(ast->function.call.functionpointer);
-        gen_push(SRAX);
-    }
+static void gen_function_args_registers(list_t *in, list_t *fl) {
+    bool  ileaf[REGISTER_MULT_SIZE];
+    bool  fleaf[REGISTER_MULT_SIZE_XMM];
+    int   ic = 0;
+    int   fc = 0;
+    list_iterator_t *it;
 
-    gen_function_args(in);
-    gen_function_args(fl);
-    gen_function_args_popf(list_length(fl));
-    gen_function_args_popi(list_length(in));
+    gen_emit("# function arguments {");
+
+    for (it = list_iterator(in); !list_iterator_end(it); ic++) {
+        ast_t *value = list_iterator_next(it);
+        if (!(ileaf[ic] = gen_function_args_leaf(value))) {
+            gen_expression(value);
+            gen_push(SRAX);
+        }
+    }
+    for (it = list_iterator(fl); !list_iterator_end(it); fc++) {
+        ast_t *value = list_iterator_next(it);
+        if (!(fleaf[fc] = gen_function_args_leaf(value))) {
+            gen_expression(value);
+            gen_push_xmm(0);
+        }
+    }
+
+    ic = 0;
+    for (it = list_iterator(in); !list_iterator_end(it); ic++) {
+        ast_t *value = list_iterator_next(it);
+        if (!ileaf[ic])
+            continue;
+        if (gen_register_operand(value, true)) {
+            gen_emit("mov %%%s, %%%s", value->variable.reg, NREG(ic));
+        } else if (gen_immediate(value)) {
+            gen_emit("mov $%d, %%%s", (int)value->integer, NREG(ic));
+        } else {
+            gen_expression(value);
+            gen_emit("mov %%rax, %%%s", NREG(ic));
+        }
+    }
+    fc = 0;
+    for (it = list_iterator(fl); !list_iterator_end(it); fc++) {
+        ast_t *value = list_iterator_next(it);
+        if (fc && fleaf[fc]) {
+            gen_expression(value);
+            gen_emit("movaps %%xmm0, %%xmm%d", fc);
+        }
+    }
+    if (fc && fleaf[0])
+        gen_expression(list_head(fl));
+
+    while (fc--)
+        if (!fleaf[fc])
+            gen_pop_xmm(fc);
+    while (ic--)
+        if (!ileaf[ic])
+            gen_pop(NREG(ic));
+
+    gen_emit("# }");
+}
+
+static void gen_function_call_default(ast_t *ast) {
+    int          save = gen_context.stack;
+    bool         fptr = (ast->type == AST_TYPE_POINTERCALL);
+    data_type_t *type = fptr ? ast->function.call.functionpointer->ctype->pointer
+                             : ast->function.call.type;
+
+    gen_emit("# function call {");
+
+    /* deal with arguments */
+    list_t *in = list_create();
+    list_t *fl = list_create();
+    list_t *re = list_create();
+
+    gen_function_args_classify(in, fl, re, ast->function.call.args);
+    if (!opt_level())
+        gen_function_args_save(list_length(in), list_length(fl));
+
+    bool algn = gen_context.stack % 16;
+    if (algn) {
+        gen_emit("sub $8, %%rsp");
+        gen_context.stack += 8;
+    }
+
+    int rest = gen_function_args(list_reverse(re));
+
+    if (fptr) {
+        gen_expression(ast->function.call.functionpointer);
+        gen_push(SRAX);
+    }
+
+    if (opt_level()) {
+        gen_function_args_registers(in, fl);
+    } else {
+        gen_function_args(in);
+        gen_function_args(fl);
+        gen_function_args_popf(list_length(fl));
+        gen_function_args_popi(list_length(in));
+    }
 
     if (fptr)
         gen_pop(SR11);
@@ -808,19 +1460,20 @@ static void gen_function_call_default(ast_t *ast) {
 
     if (rest > 0) {
         gen_emit("add $%d, %%rsp", rest);
-        stack -= rest;
+        gen_context.stack -= rest;
     }
 
     if (algn) {
         gen_emit("add $8, %%rsp");
-        stack -= 8;
+        gen_context.stack -= 8;
     }
 
-    gen_function_args_restore(list_length(in), list_length(fl));
+    if (!opt_level())
+        gen_function_args_restore(list_length(in), list_length(fl));
 
     gen_emit("# }");
 
-    if (stack != save)
+    if (gen_context.stack != save)
         compile_ice("gen_function_call (stack out of alignment)");
 }
 
@@ -854,27 +1507,145 @@ void gen_function_call(ast_t *ast) {
     gen_pop(SR11);
 }
 
-void gen_case(ast_t *ast) {
-    char *skip;
-    gen_jump((skip = ast_label()));
-    gen_label(gen_label_switch);
-    gen_label_switch = ast_label();
-    gen_emit("cmp $%d, %%eax", ast->casebeg);
-    if (ast->casebeg == ast->caseend)
-        gen_emit("jne %s", gen_label_switch);
-    else {
-        gen_emit("jl %s", gen_label_switch);
-        gen_emit("cmp $%d, %%eax", ast->caseend);
-        gen_emit("jg %s", gen_label_switch);
+/*
+ * Switch dispatch, the value is in eax (rax for 64-bit switches) and the
+ * cases arrive sorted. Runs of cases which are dense enough become jump
+ * tables, anything else is found through a balanced tree of comparisons
+ * over those runs.
+ */
+#define GEN_SWITCH_TABLE_CASES   4 /* fewest cases worth a table     */
+#define GEN_SWITCH_TABLE_DENSITY 4 /* most table entries per case    */
+#define GEN_SWITCH_LINEAR        3 /* fewest runs worth a comparison */
+
+typedef struct {
+    ast_t **cases;
+    int     count;
+    bool    table;
+} gen_switch_run_t;
+
+static long gen_switch_span(ast_t **cases, int count) {
+    return (long)((unsigned long)cases[count - 1]->caseend - cases[0]->casebeg + 1);
+}
+
+/* an operation with an immediate, which has to go through rdx if it doesn't fit in 32 bits */
+static void gen_switch_immediate(const char *op, long value, const char *reg, bool wide) {
+    if (!wide) {
+        gen_emit("%s $%d, %%e%s", op, (int)value, reg);
+    } else if (value == (int)value) {
+        gen_emit("%s $%ld, %%r%s", op, value, reg);
+    } else {
+        gen_emit("movabs $%ld, %%rdx", value);
+        gen_emit("%s %%rdx, %%r%s", op, reg);
+    }
+}
+
+static void gen_switch_table(gen_switch_run_t *run, const char *fallback, const char *miss, bool wide) {
+    char *table = ast_label();
+    long  span  = gen_switch_span(run->cases, run->count);
+
+    gen_emit(wide ? "mov %%rax, %%rcx" : "mov %%eax, %%ecx");
+    if (run->cases[0]->casebeg)
+        gen_switch_immediate("sub", run->cases[0]->casebeg, "cx", wide);
+    gen_switch_immediate("cmp", span - 1, "cx", wide);
+    gen_emit("ja %s", miss);
+    gen_emit("lea %s(%%rip), %%rdx", table);
+    gen_emit("movslq (%%rdx,%%rcx,4), %%rcx");
+    gen_emit("add %%rdx, %%rcx");
+    gen_emit("jmp *%%rcx");
+
+    /* offsets from the table keep it position independent */
+    gen_emit_inline(".section .rodata");
+    gen_emit(".p2align 2");
+    gen_label(table);
+    for (int i = 0; i < run->count; i++) {
+        ast_t *node = run->cases[i];
+        long   from = (i == 0) ? node->casebeg : run->cases[i - 1]->caseend + 1;
+        for (long value = from; value < node->casebeg; value++)
+            gen_emit(".long %s - %s", fallback, table);
+        for (long value = node->casebeg; value <= node->caseend; value++)
+            gen_emit(".long %s - %s", node->caselabel, table);
+    }
+    gen_emit_inline(".text");
+}
+
+static void gen_switch_run(gen_switch_run_t *run, const char *fallback, bool wide) {
+    if (run->table) {
+        char *miss = ast_label();
+        gen_switch_table(run, fallback, miss, wide);
+        gen_label(miss);
+        return;
+    }
+
+    ast_t *node = run->cases[0];
+    if (node->casebeg == node->caseend) {
+        gen_switch_immediate("cmp", node->casebeg, "ax", wide);
+        gen_emit("je %s", node->caselabel);
+    } else {
+        gen_emit(wide ? "mov %%rax, %%rcx" : "mov %%eax, %%ecx");
+        gen_switch_immediate("sub", node->casebeg, "cx", wide);
+        gen_switch_immediate("cmp", (long)((unsigned long)node->caseend - node->casebeg), "cx", wide);
+        gen_emit("jbe %s", node->caselabel);
+    }
+}
+
+static void gen_switch_tree(gen_switch_run_t *runs, int count, const char *fallback, bool wide) {
+    if (!count) {
+        gen_jump(fallback);
+        return;
+    }
+
+    if (count <= GEN_SWITCH_LINEAR) {
+        for (int i = 0; i < count - 1; i++)
+            gen_switch_run(&runs[i], fallback, wide);
+
+        /* a table last misses straight to the fallback */
+        if (runs[count - 1].table) {
+            gen_switch_table(&runs[count - 1], fallback, fallback, wide);
+            return;
+        }
+        gen_switch_run(&runs[count - 1], fallback, wide);
+        gen_jump(fallback);
+        return;
+    }
+
+    int   half  = count / 2;
+    char *upper = ast_label();
+    gen_switch_immediate("cmp", runs[half].cases[0]->casebeg, "ax", wide);
+    gen_emit("jge %s", upper);
+    gen_switch_tree(runs, half, fallback, wide);
+    gen_label(upper);
+    gen_switch_tree(runs + half, count - half, fallback, wide);
+}
+
+void gen_switch(ast_t **cases, int count, const char *fallback, bool wide) {
+    gen_switch_run_t *runs   = memory_allocate(sizeof(gen_switch_run_t) * (count + 1));
+    int               length = 0;
+
+    /* the longest run from each case on which is dense enough for a table */
+    for (int i = 0; i < count; ) {
+        int take = 1;
+        for (int j = GEN_SWITCH_TABLE_CASES; i + j <= count; j++) {
+            long span = gen_switch_span(cases + i, j);
+            if (span > 0 && span <= (long)GEN_SWITCH_TABLE_DENSITY * j)
+                take = j;
+        }
+
+        runs[length++] = (gen_switch_run_t) {
+            .cases = cases + i,
+            .count = take,
+            .table = take >= GEN_SWITCH_TABLE_CASES
+        };
+        i += take;
     }
-    gen_label(skip);
+
+    gen_switch_tree(runs, length, fallback, wide);
 }
 
 void gen_va_start(ast_t *ast) {
     gen_expression(ast->ap);
     gen_push(SRCX);
-    gen_emit("movl $%d, (%%rax)", gp * 8);
-    gen_emit("movl $%d, 4(%%rax)", 48 + fp * 16);
+    gen_emit("movl $%d, (%%rax)", gen_context.gp * 8);
+    gen_emit("movl $%d, 4(%%rax)", 48 + gen_context.fp * 16);
     gen_emit("lea %d(%%rbp), %%rcx", -REGISTER_AREA_SIZE);
     gen_emit("mov %%rcx, 16(%%rax)");
     gen_pop(SRCX);
@@ -906,38 +1677,27 @@ void gen_va_arg(ast_t *ast) {
 }
 
 void gen_not(ast_t *ast) {
-    gen_expression(ast->unary.operand);
-    gen_emit("cmp $0, %%rax");
-    gen_emit("sete %%al");
-    gen_emit("movzb %%al, %%eax");
+    gen_condition_set(gen_condition(ast));
 }
 
-void gen_and(ast_t *ast) {
+/* the value of && and || is formed by branching on them */
+static void gen_logical(ast_t *ast) {
+    char *no  = ast_label();
     char *end = ast_label();
-    gen_expression(ast->left);
-    gen_emit("test %%rax, %%rax");
-    gen_emit("mov $0, %%rax");
-    gen_emit("je %s", end);
-    gen_expression(ast->right);
-    gen_emit("test %%rax, %%rax");
-    gen_emit("mov $0, %%rax");
-    gen_emit("je %s", end);
-    gen_emit("mov $1, %%rax");
+    gen_branch(ast, no, false);
+    gen_emit("mov $1, %%eax");
+    gen_jump(end);
+    gen_label(no);
+    gen_emit("xor %%eax, %%eax");
     gen_label(end);
 }
 
+void gen_and(ast_t *ast) {
+    gen_logical(ast);
+}
+
 void gen_or(ast_t *ast) {
-    char *end = ast_label();
-    gen_expression(ast->left);
-    gen_emit("test %%rax, %%rax");
-    gen_emit("mov $1, %%rax");
-    gen_emit("jne %s", end);
-    gen_expression(ast->right);
-    gen_emit("test %%rax, %%rax");
-    gen_emit("mov $1, %%rax");
-    gen_emit("jne %s", end);
-    gen_emit("mov $0, %%rax");
-    gen_label(end);
+    gen_logical(ast);
 }
 
 void gen_struct(ast_t *ast) {
@@ -947,6 +1707,10 @@ void gen_struct(ast_t *ast) {
 void gen_bitandor(ast_t *ast) {
     static const char *instruction[] = { "and", "or" };
     gen_expression(ast->left);
+    if (gen_immediate(ast->right)) {
+        gen_emit("%s $%d, %%rax", instruction[!!(ast->type == '|')], (int)ast->right->integer);
+        return;
+    }
     gen_push(SRAX);
     gen_expression(ast->right);
     gen_pop(SRCX);
@@ -961,13 +1725,12 @@ void gen_bitnot(ast_t *ast) {
 void gen_negate(ast_t *ast) {
     gen_expression(ast->unary.operand);
     if (ast_type_isfloating(ast->ctype)) {
-        gen_push_xmm(1);
-        gen_emit("xorpd %%xmm1, %%xmm1");
-        if (ast->ctype->type == TYPE_DOUBLE)
-            gen_emit("subsd %%xmm1, %%xmm0");
+        /* flipping the sign bit negates zero too, unlike subtracting */
+        const char *label = gen_constant_sign(ast->ctype);
+        if (ast->ctype->type == TYPE_FLOAT)
+            gen_emit("xorps %s(%%rip), %%xmm0", label);
         else
-            gen_emit("subss %%xmm1, %%xmm0");
-        gen_pop_xmm(1);
+            gen_emit("xorpd %s(%%rip), %%xmm0", label);
         return;
     }
     gen_emit("neg %%rax");
@@ -975,7 +1738,9 @@ void gen_negate(ast_t *ast) {
 
 void gen_assign(ast_t *ast) {
     if (ast->left->ctype->type == TYPE_STRUCTURE) {
-        if (ast->left->ctype->size > 8) {
+        /* only 1, 2, 4 and 8 byte structures fit a single register move */
+        int size = ast->left->ctype->size;
+        if (size > 8 || (size & (size - 1))) {
             gen_structure_assign(ast->left, ast->right);
             return;
         }
@@ -987,9 +1752,8 @@ void gen_assign(ast_t *ast) {
 
 int parse_evaluate(ast_t *ast);
 static void gen_data_zero(int size) {
-    for (; size >= 8; size -= 8) gen_emit(".quad 0");
-    for (; size >= 4; size -= 4) gen_emit(".long 0");
-    for (; size >  0; size --)   gen_emit(".byte 0");
+    if (size > 0)
+        gen_emit(".zero %d", size);
 }
 
 static void gen_data_padding(ast_t *ast, int offset) {
@@ -999,9 +1763,90 @@ static void gen_data_padding(ast_t *ast, int offset) {
     gen_data_zero(d);
 }
 
+/* the value of a floating point constant, conversions of literals included */
+static double gen_data_floating(ast_t *ast) {
+    while (ast->type == AST_TYPE_CONVERT)
+        ast = ast->unary.operand;
+    if (ast->type != AST_TYPE_LITERAL)
+        compile_error("initializer element is not constant");
+    if (ast_type_isfloating(ast->ctype))
+        return ast->floating.value;
+    return ast->ctype->sign ? (double)ast->integer : (double)(unsigned long)ast->integer;
+}
+
+/* the bytes of a constant initializer, little endian like the target */
+static void gen_literal_bytes(ast_t *node, unsigned char *bytes) {
+    data_type_t *type  = node->init.type;
+    ast_t       *value = node->init.value;
+    uint64_t     load64;
+    uint32_t     load32;
+
+    if (ast_type_isfloating(type)) {
+        double wide   = gen_data_floating(value);
+        float  narrow = wide;
+        memcpy(&load32, &narrow, sizeof(load32));
+        memcpy(&load64, &wide,   sizeof(load64));
+        if (type->type == TYPE_FLOAT)
+            load64 = load32;
+    } else {
+        while (value->type == AST_TYPE_CONVERT)
+            value = value->unary.operand;
+        load64 = ast_type_isfloating(value->ctype) ? (uint64_t)(long)value->floating.value : (uint64_t)value->integer;
+        if (type->type == TYPE_BOOL)
+            load64 = !!load64;
+    }
+
+    for (int i = 0; i < type->size; i++)
+        bytes[i] = load64 >> (i * 8);
+}
+
+/*
+ * Initialize a run of constants in the frame by copying a template of
+ * them, holes included, out of read only data. Equal templates are
+ * shared through the constant pool.
+ */
+void gen_literal_block(ast_t **inits, size_t count, int offset) {
+    int start = inits[0]->init.offset;
+    int end   = start;
+
+    for (size_t i = 0; i < count; i++)
+        end = MAX(end, inits[i]->init.offset + inits[i]->init.type->size);
+
+    int            size  = end - start;
+    unsigned char *bytes = memory_allocate(size);
+    string_t      *key   = string_create();
+
+    memset(bytes, 0, size);
+    for (size_t i = 0; i < count; i++)
+        gen_literal_bytes(inits[i], bytes + inits[i]->init.offset - start);
+
+    string_catf(key, "t");
+    for (int i = 0; i < size; i++)
+        string_catf(key, "%02x", bytes[i]);
+
+    gen_constant_t *constant = gen_constant(key, ".section .rodata", 4);
+    if (!constant->data) {
+        size_t mark = gen_output_mark();
+        for (int i = 0; i < size; i += 16) {
+            string_t *line = string_create();
+            for (int j = i; j < size && j < i + 16; j++)
+                string_catf(line, (j == i) ? "%d" : ", %d", bytes[j]);
+            gen_emit(".byte %s", string_buffer(line));
+        }
+        gen_constant_define(constant, mark);
+    }
+
+    gen_push(SRCX);
+    gen_push(SR11);
+    gen_emit("lea %s(%%rip), %%rcx", constant->label);
+    gen_structure_copy(size, "rbp", offset + start);
+    gen_pop(SR11);
+    gen_pop(SRCX);
+}
+
 static void gen_data_intermediate(list_t *inits, int size, int offset, int depth) {
-    uint64_t load64;
-    uint32_t load32;
+    uint64_t load64 = 0;
+    uint32_t load32 = 0;
 
     list_iterator_t *it = list_iterator(inits);
     while (!list_iterator_end(it) && 0 < size) {
@@ -1039,19 +1884,18 @@ static void gen_data_intermediate(list_t *inits, int size, int offset, int depth
         }
 
         if (v->ctype->type == TYPE_ARRAY && v->ctype->pointer->type == TYPE_CHAR) {
-            char *label = ast_label();
-            gen_emit(".data %d", depth + 1);
-            gen_label(label);
-            gen_emit(".string \"%s\"", string_quote(v->string.data));
-            gen_emit(".data %d", depth);
-            gen_emit(".quad %s", label);
+            gen_emit(".quad %s", gen_constant_string(v->string.data));
             continue;
         }
 
 
-        /* load alias */
-        load32 = TYPEPUN(uint32_t, node->init.value->floating.value);
-        load64 = TYPEPUN(uint64_t, node->init.value->floating.value);
+        /* load alias, floats are narrowed before taking their bits */
+        if (ast_type_isfloating(node->init.type)) {
+            double wide   = gen_data_floating(node->init.value);
+            float  narrow = wide;
+            memcpy(&load32, &narrow, sizeof(load32));
+            memcpy(&load64, &wide,   sizeof(load64));
+        }
 
         switch (node->init.type->type) {
             case TYPE_FLOAT:   gen_emit(".long 0x%"  PRIx32, load32); break;
@@ -1077,7 +1921,6 @@ static void gen_data_intermediate(list_t *inits, int size, int offset, int depth
 }
 
 void gen_data(ast_t *ast, int offset, int depth) {
-    gen_emit(".data %d", depth);
     if (!ast->decl.var->ctype->isstatic)
         gen_emit_inline(".global %s", ast->decl.var->variable.name);
     gen_emit_inline("%s:", ast->decl.var->variable.name);
@@ -1132,12 +1975,12 @@ static void gen_function_parameters(list_t *parameters, int offset) {
                     gen_emit("mov %d(%%rbp), %%al", ar++ * 8);
                     gen_emit("movzb %%al, %%eax");
                 } else {
-                    gen_emit("mov %d(%%rbp), %%al", ar++ * 8);
+                    gen_emit("mov %d(%%rbp), %%rax", ar++ * 8);
                 }
                 gen_push(SRAX);
             } else {
                 if (value->ctype->type == TYPE_BOOL)
-                    gen_emit("movsb %%%s, %%%s", SREG(ir), MREG(ir));
+                    gen_emit("movzb %%%s, %%%s", MREG(ir), SREG(ir));
                 gen_push(NREG(ir++));
             }
             offset -= 8;
@@ -1147,6 +1990,36 @@ static void gen_function_parameters(list_t *parameters, int offset) {
     gen_emit("# }");
 }
 
+/*
+ * Scalar locals and parameters which never have their address taken are
+ * kept in registers, the most used ones first. Parameters still arrive
+ * in their stack slots and are loaded from there once the registers have
+ * been saved.
+ */
+static void gen_function_promote(ast_t *ast) {
+    list_t *variables = gen_promotable(ast);
+    int     index     = 0;
+
+    gen_context.variables = MIN(list_length(variables), VARIABLE_SIZE);
+    for (list_iterator_t *it = list_iterator(variables); !list_iterator_end(it) && index < gen_context.variables; ) {
+        ast_t *variable = list_iterator_next(it);
+        variable->variable.reg = variable_table[index++];
+    }
+
+    /* keep an even count so the alignment of calls isn't disturbed */
+    int save = (gen_context.variables + 1) & ~1;
+    if (save)
+        gen_emit("sub $%d, %%rsp", save * 8);
+    for (int i = 0; i < gen_context.variables; i++)
+        gen_emit("mov %%%s, %d(%%rbp)", variable_table[i], gen_context.frame - (i + 1) * 8);
+
+    for (list_iterator_t *it = list_iterator(ast->function.params); !list_iterator_end(it); ) {
+        ast_t *parameter = list_iterator_next(it);
+        if (parameter->variable.reg)
+            gen_emit("%s %d(%%rbp), %%%s", gen_load_instruction(parameter->ctype), parameter->variable.off, parameter->variable.reg);
+    }
+}
+
 void gen_function_prologue(ast_t *ast) {
     gen_emit("# function prologue {");
     gen_emit_inline(".text");
@@ -1179,23 +2052,1519 @@ void gen_function_prologue(ast_t *ast) {
 
     if (localdata) {
         gen_emit("sub $%d, %%rsp", localdata);
-        stack += localdata;
+        gen_context.stack += localdata;
     }
     gen_emit("# }");
+
+    /* every return goes through the single epilogue restoring registers */
+    if (opt_level()) {
+        gen_context.label_return = ast_label();
+        gen_context.frame        = offset;
+        gen_function_promote(ast);
+    }
 }
 
 void gen_function_epilogue(void) {
-    if (stack != 0)
-        gen_emit("# stack misalignment: %d\n", stack);
-    gen_return();
+    if (gen_context.stack != 0)
+        gen_emit("# stack misalignment: %d\n", gen_context.stack);
+
+    if (!opt_level()) {
+        gen_return();
+        return;
+    }
+
+    gen_label(gen_context.label_return);
+    for (int i = 0; i < gen_context.variables; i++)
+        gen_emit("mov %d(%%rbp), %%%s", gen_context.frame - (i + 1) * 8, variable_table[i]);
+    gen_emit("leave");
+    gen_emit("ret");
 }
 
 void gen_return(void) {
+    if (opt_level()) {
+        gen_jump(gen_context.label_return);
+        return;
+    }
     gen_emit("leave");
     gen_emit("ret");
 }
 
 void gen_function(ast_t *ast) {
     (void)ast;
-    stack = 8;
+    gen_context.stack     = 8;
+    gen_context.variables = 0;
+}
+
+/*
+ * Code generation from the IR, which is what functions go through when
+ * optimizing. Values are given registers by a linear scan over their live
+ * intervals, integers take %rsi, %rdi, %r8 to %r10 and the callee-saved
+ * %rbx and %r12 to %r15 while floating point values take %xmm2 to %xmm14.
+ * Only callee-saved registers survive a call, so values live across one
+ * either get one of those or a home in the frame, as does anything once
+ * the registers run out. Constants and the addresses of slots and symbols
+ * are formed right where they're used, and a comparison only feeding the
+ * branch after it just sets the flags. %rax, %rcx, %rdx, %r11, %xmm0,
+ * %xmm1 and %xmm15 are left as scratch.
+ *
+ * Functions the IR doesn't express faithfully, those with variable
+ * arguments or structures passed by value, are left to the code generator
+ * above.
+ */
+enum {
+    GEN_IR_RAX, GEN_IR_RCX, GEN_IR_RDX, GEN_IR_RBX,
+    GEN_IR_RSP, GEN_IR_RBP, GEN_IR_RSI, GEN_IR_RDI,
+    GEN_IR_R8,  GEN_IR_R9,  GEN_IR_R10, GEN_IR_R11,
+    GEN_IR_R12, GEN_IR_R13, GEN_IR_R14, GEN_IR_R15
+};
+
+static const char *gen_ir_register_table[][16] = {
+    { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8",  "r9",  "r10",  "r11",  "r12",  "r13",  "r14",  "r15"  },
+    { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" },
+    { "ax",  "cx",  "dx",  "bx",  "sp",  "bp",  "si",  "di",  "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" },
+    { "al",  "cl",  "dl",  "bl",  "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" }
+};
+
+static const int gen_ir_arguments[REGISTER_MULT_SIZE] = {
+    GEN_IR_RDI, GEN_IR_RSI, GEN_IR_RDX, GEN_IR_RCX, GEN_IR_R8, GEN_IR_R9
+};
+
+/* in order of preference, the caller-saved ones cost nothing to use */
+static const int gen_ir_allocatable[] = {
+    GEN_IR_RSI, GEN_IR_RDI, GEN_IR_R8,  GEN_IR_R9,  GEN_IR_R10,
+    GEN_IR_RBX, GEN_IR_R12, GEN_IR_R13, GEN_IR_R14, GEN_IR_R15
+};
+
+#define GEN_IR_ALLOCATABLE (int)(sizeof(gen_ir_allocatable) / sizeof(*gen_ir_allocatable))
+#define GEN_IR_XMM_FIRST   2
+#define GEN_IR_XMM_LAST    14
+#define GEN_IR_XMM_SCRATCH 15
+
+typedef struct {
+    ir_function_t *function;
+    char         **labels;    /* label of each block, NULL if nothing jumps to it  */
+    int           *homes;     /* frame offset of each value, zero if it has none   */
+    int           *registers; /* register of each value, -1 if it has none         */
+    int           *uses;
+    bool          *fused;     /* comparisons generated by the branch using them    */
+    int            saves[16]; /* where callee-saved registers used are kept, or 0  */
+    list_t        *stubs;     /* copies for phis on edges which are jumped through */
+    char          *exit;
+    bool           main;
+} gen_ir_t;
+
+/* memory, either relative to a symbol or to a base register */
+typedef struct {
+    const char *symbol;
+    int         base;
+    long        offset;
+} gen_ir_address_t;
+
+static const char *gen_ir_register(int reg, int size) {
+    switch (size) {
+        case 1:  return gen_ir_register_table[3][reg];
+        case 2:  return gen_ir_register_table[2][reg];
+        case 4:  return gen_ir_register_table[1][reg];
+    }
+    return gen_ir_register_table[0][reg];
+}
+
+/* integers narrower than int are operated on as int */
+static int gen_ir_width(ir_type_t type) {
+    return ir_type_size(type) == 8 ? 8 : 4;
+}
+
+static const char *gen_ir_format(const char *fmt, ...) {
+    va_list va;
+
+    va_start(va, fmt);
+    int length = vsnprintf(NULL, 0, fmt, va);
+    va_end(va);
+
+    char *buffer = memory_allocate(length + 1);
+    va_start(va, fmt);
+    vsnprintf(buffer, length + 1, fmt, va);
+    va_end(va);
+    return buffer;
+}
+
+static const char *gen_ir_address_string(gen_ir_address_t address, long offset) {
+    offset += address.offset;
+    if (address.symbol)
+        return offset ? gen_ir_format("%s+%ld(%%rip)", address.symbol, offset)
+                      : gen_ir_format("%s(%%rip)", address.symbol);
+    return offset ? gen_ir_format("%ld(%%%s)", offset, gen_ir_register(address.base, 8))
+                  : gen_ir_format("(%%%s)", gen_ir_register(address.base, 8));
+}
+
+static bool gen_ir_immediate(ir_value_t *value) {
+    return value->op == IR_OP_CONSTANT
+        && (ir_type_size(value->type) < 8 || value->integer == (int32_t)value->integer);
+}
+
+/* an address known without computing anything */
+static bool gen_ir_address_constant(ir_value_t *value) {
+    switch (value->op) {
+        case IR_OP_SLOT:
+        case IR_OP_SYMBOL:
+        case IR_OP_STRING:
+            return true;
+        case IR_OP_ADD:
+            return value->type == IR_TYPE_PTR
+                && gen_ir_address_constant(value->operands[0])
+                && value->operands[1]->op == IR_OP_CONSTANT
+                && value->operands[1]->integer == (int32_t)value->operands[1]->integer;
+        default:
+            break;
+    }
+    return false;
+}
+
+/* values which are formed where they're used and need no home */
+static bool gen_ir_rematerialized(ir_value_t *value) {
+    return value->op == IR_OP_CONSTANT
+        || value->op == IR_OP_FLOATING
+        || value->op == IR_OP_LABEL
+        || gen_ir_address_constant(value);
+}
+
+static const char *gen_ir_floating(ir_value_t *value) {
+    return gen_constant_floating(ast_data_table[value->type == IR_TYPE_F32 ? AST_DATA_FLOAT : AST_DATA_DOUBLE], value->floating);
+}
+
+static int gen_ir_location(gen_ir_t *ir, ir_value_t *value) {
+    return (value->id == -1) ? -1 : ir->registers[value->id];
+}
+
+static const char *gen_ir_home(gen_ir_t *ir, ir_value_t *value) {
+    if (value->id == -1 || !ir->homes[value->id])
+        return NULL;
+    return gen_ir_format("%d(%%rbp)", ir->homes[value->id]);
+}
+
+static gen_ir_address_t gen_ir_address_of_constant(gen_ir_t *ir, ir_value_t *value) {
+    switch (value->op) {
+        case IR_OP_SLOT:
+            return (gen_ir_address_t){ NULL, GEN_IR_RBP, ir->homes[value->id] };
+        case IR_OP_SYMBOL:
+            return (gen_ir_address_t){ value->symbol, 0, 0 };
+        case IR_OP_STRING:
+            return (gen_ir_address_t){ gen_constant_string((char *)value->symbol), 0, 0 };
+        default:
+            break;
+    }
+    gen_ir_address_t address = gen_ir_address_of_constant(ir, value->operands[0]);
+    address.offset += value->operands[1]->integer;
+    return address;
+}
+
+static void gen_ir_load(gen_ir_t *ir, ir_value_t *value, int reg);
+
+/* the memory an address refers to, computed into scratch if needed */
+static gen_ir_address_t gen_ir_address(gen_ir_t *ir, ir_value_t *value, int scratch) {
+    if (gen_ir_address_constant(value))
+        return gen_ir_address_of_constant(ir, value);
+    if (gen_ir_location(ir, value) != -1)
+        return (gen_ir_address_t){ NULL, gen_ir_location(ir, value), 0 };
+    gen_ir_load(ir, value, scratch);
+    return (gen_ir_address_t){ NULL, scratch, 0 };
+}
+
+/* an operand of an instruction of the given size, NULL if it has to be loaded */
+static const char *gen_ir_source(gen_ir_t *ir, ir_value_t *value, int size) {
+    if (gen_ir_immediate(value))
+        return gen_ir_format("$%ld", size == 8 ? value->integer : (long)(int32_t)value->integer);
+    if (gen_ir_location(ir, value) != -1)
+        return gen_ir_format("%%%s", gen_ir_register(gen_ir_location(ir, value), size));
+    return gen_ir_home(ir, value);
+}
+
+static const char *gen_ir_source_xmm(gen_ir_t *ir, ir_value_t *value) {
+    if (value->op == IR_OP_FLOATING)
+        return gen_ir_format("%s(%%rip)", gen_ir_floating(value));
+    if (gen_ir_location(ir, value) != -1)
+        return gen_ir_format("%%xmm%d", gen_ir_location(ir, value));
+    return gen_ir_home(ir, value);
+}
+
+static void gen_ir_load(gen_ir_t *ir, ir_value_t *value, int reg) {
+    int size = gen_ir_width(value->type);
+
+    switch (value->op) {
+        case IR_OP_CONSTANT:
+            if (!value->integer)
+                gen_emit("xor %%%s, %%%s", gen_ir_register(reg, 4), gen_ir_register(reg, 4));
+            else if (size == 4 || value->integer == (uint32_t)value->integer)
+                gen_emit("mov $%ld, %%%s", (long)(uint32_t)value->integer, gen_ir_register(reg, 4));
+            else if (value->integer == (int32_t)value->integer)
+                gen_emit("mov $%ld, %%%s", value->integer, gen_ir_register(reg, 8));
+            else
+                gen_emit("movabs $%ld, %%%s", value->integer, gen_ir_register(reg, 8));
+            return;
+        case IR_OP_LABEL:
+            gen_emit("lea %s(%%rip), %%%s", ir->labels[value->targets[0]->id], gen_ir_register(reg, 8));
+            return;
+        default:
+            break;
+    }
+
+    if (gen_ir_address_constant(value)) {
+        gen_emit("lea %s, %%%s", gen_ir_address_string(gen_ir_address_of_constant(ir, value), 0), gen_ir_register(reg, 8));
+        return;
+    }
+
+    int from = gen_ir_location(ir, value);
+    if (from != -1) {
+        if (from != reg)
+            gen_emit("mov %%%s, %%%s", gen_ir_register(from, size), gen_ir_register(reg, size));
+        return;
+    }
+
+    const char *home = gen_ir_home(ir, value);
+    if (!home)
+        compile_ice("gen_ir_load (%%%d)", value->id);
+    gen_emit("mov %s, %%%s", home, gen_ir_register(reg, size));
+}
+
+static void gen_ir_load_xmm(gen_ir_t *ir, ir_value_t *value, int reg) {
+    bool     single = value->type == IR_TYPE_F32;
+    uint64_t bits;
+
+    if (value->op == IR_OP_FLOATING) {
+        memcpy(&bits, &value->floating, sizeof(bits));
+        if (!bits) {
+            gen_emit("xorps %%xmm%d, %%xmm%d", reg, reg);
+            return;
+        }
+    }
+
+    int from = gen_ir_location(ir, value);
+    if (from != -1) {
+        if (from != reg)
+            gen_emit("movaps %%xmm%d, %%xmm%d", from, reg);
+        return;
+    }
+
+    const char *source = gen_ir_source_xmm(ir, value);
+    if (!source)
+        compile_ice("gen_ir_load_xmm (%%%d)", value->id);
+    gen_emit(single ? "movss %s, %%xmm%d" : "movsd %s, %%xmm%d", source, reg);
+}
+
+/* the result of a value was computed in a register, put it where it lives */
+static void gen_ir_define(gen_ir_t *ir, ir_value_t *value, int reg) {
+    int to = gen_ir_location(ir, value);
+    if (to != -1) {
+        if (to == reg)
+            return;
+        if (ir_type_isfloating(value->type))
+            gen_emit("movaps %%xmm%d, %%xmm%d", reg, to);
+        else
+            gen_emit("mov %%%s, %%%s", gen_ir_register(reg, 8), gen_ir_register(to, 8));
+        return;
+    }
+
+    const char *home = gen_ir_home(ir, value);
+    if (!home)
+        return;
+    if (ir_type_isfloating(value->type))
+        gen_emit(value->type == IR_TYPE_F32 ? "movss %%xmm%d, %s" : "movsd %%xmm%d, %s", reg, home);
+    else
+        gen_emit("mov %%%s, %s", gen_ir_register(reg, 8), home);
+}
+
+/*
+ * The register to compute a value in, it's own if it has one. Intervals
+ * which meet never share a register, so it can't be one of the operands.
+ */
+static int gen_ir_work(gen_ir_t *ir, ir_value_t *value, int scratch) {
+    int reg = gen_ir_location(ir, value);
+    return (reg == -1) ? scratch : reg;
+}
+
+/* sign or zero extend an integer narrower than int in a register */
+static void gen_ir_extend(int reg, ir_type_t type, bool sign) {
+    switch (ir_type_size(type)) {
+        case 1:
+            gen_emit(sign ? "movsbl %%%s, %%%s" : "movzbl %%%s, %%%s", gen_ir_register(reg, 1), gen_ir_register(reg, 4));
+            break;
+        case 2:
+            gen_emit(sign ? "movswl %%%s, %%%s" : "movzwl %%%s, %%%s", gen_ir_register(reg, 2), gen_ir_register(reg, 4));
+            break;
+    }
+}
+
+static void gen_ir_arithmetic(gen_ir_t *ir, ir_value_t *value) {
+    static const char *table[] = {
+        [IR_OP_ADD] = "add",
+        [IR_OP_SUB] = "sub",
+        [IR_OP_MUL] = "imul",
+        [IR_OP_AND] = "and",
+        [IR_OP_OR]  = "or",
+        [IR_OP_XOR] = "xor"
+    };
+
+    int         size   = gen_ir_width(value->type);
+    int         work   = gen_ir_work(ir, value, GEN_IR_RAX);
+    const char *source = gen_ir_source(ir, value->operands[1], size);
+
+    gen_ir_load(ir, value->operands[0], work);
+    if (!source) {
+        gen_ir_load(ir, value->operands[1], GEN_IR_RCX);
+        source = gen_ir_format("%%%s", gen_ir_register(GEN_IR_RCX, size));
+    }
+    gen_emit("%s %s, %%%s", table[value->op], source, gen_ir_register(work, size));
+    gen_ir_define(ir, value, work);
+}
+
+static void gen_ir_shift(gen_ir_t *ir, ir_value_t *value) {
+    static const char *table[] = {
+        [IR_OP_SHL] = "shl",
+        [IR_OP_SAR] = "sar",
+        [IR_OP_SHR] = "shr"
+    };
+
+    int         size  = gen_ir_width(value->type);
+    int         work  = gen_ir_work(ir, value, GEN_IR_RAX);
+    ir_value_t *count = value->operands[1];
+
+    gen_ir_load(ir, value->operands[0], work);
+    if (value->op != IR_OP_SHL)
+        gen_ir_extend(work, value->type, value->op == IR_OP_SAR);
+
+    if (count->op == IR_OP_CONSTANT) {
+        gen_emit("%s $%d, %%%s", table[value->op], (int)(count->integer & (size * 8 - 1)), gen_ir_register(work, size));
+    } else {
+        gen_ir_load(ir, count, GEN_IR_RCX);
+        gen_emit("%s %%cl, %%%s", table[value->op], gen_ir_register(work, size));
+    }
+    gen_ir_define(ir, value, work);
+}
+
+static void gen_ir_division(gen_ir_t *ir, ir_value_t *value) {
+    int  size = gen_ir_width(value->type);
+    bool sign = value->op == IR_OP_DIV || value->op == IR_OP_MOD;
+
+    gen_ir_load(ir, value->operands[0], GEN_IR_RAX);
+    gen_ir_load(ir, value->operands[1], GEN_IR_RCX);
+    gen_ir_extend(GEN_IR_RAX, value->type, sign);
+    gen_ir_extend(GEN_IR_RCX, value->type, sign);
+
+    if (sign)
+        gen_emit(size == 8 ? "cqto" : "cltd");
+    else
+        gen_emit("xor %%edx, %%edx");
+    gen_emit("%s %%%s", sign ? "idiv" : "div", gen_ir_register(GEN_IR_RCX, size));
+
+    gen_ir_define(ir, value, (value->op == IR_OP_DIV || value->op == IR_OP_UDIV) ? GEN_IR_RAX : GEN_IR_RDX);
+}
+
+static void gen_ir_arithmetic_floating(gen_ir_t *ir, ir_value_t *value) {
+    static const char *table[][2] = {
+        [IR_OP_ADD] = { "addsd", "addss" },
+        [IR_OP_SUB] = { "subsd", "subss" },
+        [IR_OP_MUL] = { "mulsd", "mulss" },
+        [IR_OP_DIV] = { "divsd", "divss" }
+    };
+
+    int work = gen_ir_work(ir, value, 0);
+    gen_ir_load_xmm(ir, value->operands[0], work);
+    gen_emit("%s %s, %%xmm%d", table[value->op][value->type == IR_TYPE_F32], gen_ir_source_xmm(ir, value->operands[1]), work);
+    gen_ir_define(ir, value, work);
+}
+
+static void gen_ir_unary(gen_ir_t *ir, ir_value_t *value) {
+    if (ir_type_isfloating(value->type)) {
+        /* flipping the sign bit negates zero too, unlike subtracting */
+        bool single = value->type == IR_TYPE_F32;
+        int  work   = gen_ir_work(ir, value, 0);
+        gen_ir_load_xmm(ir, value->operands[0], work);
+        gen_emit(single ? "xorps %s(%%rip), %%xmm%d" : "xorpd %s(%%rip), %%xmm%d",
+            gen_constant_sign(ast_data_table[single ? AST_DATA_FLOAT : AST_DATA_DOUBLE]), work);
+        gen_ir_define(ir, value, work);
+        return;
+    }
+
+    int work = gen_ir_work(ir, value, GEN_IR_RAX);
+    gen_ir_load(ir, value->operands[0], work);
+    gen_emit("%s %%%s", value->op == IR_OP_NEG ? "neg" : "not", gen_ir_register(work, gen_ir_width(value->type)));
+    gen_ir_define(ir, value, work);
+}
+
+/*
+ * Set the flags for a comparison and return the condition which holds
+ * when it's true, like gen_condition does for the ast.
+ */
+static gen_condition_t gen_ir_condition(gen_ir_t *ir, ir_value_t *value) {
+    ir_value_t *left  = value->operands[0];
+    ir_value_t *right = value->operands[1];
+
+    if (ir_type_isfloating(left->type)) {
+        const char *instruction = (left->type == IR_TYPE_F32) ? "ucomiss" : "ucomisd";
+
+        /* only above and below are false for unordered operands */
+        if (value->op == IR_OP_LT || value->op == IR_OP_LE) {
+            int reg = gen_ir_location(ir, right);
+            if (reg == -1)
+                gen_ir_load_xmm(ir, right, (reg = 1));
+            gen_emit("%s %s, %%xmm%d", instruction, gen_ir_source_xmm(ir, left), reg);
+            return (value->op == IR_OP_LT) ? GEN_CONDITION_A : GEN_CONDITION_AE;
+        }
+
+        int reg = gen_ir_location(ir, left);
+        if (reg == -1)
+            gen_ir_load_xmm(ir, left, (reg = 0));
+        gen_emit("%s %s, %%xmm%d", instruction, gen_ir_source_xmm(ir, right), reg);
+        switch (value->op) {
+            case IR_OP_GT: return GEN_CONDITION_A;
+            case IR_OP_GE: return GEN_CONDITION_AE;
+            case IR_OP_EQ: return GEN_CONDITION_FE;
+            case IR_OP_NE: return GEN_CONDITION_FNE;
+            default:
+                break;
+        }
+        compile_ice("gen_ir_condition");
+    }
+
+    int         size   = ir_type_size(left->type);
+    int         work   = gen_ir_location(ir, left);
+    const char *source = gen_ir_source(ir, right, size);
+
+    if (work == -1)
+        gen_ir_load(ir, left, (work = GEN_IR_RAX));
+
+    const char *reg = gen_ir_register(work, size);
+    if (right->op == IR_OP_CONSTANT && !right->integer) {
+        gen_emit("test %%%s, %%%s", reg, reg);
+    } else {
+        if (!source) {
+            gen_ir_load(ir, right, GEN_IR_RCX);
+            source = gen_ir_format("%%%s", gen_ir_register(GEN_IR_RCX, size));
+        }
+        gen_emit("cmp %s, %%%s", source, reg);
+    }
+
+    switch (value->op) {
+        case IR_OP_EQ:  return GEN_CONDITION_E;
+        case IR_OP_NE:  return GEN_CONDITION_NE;
+        case IR_OP_LT:  return GEN_CONDITION_L;
+        case IR_OP_LE:  return GEN_CONDITION_LE;
+        case IR_OP_GT:  return GEN_CONDITION_G;
+        case IR_OP_GE:  return GEN_CONDITION_GE;
+        case IR_OP_ULT: return GEN_CONDITION_B;
+        case IR_OP_ULE: return GEN_CONDITION_BE;
+        case IR_OP_UGT: return GEN_CONDITION_A;
+        case IR_OP_UGE: return GEN_CONDITION_AE;
+        default:
+            break;
+    }
+    compile_ice("gen_ir_condition");
+}
+
+static void gen_ir_conversion(gen_ir_t *ir, ir_value_t *value) {
+    ir_value_t *operand = value->operands[0];
+    bool        single  = value->type == IR_TYPE_F32;
+    int         size    = ir_type_size(operand->type);
+    int         work    = gen_ir_work(ir, value, ir_type_isfloating(value->type) ? 0 : GEN_IR_RAX);
+
+    switch (value->op) {
+        case IR_OP_SEXT:
+        case IR_OP_ZEXT:
+            gen_ir_load(ir, operand, work);
+            if (size == 4 && value->op == IR_OP_SEXT)
+                gen_emit("movslq %%%s, %%%s", gen_ir_register(work, 4), gen_ir_register(work, 8));
+            else if (size == 4)
+                gen_emit("mov %%%s, %%%s", gen_ir_register(work, 4), gen_ir_register(work, 4));
+            else
+                gen_ir_extend(work, operand->type, value->op == IR_OP_SEXT);
+            if (size < 4 && ir_type_size(value->type) == 8)
+                gen_emit(value->op == IR_OP_SEXT ? "movslq %%%s, %%%s" : "mov %%%s, %%%s",
+                    gen_ir_register(work, 4), gen_ir_register(work, value->op == IR_OP_SEXT ? 8 : 4));
+            gen_ir_define(ir, value, work);
+            return;
+
+        case IR_OP_TRUNC:
+            gen_ir_load(ir, operand, work);
+            gen_ir_define(ir, value, work);
+            return;
+
+        case IR_OP_ITOF:
+            gen_ir_load(ir, operand, GEN_IR_RAX);
+            gen_emit("%s %%%s, %%xmm%d", single ? "cvtsi2ss" : "cvtsi2sd", gen_ir_register(GEN_IR_RAX, gen_ir_width(operand->type)), work);
+            gen_ir_define(ir, value, work);
+            return;
+
+        case IR_OP_FTOI:
+            gen_emit("%s %s, %%%s", operand->type == IR_TYPE_F32 ? "cvttss2si" : "cvttsd2si",
+                gen_ir_source_xmm(ir, operand), gen_ir_register(work, gen_ir_width(value->type)));
+            gen_ir_define(ir, value, work);
+            return;
+
+        case IR_OP_FCONV:
+            gen_emit(single ? "cvtsd2ss %s, %%xmm%d" : "cvtss2sd %s, %%xmm%d", gen_ir_source_xmm(ir, operand), work);
+            gen_ir_define(ir, value, work);
+            return;
+
+        default:
+            break;
+    }
+    compile_ice("gen_ir_conversion");
+}
+
+static void gen_ir_memory_load(gen_ir_t *ir, ir_value_t *value) {
+    const char *memory = gen_ir_address_string(gen_ir_address(ir, value->operands[0], GEN_IR_R11), 0);
+    int         work   = gen_ir_work(ir, value, ir_type_isfloating(value->memory) ? 0 : GEN_IR_RAX);
+
+    switch (value->memory) {
+        case IR_TYPE_F32: gen_emit("movss %s, %%xmm%d", memory, work); break;
+        case IR_TYPE_F64: gen_emit("movsd %s, %%xmm%d", memory, work); break;
+        case IR_TYPE_I8:  gen_emit("movzbl %s, %%%s",   memory, gen_ir_register(work, 4)); break;
+        case IR_TYPE_I16: gen_emit("movzwl %s, %%%s",   memory, gen_ir_register(work, 4)); break;
+        case IR_TYPE_I32: gen_emit("mov %s, %%%s",      memory, gen_ir_register(work, 4)); break;
+        default:          gen_emit("mov %s, %%%s",      memory, gen_ir_register(work, 8)); break;
+    }
+    gen_ir_define(ir, value, work);
+}
+
+static void gen_ir_memory_store(gen_ir_t *ir, ir_value_t *value) {
+    static const char suffix[] = { 0, 'b', 'w', 0, 'l', 0, 0, 0, 'q' };
+
+    ir_value_t *stored = value->operands[1];
+    int         size   = ir_type_size(value->memory);
+    const char *memory = gen_ir_address_string(gen_ir_address(ir, value->operands[0], GEN_IR_R11), 0);
+
+    int         reg    = gen_ir_location(ir, stored);
+
+    if (ir_type_isfloating(value->memory)) {
+        if (reg == -1)
+            gen_ir_load_xmm(ir, stored, (reg = 0));
+        gen_emit(size == 4 ? "movss %%xmm%d, %s" : "movsd %%xmm%d, %s", reg, memory);
+        return;
+    }
+
+    if (stored->op == IR_OP_CONSTANT && (size < 8 || stored->integer == (int32_t)stored->integer)) {
+        long immediate = (size == 1) ? (int8_t)stored->integer
+                       : (size == 2) ? (int16_t)stored->integer
+                       : (int32_t)stored->integer;
+        gen_emit("mov%c $%ld, %s", suffix[size], immediate, memory);
+        return;
+    }
+
+    if (reg == -1)
+        gen_ir_load(ir, stored, (reg = GEN_IR_RAX));
+    gen_emit("mov %%%s, %s", gen_ir_register(reg, size), memory);
+}
+
+/*
+ * Blocks of memory are zeroed and copied like the ast does it, unrolled
+ * through %xmm15 up to GEN_BLOCK_INLINE bytes and with the string
+ * instructions beyond that.
+ */
+static void gen_ir_zero(gen_ir_t *ir, ir_value_t *value) {
+    int              size    = value->integer;
+    gen_ir_address_t address = gen_ir_address(ir, value->operands[0], GEN_IR_R11);
+    int              i       = 0;
+
+    if (size > GEN_BLOCK_INLINE) {
+        gen_emit("lea %s, %%rdi", gen_ir_address_string(address, 0));
+        gen_emit("mov $%d, %%ecx", size);
+        gen_emit("xor %%eax, %%eax");
+        gen_emit("rep stosb");
+        return;
+    }
+
+    if (size >= 16) {
+        gen_emit("xorps %%xmm15, %%xmm15");
+        for (; i <= size - 16; i += 16)
+            gen_emit("movups %%xmm15, %s", gen_ir_address_string(address, i));
+        if (i < size)
+            gen_emit("movups %%xmm15, %s", gen_ir_address_string(address, size - 16));
+        return;
+    }
+
+    for (size_t piece = 0; piece < GEN_BLOCK_PIECES; piece++)
+        for (; size - i >= gen_block_pieces[piece].size; i += gen_block_pieces[piece].size)
+            gen_emit("mov%s $0, %s", gen_block_pieces[piece].suffix, gen_ir_address_string(address, i));
+}
+
+static void gen_ir_copy(gen_ir_t *ir, ir_value_t *value) {
+    int              size   = value->integer;
+    gen_ir_address_t target = gen_ir_address(ir, value->operands[0], GEN_IR_RDX);
+    gen_ir_address_t source = gen_ir_address(ir, value->operands[1], GEN_IR_RCX);
+    int              i      = 0;
+
+    /* either address may be in %rsi or %rdi */
+    if (size > GEN_BLOCK_INLINE) {
+        gen_emit("lea %s, %%r11", gen_ir_address_string(source, 0));
+        gen_emit("lea %s, %%rdi", gen_ir_address_string(target, 0));
+        gen_emit("mov %%r11, %%rsi");
+        gen_emit("mov $%d, %%ecx", size);
+        gen_emit("rep movsb");
+        return;
+    }
+
+    if (size >= 16) {
+        for (; i <= size - 16; i += 16) {
+            gen_emit("movups %s, %%xmm15", gen_ir_address_string(source, i));
+            gen_emit("movups %%xmm15, %s", gen_ir_address_string(target, i));
+        }
+        if (i < size) {
+            gen_emit("movups %s, %%xmm15", gen_ir_address_string(source, size - 16));
+            gen_emit("movups %%xmm15, %s", gen_ir_address_string(target, size - 16));
+        }
+        return;
+    }
+
+    for (size_t piece = 0; piece < GEN_BLOCK_PIECES; piece++) {
+        int bytes = gen_block_pieces[piece].size;
+        for (; size - i >= bytes; i += bytes) {
+            gen_emit("mov %s, %%%s", gen_ir_address_string(source, i), gen_ir_register(GEN_IR_RAX, bytes));
+            gen_emit("mov %%%s, %s", gen_ir_register(GEN_IR_RAX, bytes), gen_ir_address_string(target, i));
+        }
+    }
+}
+
+/*
+ * Moves into registers which all happen at once, ordered so none of them
+ * overwrites a register another one still reads from. Whatever is left is
+ * a cycle, which is broken up through %rax or %xmm15.
+ */
+typedef struct {
+    ir_value_t *value;  /* formed or loaded from memory when from is -1 */
+    int         from;
+    int         to;
+    bool        floating;
+} gen_ir_move_t;
+
+static void gen_ir_move(gen_ir_t *ir, gen_ir_move_t *move) {
+    if (move->from == -1) {
+        if (move->floating)
+            gen_ir_load_xmm(ir, move->value, move->to);
+        else
+            gen_ir_load(ir, move->value, move->to);
+    } else if (move->from != move->to) {
+        if (move->floating)
+            gen_emit("movaps %%xmm%d, %%xmm%d", move->from, move->to);
+        else
+            gen_emit("mov %%%s, %%%s", gen_ir_register(move->from, 8), gen_ir_register(move->to, 8));
+    }
+}
+
+static bool gen_ir_move_blocked(gen_ir_move_t *moves, bool *done, int count, int index) {
+    for (int i = 0; i < count; i++)
+        if (!done[i] && i != index && moves[i].floating == moves[index].floating && moves[i].from == moves[index].to)
+            return true;
+    return false;
+}
+
+static void gen_ir_parallel(gen_ir_t *ir, gen_ir_move_t *moves, int count) {
+    bool *done      = memory_allocate(sizeof(bool) * (count + 1));
+    int   remaining = count;
+
+    memset(done, 0, sizeof(bool) * (count + 1));
+    while (remaining) {
+        bool progress = false;
+        for (int i = 0; i < count; i++) {
+            if (done[i] || gen_ir_move_blocked(moves, done, count, i))
+                continue;
+            gen_ir_move(ir, &moves[i]);
+            done[i]  = true;
+            progress = true;
+            remaining--;
+        }
+        if (progress)
+            continue;
+
+        /* free the destination of one move by setting aside what's in it */
+        int i = 0;
+        while (done[i])
+            i++;
+        gen_ir_move_t aside = {
+            .from     = moves[i].to,
+            .to       = moves[i].floating ? GEN_IR_XMM_SCRATCH : GEN_IR_RAX,
+            .floating = moves[i].floating
+        };
+        gen_ir_move(ir, &aside);
+        for (int j = 0; j < count; j++)
+            if (!done[j] && moves[j].floating == aside.floating && moves[j].from == aside.from)
+                moves[j].from = aside.to;
+    }
+}
+
+/*
+ * Arguments which don't fit in registers are pushed last to first, then
+ * the registers are loaded all at once. The caller-saved registers only
+ * hold values which aren't live past the call.
+ */
+static void gen_ir_call(gen_ir_t *ir, ir_value_t *value) {
+    int            count = list_length(value->arguments);
+    ir_value_t   **stack = memory_allocate(sizeof(ir_value_t *) * (count + 1));
+    gen_ir_move_t *moves = memory_allocate(sizeof(gen_ir_move_t) * (count + 1));
+    int            ic    = 0;
+    int            fc    = 0;
+    int            sc    = 0;
+    int            mc    = 0;
+
+    for (list_iterator_t *it = list_iterator(value->arguments); !list_iterator_end(it); ) {
+        ir_value_t *argument = list_iterator_next(it);
+        bool        floating = ir_type_isfloating(argument->type);
+        if (floating && fc < REGISTER_MULT_SIZE_XMM)
+            moves[mc++] = (gen_ir_move_t){ argument, gen_ir_location(ir, argument), fc++, true };
+        else if (!floating && ic < REGISTER_MULT_SIZE)
+            moves[mc++] = (gen_ir_move_t){ argument, gen_ir_location(ir, argument), gen_ir_arguments[ic++], false };
+        else
+            stack[sc++] = argument;
+    }
+
+    /* the stack is kept aligned to 16 bytes at the call */
+    int rest = sc * 8 + (sc & 1) * 8;
+    if (sc & 1)
+        gen_emit("sub $8, %%rsp");
+    while (sc--) {
+        int reg = gen_ir_location(ir, stack[sc]);
+        if (ir_type_isfloating(stack[sc]->type)) {
+            if (reg == -1)
+                gen_ir_load_xmm(ir, stack[sc], (reg = 0));
+            gen_emit("sub $8, %%rsp");
+            gen_emit("movsd %%xmm%d, (%%rsp)", reg);
+        } else {
+            if (reg == -1)
+                gen_ir_load(ir, stack[sc], (reg = GEN_IR_RAX));
+            gen_emit("push %%%s", gen_ir_register(reg, 8));
+        }
+    }
+
+    if (value->operands[0])
+        gen_ir_load(ir, value->operands[0], GEN_IR_R11);
+    gen_ir_parallel(ir, moves, mc);
+    if (value->variadic)
+        gen_emit("mov $%d, %%eax", fc);
+
+    if (value->operands[0])
+        gen_emit("call *%%r11");
+    else
+        gen_emit("call %s", value->symbol);
+
+    if (rest)
+        gen_emit("add $%d, %%rsp", rest);
+
+    if (value->type != IR_TYPE_VOID)
+        gen_ir_define(ir, value, ir_type_isfloating(value->type) ? 0 : GEN_IR_RAX);
+}
+
+/*
+ * Phis of a block are given the values flowing in from a predecessor, all
+ * at once. Those living in registers are parallel moves, those with a home
+ * are stored first while the registers still hold their sources. When one
+ * of the phis reads the home of another the stores go through the stack
+ * and are only done once everything has been read.
+ */
+static void gen_ir_phis(gen_ir_t *ir, ir_block_t *from, ir_block_t *to) {
+    int            count  = list_length(to->values);
+    ir_value_t   **phis   = memory_allocate(sizeof(ir_value_t *)   * (count + 1));
+    ir_value_t   **values = memory_allocate(sizeof(ir_value_t *)   * (count + 1));
+    gen_ir_move_t *moves  = memory_allocate(sizeof(gen_ir_move_t) * (count + 1));
+    int            pc     = 0;
+    int            mc     = 0;
+    bool           stack  = false;
+
+    for (list_iterator_t *it = list_iterator(to->values); !list_iterator_end(it); ) {
+        ir_value_t *phi = list_iterator_next(it);
+        if (phi->op != IR_OP_PHI)
+            break;
+
+        list_iterator_t *at = list_iterator(phi->arguments);
+        list_iterator_t *bt = list_iterator(phi->incoming);
+        while (!list_iterator_end(at)) {
+            ir_value_t *argument = list_iterator_next(at);
+            if (list_iterator_next(bt) != from || argument == phi)
+                continue;
+            bool floating = ir_type_isfloating(phi->type);
+            if (argument->op == IR_OP_PHI && argument->block == to && gen_ir_home(ir, argument))
+                stack = true;
+            if (gen_ir_location(ir, phi) != -1) {
+                moves[mc++] = (gen_ir_move_t){ argument, gen_ir_location(ir, argument), gen_ir_location(ir, phi), floating };
+            } else if (gen_ir_home(ir, phi)) {
+                phis[pc]     = phi;
+                values[pc++] = argument;
+            }
+        }
+    }
+
+    for (int i = 0; i < pc; i++) {
+        bool floating = ir_type_isfloating(phis[i]->type);
+        int  reg      = floating ? GEN_IR_XMM_SCRATCH : GEN_IR_RAX;
+        if (floating)
+            gen_ir_load_xmm(ir, values[i], reg);
+        else
+            gen_ir_load(ir, values[i], reg);
+        if (!stack)
+            gen_ir_define(ir, phis[i], reg);
+        else if (floating) {
+            gen_emit("sub $8, %%rsp");
+            gen_emit("movsd %%xmm%d, (%%rsp)", reg);
+        } else
+            gen_emit("push %%rax");
+    }
+    gen_ir_parallel(ir, moves, mc);
+    while (stack && pc--) {
+        if (ir_type_isfloating(phis[pc]->type)) {
+            gen_emit("movsd (%%rsp), %%xmm%d", GEN_IR_XMM_SCRATCH);
+            gen_emit("add $8, %%rsp");
+            gen_ir_define(ir, phis[pc], GEN_IR_XMM_SCRATCH);
+        } else {
+            gen_emit("pop %%rax");
+            gen_ir_define(ir, phis[pc], GEN_IR_RAX);
+        }
+    }
+}
+
+/* phis of a block which aren't already given their value on an edge */
+static bool gen_ir_copies(gen_ir_t *ir, ir_block_t *from, ir_block_t *to) {
+    for (list_iterator_t *it = list_iterator(to->values); !list_iterator_end(it); ) {
+        ir_value_t *phi = list_iterator_next(it);
+        if (phi->op != IR_OP_PHI)
+            break;
+
+        list_iterator_t *at = list_iterator(phi->arguments);
+        list_iterator_t *bt = list_iterator(phi->incoming);
+        while (!list_iterator_end(at)) {
+            ir_value_t *argument = list_iterator_next(at);
+            if (list_iterator_next(bt) != from || argument == phi)
+                continue;
+            if (gen_ir_location(ir, phi) == -1 && !gen_ir_home(ir, phi))
+                continue;
+            if (gen_ir_location(ir, phi) == -1 || gen_ir_location(ir, argument) != gen_ir_location(ir, phi))
+                return true;
+        }
+    }
+    return false;
+}
+
+/* edges into phis from anything but a jump go through a stub */
+static bool gen_ir_critical(gen_ir_t *ir, ir_block_t *from, ir_block_t *to) {
+    ir_value_t *terminator = list_tail(from->values);
+    return terminator->op != IR_OP_JUMP && gen_ir_copies(ir, from, to);
+}
+
+static const char *gen_ir_target(gen_ir_t *ir, ir_block_t *from, ir_block_t *to) {
+    if (!gen_ir_critical(ir, from, to))
+        return ir->labels[to->id];
+
+    char *stub = ast_label();
+    list_push(ir->stubs, pair_create(stub, pair_create(from, to)));
+    return stub;
+}
+
+static int gen_ir_case_compare(const void *a, const void *b) {
+    const ast_t *lhs = *(ast_t *const *)a;
+    const ast_t *rhs = *(ast_t *const *)b;
+    return (lhs->casebeg > rhs->casebeg) - (lhs->casebeg < rhs->casebeg);
+}
+
+/* the dispatch of the ast is reused, with a case node for each range */
+static void gen_ir_switch(gen_ir_t *ir, ir_value_t *value) {
+    ast_t     **cases   = memory_allocate(sizeof(ast_t *) * (list_length(value->incoming) + 1));
+    const char **targets = memory_allocate(sizeof(char *) * (list_length(ir->function->blocks) + 1));
+    int          count   = 0;
+
+    /* one stub for each block with phis however many cases go there */
+    memset(targets, 0, sizeof(char *) * (list_length(ir->function->blocks) + 1));
+    for (list_iterator_t *it = list_iterator(value->incoming); !list_iterator_end(it); ) {
+        ir_case_t *entry = list_iterator_next(it);
+        if (entry->begin > entry->end)
+            continue;
+        if (!targets[entry->block->id])
+            targets[entry->block->id] = gen_ir_target(ir, value->block, entry->block);
+        cases[count] = ast_case(entry->begin, entry->end);
+        cases[count++]->caselabel = (char *)targets[entry->block->id];
+    }
+    qsort(cases, count, sizeof(ast_t *), &gen_ir_case_compare);
+
+    if (!targets[value->targets[0]->id])
+        targets[value->targets[0]->id] = gen_ir_target(ir, value->block, value->targets[0]);
+
+    /* narrower values are promoted like the ast loads them */
+    gen_ir_load(ir, value->operands[0], GEN_IR_RAX);
+    gen_ir_extend(GEN_IR_RAX, value->operands[0]->type, true);
+    gen_switch(cases, count, targets[value->targets[0]->id], ir_type_size(value->operands[0]->type) == 8);
+}
+
+static void gen_ir_branch(gen_ir_t *ir, ir_value_t *value, ir_block_t *next) {
+    ir_block_t     *block     = value->block;
+    ir_value_t     *condition = value->operands[0];
+    gen_condition_t holds;
+
+    if (ir->fused[condition->id]) {
+        holds = gen_ir_condition(ir, condition);
+    } else if (gen_ir_location(ir, condition) != -1) {
+        const char *reg = gen_ir_register(gen_ir_location(ir, condition), 4);
+        gen_emit("test %%%s, %%%s", reg, reg);
+        holds = GEN_CONDITION_NE;
+    } else {
+        gen_emit("cmpl $0, %s", gen_ir_home(ir, condition));
+        holds = GEN_CONDITION_NE;
+    }
+
+    ir_block_t *then = value->targets[0];
+    ir_block_t *last = value->targets[1];
+
+    if (last == next && !gen_ir_critical(ir, block, last)) {
+        gen_condition_jump(holds, gen_ir_target(ir, block, then));
+    } else if (then == next && !gen_ir_critical(ir, block, then)) {
+        gen_condition_jump(gen_condition_invert(holds), gen_ir_target(ir, block, last));
+    } else {
+        gen_condition_jump(holds, gen_ir_target(ir, block, then));
+        gen_jump(gen_ir_target(ir, block, last));
+    }
+}
+
+static void gen_ir_value(gen_ir_t *ir, ir_value_t *value, ir_block_t *next) {
+    /* values nothing uses and which have no effect */
+    if (value->id != -1 && !ir->uses[value->id] && value->op != IR_OP_CALL && value->op != IR_OP_LOAD)
+        return;
+    if (value->id != -1 && ir->fused[value->id])
+        return;
+    if (gen_ir_rematerialized(value))
+        return;
+
+    switch (value->op) {
+        case IR_OP_PARAMETER:
+        case IR_OP_PHI:
+            break;
+
+        case IR_OP_LOAD:  gen_ir_memory_load(ir, value);  break;
+        case IR_OP_STORE: gen_ir_memory_store(ir, value); break;
+        case IR_OP_COPY:  gen_ir_copy(ir, value);         break;
+        case IR_OP_ZERO:  gen_ir_zero(ir, value);         break;
+        case IR_OP_CALL:  gen_ir_call(ir, value);         break;
+
+        case IR_OP_ADD:
+        case IR_OP_SUB:
+        case IR_OP_MUL:
+        case IR_OP_DIV:
+            if (ir_type_isfloating(value->type)) {
+                gen_ir_arithmetic_floating(ir, value);
+                break;
+            }
+            if (value->op == IR_OP_DIV) {
+                gen_ir_division(ir, value);
+                break;
+            }
+            gen_ir_arithmetic(ir, value);
+            break;
+
+        case IR_OP_AND:
+        case IR_OP_OR:
+        case IR_OP_XOR:
+            gen_ir_arithmetic(ir, value);
+            break;
+
+        case IR_OP_UDIV:
+        case IR_OP_MOD:
+        case IR_OP_UMOD:
+            gen_ir_division(ir, value);
+            break;
+
+        case IR_OP_SHL:
+        case IR_OP_SAR:
+        case IR_OP_SHR:
+            gen_ir_shift(ir, value);
+            break;
+
+        case IR_OP_NEG:
+        case IR_OP_NOT:
+            gen_ir_unary(ir, value);
+            break;
+
+        case IR_OP_EQ:  case IR_OP_NE:
+        case IR_OP_LT:  case IR_OP_LE:
+        case IR_OP_GT:  case IR_OP_GE:
+        case IR_OP_ULT: case IR_OP_ULE:
+        case IR_OP_UGT: case IR_OP_UGE:
+            gen_condition_set(gen_ir_condition(ir, value));
+            gen_ir_define(ir, value, GEN_IR_RAX);
+            break;
+
+        case IR_OP_SEXT:
+        case IR_OP_ZEXT:
+        case IR_OP_TRUNC:
+        case IR_OP_ITOF:
+        case IR_OP_FTOI:
+        case IR_OP_FCONV:
+            gen_ir_conversion(ir, value);
+            break;
+
+        case IR_OP_JUMP:
+            gen_ir_phis(ir, value->block, value->targets[0]);
+            if (value->targets[0] != next)
+                gen_jump(ir->labels[value->targets[0]->id]);
+            break;
+
+        case IR_OP_BRANCH:
+            gen_ir_branch(ir, value, next);
+            break;
+
+        case IR_OP_SWITCH:
+            gen_ir_switch(ir, value);
+            break;
+
+        case IR_OP_JUMP_INDIRECT:
+            gen_ir_load(ir, value->operands[0], GEN_IR_RAX);
+            gen_emit("jmp *%%rax");
+            break;
+
+        case IR_OP_RETURN:
+            if (value->operands[0] && ir_type_isfloating(value->operands[0]->type))
+                gen_ir_load_xmm(ir, value->operands[0], 0);
+            else if (value->operands[0])
+                gen_ir_load(ir, value->operands[0], GEN_IR_RAX);
+            else if (ir->main)
+                gen_emit("xor %%eax, %%eax");
+            gen_jump(ir->exit);
+            break;
+
+        default:
+            compile_ice("gen_ir_value (%s)", ir_op_string(value->op));
+    }
+}
+
+/*
+ * Parameters are moved from where they arrive to where they live. Those
+ * going to memory are stored first, as the ones going to registers may
+ * overwrite where others arrive, and those arriving on the stack last.
+ */
+static void gen_ir_parameters(gen_ir_t *ir) {
+    list_t        *parameters = ir->function->parameters;
+    gen_ir_move_t *moves      = memory_allocate(sizeof(gen_ir_move_t) * (list_length(parameters) + 1));
+    int           *arrive     = memory_allocate(sizeof(int) * (list_length(parameters) + 1));
+    int            ic         = 0;
+    int            fc         = 0;
+    int            mc         = 0;
+    int            stack      = 16;
+    int            index      = 0;
+
+    for (list_iterator_t *it = list_iterator(parameters); !list_iterator_end(it); index++) {
+        ir_value_t *value    = list_iterator_next(it);
+        bool        floating = ir_type_isfloating(value->type);
+        int         from     = -1;
+
+        if (floating && fc < REGISTER_MULT_SIZE_XMM)
+            from = fc++;
+        else if (!floating && ic < REGISTER_MULT_SIZE)
+            from = gen_ir_arguments[ic++];
+        else
+            stack += 8;
+
+        arrive[index] = (from == -1) ? stack - 8 : 0;
+        if (from == -1)
+            continue;
+        if (gen_ir_location(ir, value) != -1)
+            moves[mc++] = (gen_ir_move_t){ NULL, from, gen_ir_location(ir, value), floating };
+        else
+            gen_ir_define(ir, value, from);
+    }
+
+    gen_ir_parallel(ir, moves, mc);
+
+    index = 0;
+    for (list_iterator_t *it = list_iterator(parameters); !list_iterator_end(it); index++) {
+        ir_value_t *value = list_iterator_next(it);
+        if (!arrive[index] || (gen_ir_location(ir, value) == -1 && !gen_ir_home(ir, value)))
+            continue;
+        if (ir_type_isfloating(value->type)) {
+            int work = gen_ir_work(ir, value, 0);
+            gen_emit(value->type == IR_TYPE_F32 ? "movss %d(%%rbp), %%xmm%d" : "movsd %d(%%rbp), %%xmm%d", arrive[index], work);
+            gen_ir_define(ir, value, work);
+        } else {
+            int work = gen_ir_work(ir, value, GEN_IR_RAX);
+            gen_emit("mov %d(%%rbp), %%%s", arrive[index], gen_ir_register(work, 8));
+            gen_ir_define(ir, value, work);
+        }
+    }
+}
+
+/* the functions the IR expresses faithfully */
+static bool gen_ir_supported(ir_function_t *function) {
+    if (function->aggregates)
+        return false;
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            if (value->op == IR_OP_VA_START || value->op == IR_OP_VA_ARG)
+                return false;
+            if (value->op == IR_OP_CALL && value->symbol && !strcmp(value->symbol, "__builtin_return_address"))
+                return false;
+        }
+    }
+    return true;
+}
+
+static void gen_ir_use(gen_ir_t *ir, ir_value_t *value) {
+    if (value && value->id != -1)
+        ir->uses[value->id]++;
+}
+
+static void gen_ir_prepare(gen_ir_t *ir) {
+    ir_function_t *function = ir->function;
+    int            blocks   = list_length(function->blocks);
+    int            values   = function->values;
+
+    ir->labels    = memory_allocate(sizeof(char *) * (blocks + 1));
+    memset(ir->labels, 0, sizeof(char *) * (blocks + 1));
+    ir->homes     = memory_allocate(sizeof(int)    * (values + 1));
+    ir->registers = memory_allocate(sizeof(int)    * (values + 1));
+    ir->uses      = memory_allocate(sizeof(int)    * (values + 1));
+    ir->fused     = memory_allocate(sizeof(bool)   * (values + 1));
+    memset(ir->homes, 0, sizeof(int)  * (values + 1));
+    memset(ir->uses,  0, sizeof(int)  * (values + 1));
+    memset(ir->fused, 0, sizeof(bool) * (values + 1));
+    for (int i = 0; i <= values; i++)
+        ir->registers[i] = -1;
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            gen_ir_use(ir, value->operands[0]);
+            gen_ir_use(ir, value->operands[1]);
+            if (!value->arguments)
+                continue;
+            for (list_iterator_t *at = list_iterator(value->arguments); !list_iterator_end(at); )
+                gen_ir_use(ir, list_iterator_next(at));
+        }
+    }
+
+    /* a comparison right before the branch using it only sets the flags */
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        ir_value_t *last = list_tail(block->values);
+        if (last->op != IR_OP_BRANCH)
+            continue;
+        ir_value_t *condition = last->operands[0];
+        if (condition->block != block || ir->uses[condition->id] != 1 || condition->op < IR_OP_EQ || condition->op > IR_OP_UGE)
+            continue;
+        bool adjacent = false;
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            if (value == condition)
+                adjacent = true;
+            else if (value != last && !gen_ir_rematerialized(value))
+                adjacent = false;
+        }
+        ir->fused[condition->id] = adjacent;
+    }
+}
+
+/*
+ * A block needs a label unless the one before it is it's only predecessor
+ * and falls through into it. Which edges need copies for phis is only
+ * known once registers are allocated.
+ */
+static void gen_ir_labels(gen_ir_t *ir) {
+    ir_block_t *previous = NULL;
+    for (list_iterator_t *it = list_iterator(ir->function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block      = list_iterator_next(it);
+        ir_value_t *terminator = previous ? list_tail(previous->values) : NULL;
+        bool        falls      = list_length(block->predecessors) == 1
+                              && list_head(block->predecessors) == previous
+                              && !block->addressed
+                              && (terminator->op == IR_OP_JUMP || terminator->op == IR_OP_BRANCH)
+                              && !gen_ir_critical(ir, previous, block);
+
+        ir->labels[block->id] = (previous && !falls) || block->addressed ? ast_label() : NULL;
+        previous = block;
+    }
+}
+
+/* values which are computed and then used, the ones needing a register */
+static bool gen_ir_allocatable_value(gen_ir_t *ir, ir_value_t *value) {
+    return value->id != -1
+        && value->op != IR_OP_SLOT
+        && ir->uses[value->id]
+        && !ir->fused[value->id]
+        && !gen_ir_rematerialized(value);
+}
+
+static bool gen_ir_callee_saved(int reg) {
+    return reg == GEN_IR_RBX || reg >= GEN_IR_R12;
+}
+
+/*
+ * Values computed in the register their first operand was loaded into,
+ * which is then free for them to take when the operand dies right there.
+ */
+static bool gen_ir_overwrites(ir_value_t *value) {
+    switch (value->op) {
+        case IR_OP_ADD: case IR_OP_SUB: case IR_OP_MUL:
+        case IR_OP_AND: case IR_OP_OR:  case IR_OP_XOR:
+        case IR_OP_SHL: case IR_OP_SAR: case IR_OP_SHR:
+        case IR_OP_NEG: case IR_OP_NOT:
+        case IR_OP_SEXT: case IR_OP_ZEXT: case IR_OP_TRUNC:
+            return ir_type_isfloating(value->operands[0]->type) == ir_type_isfloating(value->type);
+        case IR_OP_DIV:
+            return ir_type_isfloating(value->type);
+        default:
+            return false;
+    }
+}
+
+/*
+ * Linear scan over the live intervals in the order they begin. A value
+ * which meets the registers all taken gets the one of whichever value
+ * lives the longest, and that one goes to memory instead. Values going
+ * into a phi prefer it's register, so the edge needs no copy.
+ */
+static void gen_ir_allocate(gen_ir_t *ir) {
+    ir_function_t *function  = ir->function;
+    ir_interval_t *intervals = ir_live(function);
+    ir_value_t   **values    = memory_allocate(sizeof(ir_value_t *) * (function->values + 1));
+    int            positions = 0;
+    int            count     = 0;
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); )
+        positions += list_length(((ir_block_t *)list_iterator_next(it))->values);
+
+    /*
+     * Calls, and copies and zeroing through the string instructions which
+     * use %rsi and %rdi, counted up to each position.
+     */
+    int *calls  = memory_allocate(sizeof(int) * (positions + 1));
+    int *blocks = memory_allocate(sizeof(int) * (positions + 1));
+    int  position = 0;
+
+    calls[0] = blocks[0] = 0;
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); position++) {
+            ir_value_t *value = list_iterator_next(vt);
+            bool        large = (value->op == IR_OP_COPY || value->op == IR_OP_ZERO) && value->integer > GEN_BLOCK_INLINE;
+            calls[position + 1]  = calls[position]  + (value->op == IR_OP_CALL);
+            blocks[position + 1] = blocks[position] + large;
+            if (gen_ir_allocatable_value(ir, value))
+                values[count++] = value;
+        }
+    }
+
+    /* the values are in order already except for phis, which begin early */
+    for (int i = 1; i < count; i++) {
+        ir_value_t *value = values[i];
+        int         j     = i;
+        for (; j > 0 && intervals[values[j - 1]->id].begin > intervals[value->id].begin; j--)
+            values[j] = values[j - 1];
+        values[j] = value;
+    }
+
+    /* parameters are best left in the registers they arrive in */
+    int *hints = memory_allocate(sizeof(int) * (function->values + 1));
+    int  ic    = 0;
+    int  fc    = 0;
+    for (int i = 0; i < function->values; i++)
+        hints[i] = -1;
+    for (list_iterator_t *it = list_iterator(function->parameters); !list_iterator_end(it); ) {
+        ir_value_t *parameter = list_iterator_next(it);
+        int         hint      = -1;
+        if (ir_type_isfloating(parameter->type))
+            hint = (fc < REGISTER_MULT_SIZE_XMM) ? fc++ : -1;
+        else
+            hint = (ic < REGISTER_MULT_SIZE) ? gen_ir_arguments[ic++] : -1;
+        if (parameter->id != -1)
+            hints[parameter->id] = hint;
+    }
+
+    ir_value_t **phis = memory_allocate(sizeof(ir_value_t *) * (function->values + 1));
+    memset(phis, 0, sizeof(ir_value_t *) * (function->values + 1));
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *phi = list_iterator_next(vt);
+            if (phi->op != IR_OP_PHI)
+                break;
+            for (list_iterator_t *at = list_iterator(phi->arguments); !list_iterator_end(at); ) {
+                ir_value_t *argument = list_iterator_next(at);
+                if (argument->id != -1 && argument != phi && !phis[argument->id])
+                    phis[argument->id] = phi;
+            }
+        }
+    }
+
+    int owners[2][16];
+    for (int i = 0; i < 16; i++)
+        owners[0][i] = owners[1][i] = -1;
+
+    for (int i = 0; i < count; i++) {
+        ir_value_t   *value    = values[i];
+        ir_interval_t interval = intervals[value->id];
+        bool          floating = ir_type_isfloating(value->type);
+        int          *owner    = owners[floating];
+
+        for (int reg = 0; reg < 16; reg++)
+            if (owner[reg] != -1 && intervals[owner[reg]].end < interval.begin)
+                owner[reg] = -1;
+
+        /* what happens strictly inside the interval clobbers registers */
+        bool call  = interval.end > interval.begin + 1 && calls[interval.end]  > calls[interval.begin + 1];
+        bool block = interval.end > interval.begin + 1 && blocks[interval.end] > blocks[interval.begin + 1];
+
+        int candidates[16];
+        int number = 0;
+        if (floating && !call)
+            for (int reg = GEN_IR_XMM_FIRST; reg <= GEN_IR_XMM_LAST; reg++)
+                candidates[number++] = reg;
+        if (!floating) {
+            for (int j = 0; j < GEN_IR_ALLOCATABLE; j++) {
+                int reg = gen_ir_allocatable[j];
+                if (call && !gen_ir_callee_saved(reg))
+                    continue;
+                if (block && (reg == GEN_IR_RSI || reg == GEN_IR_RDI))
+                    continue;
+                candidates[number++] = reg;
+            }
+        }
+
+        /* the register of an operand dying here if it can be computed in it */
+        int         reuse   = -1;
+        ir_value_t *operand = value->operands[0];
+        if (gen_ir_overwrites(value) && operand->id != -1 && ir->registers[operand->id] != -1
+            && intervals[operand->id].end == interval.begin)
+            reuse = ir->registers[operand->id];
+
+        int preferred[] = {
+            hints[value->id],
+            phis[value->id] ? ir->registers[phis[value->id]->id] : -1,
+            reuse
+        };
+
+        int chosen = -1;
+        for (int k = 0; k < 3 && chosen == -1; k++)
+            for (int j = 0; j < number && chosen == -1; j++)
+                if (candidates[j] == preferred[k] && (owner[candidates[j]] == -1 || candidates[j] == reuse))
+                    chosen = candidates[j];
+        for (int j = 0; j < number && chosen == -1; j++)
+            if (owner[candidates[j]] == -1)
+                chosen = candidates[j];
+
+        if (chosen == -1) {
+            int longest = -1;
+            for (int j = 0; j < number; j++)
+                if (longest == -1 || intervals[owner[candidates[j]]].end > intervals[owner[longest]].end)
+                    longest = candidates[j];
+            if (longest == -1 || intervals[owner[longest]].end <= interval.end)
+                continue;
+            ir->registers[owner[longest]] = -1;
+            chosen = longest;
+        }
+
+        owner[chosen] = value->id;
+        ir->registers[value->id] = chosen;
+    }
+}
+
+/* every slot and every value without a register gets a home in the frame */
+static int gen_ir_frame(gen_ir_t *ir) {
+    int offset = 0;
+
+    for (list_iterator_t *it = list_iterator(ir->function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            if (value->id == -1 || ir->fused[value->id])
+                continue;
+            if (value->op == IR_OP_SLOT) {
+                offset -= gen_alignment(value->integer ? value->integer : 1, 8);
+                ir->homes[value->id] = offset;
+                continue;
+            }
+            if (!gen_ir_allocatable_value(ir, value))
+                continue;
+            if (ir->registers[value->id] == -1) {
+                offset -= 8;
+                ir->homes[value->id] = offset;
+            } else if (!ir_type_isfloating(value->type) && gen_ir_callee_saved(ir->registers[value->id])) {
+                ir->saves[ir->registers[value->id]] = 1;
+            }
+        }
+    }
+
+    for (int reg = 0; reg < 16; reg++) {
+        if (!ir->saves[reg])
+            continue;
+        offset -= 8;
+        ir->saves[reg] = offset;
+    }
+    return gen_alignment(-offset, 16);
+}
+
+/* blocks in reverse postorder are only jumped back to from the loop they head */
+static bool gen_ir_loop(ir_block_t *block) {
+    for (list_iterator_t *it = list_iterator(block->predecessors); !list_iterator_end(it); )
+        if (((ir_block_t *)list_iterator_next(it))->id >= block->id)
+            return true;
+    return false;
+}
+
+bool gen_function_ir(ast_t *ast) {
+    ir_function_t *function = ir_lower(ast);
+    if (!gen_ir_supported(function))
+        return false;
+
+    gen_ir_t ir = {
+        .function = function,
+        .stubs    = list_create(),
+        .exit     = ast_label(),
+        .main     = !strcmp(function->name, "main")
+    };
+
+    gen_ir_prepare(&ir);
+    gen_ir_allocate(&ir);
+    gen_ir_labels(&ir);
+    int frame = gen_ir_frame(&ir);
+
+    gen_emit_inline(".text");
+    if (!ast->ctype->isstatic)
+        gen_emit_inline(".global %s", function->name);
+    gen_emit_inline("%s:", function->name);
+    gen_emit("push %%rbp");
+    gen_emit("mov %%rsp, %%rbp");
+    if (frame)
+        gen_emit("sub $%d, %%rsp", frame);
+    for (int reg = 0; reg < 16; reg++)
+        if (ir.saves[reg])
+            gen_emit("mov %%%s, %d(%%rbp)", gen_ir_register(reg, 8), ir.saves[reg]);
+
+    gen_ir_parameters(&ir);
+
+    int          count  = list_length(function->blocks);
+    ir_block_t **blocks = memory_allocate(sizeof(ir_block_t *) * (count + 1));
+    int          index  = 0;
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); )
+        blocks[index++] = list_iterator_next(it);
+    blocks[count] = NULL;
+
+    for (int i = 0; i < count; i++) {
+        if (ir.labels[blocks[i]->id] && gen_ir_loop(blocks[i]))
+            gen_label_loop(ir.labels[blocks[i]->id]);
+        else if (ir.labels[blocks[i]->id])
+            gen_label(ir.labels[blocks[i]->id]);
+        for (list_iterator_t *it = list_iterator(blocks[i]->values); !list_iterator_end(it); )
+            gen_ir_value(&ir, list_iterator_next(it), blocks[i + 1]);
+    }
+
+    for (list_iterator_t *it = list_iterator(ir.stubs); !list_iterator_end(it); ) {
+        pair_t *stub = list_iterator_next(it);
+        pair_t *edge = stub->second;
+        gen_label(stub->first);
+        gen_ir_phis(&ir, edge->first, edge->second);
+        gen_jump(ir.labels[((ir_block_t *)edge->second)->id]);
+    }
+
+    gen_label(ir.exit);
+    for (int reg = 0; reg < 16; reg++)
+        if (ir.saves[reg])
+            gen_emit("mov %d(%%rbp), %%%s", ir.saves[reg], gen_ir_register(reg, 8));
+    gen_emit("leave");
+    gen_emit("ret");
+    return true;
 }
@@ -0,0 +1,1841 @@
+/*
+ * File: ir.c
+ *  Lowering of the AST into the intermediate representation.
+ */
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ir.h"
+#include "conv.h"
+#include "lice.h"
+
+typedef struct {
+    ir_function_t *function;
+    data_type_t   *returntype;
+
+    /*
+     * The block values are added to, NULL after a terminator until the
+     * next block begins. Anything lowered then ends up in a fresh block
+     * without predecessors, which is dropped once lowering is done.
+     */
+    ir_block_t    *block;
+    ir_block_t    *entry;
+    ir_block_t    *breaks;
+    ir_block_t    *continues;
+    ir_value_t    *dispatch;
+
+    list_t        *blocks;
+    list_t        *variables;   /* pairs of local variable node and slot */
+    list_t        *initialized; /* compound literals initialized already */
+    table_t       *labels;
+} ir_lower_t;
+
+static ir_value_t *ir_expression(ir_lower_t *ir, ast_t *ast);
+static ir_value_t *ir_address(ir_lower_t *ir, ast_t *ast);
+static void        ir_promote(ir_function_t *function);
+
+static ir_type_t ir_type(data_type_t *type) {
+    switch (type->type) {
+        case TYPE_VOID:    return IR_TYPE_VOID;
+        case TYPE_BOOL:    return IR_TYPE_I8;
+        case TYPE_CHAR:    return IR_TYPE_I8;
+        case TYPE_SHORT:   return IR_TYPE_I16;
+        case TYPE_INT:     return IR_TYPE_I32;
+        case TYPE_LONG:    return IR_TYPE_I64;
+        case TYPE_LLONG:   return IR_TYPE_I64;
+        case TYPE_FLOAT:   return IR_TYPE_F32;
+        case TYPE_DOUBLE:  return IR_TYPE_F64;
+        case TYPE_LDOUBLE: return IR_TYPE_F64;
+        default:
+            break;
+    }
+    return IR_TYPE_PTR;
+}
+
+int ir_type_size(ir_type_t type) {
+    switch (type) {
+        case IR_TYPE_I8:  return 1;
+        case IR_TYPE_I16: return 2;
+        case IR_TYPE_I32: return 4;
+        case IR_TYPE_F32: return 4;
+        case IR_TYPE_VOID:return 0;
+        default:
+            break;
+    }
+    return 8;
+}
+
+bool ir_type_isfloating(ir_type_t type) {
+    return type == IR_TYPE_F32 || type == IR_TYPE_F64;
+}
+
+static bool ir_pointer(data_type_t *type) {
+    return type->type == TYPE_POINTER || type->type == TYPE_ARRAY;
+}
+
+static bool ir_terminator(ir_value_t *value) {
+    return value && value->op >= IR_OP_JUMP;
+}
+
+static ir_block_t *ir_block_create(ir_lower_t *ir) {
+    ir_block_t *block   = memory_allocate(sizeof(ir_block_t));
+    block->id           = list_length(ir->blocks);
+    block->values       = list_create();
+    block->predecessors = list_create();
+    block->successors   = list_create();
+    block->addressed    = false;
+    list_push(ir->blocks, block);
+    return block;
+}
+
+static ir_value_t *ir_value(ir_lower_t *ir, ir_op_t op, ir_type_t type) {
+    if (!ir->block)
+        ir->block = ir_block_create(ir);
+
+    ir_value_t *value = memory_allocate(sizeof(ir_value_t));
+    memset(value, 0, sizeof(ir_value_t));
+    value->op     = op;
+    value->type   = type;
+    value->memory = type;
+    value->id     = ir->function->values++;
+    value->block  = ir->block;
+    list_push(ir->block->values, value);
+
+    if (ir_terminator(value))
+        ir->block = NULL;
+    return value;
+}
+
+static ir_value_t *ir_unary(ir_lower_t *ir, ir_op_t op, ir_type_t type, ir_value_t *operand) {
+    ir_value_t *value  = ir_value(ir, op, type);
+    value->operands[0] = operand;
+    return value;
+}
+
+static ir_value_t *ir_binary(ir_lower_t *ir, ir_op_t op, ir_type_t type, ir_value_t *left, ir_value_t *right) {
+    ir_value_t *value  = ir_value(ir, op, type);
+    value->operands[0] = left;
+    value->operands[1] = right;
+    return value;
+}
+
+static ir_value_t *ir_constant(ir_lower_t *ir, ir_type_t type, long integer) {
+    if (ir_type_isfloating(type)) {
+        ir_value_t *value = ir_value(ir, IR_OP_FLOATING, type);
+        value->floating   = integer;
+        return value;
+    }
+    ir_value_t *value = ir_value(ir, IR_OP_CONSTANT, type);
+    value->integer    = integer;
+    return value;
+}
+
+/* control flow */
+static void ir_jump(ir_lower_t *ir, ir_block_t *target) {
+    if (!ir->block)
+        return;
+    ir_value(ir, IR_OP_JUMP, IR_TYPE_VOID)->targets[0] = target;
+}
+
+static void ir_begin(ir_lower_t *ir, ir_block_t *block) {
+    ir_jump(ir, block);
+    ir->block = block;
+}
+
+static void ir_branch(ir_lower_t *ir, ir_value_t *condition, ir_block_t *then, ir_block_t *last) {
+    ir_value_t *value = ir_unary(ir, IR_OP_BRANCH, IR_TYPE_VOID, condition);
+    value->targets[0] = then;
+    value->targets[1] = last;
+}
+
+static ir_block_t *ir_label(ir_lower_t *ir, char *label) {
+    ir_block_t *block = table_find(ir->labels, label);
+    if (!block)
+        table_insert(ir->labels, label, (block = ir_block_create(ir)));
+    return block;
+}
+
+/* conversions */
+static ir_value_t *ir_compare_zero(ir_lower_t *ir, ir_op_t op, ir_type_t type, ir_value_t *value) {
+    return ir_binary(ir, op, type, value, ir_constant(ir, value->type, 0));
+}
+
+static bool ir_compare(ir_value_t *value) {
+    return value->op >= IR_OP_EQ && value->op <= IR_OP_UGE;
+}
+
+static ir_value_t *ir_convert(ir_lower_t *ir, ir_value_t *value, data_type_t *from, data_type_t *to) {
+    if (!value || to->type == TYPE_VOID)
+        return value;
+
+    ir_type_t source = value->type;
+    ir_type_t target = ir_type(to);
+
+    if (to->type == TYPE_BOOL && from->type != TYPE_BOOL)
+        return ir_compare_zero(ir, IR_OP_NE, IR_TYPE_I8, value);
+    if (source == target)
+        return value;
+
+    bool fsource = ir_type_isfloating(source);
+    bool ftarget = ir_type_isfloating(target);
+
+    if (fsource && ftarget)
+        return ir_unary(ir, IR_OP_FCONV, target, value);
+    if (ftarget) {
+        /* the conversion is signed, so operands narrower than it are extended first */
+        if (ir_type_size(source) < 4 || (ir_type_size(source) == 4 && !from->sign))
+            value = ir_unary(ir, from->sign ? IR_OP_SEXT : IR_OP_ZEXT, from->sign ? IR_TYPE_I32 : IR_TYPE_I64, value);
+        return ir_unary(ir, IR_OP_ITOF, target, value);
+    }
+    if (fsource)
+        return ir_unary(ir, IR_OP_FTOI, target, value);
+    if (ir_type_size(target) < ir_type_size(source))
+        return ir_unary(ir, IR_OP_TRUNC, target, value);
+    if (ir_type_size(target) == ir_type_size(source))
+        return value; /* pointers and integers of the same size */
+    return ir_unary(ir, (from->sign && from->type != TYPE_POINTER) ? IR_OP_SEXT : IR_OP_ZEXT, target, value);
+}
+
+/* a value usable as the condition of a branch */
+static ir_value_t *ir_condition(ir_lower_t *ir, ast_t *ast) {
+    ir_value_t *value = ir_expression(ir, ast);
+    if (!value)
+        compile_ice("ir_condition");
+    if (ir_compare(value))
+        return value;
+    return ir_compare_zero(ir, IR_OP_NE, IR_TYPE_I32, value);
+}
+
+/* memory */
+static ir_value_t *ir_offset(ir_lower_t *ir, ir_value_t *address, int offset) {
+    if (!offset)
+        return address;
+    return ir_binary(ir, IR_OP_ADD, IR_TYPE_PTR, address, ir_constant(ir, IR_TYPE_I64, offset));
+}
+
+static ir_value_t *ir_load(ir_lower_t *ir, ir_value_t *address, data_type_t *type) {
+    switch (type->type) {
+        case TYPE_ARRAY:
+        case TYPE_STRUCTURE:
+        case TYPE_FUNCTION:
+            return address;
+        default:
+            break;
+    }
+
+    ir_value_t *value = ir_unary(ir, IR_OP_LOAD, ir_type(type), address);
+    if (type->bitfield.size <= 0)
+        return value;
+
+    ir_type_t t = value->type;
+    value = ir_binary(ir, IR_OP_SHR, t, value, ir_constant(ir, t, type->bitfield.offset));
+    return ir_binary(ir, IR_OP_AND, t, value, ir_constant(ir, t, (1L << type->bitfield.size) - 1));
+}
+
+static void ir_store(ir_lower_t *ir, ir_value_t *address, ir_value_t *value, data_type_t *type) {
+    if (type->type == TYPE_STRUCTURE || type->type == TYPE_ARRAY) {
+        ir_value_t *copy = ir_binary(ir, IR_OP_COPY, IR_TYPE_VOID, address, value);
+        copy->integer    = type->size;
+        return;
+    }
+
+    if (type->bitfield.size > 0) {
+        ir_type_t t    = value->type;
+        long      mask = (1L << type->bitfield.size) - 1;
+        ir_value_t *old = ir_unary(ir, IR_OP_LOAD, t, address);
+        value = ir_binary(ir, IR_OP_AND, t, value, ir_constant(ir, t, mask));
+        value = ir_binary(ir, IR_OP_SHL, t, value, ir_constant(ir, t, type->bitfield.offset));
+        old   = ir_binary(ir, IR_OP_AND, t, old, ir_constant(ir, t, ~(mask << type->bitfield.offset)));
+        value = ir_binary(ir, IR_OP_OR, t, old, value);
+    }
+
+    ir_value_t *store = ir_binary(ir, IR_OP_STORE, IR_TYPE_VOID, address, value);
+    store->memory     = ir_type(type);
+}
+
+static void ir_initialize(ir_lower_t *ir, ir_value_t *address, list_t *init, int size) {
+    ir_value_t *zero = ir_unary(ir, IR_OP_ZERO, IR_TYPE_VOID, address);
+    zero->integer    = size;
+
+    for (list_iterator_t *it = list_iterator(init); !list_iterator_end(it); ) {
+        ast_t      *node  = list_iterator_next(it);
+        ir_value_t *value = ir_expression(ir, node->init.value);
+        value = ir_convert(ir, value, node->init.value->ctype, node->init.type);
+        ir_store(ir, ir_offset(ir, address, node->init.offset), value, node->init.type);
+    }
+}
+
+static ir_value_t *ir_slot(ir_lower_t *ir, ast_t *variable) {
+    ir_value_t *slot = ir_value(ir, IR_OP_SLOT, IR_TYPE_PTR);
+    slot->integer    = variable->ctype->size;
+    slot->name       = variable->variable.name;
+    list_push(ir->variables, pair_create(variable, slot));
+    return slot;
+}
+
+static ir_value_t *ir_variable(ir_lower_t *ir, ast_t *ast) {
+    ir_value_t *slot = NULL;
+    for (list_iterator_t *it = list_iterator(ir->variables); !list_iterator_end(it); ) {
+        pair_t *pair = list_iterator_next(it);
+        if (pair->first == ast) {
+            slot = pair->second;
+            break;
+        }
+    }
+    if (!slot)
+        compile_ice("ir_variable (%s)", ast->variable.name);
+
+    /* compound literals are initialized where they're first used */
+    if (ast->variable.init) {
+        for (list_iterator_t *it = list_iterator(ir->initialized); !list_iterator_end(it); )
+            if (list_iterator_next(it) == ast)
+                return slot;
+        list_push(ir->initialized, ast);
+        ir_initialize(ir, slot, ast->variable.init, ast->ctype->size);
+    }
+    return slot;
+}
+
+static ir_value_t *ir_address(ir_lower_t *ir, ast_t *ast) {
+    ir_value_t *value;
+    switch (ast->type) {
+        case AST_TYPE_VAR_LOCAL:
+            return ir_variable(ir, ast);
+        case AST_TYPE_VAR_GLOBAL:
+            value         = ir_value(ir, IR_OP_SYMBOL, IR_TYPE_PTR);
+            value->symbol = ast->variable.label;
+            return value;
+        case AST_TYPE_DEREFERENCE:
+            return ir_expression(ir, ast->unary.operand);
+        case AST_TYPE_STRUCT:
+            return ir_offset(ir, ir_address(ir, ast->structure), ast->ctype->offset);
+        default:
+            break;
+    }
+    compile_ice("ir_address");
+}
+
+/* expressions */
+static ir_value_t *ir_pointer_arithmetic(ir_lower_t *ir, ast_t *ast) {
+    ast_t *pointer = ast->left;
+    ast_t *integer = ast->right;
+    if (!ir_pointer(pointer->ctype)) {
+        pointer = ast->right;
+        integer = ast->left;
+    }
+    if (!ir_pointer(pointer->ctype))
+        compile_ice("ir_pointer_arithmetic");
+
+    ir_value_t *left  = ir_expression(ir, ast->left);
+    ir_value_t *right = ir_expression(ir, ast->right);
+    int         size  = pointer->ctype->pointer->size;
+
+    /* difference of two pointers */
+    if (ir_pointer(integer->ctype)) {
+        ir_value_t *value = ir_binary(ir, IR_OP_SUB, IR_TYPE_I64, left, right);
+        if (size > 1)
+            value = ir_binary(ir, IR_OP_DIV, IR_TYPE_I64, value, ir_constant(ir, IR_TYPE_I64, size));
+        return value;
+    }
+
+    ir_value_t *index = (pointer == ast->left) ? right : left;
+    index = ir_convert(ir, index, integer->ctype, ast_data_table[AST_DATA_LONG]);
+    if (size > 1)
+        index = ir_binary(ir, IR_OP_MUL, IR_TYPE_I64, index, ir_constant(ir, IR_TYPE_I64, size));
+
+    if (pointer == ast->left)
+        return ir_binary(ir, ast->type == '-' ? IR_OP_SUB : IR_OP_ADD, IR_TYPE_PTR, left, index);
+    return ir_binary(ir, IR_OP_ADD, IR_TYPE_PTR, right, index);
+}
+
+/* the type both sides of a comparison are converted to */
+static data_type_t *ir_comparision_type(ast_t *ast) {
+    if (conv_capable(ast->left->ctype) && conv_capable(ast->right->ctype))
+        return conv_senority(ast->left->ctype, ast->right->ctype);
+    if (ir_pointer(ast->left->ctype))
+        return ast_array_convert(ast->left->ctype);
+    return ast_array_convert(ast->right->ctype);
+}
+
+static ir_value_t *ir_comparision(ir_lower_t *ir, ast_t *ast) {
+    static const ir_op_t table[][2] = {
+        /* signed     unsigned */
+        { IR_OP_LT,   IR_OP_ULT },
+        { IR_OP_GT,   IR_OP_UGT },
+        { IR_OP_LE,   IR_OP_ULE },
+        { IR_OP_GE,   IR_OP_UGE },
+        { IR_OP_EQ,   IR_OP_EQ  },
+        { IR_OP_NE,   IR_OP_NE  }
+    };
+
+    int index;
+    switch (ast->type) {
+        case '<':             index = 0; break;
+        case '>':             index = 1; break;
+        case AST_TYPE_LEQUAL: index = 2; break;
+        case AST_TYPE_GEQUAL: index = 3; break;
+        case AST_TYPE_EQUAL:  index = 4; break;
+        default:              index = 5; break;
+    }
+
+    data_type_t *type  = ir_comparision_type(ast);
+    ir_value_t  *left  = ir_convert(ir, ir_expression(ir, ast->left),  ast->left->ctype,  type);
+    ir_value_t  *right = ir_convert(ir, ir_expression(ir, ast->right), ast->right->ctype, type);
+    bool         sign  = type->sign || ast_type_isfloating(type);
+
+    return ir_binary(ir, table[index][!sign], ir_type(ast->ctype), left, right);
+}
+
+static ir_value_t *ir_arithmetic(ir_lower_t *ir, ast_t *ast) {
+    ir_op_t op;
+    bool    sign = ast->ctype->sign || ast_type_isfloating(ast->ctype);
+
+    switch (ast->type) {
+        case '+':              op = IR_OP_ADD;                       break;
+        case '-':              op = IR_OP_SUB;                       break;
+        case '*':              op = IR_OP_MUL;                       break;
+        case '/':              op = sign ? IR_OP_DIV : IR_OP_UDIV;   break;
+        case '%':              op = sign ? IR_OP_MOD : IR_OP_UMOD;   break;
+        case '&':              op = IR_OP_AND;                       break;
+        case '|':              op = IR_OP_OR;                        break;
+        case '^':              op = IR_OP_XOR;                       break;
+        case AST_TYPE_LSHIFT:  op = IR_OP_SHL;                       break;
+        case AST_TYPE_RSHIFT:  op = IR_OP_SAR;                       break;
+        case AST_TYPE_LRSHIFT: op = IR_OP_SHR;                       break;
+        default:
+            compile_ice("ir_arithmetic");
+    }
+
+    ir_value_t *left  = ir_convert(ir, ir_expression(ir, ast->left),  ast->left->ctype,  ast->ctype);
+    ir_value_t *right = ir_convert(ir, ir_expression(ir, ast->right), ast->right->ctype, ast->ctype);
+    return ir_binary(ir, op, ir_type(ast->ctype), left, right);
+}
+
+static ir_value_t *ir_binary_expression(ir_lower_t *ir, ast_t *ast) {
+    switch (ast->type) {
+        case '<':
+        case '>':
+        case AST_TYPE_EQUAL:
+        case AST_TYPE_GEQUAL:
+        case AST_TYPE_LEQUAL:
+        case AST_TYPE_NEQUAL:
+            return ir_comparision(ir, ast);
+    }
+
+    if (ast->ctype->type == TYPE_POINTER)
+        return ir_pointer_arithmetic(ir, ast);
+    if (!ast->left || !ast->right)
+        compile_ice("ir_binary_expression");
+    if (ir_pointer(ast->left->ctype) && ast->type == '-')
+        return ir_pointer_arithmetic(ir, ast);
+    return ir_arithmetic(ir, ast);
+}
+
+static ir_value_t *ir_phi(ir_lower_t *ir, ir_type_t type) {
+    ir_value_t *phi = ir_value(ir, IR_OP_PHI, type);
+    phi->arguments  = list_create();
+    phi->incoming   = list_create();
+    return phi;
+}
+
+static void ir_phi_incoming(ir_value_t *phi, ir_value_t *value, ir_block_t *block) {
+    list_push(phi->arguments, value);
+    list_push(phi->incoming, block);
+}
+
+static ir_value_t *ir_logical(ir_lower_t *ir, ast_t *ast) {
+    bool        and   = (ast->type == AST_TYPE_AND);
+    ir_block_t *right = ir_block_create(ir);
+    ir_block_t *end   = ir_block_create(ir);
+
+    ir_value_t *value = ir_condition(ir, ast->left);
+    ir_value_t *skip  = ir_constant(ir, IR_TYPE_I32, !and);
+    ir_block_t *from  = ir->block;
+    ir_branch(ir, value, and ? right : end, and ? end : right);
+
+    ir->block = right;
+    value = ir_condition(ir, ast->right);
+    if (value->type != IR_TYPE_I32)
+        value = ir_unary(ir, IR_OP_ZEXT, IR_TYPE_I32, value);
+    ir_block_t *last = ir->block;
+    ir_jump(ir, end);
+
+    ir->block = end;
+    ir_value_t *phi = ir_phi(ir, IR_TYPE_I32);
+    ir_phi_incoming(phi, skip,  from);
+    ir_phi_incoming(phi, value, last);
+    return phi;
+}
+
+static ir_value_t *ir_conditional_arm(ir_lower_t *ir, ast_t *ast, ast_t *arm, ir_block_t **from) {
+    ir_value_t *value = ir_expression(ir, arm);
+    if (value && ast->type == AST_TYPE_EXPRESSION_TERNARY && arm->ctype)
+        value = ir_convert(ir, value, arm->ctype, ast->ctype);
+    *from = ir->block;
+    return value;
+}
+
+static ir_value_t *ir_conditional(ir_lower_t *ir, ast_t *ast) {
+    ir_block_t *then = ir_block_create(ir);
+    ir_block_t *last = ir_block_create(ir);
+    ir_block_t *end  = ast->ifstmt.last ? ir_block_create(ir) : last;
+    ir_block_t *from;
+    ir_block_t *into;
+    ir_value_t *a;
+
+    if (!ast->ifstmt.then && ast->ifstmt.last) {
+        /* a ?: b yields the condition itself when it's true */
+        ir_value_t *value = ir_expression(ir, ast->ifstmt.cond);
+        a    = ir_convert(ir, value, ast->ifstmt.cond->ctype, ast->ctype);
+        from = ir->block;
+        ir_branch(ir, ir_compare(value) ? value : ir_compare_zero(ir, IR_OP_NE, IR_TYPE_I32, value), end, last);
+    } else {
+        ir_branch(ir, ir_condition(ir, ast->ifstmt.cond), then, last);
+        ir->block = then;
+        a = ir_conditional_arm(ir, ast, ast->ifstmt.then, &from);
+        ir_jump(ir, end);
+    }
+
+    if (!ast->ifstmt.last) {
+        ir->block = end;
+        return NULL;
+    }
+
+    ir->block = last;
+    ir_value_t *b = ir_conditional_arm(ir, ast, ast->ifstmt.last, &into);
+    ir_jump(ir, end);
+
+    ir->block = end;
+    if (ast->type != AST_TYPE_EXPRESSION_TERNARY || !ast->ctype || ast->ctype->type == TYPE_VOID)
+        return NULL;
+
+    /* only arms which reach the end contribute a value */
+    ir_value_t *phi = ir_phi(ir, ir_type(ast->ctype));
+    if (a && from)
+        ir_phi_incoming(phi, a, from);
+    if (b && into)
+        ir_phi_incoming(phi, b, into);
+    return phi;
+}
+
+static ir_value_t *ir_increment(ir_lower_t *ir, ast_t *ast, bool add, bool post) {
+    data_type_t *type    = ast->unary.operand->ctype;
+    ir_value_t  *address = ir_address(ir, ast->unary.operand);
+    ir_value_t  *old     = ir_load(ir, address, type);
+    ir_value_t  *step    = ir_constant(ir, type->type == TYPE_POINTER ? IR_TYPE_I64 : old->type,
+                                       type->type == TYPE_POINTER ? type->pointer->size : 1);
+    ir_value_t  *value   = ir_binary(ir, add ? IR_OP_ADD : IR_OP_SUB, old->type, old, step);
+
+    ir_store(ir, address, value, type);
+    return post ? old : value;
+}
+
+static ir_value_t *ir_assign(ir_lower_t *ir, ast_t *ast) {
+    ir_value_t *value = ir_expression(ir, ast->right);
+    value = ir_convert(ir, value, ast->right->ctype, ast->left->ctype);
+    ir_store(ir, ir_address(ir, ast->left), value, ast->left->ctype);
+    return value;
+}
+
+static bool ir_aggregate(data_type_t *type) {
+    return type->type == TYPE_STRUCTURE;
+}
+
+static ir_value_t *ir_call(ir_lower_t *ir, ast_t *ast) {
+    list_t *arguments = list_create();
+    for (list_iterator_t *it = list_iterator(ast->function.call.args); !list_iterator_end(it); ) {
+        ast_t      *argument = list_iterator_next(it);
+        ir_value_t *value    = ir_expression(ir, argument);
+
+        /* the caller extends arguments narrower than int */
+        if (ast_type_isinteger(argument->ctype) && argument->ctype->size < 4)
+            value = ir_convert(ir, value, argument->ctype, ast_data_table[AST_DATA_INT]);
+        if (ir_aggregate(argument->ctype))
+            ir->function->aggregates = true;
+        list_push(arguments, value);
+    }
+    if (ir_aggregate(ast->ctype))
+        ir->function->aggregates = true;
+
+    ir_value_t *callee = NULL;
+    if (ast->type == AST_TYPE_POINTERCALL)
+        callee = ir_expression(ir, ast->function.call.functionpointer);
+
+    data_type_t *type  = callee ? ast->function.call.functionpointer->ctype->pointer
+                                : ast->function.call.type;
+    ir_value_t  *value = ir_unary(ir, IR_OP_CALL, ir_type(ast->ctype), callee);
+    value->arguments   = arguments;
+    value->symbol      = callee ? NULL : ast->function.name;
+    value->variadic    = type->hasdots;
+    return value;
+}
+
+static ir_value_t *ir_literal(ir_lower_t *ir, ast_t *ast) {
+    ir_type_t type = ir_type(ast->ctype);
+    if (ir_type_isfloating(type)) {
+        ir_value_t *value = ir_value(ir, IR_OP_FLOATING, type);
+        value->floating   = ast->floating.value;
+        return value;
+    }
+    return ir_constant(ir, type, ast->integer);
+}
+
+/* statements */
+
+/*
+ * Loops are rotated like the code generator does, an iteration ends in
+ * the only conditional branch at the bottom. The condition is tested once
+ * up front to skip the loop, or when it can't be duplicated the loop is
+ * entered with a jump to the test at the bottom.
+ */
+static void ir_loop(ir_lower_t *ir, ast_t *ast) {
+    ir_block_t *breaks    = ir->breaks;
+    ir_block_t *continues = ir->continues;
+    ir_block_t *body      = ir_block_create(ir);
+    ir_block_t *step      = ir_block_create(ir);
+    ir_block_t *test      = ir_block_create(ir);
+    ir_block_t *end       = ir_block_create(ir);
+    ast_t      *cond      = ast->forstmt.cond;
+
+    if (ast->type == AST_TYPE_STATEMENT_FOR && ast->forstmt.init)
+        ir_expression(ir, ast->forstmt.init);
+
+    /* do loops enter the body first */
+    if (ast->type != AST_TYPE_STATEMENT_DO && cond) {
+        if (ast_duplicable(cond))
+            ir_branch(ir, ir_condition(ir, cond), body, end);
+        else
+            ir_jump(ir, test);
+    }
+
+    ir->breaks    = end;
+    ir->continues = step;
+
+    ir_begin(ir, body);
+    ir_expression(ir, ast->forstmt.body);
+    ir_begin(ir, step);
+
+    if (ast->type == AST_TYPE_STATEMENT_FOR && ast->forstmt.step)
+        ir_expression(ir, ast->forstmt.step);
+
+    ir_begin(ir, test);
+    if (cond)
+        ir_branch(ir, ir_condition(ir, cond), body, end);
+    else
+        ir_jump(ir, body);
+
+    ir->block     = end;
+    ir->breaks    = breaks;
+    ir->continues = continues;
+}
+
+static void ir_switch(ir_lower_t *ir, ast_t *ast) {
+    ir_block_t *breaks   = ir->breaks;
+    ir_value_t *dispatch = ir->dispatch;
+    ir_block_t *end      = ir_block_create(ir);
+
+    ir_value_t *value = ir_expression(ir, ast->switchstmt.expr);
+    ir->dispatch = ir_unary(ir, IR_OP_SWITCH, IR_TYPE_VOID, value);
+    ir->dispatch->targets[0] = end;
+    ir->dispatch->incoming   = list_create();
+    ir->breaks               = end;
+
+    ir_expression(ir, ast->switchstmt.body);
+    ir_begin(ir, end);
+
+    ir->breaks   = breaks;
+    ir->dispatch = dispatch;
+}
+
+static void ir_case(ir_lower_t *ir, ast_t *ast) {
+    if (!ir->dispatch)
+        compile_ice("ir_case");
+
+    ir_block_t *block = ir_block_create(ir);
+    ir_begin(ir, block);
+
+    if (ast->type == AST_TYPE_STATEMENT_DEFAULT) {
+        ir->dispatch->targets[0] = block;
+        return;
+    }
+
+    ir_case_t *entry = memory_allocate(sizeof(ir_case_t));
+    entry->begin = ast->casebeg;
+    entry->end   = ast->caseend;
+    entry->block = block;
+    list_push(ir->dispatch->incoming, entry);
+}
+
+static void ir_return(ir_lower_t *ir, ast_t *ast) {
+    ir_value_t *value = NULL;
+    if (ast->returnstmt) {
+        value = ir_expression(ir, ast->returnstmt);
+        value = ir_convert(ir, value, ast->returnstmt->ctype, ir->returntype);
+    }
+    ir_unary(ir, IR_OP_RETURN, value ? value->type : IR_TYPE_VOID, value);
+}
+
+static void ir_declaration(ir_lower_t *ir, ast_t *ast) {
+    if (!ast->decl.init)
+        return;
+    ir_initialize(ir, ir_variable(ir, ast->decl.var), ast->decl.init, ast->decl.var->ctype->size);
+}
+
+static ir_value_t *ir_compound(ir_lower_t *ir, ast_t *ast) {
+    ir_value_t *value = NULL;
+    for (list_iterator_t *it = list_iterator(ast->compound); !list_iterator_end(it); )
+        value = ir_expression(ir, list_iterator_next(it));
+    return value;
+}
+
+static ir_value_t *ir_expression(ir_lower_t *ir, ast_t *ast) {
+    ir_value_t *value;
+
+    if (!ast)
+        return NULL;
+
+    switch (ast->type) {
+        case AST_TYPE_STATEMENT_IF:
+        case AST_TYPE_EXPRESSION_TERNARY:
+            return ir_conditional(ir, ast);
+
+        case AST_TYPE_STATEMENT_FOR:
+        case AST_TYPE_STATEMENT_WHILE:
+        case AST_TYPE_STATEMENT_DO:
+            ir_loop(ir, ast);
+            return NULL;
+
+        case AST_TYPE_STATEMENT_SWITCH:
+            ir_switch(ir, ast);
+            return NULL;
+
+        case AST_TYPE_STATEMENT_CASE:
+        case AST_TYPE_STATEMENT_DEFAULT:
+            ir_case(ir, ast);
+            return NULL;
+
+        case AST_TYPE_STATEMENT_RETURN:
+            ir_return(ir, ast);
+            return NULL;
+
+        case AST_TYPE_STATEMENT_BREAK:
+            ir_jump(ir, ir->breaks);
+            ir->block = NULL;
+            return NULL;
+
+        case AST_TYPE_STATEMENT_CONTINUE:
+            ir_jump(ir, ir->continues);
+            ir->block = NULL;
+            return NULL;
+
+        case AST_TYPE_STATEMENT_COMPOUND:
+            return ir_compound(ir, ast);
+
+        case AST_TYPE_STATEMENT_GOTO:
+            ir_jump(ir, ir_label(ir, ast->gotostmt.label));
+            ir->block = NULL;
+            return NULL;
+
+        case AST_TYPE_STATEMENT_LABEL:
+            ir_begin(ir, ir_label(ir, ast->gotostmt.label));
+            return NULL;
+
+        case AST_TYPE_STATEMENT_GOTO_COMPUTED:
+            ir_unary(ir, IR_OP_JUMP_INDIRECT, IR_TYPE_VOID, ir_expression(ir, ast->unary.operand));
+            return NULL;
+
+        case AST_TYPE_STATEMENT_LABEL_COMPUTED:
+            value = ir_value(ir, IR_OP_LABEL, IR_TYPE_PTR);
+            value->targets[0] = ir_label(ir, ast->gotostmt.label);
+            value->targets[0]->addressed = true;
+            return value;
+
+        case AST_TYPE_DECLARATION:
+            ir_declaration(ir, ast);
+            return NULL;
+
+        case AST_TYPE_CALL:
+        case AST_TYPE_POINTERCALL:
+            return ir_call(ir, ast);
+
+        case AST_TYPE_LITERAL:
+            return ir_literal(ir, ast);
+
+        case AST_TYPE_STRING:
+            value = ir_value(ir, IR_OP_STRING, IR_TYPE_PTR);
+            value->symbol = ast->string.data;
+            return value;
+
+        case AST_TYPE_VAR_LOCAL:
+        case AST_TYPE_VAR_GLOBAL:
+        case AST_TYPE_STRUCT:
+            return ir_load(ir, ir_address(ir, ast), ast->ctype);
+
+        case AST_TYPE_DEREFERENCE:
+            value = ir_load(ir, ir_expression(ir, ast->unary.operand), ast->unary.operand->ctype->pointer);
+            return ir_convert(ir, value, ast->unary.operand->ctype->pointer, ast->ctype);
+
+        case AST_TYPE_ADDRESS:
+            return ir_address(ir, ast->unary.operand);
+
+        case AST_TYPE_VA_START:
+            ir_unary(ir, IR_OP_VA_START, IR_TYPE_VOID, ir_expression(ir, ast->ap));
+            return NULL;
+
+        case AST_TYPE_VA_ARG:
+            return ir_unary(ir, IR_OP_VA_ARG, ir_type(ast->ctype), ir_expression(ir, ast->ap));
+
+        case AST_TYPE_CONVERT:
+        case AST_TYPE_EXPRESSION_CAST:
+            value = ir_expression(ir, ast->unary.operand);
+            return ir_convert(ir, value, ast->unary.operand->ctype, ast->ctype);
+
+        case '!':
+            value = ir_expression(ir, ast->unary.operand);
+            return ir_compare_zero(ir, IR_OP_EQ, IR_TYPE_I32, value);
+
+        case AST_TYPE_NEGATE:
+            value = ir_expression(ir, ast->unary.operand);
+            return ir_unary(ir, IR_OP_NEG, value->type, value);
+
+        case '~':
+            value = ir_expression(ir, ast->left);
+            return ir_unary(ir, IR_OP_NOT, value->type, value);
+
+        case AST_TYPE_AND:
+        case AST_TYPE_OR:
+            return ir_logical(ir, ast);
+
+        case AST_TYPE_POST_INCREMENT: return ir_increment(ir, ast, true,  true);
+        case AST_TYPE_POST_DECREMENT: return ir_increment(ir, ast, false, true);
+        case AST_TYPE_PRE_INCREMENT:  return ir_increment(ir, ast, true,  false);
+        case AST_TYPE_PRE_DECREMENT:  return ir_increment(ir, ast, false, false);
+
+        case ',':
+            ir_expression(ir, ast->left);
+            return ir_expression(ir, ast->right);
+
+        case '=':
+            return ir_assign(ir, ast);
+
+        default:
+            break;
+    }
+    return ir_binary_expression(ir, ast);
+}
+
+/*
+ * Once everything is lowered the edges between blocks are filled in and
+ * anything which can't be reached from the entry is dropped. The values
+ * are numbered again in order of the remaining blocks.
+ */
+static void ir_edge(ir_block_t *from, ir_block_t *to) {
+    for (list_iterator_t *it = list_iterator(from->successors); !list_iterator_end(it); )
+        if (list_iterator_next(it) == to)
+            return;
+    list_push(from->successors, to);
+}
+
+static void ir_successors(ir_lower_t *ir, ir_block_t *block) {
+    ir_value_t *terminator = list_tail(block->values);
+    switch (terminator->op) {
+        case IR_OP_JUMP:
+            ir_edge(block, terminator->targets[0]);
+            break;
+        case IR_OP_BRANCH:
+            ir_edge(block, terminator->targets[0]);
+            ir_edge(block, terminator->targets[1]);
+            break;
+        case IR_OP_SWITCH:
+            for (list_iterator_t *it = list_iterator(terminator->incoming); !list_iterator_end(it); )
+                ir_edge(block, ((ir_case_t*)list_iterator_next(it))->block);
+            ir_edge(block, terminator->targets[0]);
+            break;
+        case IR_OP_JUMP_INDIRECT:
+            for (list_iterator_t *it = list_iterator(ir->blocks); !list_iterator_end(it); ) {
+                ir_block_t *target = list_iterator_next(it);
+                if (target->addressed)
+                    ir_edge(block, target);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void ir_order(ir_block_t *block, list_t *order) {
+    block->id = 0;
+
+    /* backwards so the first successor comes first in the final order */
+    for (list_iterator_t *it = list_iterator(list_reverse(block->successors)); !list_iterator_end(it); ) {
+        ir_block_t *next = list_iterator_next(it);
+        if (next->id == -1)
+            ir_order(next, order);
+    }
+    list_push(order, block);
+}
+
+static void ir_finish(ir_lower_t *ir) {
+    ir_function_t *function = ir->function;
+
+    /* falling off the end of the function */
+    if (ir->block)
+        ir_unary(ir, IR_OP_RETURN, IR_TYPE_VOID, NULL);
+
+    for (list_iterator_t *it = list_iterator(ir->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        if (!ir_terminator(list_tail(block->values))) {
+            ir->block = block;
+            ir_unary(ir, IR_OP_RETURN, IR_TYPE_VOID, NULL);
+        }
+        ir_successors(ir, block);
+        block->id = -1;
+    }
+
+    /* blocks are kept in reverse postorder, which drops unreachable ones */
+    list_t *order = list_create();
+    ir_order(ir->entry, order);
+    while (list_length(order))
+        list_push(function->blocks, list_pop(order));
+
+    int blocks = 0;
+    int values = 0;
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        block->id = blocks++;
+        for (list_iterator_t *st = list_iterator(block->successors); !list_iterator_end(st); )
+            list_push(((ir_block_t*)list_iterator_next(st))->predecessors, block);
+    }
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            value->id = (ir_terminator(value) || value->type == IR_TYPE_VOID) ? -1 : values++;
+
+            if (value->op != IR_OP_PHI)
+                continue;
+
+            /* drop incoming values of predecessors which were removed */
+            list_t *arguments = list_create();
+            list_t *incoming  = list_create();
+            list_iterator_t *at = list_iterator(value->arguments);
+            list_iterator_t *bt = list_iterator(value->incoming);
+            while (!list_iterator_end(at)) {
+                ir_value_t *argument = list_iterator_next(at);
+                ir_block_t *from     = list_iterator_next(bt);
+                if (from->id == -1)
+                    continue;
+                list_push(arguments, argument);
+                list_push(incoming,  from);
+            }
+            value->arguments = arguments;
+            value->incoming  = incoming;
+        }
+    }
+    function->values = values;
+}
+
+ir_function_t *ir_lower(ast_t *function) {
+    ir_lower_t ir = {
+        .function    = memory_allocate(sizeof(ir_function_t)),
+        .returntype  = function->ctype->returntype,
+        .blocks      = list_create(),
+        .variables   = list_create(),
+        .initialized = list_create(),
+        .labels      = table_create(NULL)
+    };
+
+    ir.function->name       = function->function.name;
+    ir.function->type       = ir_type(function->ctype->returntype);
+    ir.function->blocks     = list_create();
+    ir.function->parameters = list_create();
+    ir.function->values     = 0;
+    ir.function->aggregates = ir_aggregate(function->ctype->returntype);
+
+    ir.entry = ir.block = ir_block_create(&ir);
+
+    /* parameters are stored into slots like any other local */
+    int index = 0;
+    for (list_iterator_t *it = list_iterator(function->function.params); !list_iterator_end(it); ) {
+        ast_t      *param = list_iterator_next(it);
+        ir_value_t *value = ir_value(&ir, IR_OP_PARAMETER, ir_type(param->ctype));
+        if (ir_aggregate(param->ctype))
+            ir.function->aggregates = true;
+        value->integer    = index++;
+        value->name       = param->variable.name;
+        list_push(ir.function->parameters, value);
+    }
+
+    list_iterator_t *pt = list_iterator(function->function.params);
+    list_iterator_t *vt = list_iterator(ir.function->parameters);
+    while (!list_iterator_end(pt)) {
+        ast_t *param = list_iterator_next(pt);
+        ir_store(&ir, ir_slot(&ir, param), list_iterator_next(vt), param->ctype);
+    }
+
+    for (list_iterator_t *it = list_iterator(function->function.locals); !list_iterator_end(it); )
+        ir_slot(&ir, list_iterator_next(it));
+
+    ir_expression(&ir, function->function.body);
+    ir_finish(&ir);
+    ir_promote(ir.function);
+
+    return ir.function;
+}
+
+/*
+ * Liveness, with a bit for every value in the sets of the blocks. A value
+ * is live into a block when it's used there before being defined or it's
+ * live out of it without being defined there. The arguments of a phi are
+ * used at the end of the predecessor they flow in from.
+ */
+#define IR_LIVE_BITS (sizeof(unsigned long) * CHAR_BIT)
+
+typedef struct {
+    unsigned long *in;
+    unsigned long *out;
+    list_t        *values; /* of the block, last first */
+} ir_live_t;
+
+static bool ir_live_test(unsigned long *set, int id) {
+    return set[id / IR_LIVE_BITS] & (1UL << (id % IR_LIVE_BITS));
+}
+
+static void ir_live_set(unsigned long *set, int id) {
+    set[id / IR_LIVE_BITS] |= 1UL << (id % IR_LIVE_BITS);
+}
+
+static void ir_live_clear(unsigned long *set, int id) {
+    set[id / IR_LIVE_BITS] &= ~(1UL << (id % IR_LIVE_BITS));
+}
+
+static void ir_live_use(unsigned long *set, ir_value_t *value) {
+    if (value && value->id != -1)
+        ir_live_set(set, value->id);
+}
+
+/* the values a phi of a block takes from one of it's predecessors */
+static void ir_live_phis(unsigned long *set, ir_block_t *from, ir_block_t *to) {
+    for (list_iterator_t *it = list_iterator(to->values); !list_iterator_end(it); ) {
+        ir_value_t *phi = list_iterator_next(it);
+        if (phi->op != IR_OP_PHI)
+            break;
+        list_iterator_t *at = list_iterator(phi->arguments);
+        list_iterator_t *bt = list_iterator(phi->incoming);
+        while (!list_iterator_end(at)) {
+            ir_value_t *argument = list_iterator_next(at);
+            if (list_iterator_next(bt) == from)
+                ir_live_use(set, argument);
+        }
+    }
+}
+
+static bool ir_live_block(ir_live_t *live, ir_block_t *block, unsigned long *set, size_t words) {
+    unsigned long *out = live[block->id].out;
+    unsigned long *in  = live[block->id].in;
+    bool           changed = false;
+
+    for (list_iterator_t *it = list_iterator(block->successors); !list_iterator_end(it); ) {
+        ir_block_t    *next = list_iterator_next(it);
+        unsigned long *into = live[next->id].in;
+        for (size_t i = 0; i < words; i++) {
+            unsigned long merged = out[i] | into[i];
+            changed |= merged != out[i];
+            out[i] = merged;
+        }
+        ir_live_phis(out, block, next);
+    }
+
+    /* walk the block backwards from what's live out of it */
+    memcpy(set, out, sizeof(unsigned long) * words);
+    for (list_iterator_t *it = list_iterator(live[block->id].values); !list_iterator_end(it); ) {
+        ir_value_t *value = list_iterator_next(it);
+        if (value->id != -1)
+            ir_live_clear(set, value->id);
+        if (value->op == IR_OP_PHI)
+            continue;
+        ir_live_use(set, value->operands[0]);
+        ir_live_use(set, value->operands[1]);
+        if (value->op == IR_OP_CALL)
+            for (list_iterator_t *at = list_iterator(value->arguments); !list_iterator_end(at); )
+                ir_live_use(set, list_iterator_next(at));
+    }
+
+    for (size_t i = 0; i < words; i++) {
+        changed |= set[i] != in[i];
+        in[i] = set[i];
+    }
+    return changed;
+}
+
+static void ir_live_extend(ir_interval_t *interval, int position) {
+    if (interval->begin == -1 || position < interval->begin)
+        interval->begin = position;
+    if (position > interval->end)
+        interval->end = position;
+}
+
+ir_interval_t *ir_live(ir_function_t *function) {
+    int            blocks    = list_length(function->blocks);
+    size_t         words     = function->values / IR_LIVE_BITS + 1;
+    ir_live_t     *live      = memory_allocate(sizeof(ir_live_t) * (blocks + 1));
+    ir_interval_t *intervals = memory_allocate(sizeof(ir_interval_t) * (function->values + 1));
+    int           *begin     = memory_allocate(sizeof(int) * (blocks + 1));
+    int           *end       = memory_allocate(sizeof(int) * (blocks + 1));
+    unsigned long *set       = memory_allocate(sizeof(unsigned long) * words);
+    list_t        *reverse   = list_reverse(function->blocks);
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        ir_live_t  *entry = &live[block->id];
+        entry->in     = memory_allocate(sizeof(unsigned long) * words);
+        entry->out    = memory_allocate(sizeof(unsigned long) * words);
+        entry->values = list_reverse(block->values);
+        memset(entry->in,  0, sizeof(unsigned long) * words);
+        memset(entry->out, 0, sizeof(unsigned long) * words);
+    }
+    for (int i = 0; i < function->values; i++)
+        intervals[i] = (ir_interval_t){ -1, -1 };
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (list_iterator_t *it = list_iterator(reverse); !list_iterator_end(it); )
+            changed |= ir_live_block(live, list_iterator_next(it), set, words);
+    }
+
+    /* definitions and uses, then the blocks values are live through */
+    int position = 0;
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        begin[block->id] = position;
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); position++) {
+            ir_value_t *value = list_iterator_next(vt);
+            if (value->id != -1)
+                ir_live_extend(&intervals[value->id], position);
+            if (value->op == IR_OP_PHI)
+                continue;
+            for (int i = 0; i < 2; i++)
+                if (value->operands[i] && value->operands[i]->id != -1)
+                    ir_live_extend(&intervals[value->operands[i]->id], position);
+            if (value->op != IR_OP_CALL)
+                continue;
+            for (list_iterator_t *at = list_iterator(value->arguments); !list_iterator_end(at); ) {
+                ir_value_t *argument = list_iterator_next(at);
+                if (argument->id != -1)
+                    ir_live_extend(&intervals[argument->id], position);
+            }
+        }
+        end[block->id] = position - 1;
+    }
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        for (int id = 0; id < function->values; id++) {
+            if (ir_live_test(live[block->id].in, id))
+                ir_live_extend(&intervals[id], begin[block->id]);
+            if (ir_live_test(live[block->id].out, id))
+                ir_live_extend(&intervals[id], end[block->id]);
+        }
+    }
+
+    return intervals;
+}
+
+/*
+ * Promotion of slots to SSA values. A slot which is only ever loaded from
+ * and stored to as a whole, with the same type, never has it's address
+ * escape and can be replaced by the values stored to it. Phis are placed
+ * on the iterated dominance frontier of the blocks storing to it and the
+ * loads are renamed walking the dominator tree. Phis nothing ends up
+ * using, and those merging just one value, are removed afterwards.
+ *
+ * Functions taking the address of a block are left alone, as the edges
+ * of a computed goto can't be split for the copies phis need.
+ */
+typedef struct {
+    ir_function_t *function;
+    ir_block_t   **blocks;      /* by id                                */
+    int           *idom;        /* immediate dominator of each block    */
+    list_t       **children;    /* blocks each block dominates directly */
+    int           *index;       /* of each promoted slot, -1 if it isn't */
+    ir_type_t     *types;       /* of each slot                         */
+    list_t       **stacks;      /* current value of each promoted slot  */
+    list_t       **phis;        /* phis placed at each block            */
+    ir_value_t   **replace;     /* what each value was replaced with    */
+    bool          *removed;
+    ir_value_t    *zeros[IR_TYPE_PTR + 1];
+    list_t        *constants;   /* the zeros, for the entry block      */
+} ir_promote_t;
+
+static ir_value_t *ir_promote_value(ir_promote_t *promote, ir_op_t op, ir_type_t type, ir_block_t *block) {
+    ir_value_t *value = memory_allocate(sizeof(ir_value_t));
+    memset(value, 0, sizeof(ir_value_t));
+    value->op     = op;
+    value->type   = type;
+    value->memory = type;
+    value->id     = promote->function->values++;
+    value->block  = block;
+    return value;
+}
+
+/* what a slot reads as before anything is stored to it */
+static ir_value_t *ir_promote_zero(ir_promote_t *promote, ir_type_t type) {
+    if (!promote->zeros[type]) {
+        ir_block_t *entry = list_head(promote->function->blocks);
+        promote->zeros[type] = ir_promote_value(promote, ir_type_isfloating(type) ? IR_OP_FLOATING : IR_OP_CONSTANT, type, entry);
+        list_push(promote->constants, promote->zeros[type]);
+    }
+    return promote->zeros[type];
+}
+
+static ir_value_t *ir_promote_resolve(ir_promote_t *promote, ir_value_t *value) {
+    while (value && value->id != -1 && promote->replace[value->id])
+        value = promote->replace[value->id];
+    return value;
+}
+
+/* the promoted slot a value accesses, -1 if it doesn't */
+static int ir_promote_slot(ir_promote_t *promote, ir_value_t *value) {
+    ir_value_t *slot = value->operands[0];
+    if (value->op != IR_OP_LOAD && value->op != IR_OP_STORE && value->op != IR_OP_ZERO)
+        return -1;
+    if (!slot || slot->op != IR_OP_SLOT)
+        return -1;
+    return promote->index[slot->id];
+}
+
+static void ir_promote_reject(ir_promote_t *promote, ir_value_t *value) {
+    if (value && value->op == IR_OP_SLOT)
+        promote->index[value->id] = -1;
+}
+
+/* find the slots which can be promoted and the type of each */
+static int ir_promote_candidates(ir_promote_t *promote) {
+    ir_function_t *function = promote->function;
+    int            count    = 0;
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            if (value->op == IR_OP_SLOT) {
+                promote->index[value->id] = 0;
+                promote->types[value->id] = IR_TYPE_VOID;
+            }
+        }
+    }
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            ir_value_t *slot  = value->operands[0];
+            bool        whole = false;
+
+            if (value->arguments)
+                for (list_iterator_t *at = list_iterator(value->arguments); !list_iterator_end(at); )
+                    ir_promote_reject(promote, list_iterator_next(at));
+            ir_promote_reject(promote, value->operands[1]);
+
+            if (!slot || slot->op != IR_OP_SLOT || promote->index[slot->id] == -1)
+                continue;
+
+            switch (value->op) {
+                case IR_OP_LOAD:
+                    whole = value->type == value->memory;
+                    break;
+                case IR_OP_STORE:
+                    whole = value->operands[1]->type == value->memory;
+                    break;
+                case IR_OP_ZERO:
+                    whole = value->integer == slot->integer;
+                    break;
+                default:
+                    break;
+            }
+
+            if (value->op == IR_OP_LOAD || value->op == IR_OP_STORE) {
+                if (ir_type_size(value->memory) != slot->integer)
+                    whole = false;
+                else if (promote->types[slot->id] == IR_TYPE_VOID)
+                    promote->types[slot->id] = value->memory;
+                else if (promote->types[slot->id] != value->memory)
+                    whole = false;
+            }
+
+            if (!whole)
+                promote->index[slot->id] = -1;
+        }
+    }
+
+    for (int id = 0; id < function->values; id++) {
+        if (promote->index[id] == -1)
+            continue;
+        /* a slot only ever zeroed is never read either */
+        if (promote->types[id] == IR_TYPE_VOID)
+            promote->types[id] = IR_TYPE_I64;
+        promote->index[id] = count++;
+    }
+    return count;
+}
+
+static int ir_promote_intersect(int *idom, int a, int b) {
+    while (a != b) {
+        while (a > b)
+            a = idom[a];
+        while (b > a)
+            b = idom[b];
+    }
+    return a;
+}
+
+/* dominators over the blocks in reverse postorder, as Cooper et al. */
+static void ir_promote_dominators(ir_promote_t *promote, int blocks) {
+    for (int i = 0; i < blocks; i++)
+        promote->idom[i] = -1;
+    promote->idom[0] = 0;
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (int i = 1; i < blocks; i++) {
+            int idom = -1;
+            for (list_iterator_t *it = list_iterator(promote->blocks[i]->predecessors); !list_iterator_end(it); ) {
+                int predecessor = ((ir_block_t *)list_iterator_next(it))->id;
+                if (promote->idom[predecessor] == -1)
+                    continue;
+                idom = (idom == -1) ? predecessor : ir_promote_intersect(promote->idom, predecessor, idom);
+            }
+            if (idom != promote->idom[i]) {
+                promote->idom[i] = idom;
+                changed = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < blocks; i++)
+        promote->children[i] = list_create();
+    for (int i = 1; i < blocks; i++)
+        list_push(promote->children[promote->idom[i]], promote->blocks[i]);
+}
+
+/* place phis for a slot on the iterated dominance frontier of it's stores */
+static void ir_promote_place(ir_promote_t *promote, unsigned long **frontiers, int blocks, int slot, ir_type_t type, bool *stored) {
+    bool   *placed = memory_allocate(sizeof(bool) * (blocks + 1));
+    list_t *work   = list_create();
+
+    memset(placed, 0, sizeof(bool) * (blocks + 1));
+    for (int i = 0; i < blocks; i++)
+        if (stored[i])
+            list_push(work, promote->blocks[i]);
+
+    while (list_length(work)) {
+        ir_block_t *block = list_pop(work);
+        for (int i = 0; i < blocks; i++) {
+            if (placed[i] || !ir_live_test(frontiers[block->id], i))
+                continue;
+            placed[i] = true;
+
+            ir_value_t *phi = ir_promote_value(promote, IR_OP_PHI, IR_TYPE_VOID, promote->blocks[i]);
+            phi->type      = type;
+            phi->memory    = type;
+            phi->arguments = list_create();
+            phi->incoming  = list_create();
+            phi->integer   = slot;
+            list_push(promote->phis[i], phi);
+
+            if (!stored[i])
+                list_push(work, promote->blocks[i]);
+        }
+    }
+}
+
+static void ir_promote_push(ir_promote_t *promote, int slot, ir_value_t *value, list_t *pushed) {
+    list_push(promote->stacks[slot], value);
+    list_push(pushed, (void *)(intptr_t)slot);
+}
+
+static ir_value_t *ir_promote_current(ir_promote_t *promote, int slot, ir_type_t type) {
+    if (!list_length(promote->stacks[slot]))
+        return ir_promote_zero(promote, type);
+    return list_tail(promote->stacks[slot]);
+}
+
+static void ir_promote_rename(ir_promote_t *promote, ir_block_t *block) {
+    list_t *pushed = list_create();
+
+    for (list_iterator_t *it = list_iterator(promote->phis[block->id]); !list_iterator_end(it); ) {
+        ir_value_t *phi = list_iterator_next(it);
+        ir_promote_push(promote, phi->integer, phi, pushed);
+    }
+
+    for (list_iterator_t *it = list_iterator(block->values); !list_iterator_end(it); ) {
+        ir_value_t *value = list_iterator_next(it);
+        int         slot  = ir_promote_slot(promote, value);
+
+        if (value->op == IR_OP_SLOT && promote->index[value->id] != -1)
+            promote->removed[value->id] = true;
+        if (slot == -1)
+            continue;
+
+        switch (value->op) {
+            case IR_OP_LOAD:
+                promote->replace[value->id] = ir_promote_current(promote, slot, value->type);
+                promote->removed[value->id] = true;
+                break;
+            case IR_OP_STORE:
+                ir_promote_push(promote, slot, ir_promote_resolve(promote, value->operands[1]), pushed);
+                break;
+            default:
+                ir_promote_push(promote, slot, ir_promote_zero(promote, promote->types[value->operands[0]->id]), pushed);
+                break;
+        }
+    }
+
+    for (list_iterator_t *it = list_iterator(block->successors); !list_iterator_end(it); ) {
+        ir_block_t *next = list_iterator_next(it);
+        for (list_iterator_t *pt = list_iterator(promote->phis[next->id]); !list_iterator_end(pt); ) {
+            ir_value_t *phi = list_iterator_next(pt);
+            list_push(phi->arguments, ir_promote_current(promote, phi->integer, phi->type));
+            list_push(phi->incoming,  block);
+        }
+    }
+
+    for (list_iterator_t *it = list_iterator(promote->children[block->id]); !list_iterator_end(it); )
+        ir_promote_rename(promote, list_iterator_next(it));
+
+    while (list_length(pushed))
+        list_pop(promote->stacks[(intptr_t)list_pop(pushed)]);
+}
+
+/* accesses of promoted slots are dropped while the uses are rewritten */
+static void ir_promote_rewrite(ir_promote_t *promote) {
+    ir_function_t *function = promote->function;
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block  = list_iterator_next(it);
+        list_t     *values = list_create();
+
+        for (list_iterator_t *pt = list_iterator(promote->phis[block->id]); !list_iterator_end(pt); ) {
+            ir_value_t *phi = list_iterator_next(pt);
+            phi->integer = 0;
+            list_push(values, phi);
+        }
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            if (ir_promote_slot(promote, value) != -1 || (value->id != -1 && promote->removed[value->id]))
+                continue;
+            list_push(values, value);
+            /* the zeros go right after the parameters */
+            if (value->op == IR_OP_PARAMETER && value->integer == list_length(function->parameters) - 1)
+                for (list_iterator_t *ct = list_iterator(promote->constants); !list_iterator_end(ct); )
+                    list_push(values, list_iterator_next(ct));
+        }
+        if (block == list_head(function->blocks) && !list_length(function->parameters)) {
+            list_t *constants = list_create();
+            for (list_iterator_t *ct = list_iterator(promote->constants); !list_iterator_end(ct); )
+                list_push(constants, list_iterator_next(ct));
+            for (list_iterator_t *vt = list_iterator(values); !list_iterator_end(vt); )
+                list_push(constants, list_iterator_next(vt));
+            values = constants;
+        }
+        block->values = values;
+
+        for (list_iterator_t *vt = list_iterator(values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            value->operands[0] = ir_promote_resolve(promote, value->operands[0]);
+            value->operands[1] = ir_promote_resolve(promote, value->operands[1]);
+            if (!value->arguments)
+                continue;
+            list_t *arguments = list_create();
+            for (list_iterator_t *at = list_iterator(value->arguments); !list_iterator_end(at); )
+                list_push(arguments, ir_promote_resolve(promote, list_iterator_next(at)));
+            value->arguments = arguments;
+        }
+    }
+}
+
+/*
+ * A phi merging nothing but one other value (and itself) is that value,
+ * and phis are dropped unless something other than phis ends up using
+ * them.
+ */
+static void ir_promote_clean(ir_promote_t *promote) {
+    ir_function_t *function = promote->function;
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+            ir_block_t *block = list_iterator_next(it);
+            for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+                ir_value_t *value = list_iterator_next(vt);
+                if (value->op != IR_OP_PHI)
+                    break;
+                if (promote->replace[value->id])
+                    continue;
+
+                ir_value_t *same = NULL;
+                bool        one  = true;
+                for (list_iterator_t *at = list_iterator(value->arguments); !list_iterator_end(at); ) {
+                    ir_value_t *argument = ir_promote_resolve(promote, list_iterator_next(at));
+                    if (argument == value || argument == same)
+                        continue;
+                    if (same)
+                        one = false;
+                    same = argument;
+                }
+                if (one && same) {
+                    promote->replace[value->id] = same;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    /* phis reached from a use by anything else are the ones kept */
+    bool   *used = memory_allocate(sizeof(bool) * (function->values + 1));
+    list_t *work = list_create();
+    memset(used, 0, sizeof(bool) * (function->values + 1));
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            value->operands[0] = ir_promote_resolve(promote, value->operands[0]);
+            value->operands[1] = ir_promote_resolve(promote, value->operands[1]);
+            if (value->arguments) {
+                list_t *arguments = list_create();
+                for (list_iterator_t *at = list_iterator(value->arguments); !list_iterator_end(at); )
+                    list_push(arguments, ir_promote_resolve(promote, list_iterator_next(at)));
+                value->arguments = arguments;
+            }
+            if (value->op == IR_OP_PHI)
+                continue;
+            for (int i = 0; i < 2; i++)
+                if (value->operands[i] && value->operands[i]->op == IR_OP_PHI)
+                    list_push(work, value->operands[i]);
+            if (value->arguments)
+                for (list_iterator_t *at = list_iterator(value->arguments); !list_iterator_end(at); )
+                    list_push(work, list_iterator_next(at));
+        }
+    }
+
+    while (list_length(work)) {
+        ir_value_t *value = list_pop(work);
+        if (value->op != IR_OP_PHI || used[value->id])
+            continue;
+        used[value->id] = true;
+        for (list_iterator_t *at = list_iterator(value->arguments); !list_iterator_end(at); )
+            list_push(work, list_iterator_next(at));
+    }
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block  = list_iterator_next(it);
+        list_t     *values = list_create();
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            if (value->op != IR_OP_PHI || used[value->id])
+                list_push(values, value);
+        }
+        block->values = values;
+    }
+}
+
+static void ir_promote(ir_function_t *function) {
+    int blocks = list_length(function->blocks);
+    int values = function->values;
+
+    ir_promote_t promote = {
+        .function  = function,
+        .blocks    = memory_allocate(sizeof(ir_block_t *) * (blocks + 1)),
+        .idom      = memory_allocate(sizeof(int)          * (blocks + 1)),
+        .children  = memory_allocate(sizeof(list_t *)     * (blocks + 1)),
+        .phis      = memory_allocate(sizeof(list_t *)     * (blocks + 1)),
+        .index     = memory_allocate(sizeof(int)          * (values + 1)),
+        .types     = memory_allocate(sizeof(ir_type_t)    * (values + 1)),
+        .constants = list_create()
+    };
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        if (block->addressed)
+            return;
+        promote.blocks[block->id] = block;
+        promote.phis[block->id]   = list_create();
+    }
+
+    for (int i = 0; i < values; i++)
+        promote.index[i] = -1;
+
+    int slots = ir_promote_candidates(&promote);
+    if (!slots)
+        return;
+
+    /* dominance frontiers, as sets of blocks */
+    size_t          words     = blocks / IR_LIVE_BITS + 1;
+    unsigned long **frontiers = memory_allocate(sizeof(unsigned long *) * (blocks + 1));
+    for (int i = 0; i < blocks; i++) {
+        frontiers[i] = memory_allocate(sizeof(unsigned long) * words);
+        memset(frontiers[i], 0, sizeof(unsigned long) * words);
+    }
+
+    ir_promote_dominators(&promote, blocks);
+    for (int i = 0; i < blocks; i++) {
+        if (list_length(promote.blocks[i]->predecessors) < 2)
+            continue;
+        for (list_iterator_t *it = list_iterator(promote.blocks[i]->predecessors); !list_iterator_end(it); ) {
+            for (int runner = ((ir_block_t *)list_iterator_next(it))->id; runner != promote.idom[i]; runner = promote.idom[runner])
+                ir_live_set(frontiers[runner], i);
+        }
+    }
+
+    ir_type_t *types  = memory_allocate(sizeof(ir_type_t) * (slots + 1));
+    bool     **stored = memory_allocate(sizeof(bool *)    * (slots + 1));
+    for (int i = 0; i < values; i++)
+        if (promote.index[i] != -1)
+            types[promote.index[i]] = promote.types[i];
+    for (int i = 0; i < slots; i++) {
+        stored[i] = memory_allocate(sizeof(bool) * (blocks + 1));
+        memset(stored[i], 0, sizeof(bool) * (blocks + 1));
+    }
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            int         slot  = ir_promote_slot(&promote, value);
+            if (slot != -1 && value->op != IR_OP_LOAD)
+                stored[slot][block->id] = true;
+        }
+    }
+
+    for (int i = 0; i < slots; i++)
+        ir_promote_place(&promote, frontiers, blocks, i, types[i], stored[i]);
+
+    /* zeros and phis were numbered past the values there were */
+    int total = function->values + IR_TYPE_PTR + 1;
+    promote.replace = memory_allocate(sizeof(ir_value_t *) * (total + 1));
+    promote.removed = memory_allocate(sizeof(bool)         * (total + 1));
+    promote.stacks  = memory_allocate(sizeof(list_t *)     * (slots + 1));
+    memset(promote.replace, 0, sizeof(ir_value_t *) * (total + 1));
+    memset(promote.removed, 0, sizeof(bool)         * (total + 1));
+    for (int i = 0; i < slots; i++)
+        promote.stacks[i] = list_create();
+
+    ir_promote_rename(&promote, promote.blocks[0]);
+    ir_promote_rewrite(&promote);
+    ir_promote_clean(&promote);
+
+    int number = 0;
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); ) {
+            ir_value_t *value = list_iterator_next(vt);
+            value->id = (ir_terminator(value) || value->type == IR_TYPE_VOID) ? -1 : number++;
+        }
+    }
+    function->values = number;
+}
+
+/* printing */
+const char *ir_type_string(ir_type_t type) {
+    static const char *table[] = {
+        [IR_TYPE_VOID] = "void",
+        [IR_TYPE_I8]   = "i8",
+        [IR_TYPE_I16]  = "i16",
+        [IR_TYPE_I32]  = "i32",
+        [IR_TYPE_I64]  = "i64",
+        [IR_TYPE_F32]  = "f32",
+        [IR_TYPE_F64]  = "f64",
+        [IR_TYPE_PTR]  = "ptr"
+    };
+    return table[type];
+}
+
+const char *ir_op_string(ir_op_t op) {
+    static const char *table[] = {
+        [IR_OP_CONSTANT]      = "constant",
+        [IR_OP_FLOATING]      = "floating",
+        [IR_OP_STRING]        = "string",
+        [IR_OP_SYMBOL]        = "symbol",
+        [IR_OP_LABEL]         = "label",
+        [IR_OP_SLOT]          = "slot",
+        [IR_OP_PARAMETER]     = "parameter",
+        [IR_OP_LOAD]          = "load",
+        [IR_OP_STORE]         = "store",
+        [IR_OP_COPY]          = "copy",
+        [IR_OP_ZERO]          = "zero",
+        [IR_OP_ADD]           = "add",
+        [IR_OP_SUB]           = "sub",
+        [IR_OP_MUL]           = "mul",
+        [IR_OP_DIV]           = "div",
+        [IR_OP_UDIV]          = "udiv",
+        [IR_OP_MOD]           = "mod",
+        [IR_OP_UMOD]          = "umod",
+        [IR_OP_AND]           = "and",
+        [IR_OP_OR]            = "or",
+        [IR_OP_XOR]           = "xor",
+        [IR_OP_SHL]           = "shl",
+        [IR_OP_SAR]           = "sar",
+        [IR_OP_SHR]           = "shr",
+        [IR_OP_NEG]           = "neg",
+        [IR_OP_NOT]           = "not",
+        [IR_OP_EQ]            = "eq",
+        [IR_OP_NE]            = "ne",
+        [IR_OP_LT]            = "lt",
+        [IR_OP_LE]            = "le",
+        [IR_OP_GT]            = "gt",
+        [IR_OP_GE]            = "ge",
+        [IR_OP_ULT]           = "ult",
+        [IR_OP_ULE]           = "ule",
+        [IR_OP_UGT]           = "ugt",
+        [IR_OP_UGE]           = "uge",
+        [IR_OP_SEXT]          = "sext",
+        [IR_OP_ZEXT]          = "zext",
+        [IR_OP_TRUNC]         = "trunc",
+        [IR_OP_ITOF]          = "itof",
+        [IR_OP_FTOI]          = "ftoi",
+        [IR_OP_FCONV]         = "fconv",
+        [IR_OP_CALL]          = "call",
+        [IR_OP_PHI]           = "phi",
+        [IR_OP_VA_START]      = "va_start",
+        [IR_OP_VA_ARG]        = "va_arg",
+        [IR_OP_JUMP]          = "jump",
+        [IR_OP_BRANCH]        = "branch",
+        [IR_OP_SWITCH]        = "switch",
+        [IR_OP_JUMP_INDIRECT] = "jump",
+        [IR_OP_RETURN]        = "return"
+    };
+    return table[op];
+}
+
+static void ir_string_value(string_t *string, ir_value_t *value) {
+    string_catf(string, "    ");
+    if (value->id != -1)
+        string_catf(string, "%%%d = ", value->id);
+    string_catf(string, "%s", ir_op_string(value->op));
+
+    switch (value->op) {
+        case IR_OP_CONSTANT:
+            string_catf(string, " %s %ld", ir_type_string(value->type), value->integer);
+            break;
+        case IR_OP_FLOATING:
+            string_catf(string, " %s %.17g", ir_type_string(value->type), value->floating);
+            break;
+        case IR_OP_STRING:
+            string_catf(string, " \"%s\"", string_quote((char *)value->symbol));
+            break;
+        case IR_OP_SYMBOL:
+            string_catf(string, " @%s", value->symbol);
+            break;
+        case IR_OP_LABEL:
+        case IR_OP_JUMP:
+            string_catf(string, " .B%d", value->targets[0]->id);
+            break;
+        case IR_OP_SLOT:
+            string_catf(string, " %ld", value->integer);
+            if (value->name)
+                string_catf(string, " ; %s", value->name);
+            break;
+        case IR_OP_PARAMETER:
+            string_catf(string, " %s %ld ; %s", ir_type_string(value->type), value->integer, value->name);
+            break;
+        case IR_OP_LOAD:
+        case IR_OP_STORE:
+            string_catf(string, " %s", ir_type_string(value->memory));
+            if (value->op == IR_OP_STORE)
+                string_catf(string, " %%%d,", value->operands[1]->id);
+            string_catf(string, " %%%d", value->operands[0]->id);
+            break;
+        case IR_OP_COPY:
+            string_catf(string, " %%%d, %%%d, %ld", value->operands[0]->id, value->operands[1]->id, value->integer);
+            break;
+        case IR_OP_ZERO:
+            string_catf(string, " %%%d, %ld", value->operands[0]->id, value->integer);
+            break;
+        case IR_OP_CALL:
+            string_catf(string, " %s ", ir_type_string(value->type));
+            if (value->symbol)
+                string_catf(string, "@%s(", value->symbol);
+            else
+                string_catf(string, "%%%d(", value->operands[0]->id);
+            for (list_iterator_t *it = list_iterator(value->arguments); !list_iterator_end(it); ) {
+                string_catf(string, "%%%d", ((ir_value_t*)list_iterator_next(it))->id);
+                if (!list_iterator_end(it))
+                    string_catf(string, ", ");
+            }
+            string_cat(string, ')');
+            break;
+        case IR_OP_PHI: {
+            string_catf(string, " %s", ir_type_string(value->type));
+            list_iterator_t *at = list_iterator(value->arguments);
+            list_iterator_t *bt = list_iterator(value->incoming);
+            while (!list_iterator_end(at)) {
+                ir_value_t *argument = list_iterator_next(at);
+                ir_block_t *from     = list_iterator_next(bt);
+                string_catf(string, " [%%%d, .B%d]", argument->id, from->id);
+                if (!list_iterator_end(at))
+                    string_cat(string, ',');
+            }
+            break;
+        }
+        case IR_OP_BRANCH:
+            string_catf(string, " %%%d, .B%d, .B%d", value->operands[0]->id, value->targets[0]->id, value->targets[1]->id);
+            break;
+        case IR_OP_SWITCH:
+            string_catf(string, " %%%d, .B%d [", value->operands[0]->id, value->targets[0]->id);
+            for (list_iterator_t *it = list_iterator(value->incoming); !list_iterator_end(it); ) {
+                ir_case_t *entry = list_iterator_next(it);
+                if (entry->begin == entry->end)
+                    string_catf(string, "%ld: .B%d", entry->begin, entry->block->id);
+                else
+                    string_catf(string, "%ld...%ld: .B%d", entry->begin, entry->end, entry->block->id);
+                if (!list_iterator_end(it))
+                    string_catf(string, ", ");
+            }
+            string_cat(string, ']');
+            break;
+        case IR_OP_RETURN:
+            if (value->operands[0])
+                string_catf(string, " %s %%%d", ir_type_string(value->type), value->operands[0]->id);
+            break;
+        default:
+            if (value->type != IR_TYPE_VOID)
+                string_catf(string, " %s", ir_type_string(value->type));
+            string_catf(string, " %%%d", value->operands[0]->id);
+            if (value->operands[1])
+                string_catf(string, ", %%%d", value->operands[1]->id);
+            break;
+    }
+    string_cat(string, '\n');
+}
+
+char *ir_string(ir_function_t *function) {
+    string_t *string = string_create();
+
+    string_catf(string, "function %s(", function->name);
+    for (list_iterator_t *it = list_iterator(function->parameters); !list_iterator_end(it); ) {
+        ir_value_t *value = list_iterator_next(it);
+        string_catf(string, "%s %%%d", ir_type_string(value->type), value->id);
+        if (!list_iterator_end(it))
+            string_catf(string, ", ");
+    }
+    string_catf(string, ") -> %s {\n", ir_type_string(function->type));
+
+    for (list_iterator_t *it = list_iterator(function->blocks); !list_iterator_end(it); ) {
+        ir_block_t *block = list_iterator_next(it);
+        string_catf(string, ".B%d:", block->id);
+        if (list_length(block->predecessors)) {
+            string_catf(string, " ; from");
+            for (list_iterator_t *pt = list_iterator(block->predecessors); !list_iterator_end(pt); )
+                string_catf(string, " .B%d", ((ir_block_t*)list_iterator_next(pt))->id);
+        }
+        string_cat(string, '\n');
+        for (list_iterator_t *vt = list_iterator(block->values); !list_iterator_end(vt); )
+            ir_string_value(string, list_iterator_next(vt));
+    }
+    string_cat(string, '}');
+
+    return string_buffer(string);
+}
@@ -0,0 +1,376 @@
+#ifndef LICE_IR_HDR
+#define LICE_IR_HDR
+#include "ast.h"
+
+/*
+ * File: ir.h
+ *  Implements the interface to LICE's intermediate representation.
+ *
+ * Remarks:
+ *  A function is lowered into basic blocks with explicit control flow
+ *  between them. Every value is defined exactly once (SSA). Locals are
+ *  lowered to stack slots accessed with loads and stores, and those whose
+ *  address never escapes are then promoted out of their slots, so only
+ *  aggregates and anything which has it's address taken are left in
+ *  memory. Values merging at control flow joins use phi nodes.
+ */
+
+/*
+ * Type: ir_type_t
+ *  Type of an IR value
+ *
+ *  Constants:
+ *
+ *  IR_TYPE_VOID - No value
+ *  IR_TYPE_I8   - 8-bit integer
+ *  IR_TYPE_I16  - 16-bit integer
+ *  IR_TYPE_I32  - 32-bit integer
+ *  IR_TYPE_I64  - 64-bit integer
+ *  IR_TYPE_F32  - Single precision floating point
+ *  IR_TYPE_F64  - Double precision floating point
+ *  IR_TYPE_PTR  - Address (aggregates are always referred to by address)
+ */
+typedef enum {
+    IR_TYPE_VOID,
+    IR_TYPE_I8,
+    IR_TYPE_I16,
+    IR_TYPE_I32,
+    IR_TYPE_I64,
+    IR_TYPE_F32,
+    IR_TYPE_F64,
+    IR_TYPE_PTR
+} ir_type_t;
+
+/*
+ * Type: ir_op_t
+ *  Operation of an IR value
+ *
+ *  Constants:
+ *
+ *  IR_OP_CONSTANT      - Integer constant
+ *  IR_OP_FLOATING      - Floating point constant
+ *  IR_OP_STRING        - Address of a string literal
+ *  IR_OP_SYMBOL        - Address of a global symbol
+ *  IR_OP_LABEL         - Address of a block (labels as values)
+ *  IR_OP_SLOT          - Address of a stack slot
+ *  IR_OP_PARAMETER     - Incoming function parameter
+ *  IR_OP_LOAD          - Load from an address
+ *  IR_OP_STORE         - Store a value to an address
+ *  IR_OP_COPY          - Copy a block of memory
+ *  IR_OP_ZERO          - Zero a block of memory
+ *  IR_OP_ADD           - Addition
+ *  IR_OP_SUB           - Subtraction
+ *  IR_OP_MUL           - Multiplication
+ *  IR_OP_DIV           - Signed (or floating point) division
+ *  IR_OP_UDIV          - Unsigned division
+ *  IR_OP_MOD           - Signed remainder
+ *  IR_OP_UMOD          - Unsigned remainder
+ *  IR_OP_AND           - Bitwise and
+ *  IR_OP_OR            - Bitwise or
+ *  IR_OP_XOR           - Bitwise exclusive or
+ *  IR_OP_SHL           - Left shift
+ *  IR_OP_SAR           - Arithmetic right shift
+ *  IR_OP_SHR           - Logical right shift
+ *  IR_OP_NEG           - Negation
+ *  IR_OP_NOT           - Bitwise complement
+ *  IR_OP_EQ            - Equal
+ *  IR_OP_NE            - Not equal
+ *  IR_OP_LT            - Signed (or floating point) less than
+ *  IR_OP_LE            - Signed (or floating point) less or equal
+ *  IR_OP_GT            - Signed (or floating point) greater than
+ *  IR_OP_GE            - Signed (or floating point) greater or equal
+ *  IR_OP_ULT           - Unsigned less than
+ *  IR_OP_ULE           - Unsigned less or equal
+ *  IR_OP_UGT           - Unsigned greater than
+ *  IR_OP_UGE           - Unsigned greater or equal
+ *  IR_OP_SEXT          - Sign extension
+ *  IR_OP_ZEXT          - Zero extension
+ *  IR_OP_TRUNC         - Integer truncation
+ *  IR_OP_ITOF          - Integer to floating point
+ *  IR_OP_FTOI          - Floating point to integer
+ *  IR_OP_FCONV         - Floating point to floating point of another size
+ *  IR_OP_CALL          - Function call
+ *  IR_OP_PHI           - Merge of values at a control flow join
+ *  IR_OP_VA_START      - __builtin_va_start
+ *  IR_OP_VA_ARG        - __builtin_va_arg
+ *  IR_OP_JUMP          - Unconditional branch
+ *  IR_OP_BRANCH        - Conditional branch
+ *  IR_OP_SWITCH        - Multiway branch on integer cases
+ *  IR_OP_JUMP_INDIRECT - Branch to a computed address
+ *  IR_OP_RETURN        - Function return
+ */
+typedef enum {
+    IR_OP_CONSTANT,
+    IR_OP_FLOATING,
+    IR_OP_STRING,
+    IR_OP_SYMBOL,
+    IR_OP_LABEL,
+    IR_OP_SLOT,
+    IR_OP_PARAMETER,
+    IR_OP_LOAD,
+    IR_OP_STORE,
+    IR_OP_COPY,
+    IR_OP_ZERO,
+    IR_OP_ADD,
+    IR_OP_SUB,
+    IR_OP_MUL,
+    IR_OP_DIV,
+    IR_OP_UDIV,
+    IR_OP_MOD,
+    IR_OP_UMOD,
+    IR_OP_AND,
+    IR_OP_OR,
+    IR_OP_XOR,
+    IR_OP_SHL,
+    IR_OP_SAR,
+    IR_OP_SHR,
+    IR_OP_NEG,
+    IR_OP_NOT,
+    IR_OP_EQ,
+    IR_OP_NE,
+    IR_OP_LT,
+    IR_OP_LE,
+    IR_OP_GT,
+    IR_OP_GE,
+    IR_OP_ULT,
+    IR_OP_ULE,
+    IR_OP_UGT,
+    IR_OP_UGE,
+    IR_OP_SEXT,
+    IR_OP_ZEXT,
+    IR_OP_TRUNC,
+    IR_OP_ITOF,
+    IR_OP_FTOI,
+    IR_OP_FCONV,
+    IR_OP_CALL,
+    IR_OP_PHI,
+    IR_OP_VA_START,
+    IR_OP_VA_ARG,
+
+    /* terminators, always the last value of a block */
+    IR_OP_JUMP,
+    IR_OP_BRANCH,
+    IR_OP_SWITCH,
+    IR_OP_JUMP_INDIRECT,
+    IR_OP_RETURN
+} ir_op_t;
+
+typedef struct ir_value_s    ir_value_t;
+typedef struct ir_block_s    ir_block_t;
+typedef struct ir_function_s ir_function_t;
+
+/*
+ * Struct: ir_case_t
+ *  A case of a switch, values in the inclusive range [begin, end] branch
+ *  to block.
+ */
+typedef struct {
+    long        begin;
+    long        end;
+    ir_block_t *block;
+} ir_case_t;
+
+/*
+ * Struct: ir_value_t
+ *  A single operation, which defines a value unless it's of void type.
+ */
+struct ir_value_s {
+    ir_op_t     op;
+    ir_type_t   type;
+
+    /*
+     * Variable: id
+     *  Number of the value, unique within the function.
+     */
+    int id;
+
+    /*
+     * Variable: block
+     *  The block containing the value.
+     */
+    ir_block_t *block;
+
+    /*
+     * Variable: operands
+     *  Operands, unused ones are NULL. Stores, copies and zeroing take the
+     *  address first, everything else takes them in source order.
+     */
+    ir_value_t *operands[2];
+
+    /*
+     * Variable: targets
+     *  Branch targets (taken and not taken for conditional branches, the
+     *  default case for switches) or the block of a label address.
+     */
+    ir_block_t *targets[2];
+
+    /*
+     * Variable: arguments
+     *  Call arguments or the incoming values of a phi.
+     */
+    list_t *arguments;
+
+    /*
+     * Variable: incoming
+     *  The predecessor for each incoming value of a phi, or the list of
+     *  <ir_case_t> of a switch.
+     */
+    list_t *incoming;
+
+    /*
+     * Variable: memory
+     *  The type of memory accessed by loads and stores, which may be
+     *  narrower than the value (bool and bitfields for instance).
+     */
+    ir_type_t memory;
+
+    union {
+        long        integer;  /* constants, parameter index, slot, copy and zero size */
+        double      floating; /* floating point constants                             */
+        const char *symbol;   /* symbols, strings and direct calls                    */
+    };
+
+    /*
+     * Variable: name
+     *  Name of the variable a slot is for, NULL for temporaries.
+     */
+    const char *name;
+
+    /*
+     * Variable: variadic
+     *  A call to a function taking variable arguments.
+     */
+    bool variadic;
+};
+
+/*
+ * Struct: ir_block_t
+ *  A basic block, a list of values ending with a single terminator.
+ */
+struct ir_block_s {
+    int     id;
+    list_t *values;
+    list_t *predecessors;
+    list_t *successors;
+
+    /*
+     * Variable: addressed
+     *  The address of the block is taken for a computed goto.
+     */
+    bool addressed;
+};
+
+/*
+ * Struct: ir_function_t
+ *  A function lowered into IR.
+ */
+struct ir_function_s {
+    const char *name;
+    ir_type_t   type;
+
+    /*
+     * Variable: blocks
+     *  The reachable blocks of the function, the entry is first.
+     */
+    list_t *blocks;
+
+    /*
+     * Variable: parameters
+     *  The IR_OP_PARAMETER values in order.
+     */
+    list_t *parameters;
+
+    /*
+     * Variable: values
+     *  Number of values which were created.
+     */
+    int values;
+
+    /*
+     * Variable: aggregates
+     *  Structures are passed to or returned from a function by value,
+     *  which the IR only ever refers to by address.
+     */
+    bool aggregates;
+};
+
+/*
+ * Function: ir_lower
+ *  Lower a function into IR.
+ *
+ * Parameters:
+ *  function - An *AST_TYPE_FUNCTION* ast node
+ *
+ * Returns:
+ *  The function in IR form.
+ *
+ * Remarks:
+ *  The ast is left untouched so the code generator can still be run on
+ *  it afterwards. Slots are promoted unless the function takes the
+ *  address of a label.
+ */
+ir_function_t *ir_lower(ast_t *function);
+
+/*
+ * Structure: ir_interval_t
+ *  The positions a value is live at. Every value of a function takes a
+ *  position, counting from zero through the values of the blocks in
+ *  order.
+ */
+typedef struct {
+    int begin;
+    int end;
+} ir_interval_t;
+
+/*
+ * Function: ir_live
+ *  Compute the live interval of every value of a function.
+ *
+ * Parameters:
+ *  function - The function
+ *
+ * Returns:
+ *  The intervals indexed by the id of the values, values which are
+ *  never defined have a begin and end of -1.
+ *
+ * Remarks:
+ *  An interval is a single range from the first to the last position
+ *  the value is live at, holes in between are covered. A phi is live
+ *  from the start of it's block and it's arguments until the end of the
+ *  predecessor they come from, the phis of a block are all assigned at
+ *  once on the edge.
+ */
+ir_interval_t *ir_live(ir_function_t *function);
+
+/*
+ * Function: ir_type_size
+ *  Get the size of an IR type in bytes.
+ */
+int ir_type_size(ir_type_t type);
+
+/*
+ * Function: ir_type_isfloating
+ *  Check if an IR type is a floating point type.
+ */
+bool ir_type_isfloating(ir_type_t type);
+
+/*
+ * Function: ir_type_string
+ *  Get the name of an IR type.
+ */
+const char *ir_type_string(ir_type_t type);
+
+/*
+ * Function: ir_op_string
+ *  Get the name of an IR operation.
+ */
+const char *ir_op_string(ir_op_t op);
+
+/*
+ * Function: ir_string
+ *  Get the textual form of a function in IR form, this is what
+ *  `--dump-ir` prints.
+ */
+char *ir_string(ir_function_t *function);
+
+#endif
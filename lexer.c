@@ -2,63 +2,231 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "lexer.h"
 #include "util.h"
 #include "lice.h"
 #include "opt.h"
 
-static list_t *lexer_buffer = &SENTINEL_LIST;
-
+/*
+ * The whole source is made available in memory up front, regular files
+ * are mapped and anything else (pipes) is read into a growable buffer.
+ * The lexer then scans it by position, backslash-newline pairs are
+ * skipped lazily as characters are read.
+ */
 typedef struct {
-    char   *file;
-    size_t  line;
-    FILE   *fp;
+    char       *file;
+    size_t      line;
+    int         fd;
+    const char *buffer;
+    size_t      length;
+    size_t      position;
+    size_t      begin;
+    bool        mapped;
 } lexer_file_t;
 
-static int          lexer_continuation = -1;
-static lexer_file_t lexer_file;
+static lexer_file_t    lexer_file;
+static memory_arena_t *lexer_arena = NULL;
+
+/*
+ * The token stream is a ring of token values, lexer_ring_fill counts the
+ * tokens lexed so far and lexer_ring_read the ones handed out, ungetting
+ * a token is just stepping lexer_ring_read back.
+ */
+static lexer_token_t    lexer_ring[LEXER_LOOKAHEAD];
+static size_t           lexer_ring_fill = 0;
+static size_t           lexer_ring_read = 0;
+static lexer_token_t    lexer_token;
+static lexer_location_t lexer_location;
+static bool             lexer_reading  = false;
+static bool             lexer_scanning = false;
+static bool             lexer_space    = false;
+
+/*
+ * Punctuation only the preprocessor sees, the ends of lines (directives
+ * end with them) and the ## operator. Both are out of the range of the
+ * other punctuation, which are characters and lexer_token_type_t values.
+ */
+#define LEXER_PUNCT_NEWLINE 0x100
+#define LEXER_PUNCT_PASTE   0x101
+
+/* identifiers which are (or were) macros, kept in their intern tag */
+#define LEXER_TAG_MACRO     0x10000
+
+static const struct {
+    const char      *string;
+    lexer_keyword_t  keyword;
+} lexer_keywords[] = {
+    { "char",           LEXER_KEYWORD_CHAR          },
+    { "short",          LEXER_KEYWORD_SHORT         },
+    { "int",            LEXER_KEYWORD_INT           },
+    { "long",           LEXER_KEYWORD_LONG          },
+    { "float",          LEXER_KEYWORD_FLOAT         },
+    { "double",         LEXER_KEYWORD_DOUBLE        },
+    { "struct",         LEXER_KEYWORD_STRUCT        },
+    { "union",          LEXER_KEYWORD_UNION         },
+    { "signed",         LEXER_KEYWORD_SIGNED        },
+    { "unsigned",       LEXER_KEYWORD_UNSIGNED      },
+    { "enum",           LEXER_KEYWORD_ENUM          },
+    { "void",           LEXER_KEYWORD_VOID          },
+    { "typedef",        LEXER_KEYWORD_TYPEDEF       },
+    { "extern",         LEXER_KEYWORD_EXTERN        },
+    { "static",         LEXER_KEYWORD_STATIC        },
+    { "__static__",     LEXER_KEYWORD_STATIC        },
+    { "auto",           LEXER_KEYWORD_AUTO          },
+    { "register",       LEXER_KEYWORD_REGISTER      },
+    { "const",          LEXER_KEYWORD_CONST         },
+    { "volatile",       LEXER_KEYWORD_VOLATILE      },
+    { "inline",         LEXER_KEYWORD_INLINE        },
+    { "restrict",       LEXER_KEYWORD_RESTRICT      },
+    { "typeof",         LEXER_KEYWORD_TYPEOF        },
+    { "__typeof__",     LEXER_KEYWORD_TYPEOF        },
+    { "_Bool",          LEXER_KEYWORD_BOOL          },
+    { "if",             LEXER_KEYWORD_IF            },
+    { "else",           LEXER_KEYWORD_ELSE          },
+    { "for",            LEXER_KEYWORD_FOR           },
+    { "while",          LEXER_KEYWORD_WHILE         },
+    { "do",             LEXER_KEYWORD_DO            },
+    { "return",         LEXER_KEYWORD_RETURN        },
+    { "switch",         LEXER_KEYWORD_SWITCH        },
+    { "case",           LEXER_KEYWORD_CASE          },
+    { "default",        LEXER_KEYWORD_DEFAULT       },
+    { "break",          LEXER_KEYWORD_BREAK         },
+    { "continue",       LEXER_KEYWORD_CONTINUE      },
+    { "goto",           LEXER_KEYWORD_GOTO          },
+    { "sizeof",         LEXER_KEYWORD_SIZEOF        },
+    { "_Alignof",       LEXER_KEYWORD_ALIGNOF       },
+    { "__alignof__",    LEXER_KEYWORD_ALIGNOF_GNU   },
+    { "_Static_assert", LEXER_KEYWORD_STATIC_ASSERT },
+    { "...",            LEXER_KEYWORD_ELLIPSIS      }
+};
 
 __attribute__((constructor)) void lexer_init(void) {
     lexer_file.file = "(stdin)";
     lexer_file.line = 1;
-    lexer_file.fp   = stdin;
+    lexer_file.fd   = STDIN_FILENO;
+
+    for (size_t i = 0; i < sizeof(lexer_keywords) / sizeof(*lexer_keywords); i++) {
+        const char *string = lexer_keywords[i].string;
+        string_intern_tag_set(string_intern(string, strlen(string)), lexer_keywords[i].keyword);
+    }
+}
+
+static void lexer_file_close(void) {
+    if (lexer_file.mapped)
+        munmap((void*)lexer_file.buffer, lexer_file.length);
+    else
+        free((void*)lexer_file.buffer);
+}
+
+static void lexer_file_open(void) {
+    struct stat st;
+
+    if (fstat(lexer_file.fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, lexer_file.fd, 0);
+        if (map != MAP_FAILED) {
+            lexer_file.buffer = map;
+            lexer_file.length = st.st_size;
+            lexer_file.mapped = true;
+            return;
+        }
+    }
+
+    size_t  allocated = 0x10000;
+    size_t  length    = 0;
+    char   *buffer    = malloc(allocated);
+
+    for (;;) {
+        if (!buffer)
+            compile_error("out of memory reading %s", lexer_file.file);
+        if (length == allocated)
+            buffer = realloc(buffer, allocated *= 2);
+
+        ssize_t got = read(lexer_file.fd, buffer + length, allocated - length);
+        if (got == 0)
+            break;
+        if (got < 0)
+            compile_error("failed reading %s", lexer_file.file);
+        length += got;
+    }
+
+    lexer_file.buffer = buffer;
+    lexer_file.length = length;
+    lexer_file.mapped = false;
+}
+
+static bool lexer_file_splice(size_t position) {
+    return position + 1 < lexer_file.length
+        && lexer_file.buffer[position]     == '\\'
+        && lexer_file.buffer[position + 1] == '\n';
+}
+
+static void lexer_file_begin(void) {
+    size_t position = lexer_file.position;
+    while (position && lexer_file.buffer[position - 1] != '\n')
+        position--;
+    lexer_file.begin = position;
 }
 
 static void lexer_file_unget(int ch) {
-    if (ch == '\n')
-        lexer_file.line --;
-    if (lexer_continuation >= 0)
-        ungetc(lexer_continuation, lexer_file.fp);
-    lexer_continuation = ch;
+    if (ch == EOF)
+        return;
+
+    lexer_file.position--;
+    if (ch == '\n') {
+        lexer_file.line--;
+        lexer_file_begin();
+    }
+
+    /*
+     * Step back over the splices which preceded the character too. The
+     * character itself can never be the newline of a splice, so this is
+     * unambiguous.
+     */
+    while (lexer_file.position >= 2 && lexer_file_splice(lexer_file.position - 2)) {
+        lexer_file.position -= 2;
+        lexer_file.line--;
+        lexer_file_begin();
+    }
 }
 
 static int lexer_file_get(void) {
-    int ch = (lexer_continuation < 0) ? getc(lexer_file.fp) : lexer_continuation;
-    lexer_continuation = -1;
-    if (ch == '\\') {
-        if ((ch = getc(lexer_file.fp)) == '\n') {
-            lexer_file.line ++;
-            return lexer_file_get();
-        }
-        lexer_file_unget(ch);
-        return '\\';
+    while (lexer_file_splice(lexer_file.position)) {
+        lexer_file.position += 2;
+        lexer_file.line++;
+        lexer_file.begin = lexer_file.position;
+    }
 
+    if (lexer_file.position >= lexer_file.length)
+        return EOF;
+
+    int ch = (unsigned char)lexer_file.buffer[lexer_file.position++];
+    if (ch == '\n') {
+        lexer_file.line++;
+        lexer_file.begin = lexer_file.position;
     }
-    if (ch == '\n')
-        lexer_file.line ++;
 
     return ch;
 }
 
 static lexer_token_t *lexer_token_copy(lexer_token_t *token) {
-    return memcpy(malloc(sizeof(lexer_token_t)), token, sizeof(lexer_token_t));
+    lexer_token          = *token;
+    lexer_token.location = lexer_location;
+    lexer_token.space    = lexer_space;
+    lexer_space          = false;
+    return &lexer_token;
 }
 
-static lexer_token_t *lexer_identifier(string_t *str) {
+static lexer_token_t *lexer_identifier(const char *string, size_t length) {
+    char *interned = string_intern(string, length);
     return lexer_token_copy(&(lexer_token_t){
         .type      = LEXER_TOKEN_IDENTIFIER,
-        .string    = string_buffer(str)
+        .string    = interned,
+        .keyword   = string_intern_tag(interned) & ~LEXER_TAG_MACRO
     });
 }
 static lexer_token_t *lexer_strtok(string_t *str) {
@@ -106,6 +274,8 @@ static void lexer_skip_comment_block(void) {
 
     for (;;) {
         int c = lexer_file_get();
+        if (c == EOF)
+            compile_error("unterminated comment");
         if (c == '*')
             state = comment_astrick;
         else if (state == comment_astrick && c == '/')
@@ -115,11 +285,14 @@ static void lexer_skip_comment_block(void) {
     }
 }
 
+/* skip whitespace up to the end of the line, which is a token itself */
 static int lexer_skip(void) {
     int c;
     while ((c = lexer_file_get()) != EOF) {
-        if (isspace(c) || c == '\n' || c == '\r')
+        if (isspace(c) && c != '\n') {
+            lexer_space = true;
             continue;
+        }
         lexer_file_unget(c);
         return c;
     }
@@ -263,18 +436,42 @@ static lexer_token_t *lexer_read_string(void) {
     return lexer_strtok(string);
 }
 
+static bool lexer_isidentifier(int c) {
+    return isalnum(c) || c == '_' || c == '$';
+}
+
 static lexer_token_t *lexer_read_identifier(int c1) {
-    string_t *string = string_create();
-    string_cat(string, (char)c1);
+    static char   *buffer    = NULL;
+    static size_t  allocated = 0;
+    size_t         length    = 0;
+
+    /*
+     * Identifiers without line splices in them (all but pathological
+     * ones) are interned straight out of the source buffer.
+     */
+    const char *begin = &lexer_file.buffer[lexer_file.position - 1];
+    const char *end   = &lexer_file.buffer[lexer_file.length];
+    const char *p     = begin + 1;
+
+    while (p != end && lexer_isidentifier((unsigned char)*p))
+        p++;
+
+    if (p == end || *p != '\\') {
+        lexer_file.position += p - begin - 1;
+        return lexer_identifier(begin, p - begin);
+    }
 
-    for (;;) {
-        int c2 = lexer_file_get();
-        if (isalnum(c2) || c2 == '_' || c2 == '$') {
-            string_cat(string, c2);
-        } else {
+    for (int c2 = c1; ; c2 = lexer_file_get()) {
+        if (!lexer_isidentifier(c2)) {
             lexer_file_unget(c2);
-            return lexer_identifier(string);
+            return lexer_identifier(buffer, length);
         }
+        if (length == allocated) {
+            allocated = allocated ? allocated * 2 : 64;
+            if (!(buffer = realloc(buffer, allocated)))
+                compile_error("out of memory");
+        }
+        buffer[length++] = c2;
     }
     return NULL;
 }
@@ -296,53 +493,27 @@ static lexer_token_t *lexer_read_reclassify_two(int expect1, int a, int expect2,
     return lexer_punct(e);
 }
 
-static lexer_token_t *lexer_read_token(void);
-
-static lexer_token_t *lexer_minicpp(void) {
-    string_t *string = string_create();
-    string_t *method = string_create();
-    char     *buffer;
-    int       ch;
-
-    for (const char *p = "pragma"; *p; p++) {
-        if ((ch = lexer_file_get()) != *p) {
-            string_cat(string, ch);
-            goto error;
-        }
-    }
-
-    for (ch = lexer_file_get(); ch && ch != '\n'; ch = lexer_file_get()) {
-        if (isspace(ch))
-            continue;
-        string_cat(method, ch);
+static void lexer_file_load(void) {
+    if (!lexer_file.buffer) {
+        lexer_file_open();
+        atexit(lexer_file_close);
     }
-
-    buffer = string_buffer(method);
-
-    if (!strcmp(buffer, "warning_disable"))
-        compile_warning = false;
-    if (!strcmp(buffer, "warning_enable"))
-        compile_warning = true;
-
-    goto fall;
-
-error:
-    buffer = string_buffer(string);
-    for (char *beg = &buffer[string_length(string)]; beg != &buffer[-1]; --beg)
-        lexer_file_unget(*beg);
-
-fall:
-    lexer_skip_comment_line();
-    return lexer_read_token();
 }
 
 static lexer_token_t *lexer_read_token(void) {
     int c;
     int n;
 
+    lexer_file_load();
+
     lexer_skip();
 
+    lexer_location.file   = lexer_file.file;
+    lexer_location.line   = lexer_file.line;
+    lexer_location.column = lexer_file.position - lexer_file.begin + 1;
+
     switch ((c = lexer_file_get())) {
+        case '\n':         return lexer_punct(LEXER_PUNCT_NEWLINE);
         case '0' ... '9':  return lexer_read_number(c);
         case '"':          return lexer_read_string();
         case '\'':         return lexer_read_character();
@@ -368,9 +539,11 @@ static lexer_token_t *lexer_read_token(void) {
             switch ((c = lexer_file_get())) {
                 case '/':
                     lexer_skip_comment_line();
+                    lexer_space = true;
                     return lexer_read_token();
                 case '*':
                     lexer_skip_comment_block();
+                    lexer_space = true;
                     return lexer_read_token();
             }
             if (c == '=')
@@ -378,9 +551,8 @@ static lexer_token_t *lexer_read_token(void) {
             lexer_file_unget(c);
             return lexer_punct('/');
 
-        // ignore preprocessor lines for now
         case '#':
-            return lexer_minicpp();
+            return lexer_read_reclassify_one('#', LEXER_PUNCT_PASTE, '#');
 
         case '(': case ')':
         case ',': case ';':
@@ -432,9 +604,8 @@ static lexer_token_t *lexer_read_token(void) {
                 return lexer_read_number(c);
             }
             if (n == '.') {
-                string_t *str = string_create();
-                string_catf(str, "..%c", lexer_file_get());
-                return lexer_identifier(str);
+                char dots[] = { '.', '.', lexer_file_get() };
+                return lexer_identifier(dots, sizeof(dots));
             }
             lexer_file_unget(n);
             return lexer_punct('.');
@@ -448,6 +619,1370 @@ static lexer_token_t *lexer_read_token(void) {
     return NULL;
 }
 
+/*
+ * The preprocessor works on the tokens of the scanner above, a directive
+ * is a '#' at the beginning of a line up to the end of that line. Macros
+ * are expanded with hidesets: every token carries the names of the
+ * macros it came out of and isn't expanded by those again.
+ *
+ * Included files are read into memory once and kept for the rest of the
+ * translation unit, including a file again scans it again, as what's
+ * skipped depends on the macros defined at the time. Files entirely
+ * within #ifndef NAME ... #endif or with a #pragma once aren't even
+ * scanned again once that's known to give nothing.
+ */
+typedef struct {
+    lexer_token_t *tokens;
+    size_t         length;
+    size_t         allocated;
+} lexer_tokens_t;
+
+typedef struct lexer_hideset_s lexer_hideset_t;
+
+struct lexer_hideset_s {
+    const char      *name;
+    lexer_hideset_t *next;
+};
+
+typedef enum {
+    LEXER_MACRO_OBJECT,
+    LEXER_MACRO_FUNCTION,
+    LEXER_MACRO_FILE,
+    LEXER_MACRO_LINE
+} lexer_macro_kind_t;
+
+typedef struct {
+    lexer_macro_kind_t kind;
+    bool               defined;
+    bool               variadic;
+    int                parameters;
+    const char       **names;
+    lexer_tokens_t     body;
+    int               *indices;     /* parameter of each body token or -1 */
+} lexer_macro_t;
+
+typedef struct {
+    const char     *path;
+    const char     *buffer;
+    size_t          length;
+    bool            mapped;
+    const char     *guard;
+    bool            once;
+    bool            included;
+} lexer_include_t;
+
+typedef struct lexer_frame_s lexer_frame_t;
+
+struct lexer_frame_s {
+    lexer_include_t *include;
+    lexer_file_t     file;          /* of the including file */
+    int              conditionals;
+    lexer_frame_t   *parent;
+};
+
+typedef struct {
+    bool taken;
+    bool otherwise;
+} lexer_conditional_t;
+
+#define LEXER_INCLUDE_DEPTH 200
+
+static table_t          *lexer_macros       = NULL;
+static table_t          *lexer_headers      = NULL;
+static table_t          *lexer_lookups      = NULL;
+static list_t           *lexer_paths        = NULL;
+static list_t           *lexer_included     = NULL;
+static list_t           *lexer_conditionals = NULL;
+static lexer_frame_t    *lexer_frame        = NULL;
+static int               lexer_frame_depth  = 0;
+static lexer_tokens_t    lexer_pending;
+static bool              lexer_isolated     = false;
+static bool              lexer_bol          = true;
+static lexer_location_t  lexer_raw_location;
+
+static const char *lexer_predefined[][2] = {
+    { "__STDC__",        "1" },
+    { "__STDC_HOSTED__", "1" },
+    { "__x86_64__",      "1" },
+    { "__LP64__",        "1" }
+};
+
+static void lexer_tokens_push(lexer_tokens_t *tokens, lexer_token_t *token) {
+    if (tokens->length == tokens->allocated) {
+        size_t         allocated = tokens->allocated ? tokens->allocated * 2 : 16;
+        lexer_token_t *data      = memory_allocate(sizeof(lexer_token_t) * allocated);
+
+        if (tokens->length)
+            memcpy(data, tokens->tokens, sizeof(lexer_token_t) * tokens->length);
+        tokens->tokens    = data;
+        tokens->allocated = allocated;
+    }
+    tokens->tokens[tokens->length++] = *token;
+}
+
+static lexer_tokens_t *lexer_tokens_create(void) {
+    lexer_tokens_t *tokens = memory_allocate(sizeof(lexer_tokens_t));
+    memset(tokens, 0, sizeof(*tokens));
+    return tokens;
+}
+
+static bool lexer_hideset_contains(lexer_hideset_t *set, const char *name) {
+    for (; set; set = set->next)
+        if (set->name == name)
+            return true;
+    return false;
+}
+
+static lexer_hideset_t *lexer_hideset_add(lexer_hideset_t *set, const char *name) {
+    lexer_hideset_t *head = memory_allocate(sizeof(lexer_hideset_t));
+    head->name = name;
+    head->next = set;
+    return head;
+}
+
+static lexer_hideset_t *lexer_hideset_union(lexer_hideset_t *a, lexer_hideset_t *b) {
+    for (; a; a = a->next)
+        if (!lexer_hideset_contains(b, a->name))
+            b = lexer_hideset_add(b, a->name);
+    return b;
+}
+
+static lexer_hideset_t *lexer_hideset_intersection(lexer_hideset_t *a, lexer_hideset_t *b) {
+    lexer_hideset_t *set = NULL;
+    for (; a; a = a->next)
+        if (lexer_hideset_contains(b, a->name))
+            set = lexer_hideset_add(set, a->name);
+    return set;
+}
+
+/* the source text of a token, as far as the preprocessor is concerned */
+static const char *lexer_spelling(lexer_token_t *token) {
+    static const char *compound[] = {
+        [LEXER_TOKEN_EQUAL]           = "==",
+        [LEXER_TOKEN_LEQUAL]          = "<=",
+        [LEXER_TOKEN_GEQUAL]          = ">=",
+        [LEXER_TOKEN_NEQUAL]          = "!=",
+        [LEXER_TOKEN_INCREMENT]       = "++",
+        [LEXER_TOKEN_DECREMENT]       = "--",
+        [LEXER_TOKEN_ARROW]           = "->",
+        [LEXER_TOKEN_LSHIFT]          = "<<",
+        [LEXER_TOKEN_RSHIFT]          = ">>",
+        [LEXER_TOKEN_COMPOUND_ADD]    = "+=",
+        [LEXER_TOKEN_COMPOUND_SUB]    = "-=",
+        [LEXER_TOKEN_COMPOUND_MUL]    = "*=",
+        [LEXER_TOKEN_COMPOUND_DIV]    = "/=",
+        [LEXER_TOKEN_COMPOUND_MOD]    = "%=",
+        [LEXER_TOKEN_COMPOUND_AND]    = "&=",
+        [LEXER_TOKEN_COMPOUND_OR]     = "|=",
+        [LEXER_TOKEN_COMPOUND_XOR]    = "^=",
+        [LEXER_TOKEN_COMPOUND_LSHIFT] = "<<=",
+        [LEXER_TOKEN_COMPOUND_RSHIFT] = ">>=",
+        [LEXER_TOKEN_AND]             = "&&",
+        [LEXER_TOKEN_OR]              = "||"
+    };
+
+    string_t *string = string_create();
+
+    switch (token->type) {
+        case LEXER_TOKEN_IDENTIFIER:
+        case LEXER_TOKEN_NUMBER:
+            return token->string;
+
+        case LEXER_TOKEN_STRING:
+            string_catf(string, "\"%s\"", string_quote(token->string));
+            return string_buffer(string);
+
+        case LEXER_TOKEN_CHAR:
+            if (token->character == '\'' || token->character == '\\')
+                string_catf(string, "'\\%c'", token->character);
+            else if (!isprint((unsigned char)token->character))
+                string_catf(string, "'\\%o'", (unsigned char)token->character);
+            else
+                string_catf(string, "'%c'", token->character);
+            return string_buffer(string);
+
+        case LEXER_TOKEN_PUNCT:
+            if (token->punct == LEXER_PUNCT_PASTE)
+                return "##";
+            if (token->punct == LEXER_PUNCT_NEWLINE)
+                return "\n";
+            if ((size_t)token->punct < sizeof(compound) / sizeof(*compound) && compound[token->punct])
+                return compound[token->punct];
+            string_cat(string, token->punct);
+            return string_buffer(string);
+
+        default:
+            break;
+    }
+    compile_ice("lexer_spelling");
+    return NULL;
+}
+
+static char *lexer_join(lexer_tokens_t *tokens) {
+    string_t *string = string_create();
+    for (size_t i = 0; i < tokens->length; i++) {
+        if (i && tokens->tokens[i].space)
+            string_cat(string, ' ');
+        string_catf(string, "%s", lexer_spelling(&tokens->tokens[i]));
+    }
+    return string_buffer(string);
+}
+
+/*
+ * Scan the tokens of a string, for pasting tokens together and for macros
+ * defined from outside a source file.
+ */
+static lexer_tokens_t *lexer_scan(const char *text, lexer_location_t *location) {
+    lexer_file_t     file     = lexer_file;
+    lexer_location_t saved    = lexer_location;
+    bool             space    = lexer_space;
+    bool             scanning = lexer_scanning;
+    lexer_tokens_t  *tokens   = lexer_tokens_create();
+    lexer_token_t   *token;
+
+    lexer_file = (lexer_file_t){
+        .file   = (char *)location->file,
+        .line   = location->line,
+        .fd     = -1,
+        .buffer = text,
+        .length = strlen(text)
+    };
+
+    lexer_scanning = true;
+    while ((token = lexer_read_token()))
+        if (!lexer_ispunct(token, LEXER_PUNCT_NEWLINE))
+            lexer_tokens_push(tokens, token);
+
+    lexer_file     = file;
+    lexer_location = saved;
+    lexer_space    = space;
+    lexer_scanning = scanning;
+    return tokens;
+}
+
+/*
+ * The next token before any preprocessing, out of the innermost included
+ * file or the source file itself. Running out of an included file goes
+ * back to the one which included it.
+ */
+static bool lexer_raw(lexer_token_t *token) {
+    lexer_scanning = true;
+    lexer_token_t *read = lexer_read_token();
+    lexer_scanning = false;
+
+    if (!read) {
+        lexer_frame_t *frame = lexer_frame;
+        if (!frame)
+            return false;
+        if (list_length(lexer_conditionals) != frame->conditionals)
+            compile_error("unterminated conditional directive");
+
+        /* the last line of a file ends with the file */
+        lexer_location = (lexer_location_t){ lexer_file.file, lexer_file.line, 1 };
+        read           = lexer_punct(LEXER_PUNCT_NEWLINE);
+
+        lexer_file  = frame->file;
+        lexer_frame = frame->parent;
+        lexer_frame_depth--;
+    }
+    *token             = *read;
+    lexer_raw_location = token->location;
+    return true;
+}
+
+/* tokens read ahead and the results of expansions come before the source */
+static void lexer_unread(lexer_token_t *token) {
+    lexer_tokens_push(&lexer_pending, token);
+}
+
+static bool lexer_read_unexpanded(lexer_token_t *token) {
+    if (lexer_pending.length) {
+        *token = lexer_pending.tokens[--lexer_pending.length];
+        return true;
+    }
+    return !lexer_isolated && lexer_raw(token);
+}
+
+/* the rest of a directive, the end of the line included */
+static lexer_tokens_t *lexer_line(void) {
+    lexer_tokens_t *line = lexer_tokens_create();
+    lexer_token_t   token;
+
+    while (lexer_raw(&token) && !lexer_ispunct(&token, LEXER_PUNCT_NEWLINE))
+        lexer_tokens_push(line, &token);
+    return line;
+}
+
+static lexer_macro_t *lexer_macro_find(const char *name) {
+    if (!(string_intern_tag(name) & LEXER_TAG_MACRO))
+        return NULL;
+    return table_find_interned(lexer_macros, name);
+}
+
+static bool lexer_macro_defined(const char *name) {
+    lexer_macro_t *macro = lexer_macro_find(name);
+    return macro && macro->defined;
+}
+
+static lexer_macro_t *lexer_macro_create(const char *name) {
+    lexer_macro_t *macro = lexer_macro_find(name);
+    if (macro)
+        return macro;
+
+    macro = memory_allocate(sizeof(lexer_macro_t));
+    memset(macro, 0, sizeof(*macro));
+    table_insert_interned(lexer_macros, (char *)name, macro);
+    string_intern_tag_set(name, string_intern_tag(name) | LEXER_TAG_MACRO);
+    return macro;
+}
+
+static bool lexer_preprocess(lexer_token_t *token);
+
+/* fully expand a sequence of tokens by itself, like macro arguments */
+static lexer_tokens_t *lexer_expand_all(lexer_tokens_t *tokens) {
+    lexer_tokens_t  pending  = lexer_pending;
+    bool            isolated = lexer_isolated;
+    bool            bol      = lexer_bol;
+    lexer_tokens_t *expanded = lexer_tokens_create();
+    lexer_token_t   token;
+
+    memset(&lexer_pending, 0, sizeof(lexer_pending));
+    for (size_t i = tokens->length; i-- > 0; )
+        lexer_unread(&tokens->tokens[i]);
+
+    lexer_isolated = true;
+    lexer_bol      = false;
+    while (lexer_preprocess(&token))
+        lexer_tokens_push(expanded, &token);
+
+    lexer_pending  = pending;
+    lexer_isolated = isolated;
+    lexer_bol      = bol;
+    return expanded;
+}
+
+static lexer_token_t lexer_stringize(lexer_tokens_t *argument, lexer_token_t *site) {
+    return (lexer_token_t){
+        .type     = LEXER_TOKEN_STRING,
+        .string   = lexer_join(argument),
+        .location = site->location,
+        .space    = site->space
+    };
+}
+
+static void lexer_paste(lexer_token_t *left, lexer_token_t *right) {
+    string_t *text = string_create();
+
+    string_catf(text, "%s%s", lexer_spelling(left), lexer_spelling(right));
+
+    lexer_tokens_t *tokens = lexer_scan(string_buffer(text), &left->location);
+    if (tokens->length != 1)
+        compile_error("pasting \"%s\" and \"%s\" does not give a valid preprocessing token", lexer_spelling(left), lexer_spelling(right));
+
+    lexer_token_t pasted = tokens->tokens[0];
+    pasted.location = left->location;
+    pasted.space    = left->space;
+    pasted.hideset  = left->hideset;
+    *left           = pasted;
+}
+
+static void lexer_append(lexer_tokens_t *result, lexer_tokens_t *tokens, size_t from) {
+    for (size_t i = from; i < tokens->length; i++)
+        lexer_tokens_push(result, &tokens->tokens[i]);
+}
+
+/*
+ * Replace the parameters in the body of a macro by the arguments, handle
+ * the # and ## operators and push the result back for rescanning.
+ */
+static void lexer_substitute(lexer_macro_t *macro, lexer_tokens_t *arguments, lexer_hideset_t *hideset, lexer_token_t *site) {
+    lexer_tokens_t *result      = lexer_tokens_create();
+    lexer_token_t  *body        = macro->body.tokens;
+    size_t          length      = macro->body.length;
+    bool            placemarker = false;
+
+    for (size_t i = 0; i < length; i++) {
+        lexer_token_t *token = &body[i];
+        int            index = macro->indices[i];
+        int            next  = (i + 1 < length) ? macro->indices[i + 1] : -1;
+
+        if (macro->kind == LEXER_MACRO_FUNCTION && lexer_ispunct(token, '#') && next >= 0) {
+            lexer_token_t string = lexer_stringize(&arguments[next], token);
+            lexer_tokens_push(result, &string);
+            placemarker = false;
+            i++;
+            continue;
+        }
+
+        if (lexer_ispunct(token, LEXER_PUNCT_PASTE) && i + 1 < length) {
+            lexer_tokens_t  single = { &body[i + 1], 1, 1 };
+            lexer_tokens_t *right  = (next >= 0) ? &arguments[next] : &single;
+            bool            left   = result->length && !placemarker;
+            i++;
+
+            /* , ## __VA_ARGS__ drops the comma when there are no variadic arguments */
+            if (macro->variadic && next == macro->parameters - 1 && left
+                    && lexer_ispunct(&result->tokens[result->length - 1], ',')) {
+                if (!right->length)
+                    result->length--;
+                lexer_append(result, right, 0);
+                continue;
+            }
+
+            if (!right->length)
+                continue;
+            if (!left) {
+                lexer_append(result, right, 0);
+            } else {
+                lexer_paste(&result->tokens[result->length - 1], &right->tokens[0]);
+                lexer_append(result, right, 1);
+            }
+            placemarker = false;
+            continue;
+        }
+
+        /* the operands of ## aren't expanded */
+        if (index >= 0 && i + 1 < length && lexer_ispunct(&body[i + 1], LEXER_PUNCT_PASTE)) {
+            lexer_append(result, &arguments[index], 0);
+            placemarker = !arguments[index].length;
+            continue;
+        }
+
+        placemarker = false;
+        if (index >= 0) {
+            size_t          first    = result->length;
+            lexer_tokens_t *expanded = lexer_expand_all(&arguments[index]);
+            lexer_append(result, expanded, 0);
+            if (result->length > first)
+                result->tokens[first].space = token->space;
+            continue;
+        }
+        lexer_tokens_push(result, token);
+    }
+
+    for (size_t i = 0; i < result->length; i++) {
+        result->tokens[i].hideset  = lexer_hideset_union(result->tokens[i].hideset, hideset);
+        result->tokens[i].location = site->location;
+    }
+    if (result->length)
+        result->tokens[0].space = site->space;
+
+    for (size_t i = result->length; i-- > 0; )
+        lexer_unread(&result->tokens[i]);
+}
+
+static lexer_tokens_t *lexer_arguments(lexer_macro_t *macro, const char *name, lexer_token_t *close) {
+    int             count     = MAX(macro->parameters, 1);
+    lexer_tokens_t *arguments = memory_allocate(sizeof(lexer_tokens_t) * count);
+    int             index     = 0;
+    int             depth     = 0;
+    bool            newline   = false;
+    lexer_token_t   token;
+
+    memset(arguments, 0, sizeof(lexer_tokens_t) * count);
+    for (;;) {
+        if (!lexer_read_unexpanded(&token))
+            compile_error("unterminated argument list invoking macro '%s'", name);
+        if (lexer_ispunct(&token, LEXER_PUNCT_NEWLINE)) {
+            newline = true;
+            continue;
+        }
+        token.space |= newline;
+        newline      = false;
+
+        if (!depth && lexer_ispunct(&token, ')'))
+            break;
+        if (!depth && lexer_ispunct(&token, ',') && !(macro->variadic && index == macro->parameters - 1)) {
+            if (++index >= count)
+                compile_error("macro '%s' passed %d arguments, but takes just %d", name, index + 1, macro->parameters);
+            continue;
+        }
+        if (lexer_ispunct(&token, '('))
+            depth++;
+        else if (lexer_ispunct(&token, ')'))
+            depth--;
+        lexer_tokens_push(&arguments[index], &token);
+    }
+
+    if (!macro->parameters && arguments[0].length)
+        compile_error("macro '%s' passed 1 arguments, but takes just 0", name);
+    if (index + 1 < macro->parameters && !(macro->variadic && index + 2 == macro->parameters))
+        compile_error("macro '%s' requires %d arguments, but only %d given", name, macro->parameters, index + 1);
+
+    *close = token;
+    return arguments;
+}
+
+/* expand the macro named by a token, if it's one that is to be expanded */
+static bool lexer_expand(lexer_token_t *token) {
+    const char    *name  = token->string;
+    lexer_macro_t *macro = lexer_macro_find(name);
+    lexer_token_t  result;
+
+    if (!macro || !macro->defined || lexer_hideset_contains(token->hideset, name))
+        return false;
+
+    switch (macro->kind) {
+        case LEXER_MACRO_FILE:
+            result        = *token;
+            result.type   = LEXER_TOKEN_STRING;
+            result.string = (char *)token->location.file;
+            lexer_unread(&result);
+            return true;
+
+        case LEXER_MACRO_LINE: {
+            string_t *line = string_create();
+            string_catf(line, "%zu", token->location.line);
+            result         = *token;
+            result.type    = LEXER_TOKEN_NUMBER;
+            result.string  = string_buffer(line);
+            result.keyword = LEXER_KEYWORD_NONE;
+            lexer_unread(&result);
+            return true;
+        }
+
+        case LEXER_MACRO_OBJECT:
+            lexer_substitute(macro, NULL, lexer_hideset_add(token->hideset, name), token);
+            return true;
+
+        case LEXER_MACRO_FUNCTION:
+            break;
+    }
+
+    /* function like macros are only invoked by a parenthesis following */
+    lexer_token_t next;
+    lexer_token_t newline;
+    bool          crossed = false;
+
+    for (;;) {
+        if (!lexer_read_unexpanded(&next)) {
+            if (crossed)
+                lexer_unread(&newline);
+            return false;
+        }
+        if (!lexer_ispunct(&next, LEXER_PUNCT_NEWLINE))
+            break;
+        newline = next;
+        crossed = true;
+    }
+
+    if (!lexer_ispunct(&next, '(')) {
+        lexer_unread(&next);
+        if (crossed)
+            lexer_unread(&newline);
+        return false;
+    }
+
+    lexer_token_t    close;
+    lexer_tokens_t  *arguments = lexer_arguments(macro, name, &close);
+    lexer_hideset_t *hideset   = lexer_hideset_intersection(token->hideset, close.hideset);
+
+    lexer_substitute(macro, arguments, lexer_hideset_add(hideset, name), token);
+    return true;
+}
+
+static bool lexer_macro_equal(lexer_macro_t *a, lexer_macro_t *b) {
+    if (a->kind != b->kind || a->variadic != b->variadic || a->parameters != b->parameters)
+        return false;
+    if (a->body.length != b->body.length)
+        return false;
+    for (int i = 0; i < a->parameters; i++)
+        if (a->names[i] != b->names[i])
+            return false;
+    for (size_t i = 0; i < a->body.length; i++) {
+        if (i && a->body.tokens[i].space != b->body.tokens[i].space)
+            return false;
+        if (strcmp(lexer_spelling(&a->body.tokens[i]), lexer_spelling(&b->body.tokens[i])))
+            return false;
+    }
+    return true;
+}
+
+static void lexer_macro_define(const char *name, lexer_macro_t *definition) {
+    lexer_macro_t *macro = lexer_macro_create(name);
+
+    if (macro->kind == LEXER_MACRO_FILE || macro->kind == LEXER_MACRO_LINE)
+        compile_error("\"%s\" cannot be redefined", name);
+    if (macro->defined && !lexer_macro_equal(macro, definition))
+        compile_warn("\"%s\" redefined", name);
+
+    *macro         = *definition;
+    macro->defined = true;
+}
+
+static void lexer_directive_define(void) {
+    lexer_tokens_t *line = lexer_line();
+    lexer_token_t  *tokens = line->tokens;
+    size_t          i      = 1;
+    lexer_macro_t   macro  = { .kind = LEXER_MACRO_OBJECT };
+    list_t         *names  = list_create();
+
+    if (!line->length || tokens[0].type != LEXER_TOKEN_IDENTIFIER)
+        compile_error("macro names must be identifiers");
+
+    /* a parenthesis right after the name begins the parameters */
+    if (line->length > 1 && lexer_ispunct(&tokens[1], '(') && !tokens[1].space) {
+        macro.kind = LEXER_MACRO_FUNCTION;
+        for (i = 2; ; i++) {
+            if (i >= line->length)
+                compile_error("missing ')' in macro parameter list");
+            if (lexer_ispunct(&tokens[i], ')') && !list_length(names) && !macro.variadic) {
+                i++;
+                break;
+            }
+            if (tokens[i].type != LEXER_TOKEN_IDENTIFIER)
+                compile_error("expected parameter name, found \"%s\"", lexer_spelling(&tokens[i]));
+            if (tokens[i].keyword == LEXER_KEYWORD_ELLIPSIS) {
+                macro.variadic = true;
+                list_push(names, string_intern("__VA_ARGS__", 11));
+            } else {
+                list_push(names, tokens[i].string);
+                /* GNU extension, named variadic parameters */
+                if (i + 1 < line->length && tokens[i + 1].keyword == LEXER_KEYWORD_ELLIPSIS && tokens[i + 1].type == LEXER_TOKEN_IDENTIFIER) {
+                    macro.variadic = true;
+                    i++;
+                }
+            }
+            if (++i < line->length && lexer_ispunct(&tokens[i], ')') && (i++, true))
+                break;
+            if (i >= line->length || !lexer_ispunct(&tokens[i], ',') || macro.variadic)
+                compile_error("expected ',' or ')' in macro parameter list");
+        }
+    }
+
+    macro.parameters = list_length(names);
+    macro.names      = memory_allocate(sizeof(char *) * (macro.parameters + 1));
+    for (int j = 0; j < macro.parameters; j++)
+        macro.names[j] = list_shift(names);
+
+    macro.indices = memory_allocate(sizeof(int) * (line->length - MIN(i, line->length) + 1));
+    for (; i < line->length; i++) {
+        int index = -1;
+        if (tokens[i].type == LEXER_TOKEN_IDENTIFIER)
+            for (int j = 0; j < macro.parameters; j++)
+                if (macro.names[j] == tokens[i].string)
+                    index = j;
+        macro.indices[macro.body.length] = index;
+        lexer_tokens_push(&macro.body, &tokens[i]);
+    }
+
+    if (macro.body.length) {
+        macro.body.tokens[0].space = false;
+        if (lexer_ispunct(&macro.body.tokens[0], LEXER_PUNCT_PASTE)
+                || lexer_ispunct(&macro.body.tokens[macro.body.length - 1], LEXER_PUNCT_PASTE))
+            compile_error("'##' cannot appear at either end of a macro expansion");
+    }
+
+    lexer_macro_define(tokens[0].string, &macro);
+}
+
+static const char *lexer_directive_name(const char *directive) {
+    lexer_tokens_t *line = lexer_line();
+    if (!line->length || line->tokens[0].type != LEXER_TOKEN_IDENTIFIER)
+        compile_error("no macro name given in #%s directive", directive);
+    return line->tokens[0].string;
+}
+
+static void lexer_directive_undef(void) {
+    lexer_macro_t *macro = lexer_macro_find(lexer_directive_name("undef"));
+    if (macro)
+        macro->defined = false;
+}
+
+/*
+ * #if expressions, evaluated in long with the usual precedence. The
+ * operands which don't matter for the result (the right of && and || and
+ * the arm of ?: not taken) are parsed but not evaluated.
+ */
+static long lexer_evaluate_expression(lexer_tokens_t *tokens, size_t *index, int minimum, bool live);
+
+static lexer_token_t *lexer_evaluate_token(lexer_tokens_t *tokens, size_t index) {
+    return (index < tokens->length) ? &tokens->tokens[index] : NULL;
+}
+
+static long lexer_evaluate_number(const char *string) {
+    char          *end;
+    unsigned long  value = strtoul(string, &end, 0);
+
+    while (*end == 'u' || *end == 'U' || *end == 'l' || *end == 'L')
+        end++;
+    if (*end)
+        compile_error("invalid integer constant in preprocessor expression: %s", string);
+    return value;
+}
+
+static long lexer_evaluate_primary(lexer_tokens_t *tokens, size_t *index, bool live) {
+    lexer_token_t *token = lexer_evaluate_token(tokens, (*index)++);
+    long           value;
+
+    if (!token)
+        compile_error("#if expression ends unexpectedly");
+
+    switch (token->type) {
+        case LEXER_TOKEN_NUMBER:     return lexer_evaluate_number(token->string);
+        case LEXER_TOKEN_CHAR:       return token->character;
+        case LEXER_TOKEN_IDENTIFIER: return 0;
+        case LEXER_TOKEN_PUNCT:      break;
+        default:
+            compile_error("token \"%s\" is not valid in preprocessor expressions", lexer_spelling(token));
+    }
+
+    switch (token->punct) {
+        case '(':
+            value = lexer_evaluate_expression(tokens, index, 0, live);
+            if (!lexer_ispunct(lexer_evaluate_token(tokens, (*index)++), ')'))
+                compile_error("missing ')' in expression");
+            return value;
+        case '-': return -lexer_evaluate_primary(tokens, index, live);
+        case '+': return +lexer_evaluate_primary(tokens, index, live);
+        case '!': return !lexer_evaluate_primary(tokens, index, live);
+        case '~': return ~lexer_evaluate_primary(tokens, index, live);
+    }
+    compile_error("token \"%s\" is not valid in preprocessor expressions", lexer_spelling(token));
+    return 0;
+}
+
+static int lexer_evaluate_precedence(lexer_token_t *token) {
+    if (!token || token->type != LEXER_TOKEN_PUNCT)
+        return -1;
+
+    switch (token->punct) {
+        case '*': case '/': case '%':                      return 10;
+        case '+': case '-':                                return 9;
+        case LEXER_TOKEN_LSHIFT: case LEXER_TOKEN_RSHIFT:  return 8;
+        case '<': case '>':
+        case LEXER_TOKEN_LEQUAL: case LEXER_TOKEN_GEQUAL:  return 7;
+        case LEXER_TOKEN_EQUAL: case LEXER_TOKEN_NEQUAL:   return 6;
+        case '&':                                          return 5;
+        case '^':                                          return 4;
+        case '|':                                          return 3;
+        case LEXER_TOKEN_AND:                              return 2;
+        case LEXER_TOKEN_OR:                               return 1;
+        case '?':                                          return 0;
+    }
+    return -1;
+}
+
+static long lexer_evaluate_binary(int op, long left, long right, bool live) {
+    switch (op) {
+        case '/':
+        case '%':
+            if (!right) {
+                if (live)
+                    compile_error("division by zero in #if");
+                return 0;
+            }
+            return (op == '/') ? left / right : left % right;
+
+        case '*':                    return left * right;
+        case '+':                    return left + right;
+        case '-':                    return left - right;
+        case LEXER_TOKEN_LSHIFT:     return left << right;
+        case LEXER_TOKEN_RSHIFT:     return left >> right;
+        case '<':                    return left <  right;
+        case '>':                    return left >  right;
+        case LEXER_TOKEN_LEQUAL:     return left <= right;
+        case LEXER_TOKEN_GEQUAL:     return left >= right;
+        case LEXER_TOKEN_EQUAL:      return left == right;
+        case LEXER_TOKEN_NEQUAL:     return left != right;
+        case '&':                    return left &  right;
+        case '^':                    return left ^  right;
+        case '|':                    return left |  right;
+        case LEXER_TOKEN_AND:        return left && right;
+        case LEXER_TOKEN_OR:         return left || right;
+    }
+    compile_ice("lexer_evaluate_binary");
+    return 0;
+}
+
+static long lexer_evaluate_expression(lexer_tokens_t *tokens, size_t *index, int minimum, bool live) {
+    long left = lexer_evaluate_primary(tokens, index, live);
+
+    for (;;) {
+        lexer_token_t *token      = lexer_evaluate_token(tokens, *index);
+        int            precedence = lexer_evaluate_precedence(token);
+
+        if (precedence < minimum)
+            return left;
+        (*index)++;
+
+        if (token->punct == '?') {
+            long then = lexer_evaluate_expression(tokens, index, 0, live && left);
+            if (!lexer_ispunct(lexer_evaluate_token(tokens, (*index)++), ':'))
+                compile_error("'?' without following ':' in #if");
+            long otherwise = lexer_evaluate_expression(tokens, index, 0, live && !left);
+            left = left ? then : otherwise;
+            continue;
+        }
+
+        bool right = live;
+        if (token->punct == LEXER_TOKEN_AND)
+            right = live && left;
+        else if (token->punct == LEXER_TOKEN_OR)
+            right = live && !left;
+
+        left = lexer_evaluate_binary(token->punct, left, lexer_evaluate_expression(tokens, index, precedence + 1, right), live);
+    }
+}
+
+static bool lexer_evaluate(lexer_tokens_t *line) {
+    lexer_tokens_t *tokens = lexer_tokens_create();
+    size_t          index  = 0;
+
+    /* defined is handled before anything is expanded */
+    for (size_t i = 0; i < line->length; i++) {
+        lexer_token_t token = line->tokens[i];
+        if (token.type == LEXER_TOKEN_IDENTIFIER && !strcmp(token.string, "defined")) {
+            bool   parenthesis = i + 1 < line->length && lexer_ispunct(&line->tokens[i + 1], '(');
+            size_t name        = i + 1 + parenthesis;
+
+            if (name >= line->length || line->tokens[name].type != LEXER_TOKEN_IDENTIFIER)
+                compile_error("operator \"defined\" requires an identifier");
+            if (parenthesis && (name + 1 >= line->length || !lexer_ispunct(&line->tokens[name + 1], ')')))
+                compile_error("missing ')' after \"defined\"");
+
+            token.type   = LEXER_TOKEN_NUMBER;
+            token.string = lexer_macro_defined(line->tokens[name].string) ? "1" : "0";
+            i            = name + parenthesis;
+        }
+        lexer_tokens_push(tokens, &token);
+    }
+
+    tokens = lexer_expand_all(tokens);
+    if (!tokens->length)
+        compile_error("#if with no expression");
+
+    long value = lexer_evaluate_expression(tokens, &index, 0, true);
+    if (index != tokens->length)
+        compile_error("missing binary operator before token \"%s\"", lexer_spelling(&tokens->tokens[index]));
+    return value != 0;
+}
+
+/*
+ * Lines of groups which aren't taken needn't be made of valid tokens (an
+ * apostrophe in #error can't happen is fine there), so they're skipped
+ * a character at a time looking only for the names of directives. Quotes
+ * are matched within a line, so that comments within them don't count.
+ */
+static int lexer_skip_blank(void) {
+    for (;;) {
+        int c = lexer_file_get();
+        if (c == '/') {
+            int n = lexer_file_get();
+            if (n == '*') {
+                lexer_skip_comment_block();
+                continue;
+            }
+            if (n == '/') {
+                lexer_skip_comment_line();
+                continue;
+            }
+            lexer_file_unget(n);
+        } else if (c != '\n' && isspace(c)) {
+            continue;
+        }
+        return c;
+    }
+}
+
+static void lexer_skip_quote(int quote) {
+    for (;;) {
+        int c = lexer_file_get();
+        if (c == '\\')
+            c = lexer_file_get();
+        if (c == EOF || c == '\n') {
+            lexer_file_unget(c);
+            return;
+        }
+        if (c == quote)
+            return;
+    }
+}
+
+/* the rest of a line which is skipped, its end included */
+static void lexer_skip_rest(void) {
+    for (;;) {
+        int c = lexer_skip_blank();
+        if (c == EOF || c == '\n')
+            return;
+        if (c == '"' || c == '\'')
+            lexer_skip_quote(c);
+    }
+}
+
+/* the name of the directive starting a line, if it's one */
+static const char *lexer_skip_directive(void) {
+    int c = lexer_skip_blank();
+    if (c == '#' && (isalpha(c = lexer_skip_blank()) || c == '_'))
+        return lexer_read_identifier(c)->string;
+    lexer_file_unget(c);
+    return NULL;
+}
+
+static bool lexer_skip_end(void) {
+    int c = lexer_file_get();
+    lexer_file_unget(c);
+    return c == EOF;
+}
+
+/*
+ * Skip the lines of a group which isn't taken, up to the #elif, #else or
+ * #endif ending it. Which of those it was is returned, the rest of that
+ * line is left for the caller.
+ */
+static const char *lexer_skip_group(void) {
+    int depth = 0;
+
+    lexer_scanning = true;
+    for (;;) {
+        if (lexer_skip_end())
+            compile_error("unterminated conditional directive");
+
+        const char *name = lexer_skip_directive();
+        if (name && !depth && (!strcmp(name, "endif") || !strcmp(name, "else") || !strcmp(name, "elif"))) {
+            lexer_scanning = false;
+            return name;
+        }
+
+        if (name && (!strcmp(name, "if") || !strcmp(name, "ifdef") || !strcmp(name, "ifndef")))
+            depth++;
+        else if (name && !strcmp(name, "endif"))
+            depth--;
+        lexer_skip_rest();
+    }
+}
+
+/* skip groups of the innermost conditional until one of them is taken */
+static void lexer_conditional_skip(void) {
+    lexer_conditional_t *conditional = list_tail(lexer_conditionals);
+
+    for (;;) {
+        const char *name = lexer_skip_group();
+
+        if (!strcmp(name, "endif")) {
+            lexer_line();
+            list_pop(lexer_conditionals);
+            return;
+        }
+
+        if (conditional->otherwise)
+            compile_error("#%s after #else", name);
+
+        if (!strcmp(name, "else")) {
+            lexer_line();
+            conditional->otherwise = true;
+        } else if (conditional->taken) {
+            lexer_line();
+            continue;
+        } else if (!lexer_evaluate(lexer_line())) {
+            continue;
+        }
+
+        if (!conditional->taken) {
+            conditional->taken = true;
+            return;
+        }
+    }
+}
+
+static void lexer_conditional(bool taken) {
+    lexer_conditional_t *conditional = memory_allocate(sizeof(lexer_conditional_t));
+
+    conditional->taken     = taken;
+    conditional->otherwise = false;
+    list_push(lexer_conditionals, conditional);
+
+    if (!taken)
+        lexer_conditional_skip();
+}
+
+/* #elif and #else after a group which was taken, the rest is skipped */
+static void lexer_directive_else(const char *name) {
+    lexer_conditional_t *conditional = list_tail(lexer_conditionals);
+
+    if (list_length(lexer_conditionals) <= (lexer_frame ? lexer_frame->conditionals : 0))
+        compile_error("#%s without #if", name);
+    if (conditional->otherwise)
+        compile_error("#%s after #else", name);
+
+    lexer_line();
+    conditional->otherwise = !strcmp(name, "else");
+    lexer_conditional_skip();
+}
+
+static void lexer_directive_endif(void) {
+    if (list_length(lexer_conditionals) <= (lexer_frame ? lexer_frame->conditionals : 0))
+        compile_error("#endif without #if");
+    lexer_line();
+    list_pop(lexer_conditionals);
+}
+
+/*
+ * The macro guarding a file, when all of it is within #ifndef NAME and
+ * the #endif matching it. Including the file again while NAME is defined
+ * can't give anything then.
+ */
+static const char *lexer_include_guard(void) {
+    const char *guard = NULL;
+    const char *name;
+    int         depth = 1;
+    int         c;
+
+    while ((c = lexer_skip_blank()) == '\n')
+        ;
+    lexer_file_unget(c);
+
+    if (!(name = lexer_skip_directive()) || strcmp(name, "ifndef"))
+        return NULL;
+    if (!isalpha(c = lexer_skip_blank()) && c != '_')
+        return NULL;
+    guard = lexer_read_identifier(c)->string;
+    if (lexer_skip_blank() != '\n')
+        return NULL;
+
+    while (depth && !lexer_skip_end()) {
+        name = lexer_skip_directive();
+        if (name && (!strcmp(name, "if") || !strcmp(name, "ifdef") || !strcmp(name, "ifndef")))
+            depth++;
+        else if (name && (!strcmp(name, "else") || !strcmp(name, "elif")) && depth == 1)
+            return NULL;
+        else if (name && !strcmp(name, "endif"))
+            depth--;
+        lexer_skip_rest();
+    }
+
+    while ((c = lexer_skip_blank()) == '\n')
+        ;
+    return (!depth && c == EOF) ? guard : NULL;
+}
+
+static lexer_include_t *lexer_include_load(const char *path, int fd) {
+    lexer_file_t     file     = lexer_file;
+    bool             space    = lexer_space;
+    bool             scanning = lexer_scanning;
+    lexer_include_t *include  = memory_allocate(sizeof(lexer_include_t));
+
+    memset(include, 0, sizeof(*include));
+    include->path = string_intern(path, strlen(path));
+
+    lexer_file = (lexer_file_t){
+        .file = (char *)include->path,
+        .line = 1,
+        .fd   = fd
+    };
+
+    lexer_file_open();
+    include->buffer = lexer_file.buffer;
+    include->length = lexer_file.length;
+    include->mapped = lexer_file.mapped;
+
+    lexer_scanning = true;
+    include->guard = lexer_include_guard();
+
+    lexer_file     = file;
+    lexer_space    = space;
+    lexer_scanning = scanning;
+    return include;
+}
+
+/* files are cached by their identity, whatever path they're included as */
+static lexer_include_t *lexer_include_open(const char *path) {
+    struct stat  status;
+    string_t    *identity = string_create();
+    int          fd       = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &status) || S_ISDIR(status.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    string_catf(identity, "%lx:%lx", (unsigned long)status.st_dev, (unsigned long)status.st_ino);
+
+    char            *key     = string_intern(string_buffer(identity), string_length(identity));
+    lexer_include_t *include = table_find_interned(lexer_headers, key);
+    if (!include) {
+        include = lexer_include_load(path, fd);
+        table_insert_interned(lexer_headers, key, include);
+        list_push(lexer_included, (char *)include->path);
+    }
+    close(fd);
+    return include;
+}
+
+static const char *lexer_include_join(const char *directory, size_t length, const char *name) {
+    string_t *path = string_create();
+    string_catf(path, "%.*s%s%s", (int)length, directory, (length && directory[length - 1] != '/') ? "/" : "", name);
+    return string_buffer(path);
+}
+
+/*
+ * Where an include resolves to depends on the name, how it's quoted and
+ * for quotes where the including file is, so that's remembered too.
+ */
+static lexer_include_t *lexer_include_find(const char *name, bool angled) {
+    const char *includer  = lexer_frame ? lexer_frame->include->path : lexer_file.file;
+    const char *slash     = strrchr(includer, '/');
+    size_t      directory = (slash && !angled) ? (size_t)(slash - includer + 1) : 0;
+    string_t   *key       = string_create();
+
+    string_catf(key, "%c%.*s%s", angled ? '<' : '"', (int)directory, includer, name);
+
+    char            *interned = string_intern(string_buffer(key), string_length(key));
+    lexer_include_t *include  = table_find_interned(lexer_lookups, interned);
+
+    if (include)
+        return include;
+
+    if (*name == '/') {
+        include = lexer_include_open(name);
+    } else {
+        if (!angled)
+            include = lexer_include_open(lexer_include_join(includer, directory, name));
+        for (list_iterator_t *it = list_iterator(lexer_paths); !include && !list_iterator_end(it); ) {
+            const char *path = list_iterator_next(it);
+            include = lexer_include_open(lexer_include_join(path, strlen(path), name));
+        }
+    }
+
+    if (include)
+        table_insert_interned(lexer_lookups, interned, include);
+    return include;
+}
+
+static void lexer_directive_include(void) {
+    lexer_tokens_t *line   = lexer_line();
+    bool            angled = false;
+    string_t       *name   = string_create();
+
+    if (line->length && line->tokens[0].type != LEXER_TOKEN_STRING && !lexer_ispunct(&line->tokens[0], '<'))
+        line = lexer_expand_all(line);
+
+    if (line->length && line->tokens[0].type == LEXER_TOKEN_STRING) {
+        string_catf(name, "%s", line->tokens[0].string);
+    } else if (line->length && lexer_ispunct(&line->tokens[0], '<')) {
+        size_t i = 1;
+        for (; i < line->length && !lexer_ispunct(&line->tokens[i], '>'); i++) {
+            if (i > 1 && line->tokens[i].space)
+                string_cat(name, ' ');
+            string_catf(name, "%s", lexer_spelling(&line->tokens[i]));
+        }
+        if (i == line->length)
+            compile_error("missing terminating > character");
+        angled = true;
+    } else {
+        compile_error("#include expects \"FILENAME\" or <FILENAME>");
+    }
+
+    lexer_include_t *include = lexer_include_find(string_buffer(name), angled);
+    if (!include)
+        compile_error("%s: No such file or directory", string_buffer(name));
+
+    if ((include->once && include->included) || (include->guard && lexer_macro_defined(include->guard)))
+        return;
+
+    if (lexer_frame_depth >= LEXER_INCLUDE_DEPTH)
+        compile_error("#include nested too deeply");
+
+    lexer_frame_t *frame = memory_allocate(sizeof(lexer_frame_t));
+    frame->include       = include;
+    frame->file          = lexer_file;
+    frame->conditionals  = list_length(lexer_conditionals);
+    frame->parent        = lexer_frame;
+
+    lexer_file = (lexer_file_t){
+        .file   = (char *)include->path,
+        .line   = 1,
+        .fd     = -1,
+        .buffer = include->buffer,
+        .length = include->length,
+        .mapped = include->mapped
+    };
+
+    include->included = true;
+    lexer_frame       = frame;
+    lexer_frame_depth++;
+}
+
+/* #line and the line markers other preprocessors leave behind */
+static void lexer_directive_line(lexer_tokens_t *line) {
+    if (line->length && line->tokens[0].type != LEXER_TOKEN_NUMBER)
+        line = lexer_expand_all(line);
+    if (!line->length || line->tokens[0].type != LEXER_TOKEN_NUMBER || !isdigit(*line->tokens[0].string))
+        compile_error("#line directive requires a simple digit sequence");
+
+    size_t      number = strtoul(line->tokens[0].string, NULL, 10);
+    const char *file   = (line->length > 1 && line->tokens[1].type == LEXER_TOKEN_STRING) ? line->tokens[1].string : NULL;
+
+    /* the number is the one of the line following the directive */
+    lexer_file.line = number;
+    if (file)
+        lexer_file.file = (char *)file;
+}
+
+static void lexer_directive_pragma(void) {
+    lexer_tokens_t *line = lexer_line();
+    const char     *name = (line->length && line->tokens[0].type == LEXER_TOKEN_IDENTIFIER) ? line->tokens[0].string : "";
+
+    if (!strcmp(name, "once") && lexer_frame)
+        lexer_frame->include->once = true;
+    else if (!strcmp(name, "warning_disable"))
+        compile_warning = false;
+    else if (!strcmp(name, "warning_enable"))
+        compile_warning = true;
+}
+
+static void lexer_directive(void) {
+    lexer_token_t token;
+
+    /* the null directive */
+    if (!lexer_raw(&token) || lexer_ispunct(&token, LEXER_PUNCT_NEWLINE))
+        return;
+
+    if (token.type == LEXER_TOKEN_NUMBER) {
+        lexer_tokens_t *line = lexer_tokens_create();
+        lexer_tokens_push(line, &token);
+        lexer_append(line, lexer_line(), 0);
+        lexer_directive_line(line);
+        return;
+    }
+
+    if (token.type != LEXER_TOKEN_IDENTIFIER)
+        compile_error("invalid preprocessing directive");
+
+    const char *name = token.string;
+
+    if      (!strcmp(name, "define"))  lexer_directive_define();
+    else if (!strcmp(name, "undef"))   lexer_directive_undef();
+    else if (!strcmp(name, "include")) lexer_directive_include();
+    else if (!strcmp(name, "if"))      lexer_conditional(lexer_evaluate(lexer_line()));
+    else if (!strcmp(name, "ifdef"))   lexer_conditional(lexer_macro_defined(lexer_directive_name("ifdef")));
+    else if (!strcmp(name, "ifndef"))  lexer_conditional(!lexer_macro_defined(lexer_directive_name("ifndef")));
+    else if (!strcmp(name, "elif"))    lexer_directive_else("elif");
+    else if (!strcmp(name, "else"))    lexer_directive_else("else");
+    else if (!strcmp(name, "endif"))   lexer_directive_endif();
+    else if (!strcmp(name, "line"))    lexer_directive_line(lexer_line());
+    else if (!strcmp(name, "error"))   compile_error("#error %s", lexer_join(lexer_line()));
+    else if (!strcmp(name, "warning")) compile_warn("#warning %s", lexer_join(lexer_line()));
+    else if (!strcmp(name, "pragma"))  lexer_directive_pragma();
+    else
+        compile_error("invalid preprocessing directive #%s", name);
+}
+
+/*
+ * The next token after preprocessing, false at the end of the source or
+ * of the tokens being expanded by <lexer_expand_all>.
+ */
+static bool lexer_preprocess(lexer_token_t *token) {
+    for (;;) {
+        if (!lexer_read_unexpanded(token)) {
+            if (!lexer_isolated && list_length(lexer_conditionals))
+                compile_error("unterminated conditional directive");
+            return false;
+        }
+
+        if (lexer_ispunct(token, LEXER_PUNCT_NEWLINE)) {
+            lexer_bol = true;
+            continue;
+        }
+
+        if (lexer_bol && lexer_ispunct(token, '#')) {
+            lexer_directive();
+            continue;
+        }
+
+        lexer_bol = false;
+        if (token->type == LEXER_TOKEN_IDENTIFIER && lexer_expand(token))
+            continue;
+        return true;
+    }
+}
+
+static void lexer_builtin(const char *name, lexer_macro_kind_t kind) {
+    lexer_macro_t *macro = lexer_macro_create(string_intern(name, strlen(name)));
+    macro->kind    = kind;
+    macro->defined = true;
+}
+
+/*
+ * The tokens of the source, the macros and the included files are used
+ * for the rest of the compilation, they're all kept in an arena of their
+ * own instead of the one of whichever phase happens to be pulling tokens.
+ */
+static void lexer_setup(void) {
+    if (lexer_arena)
+        return;
+
+    lexer_arena = memory_arena_create();
+
+    memory_arena_t *previous = memory_arena_select(lexer_arena);
+
+    lexer_macros       = table_create(NULL);
+    lexer_headers      = table_create(NULL);
+    lexer_lookups      = table_create(NULL);
+    lexer_conditionals = list_create();
+    lexer_included     = list_create();
+    if (!lexer_paths)
+        lexer_paths = list_create();
+
+    lexer_builtin("__FILE__", LEXER_MACRO_FILE);
+    lexer_builtin("__LINE__", LEXER_MACRO_LINE);
+
+    memory_arena_select(previous);
+
+    for (size_t i = 0; i < sizeof(lexer_predefined) / sizeof(*lexer_predefined); i++)
+        lexer_define(lexer_predefined[i][0], lexer_predefined[i][1]);
+}
+
+const char *lexer_source_data(size_t *length) {
+    lexer_file_load();
+    *length = lexer_file.length;
+    return lexer_file.buffer;
+}
+
+list_t *lexer_includes(void) {
+    lexer_setup();
+    return lexer_included;
+}
+
+bool lexer_source(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    lexer_file.file = string_intern(path, strlen(path));
+    lexer_file.fd   = fd;
+    return true;
+}
+
+void lexer_include_path(const char *path) {
+    lexer_setup();
+
+    memory_arena_t *previous = memory_arena_select(lexer_arena);
+    list_push(lexer_paths, string_intern(path, strlen(path)));
+    memory_arena_select(previous);
+}
+
+void lexer_define(const char *name, const char *value) {
+    lexer_setup();
+
+    memory_arena_t   *previous = memory_arena_select(lexer_arena);
+    lexer_location_t  location = { "(command line)", 1, 1 };
+    lexer_macro_t     macro    = { .kind = LEXER_MACRO_OBJECT };
+    lexer_tokens_t   *tokens   = lexer_scan(value, &location);
+
+    macro.body    = *tokens;
+    macro.indices = memory_allocate(sizeof(int) * (tokens->length + 1));
+    for (size_t i = 0; i < tokens->length; i++)
+        macro.indices[i] = -1;
+    if (tokens->length)
+        macro.body.tokens[0].space = false;
+
+    lexer_macro_define(string_intern(name, strlen(name)), &macro);
+    memory_arena_select(previous);
+}
+
 bool lexer_ispunct(lexer_token_t *token, int c) {
     return token && (token->type == LEXER_TOKEN_PUNCT) && (token->punct == c);
 }
@@ -455,13 +1990,39 @@ bool lexer_ispunct(lexer_token_t *token, int c) {
 void lexer_unget(lexer_token_t *token) {
     if (!token)
         return;
-    list_push(lexer_buffer, token);
+
+    if (lexer_ring_read == 0 || lexer_ring_fill - lexer_ring_read >= LEXER_LOOKAHEAD)
+        compile_ice("token stream rewound past its lookahead");
+
+    lexer_token_t *slot = &lexer_ring[--lexer_ring_read % LEXER_LOOKAHEAD];
+    if (slot != token)
+        *slot = *token;
 }
 
 lexer_token_t *lexer_next(void) {
-    if (list_length(lexer_buffer) > 0)
-        return list_pop(lexer_buffer);
-    return lexer_read_token();
+    if (lexer_ring_read < lexer_ring_fill)
+        return &lexer_ring[lexer_ring_read++ % LEXER_LOOKAHEAD];
+
+    lexer_setup();
+
+    memory_arena_t *previous = memory_arena_select(lexer_arena);
+    lexer_token_t   token;
+    bool            read;
+
+    lexer_reading = true;
+    read          = lexer_preprocess(&token);
+    lexer_reading = false;
+
+    memory_arena_select(previous);
+
+    if (!read)
+        return NULL;
+
+    lexer_token_t *slot = &lexer_ring[lexer_ring_fill++ % LEXER_LOOKAHEAD];
+    *slot = token;
+    lexer_ring_read = lexer_ring_fill;
+
+    return slot;
 }
 
 lexer_token_t *lexer_peek(void) {
@@ -470,6 +2031,16 @@ lexer_token_t *lexer_peek(void) {
     return token;
 }
 
+size_t lexer_mark(void) {
+    return lexer_ring_read;
+}
+
+void lexer_rewind(size_t mark) {
+    if (mark > lexer_ring_read || lexer_ring_fill - mark > LEXER_LOOKAHEAD)
+        compile_ice("token stream rewound past its lookahead");
+    lexer_ring_read = mark;
+}
+
 char *lexer_token_string(lexer_token_t *token) {
     string_t *string = string_create();
     if (!token)
@@ -499,7 +2070,18 @@ char *lexer_token_string(lexer_token_t *token) {
 }
 
 char *lexer_marker(void) {
-    string_t *string = string_create();
-    string_catf(string, "%s:%zu", lexer_file.file, lexer_file.line);
+    string_t         *string   = string_create();
+    lexer_location_t *location = &lexer_ring[(lexer_ring_read - 1) % LEXER_LOOKAHEAD].location;
+
+    /*
+     * Errors found scanning are reported where the scanner is, those of
+     * the preprocessor where the last token it read is.
+     */
+    if (lexer_scanning || (!lexer_ring_read && !lexer_raw_location.file))
+        string_catf(string, "%s:%zu:%zu", lexer_file.file, lexer_file.line, lexer_file.position - lexer_file.begin + 1);
+    else if (lexer_reading || !lexer_ring_read)
+        string_catf(string, "%s:%zu:%zu", lexer_raw_location.file, lexer_raw_location.line, lexer_raw_location.column);
+    else
+        string_catf(string, "%s:%zu:%zu", location->file, location->line, location->column);
     return string_buffer(string);
 }
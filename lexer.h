@@ -5,6 +5,9 @@
  *  Implements the interface for LICE's lexer
  */
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "list.h"
 
 /*
  * Type: lexer_token_type_t
@@ -71,6 +74,75 @@ typedef enum {
     LEXER_TOKEN_OR
 } lexer_token_type_t;
 
+/*
+ * Type: lexer_keyword_t
+ *  Type to describe which keyword an identifier token is.
+ *
+ *  Remarks:
+ *   Keywords are recognized once when the identifier is interned,
+ *   alternate spellings (like __typeof__ for typeof) share the same
+ *   keyword. The keywords which can begin a type are kept together
+ *   between LEXER_KEYWORD_CHAR and LEXER_KEYWORD_BOOL.
+ */
+typedef enum {
+    LEXER_KEYWORD_NONE,
+
+    LEXER_KEYWORD_CHAR,
+    LEXER_KEYWORD_SHORT,
+    LEXER_KEYWORD_INT,
+    LEXER_KEYWORD_LONG,
+    LEXER_KEYWORD_FLOAT,
+    LEXER_KEYWORD_DOUBLE,
+    LEXER_KEYWORD_STRUCT,
+    LEXER_KEYWORD_UNION,
+    LEXER_KEYWORD_SIGNED,
+    LEXER_KEYWORD_UNSIGNED,
+    LEXER_KEYWORD_ENUM,
+    LEXER_KEYWORD_VOID,
+    LEXER_KEYWORD_TYPEDEF,
+    LEXER_KEYWORD_EXTERN,
+    LEXER_KEYWORD_STATIC,
+    LEXER_KEYWORD_AUTO,
+    LEXER_KEYWORD_REGISTER,
+    LEXER_KEYWORD_CONST,
+    LEXER_KEYWORD_VOLATILE,
+    LEXER_KEYWORD_INLINE,
+    LEXER_KEYWORD_RESTRICT,
+    LEXER_KEYWORD_TYPEOF,
+    LEXER_KEYWORD_BOOL,
+
+    LEXER_KEYWORD_IF,
+    LEXER_KEYWORD_ELSE,
+    LEXER_KEYWORD_FOR,
+    LEXER_KEYWORD_WHILE,
+    LEXER_KEYWORD_DO,
+    LEXER_KEYWORD_RETURN,
+    LEXER_KEYWORD_SWITCH,
+    LEXER_KEYWORD_CASE,
+    LEXER_KEYWORD_DEFAULT,
+    LEXER_KEYWORD_BREAK,
+    LEXER_KEYWORD_CONTINUE,
+    LEXER_KEYWORD_GOTO,
+    LEXER_KEYWORD_SIZEOF,
+    LEXER_KEYWORD_ALIGNOF,
+    LEXER_KEYWORD_ALIGNOF_GNU,
+    LEXER_KEYWORD_STATIC_ASSERT,
+    LEXER_KEYWORD_ELLIPSIS
+} lexer_keyword_t;
+
+/*
+ * Class: lexer_location_t
+ *  Describes where in the source a token begins
+ */
+typedef struct {
+    /* Variable: file */
+    const char *file;
+    /* Variable: line */
+    size_t      line;
+    /* Variable: column */
+    size_t      column;
+} lexer_location_t;
+
 /*
  * Class: lexer_token_t
  *  Describes a token in the token stream
@@ -88,6 +160,36 @@ typedef struct {
         char *string;
         char  character;
     };
+
+    /*
+     * Variable: keyword
+     *  For identifiers, which keyword the identifier is or
+     *  LEXER_KEYWORD_NONE. The string of an identifier is interned,
+     *  identifiers can be compared by pointer.
+     */
+    lexer_keyword_t keyword;
+
+    /*
+     * Variable: location
+     *  Where in the source the token begins, for tokens out of a macro
+     *  expansion where the macro was expanded
+     */
+    lexer_location_t location;
+
+    /*
+     * Variable: space
+     *  Whether whitespace or a comment came before the token, the
+     *  preprocessor needs it to stringize and to tell function like
+     *  macro definitions apart.
+     */
+    bool space;
+
+    /*
+     * Variable: hideset
+     *  The macros the token came out of the expansion of, which aren't
+     *  expanded again within it
+     */
+    struct lexer_hideset_s *hideset;
 } lexer_token_t;
 
 /*
@@ -159,9 +261,34 @@ void lexer_unget(lexer_token_t *token);
  * Returns:
  *  The next token in the token stream or NULL
  *  on failure or EOF.
+ *
+ * Remarks:
+ *  Tokens live in a fixed size ring buffer, a token stays valid until
+ *  <LEXER_LOOKAHEAD> more tokens have been read after it.
  */
 lexer_token_t *lexer_next(void);
 
+/*
+ * Constant: LEXER_LOOKAHEAD
+ *  How many tokens the token stream keeps around, this bounds both how
+ *  long a token stays valid and how far back the stream can be rewound.
+ */
+#define LEXER_LOOKAHEAD 4096
+
+/*
+ * Function: lexer_mark
+ *  Mark the current position in the token stream to come back to with
+ *  <lexer_rewind>.
+ */
+size_t lexer_mark(void);
+
+/*
+ * Function: lexer_rewind
+ *  Rewind the token stream to a position previously returned by
+ *  <lexer_mark>, the tokens read since are read again.
+ */
+void lexer_rewind(size_t mark);
+
 /*
  * Function: lexer_peek
  *  Look at the next token without advancing the stream.
@@ -188,13 +315,67 @@ lexer_token_t *lexer_peek(void);
  */
 char *lexer_token_string(lexer_token_t *token);
 
+/*
+ * Function: lexer_include_path
+ *  Add a directory to search for included files in.
+ *
+ * Parameters:
+ *  path    - The directory
+ *
+ * Remarks:
+ *  Directories are searched in the order they were added, for
+ *  #include "file" the directory of the including file is searched
+ *  before all of them.
+ */
+void lexer_include_path(const char *path);
+
+/*
+ * Function: lexer_define
+ *  Define an object like macro, as if by #define.
+ *
+ * Parameters:
+ *  name    - The name of the macro
+ *  value   - The replacement text of the macro
+ */
+void lexer_define(const char *name, const char *value);
+
+/*
+ * Function: lexer_source
+ *  Read the translation unit from a file instead of standard input.
+ *
+ * Parameters:
+ *  path    - The file to read
+ *
+ * Returns:
+ *  false if the file cannot be opened, true otherwise.
+ *
+ * Remarks:
+ *  Must be called before the first token is read. The path is what
+ *  diagnostics and __FILE__ refer to the file as.
+ */
+bool lexer_source(const char *path);
+
+/*
+ * Function: lexer_source_data
+ *  Get the source of the translation unit, exactly as it's lexed.
+ *
+ * Parameters:
+ *  length  - Receives the length of the source in bytes
+ */
+const char *lexer_source_data(size_t *length);
+
+/*
+ * Function: lexer_includes
+ *  Get the paths of all files included so far, each of them once.
+ */
+list_t *lexer_includes(void);
+
 /*
  * Function: lexer_marker
- *  Get the line marker of where the lexer currently is.
+ *  Get the line marker of the last token read from the token stream.
  *
  * Remarks:
- *  Currently returns file.c:line, will later be extended to also include
- *  column marker. This is used in error reporting.
+ *  Returns file.c:line:column. This is used in error reporting.
  */
 char *lexer_marker(void);
 
@@ -1,13 +1,23 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/wait.h>
 
 #include "lexer.h"
 #include "parse.h"
 #include "gen.h"
 #include "opt.h"
+#include "asm.h"
+#include "ir.h"
+#include "fold.h"
+#include "peep.h"
+#include "cache.h"
 
 bool compile_warning = true;
 
@@ -46,23 +56,359 @@ void compile_ice(const char *fmt, ...) {
     abort();
 }
 
-int compile_begin(bool dump) {
+typedef struct {
+    bool   dumpast;
+    bool   dumpir;
+    size_t index;
+} compile_state_t;
+
+/*
+ * Generate a toplevel into the output of the calling thread, in a context
+ * of its own so it comes out the same whichever thread generates it.
+ */
+static void compile_generate(compile_state_t *state, ast_t *ast, size_t index, memory_arena_t *persistent) {
+    gen_context_begin(index, persistent);
+
+    if (opt_level() && ast->type == AST_TYPE_FUNCTION)
+        fold_function(ast);
+
+    gen_emit_inline("# block %zu", index);
+    if (state->dumpir) {
+        if (ast->type == AST_TYPE_FUNCTION)
+            gen_emit_inline("%s", ir_string(ir_lower(ast)));
+    } else if (state->dumpast) {
+        gen_emit_inline("%s", ast_string(ast));
+    } else {
+        gen_toplevel(ast);
+    }
+
+    gen_context_end();
+}
+
+static void compile_toplevel(ast_t *ast, void *data) {
+    compile_state_t *state = data;
+
+    compile_generate(state, ast, state->index++, NULL);
+    gen_constants_merge(gen_constants_release());
+}
+
+/*
+ * Code generation of toplevels is independent of each other, with more
+ * than one job they're handed out to a pool of threads. Every toplevel is
+ * generated into an output of its own and those are written in source
+ * order once all of them are done, the same as generating them in turn.
+ */
+typedef struct {
+    ast_t  *ast;
+    char   *text;
+    size_t  length;
+    list_t *constants;
+} compile_task_t;
+
+typedef struct {
+    compile_state_t *state;
+    compile_task_t  *tasks;
+    size_t           count;
+    size_t           next;
+} compile_pool_t;
+
+typedef struct {
+    compile_pool_t *pool;
+    memory_arena_t *persistent;
+    pthread_t       thread;
+} compile_worker_t;
+
+static void *compile_worker(void *data) {
+    compile_worker_t *worker = data;
+    compile_pool_t   *pool   = worker->pool;
+    memory_arena_t   *arena  = memory_arena_create();
+
+    memory_arena_select(arena);
+    gen_output_memory();
+
+    for (;;) {
+        size_t index = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (index >= pool->count)
+            break;
+
+        compile_task_t *task = &pool->tasks[index];
+
+        compile_generate(pool->state, task->ast, index, worker->persistent);
+        task->text      = gen_output_release(&task->length);
+        task->constants = gen_constants_release();
+
+        memory_arena_reset(arena);
+    }
+
+    memory_arena_select(NULL);
+    memory_arena_destroy(arena);
+    return NULL;
+}
+
+static void compile_parallel(compile_state_t *state, list_t *block, int jobs) {
+    size_t            count   = list_length(block);
+    size_t            threads = MIN((size_t)jobs, count);
+    compile_task_t   *tasks   = memory_allocate(sizeof(compile_task_t) * count);
+    compile_worker_t *workers = memory_allocate(sizeof(compile_worker_t) * threads);
+    compile_pool_t    pool    = { state, tasks, count, 0 };
+    size_t            index   = 0;
+
+    for (list_iterator_t *it = list_iterator(block); !list_iterator_end(it); )
+        tasks[index++].ast = list_iterator_next(it);
+
+    for (size_t i = 0; i < threads; i++) {
+        workers[i].pool       = &pool;
+        workers[i].persistent = memory_arena_create();
+        if (pthread_create(&workers[i].thread, NULL, &compile_worker, &workers[i]))
+            compile_error("failed creating thread for code generation");
+    }
+
+    for (size_t i = 0; i < threads; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    for (size_t i = 0; i < count; i++) {
+        if (tasks[i].length)
+            gen_output_data(tasks[i].text, tasks[i].length);
+        free(tasks[i].text);
+        gen_constants_merge(tasks[i].constants);
+    }
+
+    /* the pool refers to constants kept in the arenas of the workers */
+    gen_constants_emit();
+
+    for (size_t i = 0; i < threads; i++)
+        memory_arena_destroy(workers[i].persistent);
+}
+
+int compile_begin(bool dumpast, bool dumpir, int jobs) {
+    compile_state_t state = { dumpast, dumpir, 0 };
+
     parse_init();
 
-    list_t *block = parse_run();
-    size_t  index = 0;
+    /*
+     * Each toplevel is generated as soon as it's parsed, the parser takes
+     * care of releasing what it and the code generator allocated for it.
+     */
+    if (!opt_unit() && jobs <= 1) {
+        parse_run(&compile_toplevel, &state);
+        gen_constants_emit();
+        gen_output_flush();
+        return true;
+    }
 
-    for (list_iterator_t *it = list_iterator(block); !list_iterator_end(it); index++) {
-        printf("# block %zu\n", index);
-        if (!dump) {
-            gen_toplevel(list_iterator_next(it));
-        } else {
-            printf("%s", ast_string(list_iterator_next(it)));
-        }
+    list_t *block = parse_unit();
+
+    if (jobs > 1) {
+        compile_parallel(&state, block, jobs);
+        gen_output_flush();
+        return true;
     }
+
+    memory_arena_t *arena = memory_arena_create();
+
+    for (list_iterator_t *it = list_iterator(block); !list_iterator_end(it); ) {
+        /*
+         * Everything code generation allocates for a toplevel is dead
+         * once it's been emitted, so give each toplevel a fresh arena.
+         */
+        memory_arena_t *previous = memory_arena_select(arena);
+
+        compile_toplevel(list_iterator_next(it), &state);
+
+        memory_arena_select(previous);
+        memory_arena_reset(arena);
+    }
+
+    gen_constants_emit();
+    memory_arena_destroy(arena);
+    gen_output_flush();
+    return true;
+}
+
+/*
+ * The generated code is gathered in memory when compiling to an object
+ * file, it's assembled once everything has been generated and the object
+ * file is written to the output instead.
+ */
+static bool compile_write(const char *output, const void *data, size_t size) {
+    if (!output)
+        gen_output_fd(STDOUT_FILENO);
+    else if (!gen_output_file(output)) {
+        fprintf(stderr, "cannot open output file: %s\n", output);
+        return false;
+    }
+
+    gen_output_data(data, size);
+    gen_output_flush();
     return true;
 }
 
+static bool compile_object(const char *output) {
+    size_t         length;
+    size_t         size;
+    char          *text  = gen_output_release(&length);
+    unsigned char *image = asm_assemble(text, length, &size);
+
+    free(text);
+
+    bool written = compile_write(output, image, size);
+    free(image);
+    return written;
+}
+
+/*
+ * With a cache the output is looked up by the source of the translation
+ * unit first. On a miss it's generated in memory and stored before it's
+ * written, the same output either way.
+ */
+static bool compile_cached(const char *output, bool dumpast, bool dumpir, bool object, int jobs) {
+    size_t      length;
+    size_t      size;
+    const char *source = lexer_source_data(&length);
+    const void *cached = cache_find(source, length, &size);
+
+    if (cached) {
+        bool written = compile_write(output, cached, size);
+        cache_release();
+        return written;
+    }
+
+    gen_output_memory();
+    if (!compile_begin(dumpast, dumpir, jobs))
+        return false;
+
+    char *text = gen_output_release(&length);
+    void *data = text;
+
+    size = length;
+    if (object) {
+        data = asm_assemble(text, length, &size);
+        free(text);
+    }
+
+    cache_store(data, size, lexer_includes());
+
+    bool written = compile_write(output, data, size);
+    free(data);
+    return written;
+}
+
+/* compile the translation unit to the output, or standard output without one */
+static bool compile_unit(const char *output, bool dumpast, bool dumpir, bool object, int jobs) {
+    if (cache_enabled())
+        return compile_cached(output, dumpast, dumpir, object, jobs);
+
+    if (object)
+        gen_output_memory();
+    else if (output && !gen_output_file(output)) {
+        fprintf(stderr, "cannot open output file: %s\n", output);
+        return false;
+    }
+
+    if (!compile_begin(dumpast, dumpir, jobs))
+        return false;
+
+    return !object || compile_object(output);
+}
+
+/*
+ * Given files on the command line they're compiled as a batch, every one
+ * of them in a process of its own forked from the driver, so a file which
+ * fails to compile doesn't take the others with it. The output of a.c is
+ * written to a.s (or a.o) in the output directory, or to the output file
+ * when it's the only one.
+ */
+typedef struct {
+    const char *input;
+    char       *output;
+    pid_t       pid;
+    double      start;
+    double      time;
+    bool        failed;
+} compile_batch_t;
+
+static double compile_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static char *compile_batch_output(const char *input, const char *directory, bool object) {
+    const char *base   = strrchr(input, '/') ? strrchr(input, '/') + 1 : input;
+    const char *dot    = strrchr(base, '.');
+    string_t   *output = string_create();
+
+    string_catf(output, "%s/", directory ? directory : ".");
+    for (const char *p = base; *p && p != dot; p++)
+        string_cat(output, *p);
+    string_catf(output, object ? ".o" : ".s");
+
+    return string_buffer(output);
+}
+
+static void compile_batch_child(compile_batch_t *file, bool dumpast, bool dumpir, bool object) {
+    if (!lexer_source(file->input)) {
+        fprintf(stderr, "cannot open input file: %s\n", file->input);
+        exit(EXIT_FAILURE);
+    }
+
+    /* the name of the file shows up in the output with __FILE__ */
+    cache_option(file->input);
+
+    exit(compile_unit(file->output, dumpast, dumpir, object, 1) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static bool compile_batch(compile_batch_t *files, size_t count, int jobs, bool dumpast, bool dumpir, bool object) {
+    size_t next    = 0;
+    size_t running = 0;
+    size_t failed  = 0;
+    double start   = compile_clock();
+
+    /* anything buffered would be written again by every child */
+    fflush(NULL);
+
+    while (next < count || running) {
+        if (next < count && running < (size_t)jobs) {
+            compile_batch_t *file = &files[next++];
+
+            file->start = compile_clock();
+            if ((file->pid = fork()) == 0)
+                compile_batch_child(file, dumpast, dumpir, object);
+            if (file->pid == -1) {
+                fprintf(stderr, "cannot start compiling: %s\n", file->input);
+                file->failed = true;
+                continue;
+            }
+            running++;
+            continue;
+        }
+
+        int   status;
+        pid_t pid = wait(&status);
+        if (pid == -1)
+            break;
+
+        for (size_t i = 0; i < next; i++) {
+            if (files[i].pid != pid)
+                continue;
+            files[i].time   = compile_clock() - files[i].start;
+            files[i].failed = !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS;
+            if (files[i].failed)
+                unlink(files[i].output);
+            running--;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        fprintf(stderr, "%10.2f ms  %-6s  %s\n", files[i].time, files[i].failed ? "failed" : "ok", files[i].input);
+        failed += files[i].failed;
+    }
+    fprintf(stderr, "%10.2f ms  %zu of %zu files compiled\n", compile_clock() - start, count - failed, count);
+
+    return !failed;
+}
+
 static bool parse_option(const char *optname, int *cargc, char ***cargv, char **out, int ds, bool split) {
     int    argc = *cargc;
     char **argv = *cargv;
@@ -90,7 +436,18 @@ static bool parse_option(const char *optname, int *cargc, char ***cargv, char **
 
 int main(int argc, char **argv) {
     bool  dumpast  = false;
+    bool  dumpir   = false;
+    bool  stats    = false;
+    bool  object   = false;
     char *standard = NULL;
+    char *output   = NULL;
+    int   jobs     = 1;
+    char *cachedir = NULL;
+    char *limit    = NULL;
+    bool  summary  = false;
+
+    compile_batch_t *files = memory_allocate(sizeof(compile_batch_t) * argc);
+    size_t           count = 0;
 
     while (argc > 1) {
         ++argv;
@@ -99,6 +456,40 @@ int main(int argc, char **argv) {
         if (argv[0][0] == '-') {
             if (parse_option("std", &argc, &argv, &standard, 1, false))
                 continue;
+            if (parse_option("cache-dir", &argc, &argv, &cachedir, 2, true))
+                continue;
+            if (parse_option("cache-size", &argc, &argv, &limit, 2, true))
+                continue;
+        }
+
+        /* -Ipath and -I path both add to the search path for includes */
+        if (!strncmp(*argv, "-I", 2)) {
+            if (argv[0][2]) {
+                lexer_include_path(*argv + 2);
+                cache_option(*argv);
+                continue;
+            }
+            if (argc > 1) {
+                lexer_include_path(argv[1]);
+                cache_option("-I");
+                cache_option(argv[1]);
+                ++argv;
+                --argc;
+                continue;
+            }
+        }
+
+        /* -DNAME defines NAME as 1 like other compilers do */
+        if (!strncmp(*argv, "-D", 2) && argv[0][2]) {
+            char *value = strchr(*argv + 2, '=');
+            cache_option(*argv);
+            if (value) {
+                *value = '\0';
+                lexer_define(*argv + 2, value + 1);
+            } else {
+                lexer_define(*argv + 2, "1");
+            }
+            continue;
         }
 
         if (!strcmp(*argv, "--dump-ast")) {
@@ -106,6 +497,63 @@ int main(int argc, char **argv) {
             continue;
         }
 
+        /* -O is the same as -O1, anything past that is the same as well */
+        if (!strncmp(*argv, "-O", 2) && strspn(*argv + 2, "0123456789") == strlen(*argv + 2)) {
+            opt_level_set(argv[0][2] ? atoi(*argv + 2) : 1);
+            continue;
+        }
+
+        if (!strcmp(*argv, "--dump-ir")) {
+            dumpir = true;
+            continue;
+        }
+
+        /* -jN and -j N set how many threads generate code, or files compile at once */
+        if (!strncmp(*argv, "-j", 2) && (argv[0][2] || argc > 1)) {
+            const char *number = argv[0][2] ? *argv + 2 : argv[1];
+            if (!argv[0][2]) {
+                ++argv;
+                --argc;
+            }
+            if (strspn(number, "0123456789") != strlen(number) || (jobs = atoi(number)) < 1) {
+                fprintf(stderr, "invalid job count: %s\n", number);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+
+        if (!strcmp(*argv, "--whole-unit")) {
+            opt_unit_set(true);
+            continue;
+        }
+
+        if (!strcmp(*argv, "--cache-stats")) {
+            summary = true;
+            continue;
+        }
+
+        if (!strcmp(*argv, "--stats")) {
+            stats = true;
+            continue;
+        }
+
+        if (!strcmp(*argv, "-c")) {
+            object = true;
+            continue;
+        }
+
+        if (!strcmp(*argv, "-o") && argc > 1) {
+            output = argv[1];
+            ++argv;
+            --argc;
+            continue;
+        }
+
+        if (argv[0][0] != '-') {
+            files[count++].input = *argv;
+            continue;
+        }
+
         fprintf(stderr, "unknown option: %s\n", argv[argc-1]);
         return EXIT_FAILURE;
     }
@@ -123,5 +571,76 @@ int main(int argc, char **argv) {
         }
     }
 
-    return compile_begin(dumpast);
+    /* the size of the cache can be given in kilobytes, megabytes or gigabytes */
+    if (limit) {
+        char   *unit;
+        size_t  bytes = strtoul(limit, &unit, 10);
+        if (unit == limit || (*unit && (!strchr("kKmMgG", *unit) || unit[1]))) {
+            fprintf(stderr, "invalid cache size: %s\n", limit);
+            return EXIT_FAILURE;
+        }
+        for (const char *scale = "kmg"; *unit && *scale; scale++) {
+            bytes <<= 10;
+            if (tolower(*unit) == *scale)
+                break;
+        }
+        cache_limit(bytes);
+    }
+
+    if (cachedir && !cache_open(cachedir)) {
+        fprintf(stderr, "cannot open cache directory: %s\n", cachedir);
+        return EXIT_FAILURE;
+    }
+
+    if (summary) {
+        if (!cachedir) {
+            fprintf(stderr, "no cache directory given\n");
+            return EXIT_FAILURE;
+        }
+        cache_stats(stdout);
+        return EXIT_SUCCESS;
+    }
+
+    if (dumpast) cache_option("--dump-ast");
+    if (dumpir)  cache_option("--dump-ir");
+    if (object)  cache_option("-c");
+
+    /*
+     * With a single file to compile the output is the file to write, with
+     * more of them it's the directory to put them in. Files of the same
+     * name in different directories would be written to the same output.
+     */
+    if (count) {
+        for (size_t i = 0; i < count; i++) {
+            files[i].output = (count == 1 && output)
+                ? output
+                : compile_batch_output(files[i].input, output, object);
+            for (size_t j = 0; j < i; j++) {
+                if (strcmp(files[i].output, files[j].output))
+                    continue;
+                fprintf(stderr, "output file %s is written by both %s and %s\n",
+                    files[i].output, files[j].input, files[i].input);
+                return EXIT_FAILURE;
+            }
+        }
+
+        /* the children count the rules applied into the same memory */
+        if (stats && !peep_share()) {
+            fprintf(stderr, "cannot share statistics between processes\n");
+            return EXIT_FAILURE;
+        }
+
+        bool success = compile_batch(files, count, jobs, dumpast, dumpir, object);
+        if (stats)
+            peep_stats(stderr);
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (!compile_unit(output, dumpast, dumpir, object, jobs))
+        return EXIT_FAILURE;
+
+    if (stats)
+        peep_stats(stderr);
+
+    return EXIT_SUCCESS;
 }
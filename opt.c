@@ -33,6 +33,8 @@ static const opt_extension_t opt_extension_matrix[] = {
 
 static opt_std_t       standard   = STANDARD_LICEC;
 static opt_extension_t extensions = ~0;
+static int             level      = 0;
+static bool            unit       = false;
 
 bool opt_std_test(opt_std_t std) {
     return (standard == std);
@@ -42,6 +44,14 @@ bool opt_extension_test(opt_extension_t ext) {
     return (extensions & ext);
 }
 
+opt_std_t opt_std(void) {
+    return standard;
+}
+
+opt_extension_t opt_extensions(void) {
+    return extensions;
+}
+
 void opt_std_set(opt_std_t std) {
     standard   = std;
     extensions = opt_extension_matrix[std];
@@ -51,3 +61,23 @@ void opt_extension_set(opt_extension_t ext) {
     if (opt_extension_matrix[standard] & ext)
         extensions &= ext;
 }
+
+void opt_level_set(int value) {
+    level = value;
+}
+
+int opt_level(void) {
+    return level;
+}
+
+/*
+ * Toplevels are normally generated as soon as they're parsed, passes
+ * which need to see the whole translation unit at once ask for it here.
+ */
+void opt_unit_set(bool whole) {
+    unit = whole;
+}
+
+bool opt_unit(void) {
+    return unit;
+}
@@ -33,7 +33,13 @@ typedef enum {
 
 bool opt_std_test(opt_std_t std);
 bool opt_extension_test(opt_extension_t ext);
+opt_std_t opt_std(void);
+opt_extension_t opt_extensions(void);
 void opt_std_set(opt_std_t std);
 void opt_extension_set(opt_extension_t ext);
+void opt_level_set(int level);
+int  opt_level(void);
+void opt_unit_set(bool whole);
+bool opt_unit(void);
 
 #endif
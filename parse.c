@@ -72,8 +72,8 @@ void parse_semantic_assignable(data_type_t *to, data_type_t *from) {
     compile_error("incompatible types '%s' and '%s' in assignment", ast_type_string(to), ast_type_string(from));
 }
 
-static bool parse_identifer_check(lexer_token_t *token, const char *identifier) {
-    return token->type == LEXER_TOKEN_IDENTIFIER && !strcmp(token->string, identifier);
+static bool parse_keyword_check(lexer_token_t *token, lexer_keyword_t keyword) {
+    return token->type == LEXER_TOKEN_IDENTIFIER && token->keyword == keyword;
 }
 
 long parse_evaluate(ast_t *ast);
@@ -235,7 +235,7 @@ static ast_t *parse_function_pointer_call(ast_t *function) {
 }
 
 static ast_t *parse_generic(char *name) {
-    ast_t *ast = table_find(ast_localenv ? ast_localenv : ast_globalenv, name);
+    ast_t *ast = table_find_interned(ast_localenv ? ast_localenv : ast_globalenv, name);
 
     if (!ast || ast->ctype->type == TYPE_FUNCTION)
         return ast_designator(name, ast);
@@ -473,7 +473,7 @@ static ast_t *parse_structure_field(ast_t *structure) {
     if (name->type != LEXER_TOKEN_IDENTIFIER)
         compile_error("expected field name, got `%s' instead", lexer_token_string(name));
 
-    data_type_t *field = table_find(structure->ctype->fields, name->string);
+    data_type_t *field = table_find_interned(structure->ctype->fields, name->string);
     if (!field)
         compile_error("structure has no such field `%s'", lexer_token_string(name));
     return ast_structure_reference(field, structure, name->string);
@@ -602,16 +602,16 @@ static ast_t *parse_expression_unary_not(void) {
 
 static ast_t *parse_expression_unary(void) {
     lexer_token_t *token = lexer_peek();
-    if (parse_identifer_check(token, "sizeof")) {
+    if (parse_keyword_check(token, LEXER_KEYWORD_SIZEOF)) {
         lexer_next();
         return parse_sizeof();
     }
 
 
-    if (parse_identifer_check(token, "__alignof__"))
+    if (parse_keyword_check(token, LEXER_KEYWORD_ALIGNOF_GNU))
         goto alignof;
 
-    if (parse_identifer_check(token, "_Alignof")) {
+    if (parse_keyword_check(token, LEXER_KEYWORD_ALIGNOF)) {
         if (!opt_std_test(STANDARD_C11) && !opt_std_test(STANDARD_LICEC))
             compile_error("_Alignof not supported in this version of the standard, try -std=c11 or -std=licec");
 
@@ -621,13 +621,15 @@ static ast_t *parse_expression_unary(void) {
     }
 
     if (parse_next(LEXER_TOKEN_INCREMENT) || parse_next(LEXER_TOKEN_DECREMENT)) {
-        ast_t *operand = parse_expression_unary();
-        operand = ast_designator_convert(operand);
-        parse_semantic_lvalue(operand);
+        /* decide before parsing the operand, which can exhaust the token's lifetime */
         int operation = lexer_ispunct(token, LEXER_TOKEN_INCREMENT)
                             ? AST_TYPE_PRE_INCREMENT
                             : AST_TYPE_PRE_DECREMENT;
 
+        ast_t *operand = parse_expression_unary();
+        operand = ast_designator_convert(operand);
+        parse_semantic_lvalue(operand);
+
         return ast_new_unary(operation, operand->ctype, operand);
     }
 
@@ -795,12 +797,14 @@ ast_t *parse_expression_assignment(void) {
         return ast_ternary(operand->ctype, ast, then, last);
     }
 
-    int compound   = parse_operation_compound_operator(token);
-    int reclassify = parse_operation_reclassify(compound);
-    if (lexer_ispunct(token, '=') || compound) {
+    /* decide before parsing the value, which can exhaust the token's lifetime */
+    int  compound   = parse_operation_compound_operator(token);
+    int  reclassify = parse_operation_reclassify(compound);
+    bool assign     = lexer_ispunct(token, '=') || compound;
+
+    if (assign) {
         ast_t *value = parse_expression_assignment();
-        if (lexer_ispunct(token, '=') || compound)
-            parse_semantic_lvalue(ast);
+        parse_semantic_lvalue(ast);
 
         ast_t *right = compound ? conv_usual(reclassify, ast, value) : value;
         if (conv_capable(right->ctype) && ast->ctype->type != right->ctype->type)
@@ -857,28 +861,10 @@ static bool parse_type_check(lexer_token_t *token) {
     if (token->type != LEXER_TOKEN_IDENTIFIER)
         return false;
 
-    static const char *keywords[] = {
-        "char",     "short",  "int",      "long",     "float",    "double",
-        "struct",   "union",  "signed",   "unsigned", "enum",     "void",
-        "typedef",  "extern", "static",   "auto",     "register", "const",
-        "volatile", "inline", "restrict", "typeof",   "_Bool",
-
-        /*
-         * Ironically there is also another way to specific some keywords
-         * in C due to compilers being sneaky. Thus some code may use
-         * things like, __static__, or __typeof__, which are compilers
-         * reserved implementations of those keywords before the standard
-         * was ratified.
-         */
-        "__static__",
-        "__typeof__",
-    };
-
-    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
-        if (!strcmp(keywords[i], token->string))
-            return true;
+    if (token->keyword >= LEXER_KEYWORD_CHAR && token->keyword <= LEXER_KEYWORD_BOOL)
+        return true;
 
-    if (table_find(parse_typedefs, token->string))
+    if (table_find_interned(parse_typedefs, token->string))
         return true;
 
     return false;
@@ -951,7 +937,7 @@ static list_t *parse_memory_fields_intermediate(void) {
     for (;;) {
 
         lexer_token_t *next = lexer_next();
-        if (parse_identifer_check(next, "_Static_assert")) {
+        if (parse_keyword_check(next, LEXER_KEYWORD_STATIC_ASSERT)) {
             if (!opt_std_test(STANDARD_C11) && !opt_std_test(STANDARD_LICEC))
                 compile_error("_Static_assert not supported in this version of the standard, try -std=c11 or -std=licec");
 
@@ -1088,7 +1074,7 @@ static table_t *parse_memory_fields(int *size, bool isstruct) {
                 : parse_union_offset(fields, size);
 }
 
-static data_type_t *parse_tag_definition(table_t *table, bool isstruct) {
+static data_type_t *parse_tag_definition_intermediate(table_t *table, bool isstruct) {
     char        *tag = parse_memory_tag();
     data_type_t *r;
 
@@ -1116,6 +1102,18 @@ static data_type_t *parse_tag_definition(table_t *table, bool isstruct) {
     return NULL;
 }
 
+/*
+ * Tags are visible past the end of the function they're declared in, they
+ * can't be allocated from the arena the function is parsed into.
+ */
+static data_type_t *parse_tag_definition(table_t *table, bool isstruct) {
+    memory_arena_t *previous = memory_arena_select(NULL);
+    data_type_t    *type     = parse_tag_definition_intermediate(table, isstruct);
+
+    memory_arena_select(previous);
+    return type;
+}
+
 /* enum */
 data_type_t *parse_enumeration(void) {
     lexer_token_t *token = lexer_next();
@@ -1172,7 +1170,7 @@ data_type_t *parse_union(void) {
 }
 
 data_type_t *parse_typedef_find(const char *key) {
-    return table_find(parse_typedefs, key);
+    return table_find_interned(parse_typedefs, key);
 }
 
 /* declarator */
@@ -1207,7 +1205,7 @@ static ast_t *parse_statement_if(void) {
     then  = parse_statement();
     token = lexer_next();
 
-    if (!token || token->type != LEXER_TOKEN_IDENTIFIER || strcmp(token->string, "else")) {
+    if (!token || !parse_keyword_check(token, LEXER_KEYWORD_ELSE)) {
         lexer_unget(token);
         return ast_if(cond, then, NULL);
     }
@@ -1253,7 +1251,7 @@ static ast_t *parse_statement_do(void) {
     ast_t         *body  = parse_statement();
     lexer_token_t *token = lexer_next();
 
-    if (!parse_identifer_check(token, "while"))
+    if (!parse_keyword_check(token, LEXER_KEYWORD_WHILE))
         compile_error("expected ‘while’ before ‘%s’ token", lexer_token_string(token));
 
     parse_expect('(');
@@ -1274,6 +1272,25 @@ static ast_t *parse_statement_continue(void) {
     return ast_make(AST_TYPE_STATEMENT_CONTINUE);
 }
 
+/*
+ * The cases of the switch being parsed, kept so a case can be checked
+ * against the ones before it where it's written. Their values are those
+ * of the constant converted to the type of the controlling expression.
+ */
+typedef struct {
+    data_type_t *type;
+    list_t      *cases;
+} parse_switch_t;
+
+static parse_switch_t *parse_switch = NULL;
+
+/* narrower switches compare in 32 bits, where signed and unsigned values are the same */
+static long parse_switch_convert(long value) {
+    if (!parse_switch || parse_switch->type->size > 4)
+        return value;
+    return (int)value;
+}
+
 static ast_t *parse_statement_switch(void) {
     parse_expect('(');
     ast_t *expression = parse_expression();
@@ -1286,16 +1303,24 @@ static ast_t *parse_statement_switch(void) {
     }
 
     parse_expect(')');
-    ast_t *body = parse_statement();
+
+    parse_switch_t *enclosing = parse_switch;
+    parse_switch_t  context   = { expression->ctype, list_create() };
+
+    parse_switch = &context;
+    ast_t *body  = parse_statement();
+    parse_switch = enclosing;
+
     return ast_switch(expression, body);
 }
 
 static ast_t *parse_statement_case(void) {
-    int begin = parse_expression_evaluate();
-    int end;
+    size_t mark  = lexer_mark();
+    long   begin = parse_switch_convert(parse_evaluate(parse_expression_conditional()));
+    long   end;
     lexer_token_t *token = lexer_next();
-    if (parse_identifer_check(token, "..."))
-        end = parse_expression_evaluate();
+    if (parse_keyword_check(token, LEXER_KEYWORD_ELLIPSIS))
+        end = parse_switch_convert(parse_evaluate(parse_expression_conditional()));
     else {
         end = begin;
         lexer_unget(token);
@@ -1303,7 +1328,23 @@ static ast_t *parse_statement_case(void) {
     parse_expect(':');
     if (begin > end)
         compile_warn("empty case range specified");
-    return ast_case(begin, end);
+
+    ast_t *node = ast_case(begin, end);
+    if (!parse_switch || begin > end)
+        return node;
+
+    for (list_iterator_t *it = list_iterator(parse_switch->cases); !list_iterator_end(it); ) {
+        ast_t *other = list_iterator_next(it);
+        if (begin > other->caseend || end < other->casebeg)
+            continue;
+
+        /* reported at the case keyword, the last token read before the mark */
+        if (lexer_mark() - mark < LEXER_LOOKAHEAD)
+            lexer_rewind(mark);
+        compile_error("duplicate case value %ld in switch", MAX(begin, other->casebeg));
+    }
+    list_push(parse_switch->cases, node);
+    return node;
 }
 
 static ast_t *parse_statement_default(void) {
@@ -1373,17 +1414,17 @@ static ast_t *parse_statement(void) {
     ast_t         *ast;
 
     if (lexer_ispunct        (token, '{'))        return parse_statement_compound();
-    if (parse_identifer_check(token, "if"))       return parse_statement_if();
-    if (parse_identifer_check(token, "for"))      return parse_statement_for();
-    if (parse_identifer_check(token, "while"))    return parse_statement_while();
-    if (parse_identifer_check(token, "do"))       return parse_statement_do();
-    if (parse_identifer_check(token, "return"))   return parse_statement_return();
-    if (parse_identifer_check(token, "switch"))   return parse_statement_switch();
-    if (parse_identifer_check(token, "case"))     return parse_statement_case();
-    if (parse_identifer_check(token, "default"))  return parse_statement_default();
-    if (parse_identifer_check(token, "break"))    return parse_statement_break();
-    if (parse_identifer_check(token, "continue")) return parse_statement_continue();
-    if (parse_identifer_check(token, "goto"))     return parse_statement_goto();
+    if (parse_keyword_check(token, LEXER_KEYWORD_IF))       return parse_statement_if();
+    if (parse_keyword_check(token, LEXER_KEYWORD_FOR))      return parse_statement_for();
+    if (parse_keyword_check(token, LEXER_KEYWORD_WHILE))    return parse_statement_while();
+    if (parse_keyword_check(token, LEXER_KEYWORD_DO))       return parse_statement_do();
+    if (parse_keyword_check(token, LEXER_KEYWORD_RETURN))   return parse_statement_return();
+    if (parse_keyword_check(token, LEXER_KEYWORD_SWITCH))   return parse_statement_switch();
+    if (parse_keyword_check(token, LEXER_KEYWORD_CASE))     return parse_statement_case();
+    if (parse_keyword_check(token, LEXER_KEYWORD_DEFAULT))  return parse_statement_default();
+    if (parse_keyword_check(token, LEXER_KEYWORD_BREAK))    return parse_statement_break();
+    if (parse_keyword_check(token, LEXER_KEYWORD_CONTINUE)) return parse_statement_continue();
+    if (parse_keyword_check(token, LEXER_KEYWORD_GOTO))     return parse_statement_goto();
 
     if (token->type == LEXER_TOKEN_IDENTIFIER && lexer_ispunct(lexer_peek(), ':'))
         return parse_label(token);
@@ -1404,7 +1445,7 @@ static void parse_statement_declaration(list_t *list){
         parse_declaration(list, ast_variable_local);
     } else {
         lexer_token_t *next = lexer_next();
-        if (parse_identifer_check(next, "_Static_assert"))
+        if (parse_keyword_check(next, LEXER_KEYWORD_STATIC_ASSERT))
             return parse_static_assert();
         else
             lexer_unget(next);
@@ -1435,7 +1476,7 @@ static data_type_t *parse_function_parameters(list_t *paramvars, data_type_t *re
     lexer_token_t *token      = lexer_next();
     lexer_token_t *next       = lexer_next();
 
-    if (parse_identifer_check(token, "void") && lexer_ispunct(next, ')'))
+    if (parse_keyword_check(token, LEXER_KEYWORD_VOID) && lexer_ispunct(next, ')'))
         return ast_prototype(returntype, paramtypes, false);
     lexer_unget(next);
     if (lexer_ispunct(token, ')'))
@@ -1444,7 +1485,7 @@ static data_type_t *parse_function_parameters(list_t *paramvars, data_type_t *re
 
     for (;;) {
         token = lexer_next();
-        if (parse_identifer_check(token, "...")) {
+        if (parse_keyword_check(token, LEXER_KEYWORD_ELLIPSIS)) {
             if (list_length(paramtypes) == 0)
                 compile_ice("parse_function_parameters");
             parse_expect(')');
@@ -1483,7 +1524,13 @@ static ast_t *parse_function_definition(data_type_t *functype, char *name, list_
     ast_t *body = parse_statement_compound();
     ast_t *r    = ast_function(functype, name, parameters, body, ast_locals);
 
-    table_insert(ast_globalenv, name, r);
+    /*
+     * References to the function past its definition only need the name
+     * and type, the definition itself may be released after codegen.
+     */
+    memory_arena_t *previous = memory_arena_select(NULL);
+    table_insert(ast_globalenv, name, ast_function(functype, name, NULL, NULL, NULL));
+    memory_arena_select(previous);
 
     ast_data_table[AST_DATA_FUNCTION] = NULL;
     ast_localenv                      = NULL;
@@ -1493,15 +1540,14 @@ static ast_t *parse_function_definition(data_type_t *functype, char *name, list_
 }
 
 static bool parse_function_definition_check(void) {
-    list_t *buffer = list_create();
-    int     nests  = 0;
-    bool    paren  = false;
-    bool    ready  = true;
+    size_t  mark  = lexer_mark();
+    int     nests = 0;
+    bool    paren = false;
+    bool    ready = true;
 
     for (;;) {
 
         lexer_token_t *token = lexer_next();
-        list_push(buffer, token);
 
         if (!token)
             compile_error("function definition with unexpected ending");
@@ -1528,13 +1574,12 @@ static bool parse_function_definition_check(void) {
         }
     }
 
-    while (list_length(buffer) > 0)
-        lexer_unget(list_pop(buffer));
+    lexer_rewind(mark);
 
     return ready;
 }
 
-static ast_t *parse_function_definition_intermediate(void) {
+static ast_t *parse_function_definition_intermediate(memory_arena_t *arena) {
     char        *name;
     storage_t    storage;
     list_t      *parameters = list_create();
@@ -1546,18 +1591,35 @@ static ast_t *parse_function_definition_intermediate(void) {
         compile_warn("return type defaults to ’int’");
 
     ast_localenv = table_create(ast_globalenv);
-    ast_labels   = table_create(NULL);
-    ast_gotos    = list_create();
 
     data_type_t *functype = parse_declarator(&name, basetype, parameters, CDECL_BODY);
     functype->isstatic = !!(storage == STORAGE_STATIC);
     ast_variable_global(functype, name);
+
+    /*
+     * Everything past the declarator belongs to the body alone, it's
+     * parsed into the arena of the toplevel when there is one. Typedefs
+     * in the body are scoped to it for the same reason.
+     */
+    memory_arena_t *previous = arena ? memory_arena_select(arena) : NULL;
+    table_t        *typedefs = parse_typedefs;
+
+    parse_typedefs = table_create(parse_typedefs);
+    ast_labels     = table_create(NULL);
+    ast_gotos      = list_create();
+
     parse_expect('{');
     ast_t *value = parse_function_definition(functype, name, parameters);
 
     parse_label_backfill();
 
-    ast_localenv = NULL;
+    parse_typedefs = typedefs;
+    ast_localenv   = NULL;
+    ast_labels     = NULL;
+    ast_gotos      = NULL;
+
+    if (arena)
+        memory_arena_select(previous);
     return value;
 }
 
@@ -1590,16 +1652,21 @@ static data_type_t *parse_declarator_direct_restage(data_type_t *basetype, list_
     return basetype;
 }
 
-static void parse_qualifiers_skip(void) {
+/* qualifiers of a pointer, returns if it's const qualified */
+static bool parse_qualifiers(void) {
+    bool constant = false;
     for (;;) {
         lexer_token_t *token = lexer_next();
-        if (parse_identifer_check(token, "const")
-         || parse_identifer_check(token, "volatile")
-         || parse_identifer_check(token, "restrict")) {
+        if (parse_keyword_check(token, LEXER_KEYWORD_CONST)) {
+            constant = true;
+            continue;
+        }
+        if (parse_keyword_check(token, LEXER_KEYWORD_VOLATILE)
+         || parse_keyword_check(token, LEXER_KEYWORD_RESTRICT)) {
             continue;
         }
         lexer_unget(token);
-        return;
+        return constant;
     }
 }
 
@@ -1616,10 +1683,11 @@ static data_type_t *parse_declarator_direct(char **rname, data_type_t *basetype,
     }
 
     if (lexer_ispunct(token, '*')) {
-        parse_qualifiers_skip();
-        data_type_t *stub = ast_type_stub();
-        data_type_t *type = parse_declarator_direct(rname, stub, parameters, context);
+        bool         constant = parse_qualifiers();
+        data_type_t *stub     = ast_type_stub();
+        data_type_t *type     = parse_declarator_direct(rname, stub, parameters, context);
         *stub = *ast_pointer(basetype);
+        stub->isconst = constant;
         return type;
     }
 
@@ -1696,17 +1764,48 @@ static void parse_declaration(list_t *list, ast_t *(*make)(data_type_t *, char *
     }
 }
 
-list_t *parse_run(void) {
+/*
+ * Hand every toplevel to the caller as soon as it's parsed. With an arena
+ * function bodies are parsed into it and it's selected while the caller
+ * handles the toplevel, then reset.
+ */
+static void parse_toplevel(parse_toplevel_t toplevel, void *data, memory_arena_t *arena) {
     list_t *list = list_create();
-    for (;;) {
-        if (!lexer_peek())
-            return list;
+
+    while (lexer_peek()) {
         if (parse_function_definition_check())
-            list_push(list, parse_function_definition_intermediate());
+            list_push(list, parse_function_definition_intermediate(arena));
         else
             parse_declaration(list, &ast_variable_global);
+
+        while (list_length(list)) {
+            ast_t          *ast      = list_shift(list);
+            memory_arena_t *previous = arena ? memory_arena_select(arena) : NULL;
+
+            toplevel(ast, data);
+
+            if (arena) {
+                memory_arena_select(previous);
+                memory_arena_reset(arena);
+            }
+        }
     }
-    return NULL;
+}
+
+void parse_run(parse_toplevel_t toplevel, void *data) {
+    memory_arena_t *arena = memory_arena_create();
+    parse_toplevel(toplevel, data, arena);
+    memory_arena_destroy(arena);
+}
+
+static void parse_unit_push(ast_t *ast, void *list) {
+    list_push(list, ast);
+}
+
+list_t *parse_unit(void) {
+    list_t *list = list_create();
+    parse_toplevel(&parse_unit_push, list, NULL);
+    return list;
 }
 
 void parse_init(void) {
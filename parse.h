@@ -44,29 +44,53 @@ data_type_t *parse_typeof(void);
  *  Search the parser typedef table for a typedef
  *
  * Parameters:
- *  string - The key of the type to search in the typedef table
+ *  string - The name of the type to search for, an interned identifier
  *
  * Returns:
  *  The data type representing that typedef if found, otherwise NULL.
  */
 data_type_t *parse_typedef_find(const char *string);
 
+/*
+ * Type: parse_toplevel_t
+ *  Function type of the callback <parse_run> hands toplevels to.
+ */
+typedef void (*parse_toplevel_t)(ast_t *ast, void *data);
+
 /*
  * Function: parse_run
  *  Main entry point for the parser.
  *
+ * Parameters:
+ *  toplevel - Called with every AST toplevel expression as soon as it's
+ *             parsed, in order
+ *  data     - Passed on to *toplevel*
+ *
+ * Remarks:
+ *  Function bodies are parsed into an arena which is selected while
+ *  *toplevel* is called and reset once it returns, so neither the body
+ *  nor anything *toplevel* allocates outlives the call. Everything which
+ *  later toplevels can refer to (declarations, types and tags) is kept.
+ */
+void parse_run(parse_toplevel_t toplevel, void *data);
+
+/*
+ * Function: parse_unit
+ *  Parse the whole translation unit up front, for passes which need to
+ *  see all of it.
+ *
  * Returns:
- *  Will produce a list of AST toplevel expressions which can be handed
- *  down to the code generator one at a time.
+ *  A list of every AST toplevel expression, allocated from the arena
+ *  which is selected.
  */
-list_t *parse_run(void);
+list_t *parse_unit(void);
 
 /*
  * Function: parse_init
  *  Main initialization for the global parser context.
  *
  * Remarks:
- *  This must be called before calling <parse_run>.
+ *  This must be called before calling <parse_run> or <parse_unit>.
  */
 void parse_init(void);
 
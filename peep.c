@@ -0,0 +1,663 @@
+/*
+ * File: peep.c
+ *  Peephole optimization of the generated assembly.
+ *
+ *  The assembly of a function is split into lines which are classified
+ *  as instructions, labels, directives and comments. The rules in the
+ *  rule table are tried on every instruction until none of them applies
+ *  anymore, rules delete lines or rewrite instructions in place. Only
+ *  rewritten instructions are formatted again, everything else is copied
+ *  through verbatim.
+ */
+#include <string.h>
+#include <ctype.h>
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "peep.h"
+#include "lice.h"
+
+#define PEEP_OPERANDS 3
+#define PEEP_PASSES   8
+#define PEEP_WINDOW   8
+
+typedef enum {
+    PEEP_BLANK,
+    PEEP_COMMENT,
+    PEEP_LABEL,
+    PEEP_DIRECTIVE,
+    PEEP_INSTRUCTION
+} peep_kind_t;
+
+typedef struct {
+    peep_kind_t  kind;
+    bool         deleted;
+
+    /* the line as it was emitted including the newline, NULL once rewritten */
+    const char  *raw;
+    size_t       length;
+
+    /* label name or instruction */
+    const char  *name;
+    const char  *operands[PEEP_OPERANDS];
+    int          count;
+} peep_line_t;
+
+typedef struct {
+    peep_line_t *lines;
+    size_t       count;
+    table_t      labels; /* label name to line index + 1 */
+} peep_t;
+
+typedef size_t (*peep_apply_t)(peep_t *peep, size_t index);
+
+typedef struct {
+    const char   *name;
+    peep_apply_t  apply;
+} peep_rule_t;
+
+/*
+ * General purpose registers by family, with the names of the 64, 32,
+ * 16 and 8-bit parts.
+ */
+static const char *peep_register_names[16][4] = {
+    { "rax", "eax",  "ax",   "al"   }, { "rcx", "ecx",  "cx",   "cl"   },
+    { "rdx", "edx",  "dx",   "dl"   }, { "rbx", "ebx",  "bx",   "bl"   },
+    { "rsp", "esp",  "sp",   "spl"  }, { "rbp", "ebp",  "bp",   "bpl"  },
+    { "rsi", "esi",  "si",   "sil"  }, { "rdi", "edi",  "di",   "dil"  },
+    { "r8",  "r8d",  "r8w",  "r8b"  }, { "r9",  "r9d",  "r9w",  "r9b"  },
+    { "r10", "r10d", "r10w", "r10b" }, { "r11", "r11d", "r11w", "r11b" },
+    { "r12", "r12d", "r12w", "r12b" }, { "r13", "r13d", "r13w", "r13b" },
+    { "r14", "r14d", "r14w", "r14b" }, { "r15", "r15d", "r15w", "r15b" }
+};
+
+#define PEEP_REGISTER_RSP 4
+
+static char *peep_string(const char *string, size_t length) {
+    char *copy = memory_allocate(length + 1);
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+static const char *peep_trim(const char *begin, const char *end, size_t *length) {
+    while (begin < end && isspace((unsigned char)*begin))
+        begin++;
+    while (end > begin && isspace((unsigned char)end[-1]))
+        end--;
+    *length = end - begin;
+    return begin;
+}
+
+/* operands are separated by commas outside of memory references */
+static bool peep_parse_operands(peep_line_t *line, const char *p, const char *end) {
+    while (p < end) {
+        const char *begin = p;
+        int         depth = 0;
+        while (p < end && (depth || *p != ',')) {
+            if (*p == '(')
+                depth++;
+            else if (*p == ')')
+                depth--;
+            else if (*p == '#' || *p == '"')
+                return false;
+            p++;
+        }
+        if (line->count == PEEP_OPERANDS)
+            return false;
+
+        size_t      length;
+        const char *operand = peep_trim(begin, p, &length);
+        line->operands[line->count++] = peep_string(operand, length);
+        if (p < end)
+            p++;
+    }
+    return true;
+}
+
+static void peep_parse_line(peep_t *peep, peep_line_t *line) {
+    size_t      length;
+    const char *text = peep_trim(line->raw, line->raw + line->length, &length);
+    const char *end  = text + length;
+
+    if (!length) {
+        line->kind = PEEP_BLANK;
+        return;
+    }
+
+    if (*text == '#') {
+        line->kind = PEEP_COMMENT;
+        return;
+    }
+
+    if (end[-1] == ':' && !memchr(text, ' ', length) && !memchr(text, '\t', length)) {
+        line->kind = PEEP_LABEL;
+        line->name = peep_string(text, length - 1);
+        table_insert(&peep->labels, (char *)line->name, (void *)(line - peep->lines + 1));
+        return;
+    }
+
+    if (*text == '.') {
+        line->kind = PEEP_DIRECTIVE;
+        return;
+    }
+
+    const char *p = text;
+    while (p < end && !isspace((unsigned char)*p))
+        p++;
+
+    line->kind = PEEP_INSTRUCTION;
+    line->name = peep_string(text, p - text);
+
+    /* anything not understood is left alone and treated as a barrier */
+    if (!peep_parse_operands(line, p, end)) {
+        line->kind  = PEEP_DIRECTIVE;
+        line->count = 0;
+    }
+}
+
+static void peep_parse(peep_t *peep, const char *text, size_t length) {
+    const char *end = text + length;
+
+    peep->count = 0;
+    for (const char *p = text; p < end; p++)
+        if (*p == '\n')
+            peep->count++;
+    if (length && end[-1] != '\n')
+        peep->count++;
+
+    peep->lines  = memory_allocate(sizeof(peep_line_t) * (peep->count + 1));
+    peep->labels = SENTINEL_TABLE;
+
+    size_t index = 0;
+    for (const char *p = text; p < end; index++) {
+        const char *newline = memchr(p, '\n', end - p);
+        const char *next    = newline ? newline + 1 : end;
+
+        peep->lines[index] = (peep_line_t) {
+            .raw    = p,
+            .length = next - p
+        };
+        peep_parse_line(peep, &peep->lines[index]);
+        p = next;
+    }
+}
+
+static size_t peep_format_length(peep_line_t *line) {
+    if (line->raw)
+        return line->length;
+
+    size_t length = strlen(line->name) + 2;
+    for (int i = 0; i < line->count; i++)
+        length += strlen(line->operands[i]) + (i ? 2 : 1);
+    return length;
+}
+
+static char *peep_append(char *out, const char *string) {
+    size_t length = strlen(string);
+    memcpy(out, string, length);
+    return out + length;
+}
+
+static char *peep_format(peep_line_t *line, char *out) {
+    if (line->raw) {
+        memcpy(out, line->raw, line->length);
+        return out + line->length;
+    }
+
+    *out++ = '\t';
+    out = peep_append(out, line->name);
+    for (int i = 0; i < line->count; i++) {
+        out = peep_append(out, i ? ", " : " ");
+        out = peep_append(out, line->operands[i]);
+    }
+    *out++ = '\n';
+    return out;
+}
+
+/*
+ * Helpers for rules: instructions are only ever looked at through these,
+ * comments and blank lines are never in the way of a rule.
+ */
+static bool peep_visible(peep_line_t *line) {
+    return !line->deleted && line->kind != PEEP_BLANK && line->kind != PEEP_COMMENT;
+}
+
+static size_t peep_next(peep_t *peep, size_t index) {
+    while (++index < peep->count && !peep_visible(&peep->lines[index]))
+        ;
+    return index;
+}
+
+static peep_line_t *peep_instruction(peep_t *peep, size_t index) {
+    if (index >= peep->count || peep->lines[index].kind != PEEP_INSTRUCTION)
+        return NULL;
+    return &peep->lines[index];
+}
+
+static bool peep_is(peep_line_t *line, const char *name) {
+    return line && !strcmp(line->name, name);
+}
+
+static void peep_delete(peep_line_t *line) {
+    line->deleted = true;
+}
+
+static void peep_rewrite(peep_line_t *line, const char *name, int count, const char *first, const char *second) {
+    line->raw         = NULL;
+    line->name        = name;
+    line->count       = count;
+    line->operands[0] = first;
+    line->operands[1] = second;
+}
+
+static bool peep_jump(peep_line_t *line) {
+    return line && line->name[0] == 'j';
+}
+
+static bool peep_jump_direct(peep_line_t *line) {
+    return peep_jump(line) && line->count == 1 && line->operands[0][0] != '*';
+}
+
+static bool peep_flags_read(peep_line_t *line) {
+    if (!line)
+        return false;
+    if (peep_jump(line))
+        return !peep_is(line, "jmp");
+    return !strncmp(line->name, "set",  3)
+        || !strncmp(line->name, "cmov", 4)
+        || peep_is(line, "adc")
+        || peep_is(line, "sbb");
+}
+
+/* instructions which set every flag an earlier one could have left behind */
+static bool peep_flags_written(peep_line_t *line) {
+    static const char *writers[] = {
+        "add", "sub", "and", "or", "xor", "cmp", "test", "neg",
+        "imul", "mul", "idiv", "div", "ucomiss", "ucomisd", "comiss", "comisd"
+    };
+
+    size_t length = strlen(line->name);
+    for (size_t i = 0; i < sizeof(writers) / sizeof(*writers); i++) {
+        size_t size = strlen(writers[i]);
+        if (strncmp(line->name, writers[i], size))
+            continue;
+        if (length == size || (length == size + 1 && strchr("bwlq", line->name[size])))
+            return true;
+    }
+    return peep_is(line, "call") || peep_is(line, "ret");
+}
+
+/*
+ * The flags an instruction sets are live if they're read before they're
+ * set again. Anything which isn't an instruction or passes control on
+ * elsewhere ends the search with the flags taken to be live.
+ */
+static bool peep_flags_live(peep_t *peep, size_t index) {
+    for (index = peep_next(peep, index); index < peep->count; index = peep_next(peep, index)) {
+        peep_line_t *line = peep_instruction(peep, index);
+        if (!line || peep_flags_read(line) || peep_jump(line))
+            return true;
+        if (peep_flags_written(line))
+            return false;
+    }
+    return true;
+}
+
+/* the family of a register operand and it's size in bytes, -1 if it isn't one */
+static int peep_register(const char *operand, int *size) {
+    static const int sizes[] = { 8, 4, 2, 1 };
+    if (!operand || *operand != '%')
+        return -1;
+    for (int family = 0; family < 16; family++) {
+        for (int part = 0; part < 4; part++) {
+            if (!strcmp(operand + 1, peep_register_names[family][part])) {
+                if (size)
+                    *size = sizes[part];
+                return family;
+            }
+        }
+    }
+    return -1;
+}
+
+static bool peep_mentions_operand(const char *operand, int family) {
+    for (int part = 0; part < 4; part++) {
+        const char *name   = peep_register_names[family][part];
+        size_t      length = strlen(name);
+        for (const char *p = operand; (p = strchr(p, '%')); p++)
+            if (!strncmp(p + 1, name, length) && !isalnum((unsigned char)p[length + 1]))
+                return true;
+    }
+    return false;
+}
+
+static bool peep_mentions(peep_line_t *line, int family) {
+    for (int i = 0; i < line->count; i++)
+        if (peep_mentions_operand(line->operands[i], family))
+            return true;
+    return false;
+}
+
+/*
+ * Instructions which only touch their explicit operands, anything else
+ * (calls, division, sign extension of rax into rdx, string instructions)
+ * uses registers which aren't spelled out.
+ */
+static bool peep_explicit(peep_line_t *line) {
+    if (!line || peep_jump(line))
+        return false;
+    if (line->count >= 2)
+        return true;
+    if (line->count == 1)
+        return peep_is(line, "neg") || peep_is(line, "not") || peep_is(line, "inc")
+            || peep_is(line, "dec") || !strncmp(line->name, "set", 3);
+    return false;
+}
+
+/* an instruction replacing all 64 bits of it's register destination */
+static int peep_register_written(peep_line_t *line) {
+    static const char *writes[] = {
+        "mov",    "movq",   "movl",   "movabs", "movslq", "movsbq", "movsbl",
+        "movswq", "movswl", "movzbq", "movzbl", "movzwq", "movzwl", "movzb",
+        "lea"
+    };
+
+    if (!line || line->count != 2)
+        return -1;
+
+    for (size_t i = 0; i < sizeof(writes) / sizeof(*writes); i++) {
+        if (!peep_is(line, writes[i]))
+            continue;
+
+        int size;
+        int family = peep_register(line->operands[1], &size);
+        if (family == -1 || size < 4 || peep_mentions_operand(line->operands[0], family))
+            return -1;
+        return family;
+    }
+    return -1;
+}
+
+/*
+ * Rule: push and pop pairs
+ *  push %x followed by pop %x with nothing in between using either the
+ *  register or the stack is dropped, a pop into another register becomes
+ *  a move.
+ */
+static size_t peep_push_pop(peep_t *peep, size_t index) {
+    peep_line_t *push = &peep->lines[index];
+    int          size;
+    int          from = peep_register(push->operands[0], &size);
+
+    if (!peep_is(push, "push") || from == -1 || size != 8)
+        return 0;
+
+    size_t next = index;
+    for (int window = 0; window <= PEEP_WINDOW; window++) {
+        peep_line_t *line = peep_instruction(peep, next = peep_next(peep, next));
+        if (!line)
+            return 0;
+
+        if (peep_is(line, "pop")) {
+            int to = peep_register(line->operands[0], &size);
+            if (to == -1 || size != 8)
+                return 0;
+
+            /* the popped register must not be used in between either */
+            for (size_t i = peep_next(peep, index); i != next; i = peep_next(peep, i))
+                if (peep_mentions(&peep->lines[i], to))
+                    return 0;
+
+            peep_delete(push);
+            if (to == from) {
+                peep_delete(line);
+                return 2;
+            }
+            peep_rewrite(line, "mov", 2, push->operands[0], line->operands[0]);
+            return 1;
+        }
+
+        if (!peep_explicit(line) || peep_mentions(line, from) || peep_mentions(line, PEEP_REGISTER_RSP))
+            return 0;
+    }
+    return 0;
+}
+
+/*
+ * Rule: pop and push pairs
+ *  pop %x followed by push %x leaves the value on the stack, it's only
+ *  read from there.
+ */
+static size_t peep_pop_push(peep_t *peep, size_t index) {
+    peep_line_t *pop  = &peep->lines[index];
+    peep_line_t *push = peep_instruction(peep, peep_next(peep, index));
+
+    if (!peep_is(pop, "pop") || !peep_is(push, "push") || strcmp(pop->operands[0], push->operands[0]))
+        return 0;
+    if (peep_register(pop->operands[0], NULL) == -1)
+        return 0;
+
+    peep_rewrite(pop, "mov", 2, "(%rsp)", pop->operands[0]);
+    peep_delete(push);
+    return 1;
+}
+
+/*
+ * Rule: jumps to the next instruction
+ *  A jump to a label which directly follows it (possibly along with other
+ *  labels) does nothing.
+ */
+static size_t peep_jump_next(peep_t *peep, size_t index) {
+    peep_line_t *jump = &peep->lines[index];
+    if (!peep_jump_direct(jump))
+        return 0;
+
+    for (size_t next = peep_next(peep, index); next < peep->count; next = peep_next(peep, next)) {
+        peep_line_t *line = &peep->lines[next];
+        if (line->kind != PEEP_LABEL)
+            return 0;
+        if (!strcmp(line->name, jump->operands[0])) {
+            peep_delete(jump);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Rule: jump threading
+ *  A jump to a label which is followed by an unconditional jump goes to
+ *  the final destination right away.
+ */
+static size_t peep_jump_thread(peep_t *peep, size_t index) {
+    peep_line_t *jump = &peep->lines[index];
+    if (!peep_jump_direct(jump))
+        return 0;
+
+    size_t label = (size_t)table_find(&peep->labels, jump->operands[0]);
+    if (!label)
+        return 0;
+
+    size_t next = label - 1;
+    while ((next = peep_next(peep, next)) < peep->count && peep->lines[next].kind == PEEP_LABEL)
+        ;
+
+    peep_line_t *target = peep_instruction(peep, next);
+    if (!peep_is(target, "jmp") || !peep_jump_direct(target) || target == jump)
+        return 0;
+    if (!strcmp(target->operands[0], jump->operands[0]))
+        return 0;
+
+    peep_rewrite(jump, jump->name, 1, target->operands[0], NULL);
+    return 1;
+}
+
+/*
+ * Rule: unreachable code
+ *  Instructions after an unconditional jump or return can't be reached
+ *  unless there is a label in between.
+ */
+static size_t peep_unreachable(peep_t *peep, size_t index) {
+    peep_line_t *line = &peep->lines[index];
+    if (!peep_is(line, "jmp") && !peep_is(line, "ret"))
+        return 0;
+
+    size_t removed = 0;
+    for (size_t next = peep_next(peep, index); next < peep->count; next = peep_next(peep, next)) {
+        if (peep->lines[next].kind != PEEP_INSTRUCTION)
+            break;
+        peep_delete(&peep->lines[next]);
+        removed++;
+    }
+    return removed;
+}
+
+/*
+ * Rule: dead moves
+ *  Moves of a register to itself, moves back to where a value was just
+ *  copied from and moves into a register which is overwritten by the very
+ *  next instruction.
+ */
+static size_t peep_move_dead(peep_t *peep, size_t index) {
+    peep_line_t *move = &peep->lines[index];
+    int          size = 0;
+    int          from;
+    int          to;
+
+    if (!peep_is(move, "mov") || move->count != 2)
+        return 0;
+
+    from = peep_register(move->operands[0], NULL);
+    to   = peep_register(move->operands[1], &size);
+
+    /* mov %rax, %rax (the 32-bit form clears the upper half) */
+    if (from != -1 && !strcmp(move->operands[0], move->operands[1]) && size == 8) {
+        peep_delete(move);
+        return 1;
+    }
+
+    if (to == -1 || size < 4)
+        return 0;
+
+    peep_line_t *next = peep_instruction(peep, peep_next(peep, index));
+    if (!next)
+        return 0;
+
+    /* mov %rax, %rbx; mov %rbx, %rax */
+    if (from != -1 && size == 8 && peep_is(next, "mov") && next->count == 2
+            && !strcmp(next->operands[0], move->operands[1])
+            && !strcmp(next->operands[1], move->operands[0])) {
+        peep_delete(next);
+        return 1;
+    }
+
+    /* loads aren't dropped, only register and immediate sources */
+    if (strchr(move->operands[0], '('))
+        return 0;
+
+    if (peep_register_written(next) == to) {
+        peep_delete(move);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Rule: adding or subtracting zero
+ *  Dropped unless the flags it sets are read before anything sets them
+ *  again, the 32-bit forms also clear the upper half of the register so
+ *  only the 64-bit ones and memory are dropped.
+ */
+static size_t peep_zero(peep_t *peep, size_t index) {
+    peep_line_t *line = &peep->lines[index];
+    int          size = 8;
+
+    if ((!peep_is(line, "add") && !peep_is(line, "sub")) || line->count != 2)
+        return 0;
+    if (strcmp(line->operands[0], "$0"))
+        return 0;
+    if (line->operands[1][0] == '%' && (peep_register(line->operands[1], &size) == -1 || size != 8))
+        return 0;
+    if (peep_flags_live(peep, index))
+        return 0;
+
+    peep_delete(line);
+    return 1;
+}
+
+static peep_rule_t peep_rules[] = {
+    { "push/pop pairs",   peep_push_pop    },
+    { "pop/push pairs",   peep_pop_push    },
+    { "jumps to next",    peep_jump_next   },
+    { "jumps threaded",   peep_jump_thread },
+    { "unreachable code", peep_unreachable },
+    { "dead moves",       peep_move_dead   },
+    { "add/sub of zero",  peep_zero        }
+};
+
+#define PEEP_RULES (sizeof(peep_rules) / sizeof(*peep_rules))
+
+/* how often each rule applied, in shared memory once <peep_share> is called */
+static size_t  peep_local[PEEP_RULES];
+static size_t *peep_counts = peep_local;
+
+bool peep_share(void) {
+    /* a shared mapping of /dev/zero, anonymous ones aren't in c99 */
+    int fd = open("/dev/zero", O_RDWR);
+    if (fd == -1)
+        return false;
+    size_t *counts = mmap(NULL, sizeof(peep_local), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (counts == MAP_FAILED)
+        return false;
+    memcpy(counts, peep_counts, sizeof(peep_local));
+    peep_counts = counts;
+    return true;
+}
+
+char *peep_function(const char *text, size_t length, size_t *result) {
+    peep_t peep;
+    peep_parse(&peep, text, length);
+
+    for (int pass = 0; pass < PEEP_PASSES; pass++) {
+        bool changed = false;
+        for (size_t index = 0; index < peep.count; index++) {
+            for (size_t rule = 0; rule < PEEP_RULES; rule++) {
+                peep_line_t *line = &peep.lines[index];
+                if (line->deleted || line->kind != PEEP_INSTRUCTION)
+                    break;
+
+                /* functions may be optimized on several threads at once */
+                size_t applied = peep_rules[rule].apply(&peep, index);
+                if (applied) {
+                    __atomic_fetch_add(&peep_counts[rule], applied, __ATOMIC_RELAXED);
+                    changed = true;
+                }
+            }
+        }
+        if (!changed)
+            break;
+    }
+
+    size_t size = 0;
+    for (size_t index = 0; index < peep.count; index++)
+        if (!peep.lines[index].deleted)
+            size += peep_format_length(&peep.lines[index]);
+
+    char *output = memory_allocate(size + 1);
+    char *out    = output;
+    for (size_t index = 0; index < peep.count; index++)
+        if (!peep.lines[index].deleted)
+            out = peep_format(&peep.lines[index], out);
+
+    *result = out - output;
+    return output;
+}
+
+void peep_stats(FILE *stream) {
+    for (size_t rule = 0; rule < PEEP_RULES; rule++)
+        fprintf(stream, "peephole: %-18s %zu\n", peep_rules[rule].name, peep_counts[rule]);
+}
@@ -0,0 +1,52 @@
+#ifndef LICE_PEEP_HDR
+#define LICE_PEEP_HDR
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * File: peep.h
+ *  Implements the interface to LICE's peephole optimizer, which works on
+ *  the generated assembly of a function before it's written out.
+ */
+
+/*
+ * Function: peep_function
+ *  Run the peephole optimizer over the assembly of a function.
+ *
+ * Parameters:
+ *  text   - The assembly of the function, one statement per line
+ *  length - Length of *text* in bytes
+ *  result - Receives the length of the optimized assembly
+ *
+ * Returns:
+ *  The optimized assembly, which is allocated with <memory_allocate>.
+ *
+ * Remarks:
+ *  The rules are local rewrites of a few adjacent instructions, like
+ *  push and pop pairs, jumps to the next instruction, jumps to jumps,
+ *  unreachable code after jumps and moves which are overwritten right
+ *  away. Labels and directives are barriers nothing is moved across.
+ */
+char *peep_function(const char *text, size_t length, size_t *result);
+
+/*
+ * Function: peep_stats
+ *  Print how often each rule was applied so far.
+ *
+ * Parameters:
+ *  stream - The stream to print to
+ */
+void peep_stats(FILE *stream);
+
+/*
+ * Function: peep_share
+ *  Keep the counts printed by <peep_stats> in memory shared with the
+ *  processes forked afterwards, so they add up across all of them.
+ *
+ * Returns:
+ *  false if the shared memory cannot be mapped, true otherwise.
+ */
+bool peep_share(void);
+
+#endif
@@ -10,8 +10,10 @@
 
 #define TEST_DIR "tests"
 #define TEST_AS  "gcc -xassembler"
-#define TEST_CPP "cpp -nostdinc -Iinclude/"
-#define TEST_CC  "./lice -std=licec"
+#define TEST_CC  "./lice -std=licec -Iinclude/"
+#define TEST_OBJ "lice-test.o"
+#define TEST_LD  "gcc"
+#define TEST_OPT "-O1"
 
 list_t *test_find(void) {
     list_t        *list = list_create();
@@ -62,7 +64,7 @@ list_t *test_find(void) {
     return list;
 }
 
-int test_compile(string_t *file, bool ld) {
+int test_compile(string_t *file, bool ld, bool object, const char *flags) {
     string_t *command = string_create();
     FILE     *find;
 
@@ -72,7 +74,10 @@ int test_compile(string_t *file, bool ld) {
     }
     fclose(find);
 
-    string_catf(command, "{ cat testrun.c; %s %s; } | %s | %s - ", TEST_CPP, string_buffer(file), TEST_CC, TEST_AS);
+    if (object)
+        string_catf(command, "{ cat testrun.c; cat %s; } | %s%s -c -o %s && %s %s", string_buffer(file), TEST_CC, flags, TEST_OBJ, TEST_LD, TEST_OBJ);
+    else
+        string_catf(command, "{ cat testrun.c; cat %s; } | %s%s | %s - ", string_buffer(file), TEST_CC, flags, TEST_AS);
     if (ld)
         string_catf(command, " -ldl");
     string_catf(command, " && ./a.out");
@@ -110,20 +115,33 @@ int main() {
         for (size_t i = 0; i < 40 - size; i++)
             printf(" ");
 
-        if (test_compile(test->first, needld)) {
-            printf("\033[31mERROR\033[0m\n");
+        /*
+         * once through the external assembler, once as an object file and
+         * once more with optimizations
+         */
+        bool assembly  = test_compile(test->first, needld, false, "");
+        bool object    = test_compile(test->first, needld, true,  "");
+        bool optimized = test_compile(test->first, needld, false, " " TEST_OPT);
+
+        if (assembly || object || optimized) {
+            printf("\033[31mERROR\033[0m%s%s%s\n",
+                assembly  ? " (assembly)"  : "",
+                object    ? " (object)"    : "",
+                optimized ? " (optimized)" : "");
             error++;
         } else {
             printf("\033[32mOK\033[0m\n");
         }
     }
 
-    // print the command used for the tests
-    printf("\nAll test were run with the following command:\n");
-    if (!needld)
-        printf("{ cat testrun.c; %s $SRC; } | %s | %s - && ./a.out\n", TEST_CPP, TEST_CC, TEST_AS);
-    else
-        printf("{ cat testrun.c; %s $SRC; } | %s | %s - -ldl && ./a.out\n", TEST_CPP, TEST_CC, TEST_AS);
+    remove(TEST_OBJ);
+
+    // print the commands used for the tests
+    const char *libraries = needld ? " -ldl" : "";
+    printf("\nAll test were run with the following commands:\n");
+    printf("{ cat testrun.c; cat $SRC; } | %s | %s -%s && ./a.out\n", TEST_CC, TEST_AS, libraries);
+    printf("{ cat testrun.c; cat $SRC; } | %s -c -o %s && %s %s%s && ./a.out\n", TEST_CC, TEST_OBJ, TEST_LD, TEST_OBJ, libraries);
+    printf("{ cat testrun.c; cat $SRC; } | %s %s | %s -%s && ./a.out\n", TEST_CC, TEST_OPT, TEST_AS, libraries);
 
     return (error) ? EXIT_FAILURE
                    : EXIT_SUCCESS;
@@ -640,6 +640,20 @@ void test_mix(short  value1  , short  value2  , int    value3  , short  value4
     expectl(value126, 126);
     expecti(value127, 127);
 }
+int nested_int(int a, int b, int c) {
+    return a * 100 + b * 10 + c;
+}
+double nested_mix(double a, int b, double c, int d) {
+    return a * 1000 + b * 100 + c * 10 + d;
+}
+void test_nested(void) {
+    int    a = 1;
+    double d = 2;
+    expecti(nested_int(a, nested_int(4, 5, 6), 7), 4667);
+    expecti(nested_int(nested_int(a, 2, 3), a, nested_int(0, 0, a)), 12311);
+    expectd(nested_mix(d, nested_int(0, 0, 3), nested_mix(0, 0, 0, 4), a), 2000 + 300 + 40 + 1);
+    expectd(nested_mix(nested_mix(0, 0, 0, 1), 2, d, nested_int(0, 0, 4)), 1000 + 200 + 20 + 4);
+}
 int main(void) {
     test_int(1  , 2  , 3  , 4  , 5  , 6  , 7  , 8  ,
              9  , 10 , 11 , 12 , 13 , 14 , 15 , 16 ,
@@ -709,5 +723,6 @@ int main(void) {
              113   , 114   , 115   , 116   , 117   , 118   , 119   , 120   ,
              121   , 122   , 123   , 124   , 125   , 126   , 127
     );
+    test_nested();
     return 0;
 }
@@ -1,5 +1,28 @@
 // comparison
 
+int count;
+
+int tick(int value) {
+    count++;
+    return value;
+}
+
+int branch(int a, int b) {
+    count = 0;
+    if (tick(a) && tick(b))
+        return 1;
+    if (tick(a) || !tick(b))
+        return 2;
+    return 3;
+}
+
+int loop(unsigned n) {
+    int i = 0;
+    while (i < 10 && !(n < (unsigned)i))
+        i++;
+    return i;
+}
+
 int main(void) {
     expecti(1 < 2,  1);
     expecti(1 > 2,  0);
@@ -29,6 +52,49 @@ int main(void) {
     expecti(1.0  == 2.0,  0);
     expecti(1.0  != 1.0,  0);
     expecti(1.0  != 2.0,  1);
+    expecti(1.0f <  2.0f, 1);
+    expecti(2.0f <  1.0f, 0);
+    expecti(1.0  <= 1.0,  1);
+    expecti(2.0  <= 1.0,  0);
+    expecti(2.0  >  1.0,  1);
+    expecti(1.0  >= 2.0,  0);
+
+    double nan = 0.0;
+    nan = nan / nan;
+    expecti(nan == nan, 0);
+    expecti(nan != nan, 1);
+    expecti(nan <  1.0, 0);
+    expecti(nan >= 1.0, 0);
+    expecti(!(nan < 1.0), 1);
+    if (nan == nan)
+        expecti(0, 1);
+    if (!(nan != nan))
+        expecti(0, 1);
+
+    unsigned int big = 4000000000u;
+    expecti(big > 1, 1);
+    expecti(big < 1u, 0);
+
+    long wide = 0x100000000;
+    expecti(wide > 1, 1);
+    expecti(wide == 0, 0);
+
+    char buffer[2];
+    char *p = buffer;
+    expecti(p < p + 1, 1);
+    expecti(p == 0, 0);
+
+    expecti(branch(1, 1), 1);
+    expecti(count, 2);
+    expecti(branch(0, 1), 3);
+    expecti(count, 3);
+    expecti(branch(1, 0), 2);
+    expecti(count, 3);
+    expecti(loop(3), 4);
+    expecti(loop(100), 10);
+    expecti(1 && 2, 1);
+    expecti(0 || 0, 0);
+    expecti(0.5 ? 1 : 2, 1);
 
     return 0;
 }
@@ -162,6 +162,32 @@ int main(void) {
     do { i++; break; } while (0.5);
     expecti(i, 1);
 
+    // continue in do evaluates the condition
+    i = 0;
+    do {
+        i++;
+        continue;
+    } while (i < 3);
+    expecti(i, 3);
+
+    // loops which are never entered
+    j = 0;
+    for (i = 10; i < 5; i++)
+        j++;
+    while (j)
+        j++;
+    expecti(j, 0);
+
+    // conditions which can't be duplicated
+    i = 0;
+    j = 0;
+    while (({ int k = i; k < 4; })) {
+        if (i++ == 1)
+            continue;
+        j++;
+    }
+    expecti(j, 3);
+
     // switch control
     i = 0;
     switch (1 + 2) {
@@ -0,0 +1,67 @@
+// constant folding
+
+int multiply(int x) {
+    return x * 8 + 0;
+}
+
+unsigned divide(unsigned x) {
+    return x / 16;
+}
+
+unsigned remainder(unsigned x) {
+    return x % 16;
+}
+
+long identity(long x) {
+    return (x * 1) << 0;
+}
+
+int effect(int *p) {
+    return (*p)++ * 0;
+}
+
+int main(void) {
+    int    a = 3;
+    double d = 1 + 2;
+    double n = 2.5;
+    float  f = 2.5;
+
+    expecti(multiply(a),  24);
+    expecti(multiply(-1), -8);
+    expectl((long)multiply(-1), -8);
+    expecti(divide(100), 6);
+    expecti(remainder(100), 4);
+    expectl(identity(5), 5);
+
+    /* side effects are never dropped */
+    expecti(effect(&a), 0);
+    expecti(a, 4);
+
+    expecti(1 << 4, 16);
+    expectl(sizeof(int) * 8, 32);
+    expecti(-7 / 2, -3);
+    expecti(-7 % 2, -1);
+    expecti(7u / 2u, 3);
+    expecti(1 ? 5 : 6, 5);
+    expecti(0 && a, 0);
+    expecti(1 || a, 1);
+    expecti(!0, 1);
+    expecti(~0, -1);
+    expecti(2.5 > 1, 1);
+    expecti((int)2.9, 2);
+    expectl(0x100000000, 4294967296);
+    expectl(1L << 40, 1099511627776);
+
+    expectd(-1.5, -1.5 * 1);
+    expectf(2.5f * 2, 5.0f);
+    expectd(1 / 2.0, 0.5);
+    expectd(d, 3.0);
+    expectd(-n, -2.5);
+    expectf(-f, -2.5);
+
+    expecti(a * 4 / 4, 4);
+    expecti(a - 0, 4);
+    expecti((a & 0) + (a | 0) + (a ^ 0), 8);
+
+    return 0;
+}
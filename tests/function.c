@@ -64,6 +64,17 @@ void empty2(void) {
     ;;;
 }
 
+int many(int a, int b, int c, int d, int e, int f, int g, int h) {
+    return a + b + c + d + e + f + g * 1000 + h;
+}
+
+int sum(int *a, int n) {
+    int s = 0;
+    for (int i = 0; i < n; i++)
+        s += a[i];
+    return s;
+}
+
 int main(void) {
     expecti(i1(), 42);
     expecti(i2(), 42);
@@ -94,5 +105,10 @@ int main(void) {
     empty1();
     empty2();
 
+    int v[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    expecti(many(1, 2, 3, 4, 5, 6, 700, 800), 700821);
+    expecti(sum(v, 10), 55);
+    expecti(sum(v, 0),  0);
+
     return 0;
 }
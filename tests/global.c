@@ -16,6 +16,13 @@ char *l   = "world";
 long m  = 32;
 int *n  = &(int) { 64 };
 
+const int   o[4]  = { 1, 2, 3, 4 };
+const char *p[]   = { "const", "table" };
+int         q[64] = { 0 };
+double      r     = 0.0;
+float       s     = 1.5;
+const float t[2]  = { 0.25, 3 };
+
 int main(void) {
     expecti(a, 1024);
 
@@ -45,5 +52,19 @@ int main(void) {
     expectl(m, 32);
     expectl(*n, 64);
 
+    expecti(o[3], 4);
+    expectstr(p[1], "table");
+    expecti(q[63], 0);
+    q[63] = 1;
+    expecti(q[63], 1);
+    expectd(r, 0.0);
+    r = 1.5;
+    expectd(r, 1.5);
+    expectf(s, 1.5);
+    s = 4.5;
+    expectf(s, 4.5);
+    expectf(t[0], 0.25);
+    expectf(t[1], 3);
+
     return 0;
 }
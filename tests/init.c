@@ -182,6 +182,60 @@ void testzero(void) {
     expecti(b.b, 1024);
 }
 
+void testzeroblocks(void) {
+    // every size class, dirtied between iterations so the zeroing shows
+    for (int i = 0; i < 2; i++) {
+        char small[13]  = { 1 };
+        char medium[37] = { 1 };
+        char large[4099] = { 1 };
+
+        expecti(small[12],    0);
+        expecti(medium[36],   0);
+        expecti(medium[20],   0);
+        expecti(large[4098],  0);
+        expecti(large[2048],  0);
+        expecti(large[1],     0);
+        expecti(large[0],     1);
+
+        small[12]   = 1;
+        medium[36]  = 1;
+        medium[20]  = 1;
+        large[4098] = 1;
+        large[2048] = 1;
+        large[1]    = 1;
+    }
+}
+
+void testtemplates(void) {
+    // constant runs, holes and variables mixed, dirtied between iterations
+    for (int i = 0; i < 2; i++) {
+        int x = 42 + i;
+        int a[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+        struct { char c; int i; long l; } b[3] = { { 1, 2, 3 }, { 4, 5, 6 }, { 7, 8, 9 } };
+        double c[8] = { 1.5, 2, 3, 4 };
+        int d[12] = { x, 1, 2, 3, 4, 5, 6, 7, 8, 9, x, [11] = x };
+
+        expecti(a[0],  1);
+        expecti(a[11], 12);
+        expecti(a[12], 0);
+        expecti(a[15], 0);
+        expecti(b[2].c, 7);
+        expecti(b[1].i, 5);
+        expecti(b[2].l, 9);
+        expectd(c[0], 1.5);
+        expectd(c[1], 2.0);
+        expectd(c[7], 0.0);
+        expecti(d[0],  42 + i);
+        expecti(d[9],  9);
+        expecti(d[10], 42 + i);
+        expecti(d[11], 42 + i);
+
+        a[12] = 99;
+        a[15] = 99;
+        c[7]  = 99;
+    }
+}
+
 void testtypedef(void) {
     typedef int array[];
     array a = { 1, 2, 3 };
@@ -204,6 +258,8 @@ int main(void) {
     teststruct();
     testdesignated();
     testzero();
+    testzeroblocks();
+    testtemplates();
     testtypedef();
     testorder();
 
@@ -65,6 +65,13 @@ int main(void) {
     expecti(d->b->a[0], 42);
     expecti(d->b->a[1], 42);
 
+    // identical literals are one object, zero keeps its sign
+    char *e = "pooled";
+    expecti(e == "pooled", 1);
+    expecti(1.0 / 0.0 > 0, 1);
+    expecti(1.0 / -0.0 < 0, 1);
+    expectf(0.0f, 0.0f);
+
     // universal (unicode / host defined)
     expecti(L'\u0024', '$');
     expecti(L'\U00000024', '$');
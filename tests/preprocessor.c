@@ -0,0 +1,120 @@
+// preprocessor
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "include/stdbool.h"
+
+#define ONE       1
+#define TWO       (ONE + ONE)
+#define SQUARE(x) ((x) * (x))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define CAT(a, b) a ## b
+#define STR(x)    #x
+#define XSTR(x)   STR(x)
+#define EMPTY
+#define SUM(...)  sum(__VA_ARGS__, 0)
+#define FIRST(x, ...) x
+#define COUNT(fmt, ...) count(fmt, ## __VA_ARGS__)
+#define f(x)      (x + 100)
+#define g         f
+#define LATER     REDEFINED
+#define REDEFINED 42
+
+int sum(int a, ...) {
+    return a;
+}
+
+int count(const char *fmt, ...) {
+    int n = 0;
+    while (*fmt)
+        if (*fmt++ == '%')
+            n++;
+    return n;
+}
+
+int main(void) {
+    int self      = 1;
+    int CAT(x, y) = 5;
+    int line      = __LINE__;
+
+#define self      self + 1
+#define INDIRECT  self
+
+    expecti(ONE, 1);
+    expecti(TWO * 3, 6);
+    expecti(SQUARE(TWO + 1), 9);
+    expecti(MAX(SQUARE(2), 3), 4);
+    expecti(xy, 5);
+    expecti(CAT(1, 2) + 0, 12);
+    expecti(LATER, 42);
+    expecti(self, 2);
+    expecti(INDIRECT, 2);
+    expecti(g(1), 101);
+    expecti(f(f(1)), 201);
+    expecti(SUM(3, 4), 3);
+    expecti(FIRST(7 EMPTY, 8, 9), 7);
+    expecti(COUNT("%d %d", 1, 2), 2);
+    expecti(COUNT("none"), 0);
+    expecti(f
+           (2), 102);
+
+    expectstr(STR(a  +   b), "a + b");
+    expectstr(STR("q\n"), "\"q\\n\"");
+    expectstr(XSTR(TWO), "(1 + 1)");
+    expectstr(STR(TWO), "TWO");
+    expectstr(__FILE__, "(stdin)");
+    expecti(__LINE__, line + 28);
+
+#line 1000
+    expecti(__LINE__, 1000);
+
+    expecti(sizeof(size_t), 8);
+    expecti(true, 1);
+    expecti(NULL == 0, 1);
+
+#if defined(ONE) && TWO == 2 && !defined NOTHING
+    int taken = 1;
+#elif 1 / 0
+    int taken = 2;
+#else
+    int taken = 3;
+#endif
+    expecti(taken, 1);
+
+#if 0
+    # this is not a directive
+    #if 1
+    int skipped = 1;
+    #endif
+#elif (1 ? 2 : 1 / 0) == 2 && 0x10 == 16 && -1 < 0 && 10L << 2 == 40
+    int chosen = 1;
+#else
+    int chosen = 2;
+#endif
+    expecti(chosen, 1);
+
+#ifdef SQUARE
+#undef SQUARE
+#endif
+#ifndef SQUARE
+    int SQUARE = 3;
+#endif
+    expecti(SQUARE, 3);
+
+#if NOTHING || UNDEFINED_ZERO
+    expecti(0, 1);
+#endif
+
+#if 0
+#error can't happen
+    "/*" isn't a comment
+#elif 0
+    don't
+#else
+    int apostrophe = 1;
+#endif
+    expecti(apostrophe, 1);
+
+    return 0;
+}
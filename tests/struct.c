@@ -292,5 +292,30 @@ int main(void) {
     expecti(OV.b[2], 4);
     expecti(OV.b[3], 5);
 
+    // copies of every size class, the tails included
+    struct { char a[3];   } c3,   d3;
+    struct { char a[13];  } c13,  d13;
+    struct { char a[40];  } c40,  d40;
+    struct { char a[300]; } c300, d300;
+    for (int i = 0; i < 300; i++) {
+        if (i < 3)  c3.a[i]  = i + 1;
+        if (i < 13) c13.a[i] = i + 1;
+        if (i < 40) c40.a[i] = i + 1;
+        c300.a[i] = i % 100;
+    }
+    d3 = c3; d13 = c13; d40 = c40; d300 = c300;
+    expecti(d3.a[2],     3);
+    expecti(d13.a[12],   13);
+    expecti(d13.a[8],    9);
+    expecti(d40.a[39],   40);
+    expecti(d40.a[20],   21);
+    expecti(d300.a[299], 99);
+    expecti(d300.a[150], 50);
+
+    struct { char a[20]; } copies[2], tail = { "overlapping tail" };
+    int index = 1;
+    copies[index] = tail;
+    expectstr(copies[1].a, "overlapping tail");
+
     return 0;
 }
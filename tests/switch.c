@@ -0,0 +1,167 @@
+// switch statements
+
+int dense(int x) {
+    switch (x) {
+        case 0:  return 10;
+        case 1:  return 11;
+        case 2:  return 12;
+        case 3:  return 13;
+        case 5:  return 15;
+        case 6:  return 16;
+        case 7:  return 17;
+        default: return -1;
+    }
+}
+
+int sparse(int x) {
+    switch (x) {
+        case -1000:  return 1;
+        case 3:      return 2;
+        case 100:    return 3;
+        case 2000:   return 4;
+        case 50000:  return 5;
+        case 700000: return 6;
+    }
+    return 0;
+}
+
+int clustered(int x) {
+    switch (x) {
+        case 1: case 2: case 3: case 4: case 5:
+            return 1;
+        case 1000: case 1001: case 1002: case 1003:
+            return 2;
+        case 5000:
+            return 3;
+        case 'a' ... 'z':
+            return 4;
+        case -20 ... -10:
+            return 5;
+    }
+    return 0;
+}
+
+int late(int x) {
+    int r = 0;
+    switch (x) {
+        default:
+            r = 100;
+            break;
+        case 1:
+            r = 1;
+        case 2:
+            r += 2;
+            break;
+    }
+    return r;
+}
+
+int nested(int x, int y) {
+    int r = 0;
+    for (int i = 0; i < 3; i++) {
+        switch (x) {
+            case 1:
+                switch (y) {
+                    case 1:  r += 1; break;
+                    default: r += 10; break;
+                }
+                break;
+            default:
+                r += 100;
+                break;
+        }
+    }
+    return r;
+}
+
+int duff(int count) {
+    int n = (count + 3) / 4;
+    int r = 0;
+    switch (count % 4) {
+        case 0: do { r++;
+        case 3:      r++;
+        case 2:      r++;
+        case 1:      r++;
+                } while (--n > 0);
+    }
+    return r;
+}
+
+int character(char c) {
+    switch (c) {
+        case 'x': return 1;
+        case 'y': return 2;
+        case 'z': return 3;
+        case 'w': return 4;
+    }
+    return 0;
+}
+
+int empty(int x) {
+    switch (x) {
+        default:
+            x++;
+    }
+    switch (x) { }
+    return x;
+}
+
+int wide(long x) {
+    switch (x) {
+        case 1:                           return 1;
+        case 0x100000001:                 return 2;
+        case 0x200000000 ... 0x200000003: return 3;
+        case 0x7fffffffffffffff:          return 4;
+    }
+    return 0;
+}
+
+int main(void) {
+    expecti(dense(0), 10);
+    expecti(dense(3), 13);
+    expecti(dense(4), -1);
+    expecti(dense(7), 17);
+    expecti(dense(8), -1);
+    expecti(dense(-1), -1);
+
+    expecti(sparse(-1000), 1);
+    expecti(sparse(3), 2);
+    expecti(sparse(100), 3);
+    expecti(sparse(2000), 4);
+    expecti(sparse(50000), 5);
+    expecti(sparse(700000), 6);
+    expecti(sparse(4), 0);
+
+    expecti(clustered(3), 1);
+    expecti(clustered(1002), 2);
+    expecti(clustered(5000), 3);
+    expecti(clustered('q'), 4);
+    expecti(clustered(-15), 5);
+    expecti(clustered(0), 0);
+    expecti(clustered(1004), 0);
+
+    expecti(late(1), 3);
+    expecti(late(2), 2);
+    expecti(late(3), 100);
+
+    expecti(nested(1, 1), 3);
+    expecti(nested(1, 2), 30);
+    expecti(nested(2, 1), 300);
+
+    expecti(duff(7), 7);
+    expecti(duff(8), 8);
+
+    expecti(character('z'), 3);
+    expecti(character('a'), 0);
+
+    expecti(empty(1), 2);
+
+    expecti(wide(1), 1);
+    expecti(wide(0x100000001), 2);
+    expecti(wide(0x200000002), 3);
+    expecti(wide(0x200000004), 0);
+    expecti(wide(0x7fffffffffffffff), 4);
+    expecti(wide(0x1ffffffff), 0);
+
+    return 0;
+}
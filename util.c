@@ -3,39 +3,176 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <stddef.h>
 
 #include "util.h"
 
-#define MEMORY 0x8000000
+/*
+ * The smallest and largest chunk sizes an arena requests from the system,
+ * chunks double in size between the two so that the number of chunks stays
+ * logarithmic in the amount of memory used.
+ */
+#define MEMORY_CHUNK_MIN 0x10000
+#define MEMORY_CHUNK_MAX 0x400000
 
-static unsigned char *memory_pool = NULL;
-static size_t         memory_next = 0;
+/* Strictest alignment any object allocated from an arena needs */
+#define MEMORY_ALIGNMENT 16
+
+typedef struct memory_chunk_s memory_chunk_t;
+
+struct memory_chunk_s {
+    memory_chunk_t *next;
+    size_t          size;
+    size_t          used;
+    unsigned char  *data;
+};
+
+struct memory_arena_s {
+    memory_chunk_t *chunks;
+    size_t          grow;
+};
+
+static memory_arena_t               memory_arena_default = { NULL, MEMORY_CHUNK_MIN };
+static THREAD_LOCAL memory_arena_t *memory_arena_active  = &memory_arena_default;
+static bool                         memory_registered    = false;
+
+static void memory_arena_destroy_chunks(memory_arena_t *arena) {
+    for (memory_chunk_t *chunk = arena->chunks; chunk; ) {
+        memory_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+}
 
 static void memory_cleanup(void) {
-    free(memory_pool);
+    memory_arena_destroy_chunks(&memory_arena_default);
 }
 
-void *memory_allocate(size_t bytes) {
-    void *value;
+static void memory_exhausted(void) {
+    fprintf(stderr, "[lice] out of memory\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * The natural alignment of an object always divides its size, the lowest
+ * set bit of the requested size is therefor a valid (and the tightest)
+ * alignment for it.
+ */
+static size_t memory_alignment(size_t bytes) {
+    size_t align = bytes & -bytes;
+    return (align && align < MEMORY_ALIGNMENT) ? align : MEMORY_ALIGNMENT;
+}
 
-    if (!memory_pool) {
-        memory_pool = malloc(MEMORY);
+static memory_chunk_t *memory_chunk_create(memory_arena_t *arena, size_t bytes) {
+    size_t size = arena->grow;
+
+    /* oversized requests get a chunk of their own */
+    if (size < bytes + MEMORY_ALIGNMENT)
+        size = bytes + MEMORY_ALIGNMENT;
+    else if (arena->grow < MEMORY_CHUNK_MAX)
+        arena->grow *= 2;
+
+    memory_chunk_t *chunk = calloc(1, sizeof(memory_chunk_t) + size);
+    if (!chunk)
+        memory_exhausted();
+
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->data = (unsigned char *)(chunk + 1);
+    chunk->next = arena->chunks;
+
+    return arena->chunks = chunk;
+}
+
+void *memory_arena_allocate(memory_arena_t *arena, size_t bytes) {
+    memory_chunk_t *chunk = arena->chunks;
+    size_t          align = memory_alignment(bytes);
+
+    if (!memory_registered) {
+        memory_registered = true;
         atexit(memory_cleanup);
     }
 
-    if (memory_next > MEMORY)
-        goto bail;
+    if (chunk) {
+        uintptr_t address = (uintptr_t)(chunk->data + chunk->used);
+        size_t    offset  = chunk->used + ((align - (address & (align - 1))) & (align - 1));
 
-    value = &memory_pool[memory_next];
-    memory_next += bytes;
+        if (offset + bytes <= chunk->size) {
+            chunk->used = offset + bytes;
+            return chunk->data + offset;
+        }
+    }
+
+    /* chunk data begins at a MEMORY_ALIGNMENT boundary */
+    chunk       = memory_chunk_create(arena, bytes);
+    chunk->used = bytes;
+    return chunk->data;
+}
+
+memory_arena_t *memory_arena_create(void) {
+    memory_arena_t *arena = malloc(sizeof(memory_arena_t));
+    if (!arena)
+        memory_exhausted();
 
-    if (memory_next > MEMORY) {
-bail:
-        fprintf(stderr, "[lice] out of memory");
-        exit(EXIT_FAILURE);
+    arena->chunks = NULL;
+    arena->grow   = MEMORY_CHUNK_MIN;
+    return arena;
+}
+
+void memory_arena_reset(memory_arena_t *arena) {
+    memory_chunk_t *keep = arena->chunks;
+    if (!keep)
+        return;
+
+    /*
+     * Keep the largest chunk around for reuse, which isn't necessarily the
+     * most recent one as oversized requests get a chunk of their own.
+     */
+    for (memory_chunk_t *chunk = keep->next; chunk; chunk = chunk->next)
+        if (chunk->size > keep->size)
+            keep = chunk;
+
+    for (memory_chunk_t *chunk = arena->chunks; chunk; ) {
+        memory_chunk_t *next = chunk->next;
+        if (chunk != keep)
+            free(chunk);
+        chunk = next;
     }
 
-    return value;
+    /* memory is handed out zeroed, which is what it's cleared back to */
+    memset(keep->data, 0, keep->used);
+    keep->next    = NULL;
+    keep->used    = 0;
+    arena->chunks = keep;
+}
+
+void memory_arena_destroy(memory_arena_t *arena) {
+    if (!arena || arena == &memory_arena_default)
+        return;
+    if (memory_arena_active == arena)
+        memory_arena_active = &memory_arena_default;
+
+    memory_arena_destroy_chunks(arena);
+    free(arena);
+}
+
+memory_arena_t *memory_arena_select(memory_arena_t *arena) {
+    memory_arena_t *previous = memory_arena_active;
+    memory_arena_active = arena ? arena : &memory_arena_default;
+    return previous;
+}
+
+size_t memory_arena_size(memory_arena_t *arena) {
+    size_t size = 0;
+    for (memory_chunk_t *chunk = (arena ? arena : &memory_arena_default)->chunks; chunk; chunk = chunk->next)
+        size += chunk->size;
+    return size;
+}
+
+void *memory_allocate(size_t bytes) {
+    return memory_arena_allocate(memory_arena_active, bytes);
 }
 
 struct string_s {
@@ -110,36 +247,228 @@ size_t string_length(string_t *string) {
     return (string) ? string->length : 0;
 }
 
+/*
+ * The intern pool hands out a single canonical copy of every string it's
+ * given. Each copy is preceded by a header holding its hash, length and a
+ * tag the owner of the string is free to use (the lexer marks keywords
+ * with it), so all of that is available from the canonical pointer alone.
+ */
 typedef struct {
-    char *key;
-    void *value;
-} table_entry_t;
+    unsigned hash;
+    int      tag;
+    size_t   length;
+    char     string[];
+} string_interned_t;
+
+static memory_arena_t     *string_intern_arena    = NULL;
+static string_interned_t **string_intern_slots    = NULL;
+static size_t              string_intern_capacity = 0;
+static size_t              string_intern_count    = 0;
+
+static string_interned_t *string_interned(const char *interned) {
+    return (string_interned_t*)(interned - offsetof(string_interned_t, string));
+}
+
+unsigned string_hash(const char *string, size_t length) {
+    /* FNV-1a */
+    unsigned hash = 2166136261u;
+    while (length--)
+        hash = (hash ^ (unsigned char)*string++) * 16777619u;
+    return hash;
+}
+
+static void string_intern_rehash(void) {
+    size_t              capacity = string_intern_capacity ? string_intern_capacity * 2 : 4096;
+    string_interned_t **slots    = calloc(capacity, sizeof(string_interned_t*));
+
+    if (!slots)
+        memory_exhausted();
+
+    for (size_t i = 0; i < string_intern_capacity; i++) {
+        string_interned_t *entry = string_intern_slots[i];
+        if (!entry)
+            continue;
+        size_t j = entry->hash & (capacity - 1);
+        while (slots[j])
+            j = (j + 1) & (capacity - 1);
+        slots[j] = entry;
+    }
+
+    free(string_intern_slots);
+    string_intern_slots    = slots;
+    string_intern_capacity = capacity;
+}
+
+static void string_intern_cleanup(void) {
+    free(string_intern_slots);
+    memory_arena_destroy(string_intern_arena);
+}
+
+char *string_intern(const char *string, size_t length) {
+    if (string_intern_count * 2 >= string_intern_capacity) {
+        if (!string_intern_arena) {
+            string_intern_arena = memory_arena_create();
+            atexit(string_intern_cleanup);
+        }
+        string_intern_rehash();
+    }
+
+    unsigned hash = string_hash(string, length);
+    size_t   mask = string_intern_capacity - 1;
+    size_t   i    = hash & mask;
+
+    for (; string_intern_slots[i]; i = (i + 1) & mask) {
+        string_interned_t *entry = string_intern_slots[i];
+        if (entry->hash == hash && entry->length == length && !memcmp(entry->string, string, length))
+            return entry->string;
+    }
+
+    /* round up so the arena aligns the header for the size_t in it */
+    size_t             bytes = (sizeof(string_interned_t) + length + sizeof(size_t)) & ~(sizeof(size_t) - 1);
+    string_interned_t *entry = memory_arena_allocate(string_intern_arena, bytes);
+    entry->hash   = hash;
+    entry->tag    = 0;
+    entry->length = length;
+    memcpy(entry->string, string, length);
+    entry->string[length] = '\0';
+
+    string_intern_slots[i] = entry;
+    string_intern_count++;
+
+    return entry->string;
+}
+
+unsigned string_intern_hash(const char *interned) {
+    return string_interned(interned)->hash;
+}
+
+int string_intern_tag(const char *interned) {
+    return string_interned(interned)->tag;
+}
+
+void string_intern_tag_set(const char *interned, int tag) {
+    string_interned(interned)->tag = tag;
+}
+
+/*
+ * Tables are a chain of scopes, each scope keeps its entries in insertion
+ * order in an array and, once it grows past a handful of entries, indexes
+ * them with an open addressing hash table (linear probing) of entry
+ * indices. Small scopes (most block scopes) are simply scanned.
+ */
+#define TABLE_LINEAR   8
+#define TABLE_ENTRIES  8
+
+struct table_entry_s {
+    char     *key;
+    void     *value;
+    unsigned  hash;
+};
+
+static bool table_entry_match(table_entry_t *entry, const char *key, unsigned hash) {
+    return entry->hash == hash && (entry->key == key || !strcmp(entry->key, key));
+}
+
+/*
+ * Slots hold an index into the entry array plus one, zero marks an empty
+ * slot. Only the first entry for a given key gets a slot, duplicate keys
+ * stay reachable through table_keys and table_values but lookups resolve
+ * to the oldest entry like the list walk this replaced did.
+ */
+static void table_slot_insert(table_t *table, size_t index) {
+    size_t mask = table->capacity - 1;
+    for (size_t i = table->entries[index].hash & mask; ; i = (i + 1) & mask) {
+        if (!table->slots[i]) {
+            table->slots[i] = index + 1;
+            return;
+        }
+        if (table_entry_match(&table->entries[table->slots[i] - 1], table->entries[index].key, table->entries[index].hash))
+            return;
+    }
+}
+
+static void table_rehash(table_t *table) {
+    size_t capacity = table->capacity ? table->capacity * 2 : TABLE_LINEAR * 4;
+
+    table->capacity = capacity;
+    table->slots    = memory_allocate(sizeof(size_t) * capacity);
+    memset(table->slots, 0, sizeof(size_t) * capacity);
+
+    for (size_t i = 0; i < table->length; i++)
+        table_slot_insert(table, i);
+}
+
+static table_entry_t *table_lookup(table_t *table, const char *key, unsigned hash) {
+    if (!table->slots) {
+        for (size_t i = 0; i < table->length; i++)
+            if (table_entry_match(&table->entries[i], key, hash))
+                return &table->entries[i];
+        return NULL;
+    }
+
+    size_t mask = table->capacity - 1;
+    for (size_t i = hash & mask; table->slots[i]; i = (i + 1) & mask)
+        if (table_entry_match(&table->entries[table->slots[i] - 1], key, hash))
+            return &table->entries[table->slots[i] - 1];
+    return NULL;
+}
 
 void *table_create(void *parent) {
     table_t *table = memory_allocate(sizeof(table_t));
-    table->list    = list_create();
+    *table         = SENTINEL_TABLE;
     table->parent  = parent;
 
     return table;
 }
 
-void *table_find(table_t *table, const char *key) {
+static void *table_find_hashed(table_t *table, const char *key, unsigned hash) {
     for (; table; table = table->parent) {
-        for (list_iterator_t *it = list_iterator(table->list); !list_iterator_end(it); ) {
-            table_entry_t *entry = list_iterator_next(it);
-            if (!strcmp(key, entry->key))
-                return entry->value;
-        }
+        table_entry_t *entry = table_lookup(table, key, hash);
+        if (entry)
+            return entry->value;
     }
     return NULL;
 }
 
-void table_insert(table_t *table, char *key, void *value) {
-    table_entry_t *entry = memory_allocate(sizeof(table_entry_t));
+void *table_find(table_t *table, const char *key) {
+    return table_find_hashed(table, key, string_hash(key, strlen(key)));
+}
+
+/* interned keys carry their hash, and equal ones match on the pointer */
+void *table_find_interned(table_t *table, const char *key) {
+    return table_find_hashed(table, key, string_intern_hash(key));
+}
+
+static void table_insert_hashed(table_t *table, char *key, void *value, unsigned hash) {
+    if (table->length == table->allocated) {
+        size_t         allocated = table->allocated ? table->allocated * 2 : TABLE_ENTRIES;
+        table_entry_t *entries   = memory_allocate(sizeof(table_entry_t) * allocated);
+
+        if (table->length)
+            memcpy(entries, table->entries, sizeof(table_entry_t) * table->length);
+
+        table->entries   = entries;
+        table->allocated = allocated;
+    }
+
+    table_entry_t *entry = &table->entries[table->length++];
     entry->key           = key;
     entry->value         = value;
+    entry->hash          = hash;
+
+    /* keep the load factor of the slots at or below a half */
+    if (table->slots && table->length * 2 <= table->capacity)
+        table_slot_insert(table, table->length - 1);
+    else if (table->length > TABLE_LINEAR)
+        table_rehash(table);
+}
+
+void table_insert(table_t *table, char *key, void *value) {
+    table_insert_hashed(table, key, value, string_hash(key, strlen(key)));
+}
 
-    list_push(table->list, entry);
+void table_insert_interned(table_t *table, char *key, void *value) {
+    table_insert_hashed(table, key, value, string_intern_hash(key));
 }
 
 void *table_parent(table_t *table) {
@@ -149,16 +478,16 @@ void *table_parent(table_t *table) {
 list_t *table_values(table_t *table) {
     list_t *list = list_create();
     for (; table; table = table->parent)
-        for (list_iterator_t *it = list_iterator(table->list); !list_iterator_end(it); )
-            list_push(list, ((table_entry_t*)list_iterator_next(it))->value);
+        for (size_t i = 0; i < table->length; i++)
+            list_push(list, table->entries[i].value);
     return list;
 }
 
 list_t *table_keys(table_t *table) {
     list_t *list = list_create();
     for (; table; table = table->parent)
-        for (list_iterator_t *it = list_iterator(table->list); !list_iterator_end(it); )
-            list_push(list, ((table_entry_t*)list_iterator_next(it))->key);
+        for (size_t i = 0; i < table->length; i++)
+            list_push(list, table->entries[i].key);
     return list;
 }
 
@@ -48,15 +48,54 @@ char *string_quote(char *p);
  */
 size_t string_length(string_t *string);
 
+/*
+ * Function: string_hash
+ *  Hash the given length of a string
+ */
+unsigned string_hash(const char *string, size_t length);
+
+/*
+ * Function: string_intern
+ *  Get the canonical copy of a string from the intern pool, adding
+ *  it to the pool if it isn't in there yet. Interned strings are
+ *  equal if and only if their pointers are equal.
+ */
+char *string_intern(const char *string, size_t length);
+
+/*
+ * Function: string_intern_hash
+ *  Get the hash of an interned string, it's the same value
+ *  <string_hash> would calculate.
+ */
+unsigned string_intern_hash(const char *interned);
+
+/*
+ * Function: string_intern_tag
+ *  Get the tag associated with an interned string, zero unless
+ *  one was set with <string_intern_tag_set>.
+ */
+int string_intern_tag(const char *interned);
+
+/*
+ * Function: string_intern_tag_set
+ *  Associate a tag with an interned string
+ */
+void string_intern_tag_set(const char *interned, int tag);
+
 /*
  * Type: table_t
  *  A key value associative table
  */
 typedef struct table_s table_t;
+typedef struct table_entry_s table_entry_t;
 
 struct table_s {
-    list_t  *list;
-    table_t *parent;
+    table_entry_t *entries;
+    size_t         length;
+    size_t         allocated;
+    size_t        *slots;
+    size_t         capacity;
+    table_t       *parent;
 };
 
 /*
@@ -68,10 +107,18 @@ void *table_create(void *parent);
 /*
  * Funciton: table_find
  *  Searches for a given value in the table based on the
- *  key associated with it.
+ *  key associated with it. Each scope is searched with a hash
+ *  lookup before moving on to its parent.
  */
 void *table_find(table_t *table, const char *key);
 
+/*
+ * Function: table_find_interned
+ *  Same as <table_find> for a key which is an interned string,
+ *  the hash kept with the string is used instead of hashing it.
+ */
+void *table_find_interned(table_t *table, const char *key);
+
 /*
  * Function: table_insert
  *  Inserts a value for the given key as an entry in the
@@ -79,6 +126,12 @@ void *table_find(table_t *table, const char *key);
  */
 void  table_insert(table_t *table, char *key, void *value);
 
+/*
+ * Function: table_insert_interned
+ *  Same as <table_insert> for a key which is an interned string.
+ */
+void  table_insert_interned(table_t *table, char *key, void *value);
+
 /*
  * Function: table_parent
  *  Returns the parent opaque object for the given table to
@@ -105,17 +158,82 @@ list_t *table_keys(table_t *table);
  *  Initialize an empty table in place
  */
 #define SENTINEL_TABLE ((table_t) { \
-    .list   = &SENTINEL_LIST,       \
-    .parent = NULL                  \
+    .entries   = NULL,              \
+    .length    = 0,                 \
+    .allocated = 0,                 \
+    .slots     = NULL,              \
+    .capacity  = 0,                 \
+    .parent    = NULL               \
 })
 
 
 #define MIN(A, B) (((A) < (B)) ? (A) : (B))
 #define MAX(A, B) (((A) > (B)) ? (A) : (B))
 
+/*
+ * Macro: THREAD_LOCAL
+ *  Storage class of state every thread has a copy of its own of.
+ */
+#ifdef __GNUC__
+#   define THREAD_LOCAL __thread
+#else
+#   define THREAD_LOCAL _Thread_local
+#endif
+
+/*
+ * Type: memory_arena_t
+ *  A growable region of memory made of chunks which objects are
+ *  allocated from and which is released all at once.
+ */
+typedef struct memory_arena_s memory_arena_t;
+
+/*
+ * Function: memory_arena_create
+ *  Create an empty arena
+ */
+memory_arena_t *memory_arena_create(void);
+
+/*
+ * Function: memory_arena_allocate
+ *  Allocate some suitably aligned, zeroed memory from the given arena
+ */
+void *memory_arena_allocate(memory_arena_t *arena, size_t bytes);
+
+/*
+ * Function: memory_arena_reset
+ *  Release everything allocated from the given arena, the arena
+ *  keeps its largest chunk around to be reused.
+ */
+void memory_arena_reset(memory_arena_t *arena);
+
+/*
+ * Function: memory_arena_destroy
+ *  Release everything allocated from the given arena along with
+ *  the arena itself.
+ */
+void memory_arena_destroy(memory_arena_t *arena);
+
+/*
+ * Function: memory_arena_select
+ *  Make the given arena the one <memory_allocate> allocates from on
+ *  the calling thread, NULL selects the default arena.
+ *
+ * Returns:
+ *  The previously selected arena, to be restored with another call
+ *  to this function once the caller is done.
+ */
+memory_arena_t *memory_arena_select(memory_arena_t *arena);
+
+/*
+ * Function: memory_arena_size
+ *  The amount of memory the given arena holds on to, NULL is the
+ *  default arena.
+ */
+size_t memory_arena_size(memory_arena_t *arena);
+
 /*
  * Function: memory_allocate
- * Allocate some memory
+ *  Allocate some zeroed memory from the selected arena
  */
 void *memory_allocate(size_t bytes);
 